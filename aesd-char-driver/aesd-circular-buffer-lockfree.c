@@ -0,0 +1,177 @@
+/**
+ * @file aesd-circular-buffer-lockfree.c
+ * @brief Lock free circular buffer with the aesd-circular-buffer.c retention semantics
+ *
+ * Each slot works like a seqlock keyed by ticket: a producer clears seq,
+ * stores the entry, then sets seq to its ticket plus one with release
+ * ordering.  A consumer accepts a slot only if it sees the ticket it expects
+ * both before and after copying the entry.
+ */
+
+#include <string.h>
+#include <sched.h>
+#include "aesd-circular-buffer-lockfree.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+/**
+ * Spins before yielding while waiting on another producer, which may have been preempted
+ */
+#define AESD_LF_SPIN_LIMIT 128
+
+static void aesd_lf_backoff(unsigned int *spins)
+{
+    if (++*spins < AESD_LF_SPIN_LIMIT) {
+        cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+/**
+* Initializes @param buffer to an empty buffer accepting producers as described by @param mode.
+* Must not race with any other use of the buffer.
+*/
+void aesd_lf_circular_buffer_init(struct aesd_lf_circular_buffer *buffer, enum aesd_lf_producer_mode mode)
+{
+    uint8_t index;
+
+    buffer->mode = mode;
+    atomic_init(&buffer->head, 0);
+    atomic_init(&buffer->published, 0);
+    for (index = 0; index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; index++) {
+        atomic_init(&buffer->entry[index].seq, 0);
+        atomic_init(&buffer->entry[index].buffptr, NULL);
+        atomic_init(&buffer->entry[index].size, 0);
+    }
+}
+
+/**
+* Adds entry @param add_entry to @param buffer, overwriting the oldest entry when full.
+* In AESD_LF_MULTI_PRODUCER mode a producer waits for the producers holding earlier tickets to
+* publish, so entries become visible in the order their tickets were claimed.
+* Any memory referenced in @param add_entry must stay valid while any consumer may still hold a
+* copy of the entry, including after it has been overwritten.
+*/
+void aesd_lf_circular_buffer_add_entry(struct aesd_lf_circular_buffer *buffer,
+            const struct aesd_buffer_entry *add_entry)
+{
+    uint64_t ticket;
+    struct aesd_lf_slot *slot;
+    unsigned int spins = 0;
+
+    if (buffer->mode == AESD_LF_SINGLE_PRODUCER) {
+        ticket = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+        atomic_store_explicit(&buffer->head, ticket + 1, memory_order_relaxed);
+    } else {
+        ticket = atomic_fetch_add_explicit(&buffer->head, 1, memory_order_relaxed);
+        // The previous occupant of the slot must be published before it is overwritten
+        while (atomic_load_explicit(&buffer->published, memory_order_acquire) +
+                AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED <= ticket)
+            aesd_lf_backoff(&spins);
+    }
+
+    slot = &buffer->entry[ticket % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->buffptr, add_entry->buffptr, memory_order_relaxed);
+    atomic_store_explicit(&slot->size, add_entry->size, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, ticket + 1, memory_order_release);
+
+    if (buffer->mode == AESD_LF_MULTI_PRODUCER) {
+        while (atomic_load_explicit(&buffer->published, memory_order_acquire) != ticket)
+            aesd_lf_backoff(&spins);
+    }
+    atomic_store_explicit(&buffer->published, ticket + 1, memory_order_release);
+}
+
+/**
+* Copies the entry for @param ticket into @param entry_rtn.
+* @return false if a producer has started overwriting the slot
+*/
+static bool aesd_lf_read_slot(struct aesd_lf_circular_buffer *buffer, uint64_t ticket,
+            struct aesd_buffer_entry *entry_rtn)
+{
+    struct aesd_lf_slot *slot = &buffer->entry[ticket % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != ticket + 1)
+        return false;
+    entry_rtn->buffptr = atomic_load_explicit(&slot->buffptr, memory_order_relaxed);
+    entry_rtn->size = atomic_load_explicit(&slot->size, memory_order_relaxed);
+    entry_rtn->seq = ticket;
+    // Timestamps are not recorded by the lock free buffer
+    entry_rtn->timestamp_ns = 0;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->seq, memory_order_relaxed) == ticket + 1;
+}
+
+/**
+* @return true if no entry was published since @param published was loaded and the slots for
+*      tickets @param first up to @param end still hold those tickets.  Slots never go back to an
+*      overwritten ticket, so every entry read was then in the buffer at the same time
+*/
+static bool aesd_lf_walk_stable(struct aesd_lf_circular_buffer *buffer, uint64_t published,
+            uint64_t first, uint64_t end)
+{
+    uint64_t ticket;
+
+    if (atomic_load_explicit(&buffer->published, memory_order_acquire) != published)
+        return false;
+    for (ticket = first; ticket < end; ticket++) {
+        struct aesd_lf_slot *slot = &buffer->entry[ticket % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != ticket + 1)
+            return false;
+    }
+    return true;
+}
+
+/**
+* Same search as aesd_circular_buffer_find_entry_offset_for_fpos(), over a consistent snapshot of
+* the published entries: a walk is only used if no producer published or overwrote an entry it
+* read before it finished, otherwise it starts again from the new oldest entry.  Safe to call
+* concurrently with producers and other consumers, but may retry for as long as producers keep
+* adding entries faster than one walk takes.
+* @param entry_rtn receives a copy of the matching entry, since the slot may be overwritten as soon
+*      as this function returns
+* @return true if char_offset was found, false if not enough data is in the buffer
+*/
+bool aesd_lf_circular_buffer_find_entry_offset_for_fpos(struct aesd_lf_circular_buffer *buffer,
+            size_t char_offset, struct aesd_buffer_entry *entry_rtn, size_t *entry_offset_byte_rtn)
+{
+    for (;;) {
+        uint64_t published = atomic_load_explicit(&buffer->published, memory_order_acquire);
+        uint64_t oldest = published > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ?
+            published - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : 0;
+        uint64_t ticket;
+        size_t total_bytes = 0;
+        struct aesd_buffer_entry entry;
+        bool found = false;
+
+        for (ticket = oldest; ticket < published; ticket++) {
+            if (!aesd_lf_read_slot(buffer, ticket, &entry))
+                break;
+            if (char_offset < total_bytes + entry.size) {
+                found = true;
+                break;
+            }
+            total_bytes += entry.size;
+        }
+
+        // An overwritten slot means this walk mixed two generations of the buffer
+        if (!found && ticket != published)
+            continue;
+        if (!aesd_lf_walk_stable(buffer, published, oldest, found ? ticket + 1 : published))
+            continue;
+        if (found) {
+            *entry_rtn = entry;
+            *entry_offset_byte_rtn = char_offset - total_bytes;
+        }
+        return found;
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ * aesd-circular-buffer-lockfree.h
+ *
+ *  @brief Lock free variant of the aesd circular buffer for userspace producers
+ *
+ *  Keeps the last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries like
+ *  aesd-circular-buffer.h, overwriting the oldest when full, but lets producers
+ *  add entries and consumers search them concurrently without a lock.
+ *  Producers claim a ticket, fill the slot for that ticket and publish in
+ *  ticket order.  Consumers validate each slot with its sequence number and
+ *  retry if a producer overwrote it while they were reading.
+ *  Userspace only, requires C11 atomics.
+ */
+
+#ifndef AESD_CIRCULAR_BUFFER_LOCKFREE_H
+#define AESD_CIRCULAR_BUFFER_LOCKFREE_H
+
+#include <stdatomic.h>
+#include "aesd-circular-buffer.h"
+
+#define AESD_LF_CACHE_LINE 64
+
+enum aesd_lf_producer_mode {
+    /**
+     * Only one thread ever calls aesd_lf_circular_buffer_add_entry()
+     */
+    AESD_LF_SINGLE_PRODUCER,
+    /**
+     * Any number of threads may call aesd_lf_circular_buffer_add_entry() concurrently
+     */
+    AESD_LF_MULTI_PRODUCER,
+};
+
+struct aesd_lf_slot
+{
+    /**
+     * Ticket of the entry stored in this slot plus one, 0 while a producer is writing it
+     */
+    _Atomic uint64_t seq;
+    _Atomic(const char *) buffptr;
+    _Atomic size_t size;
+};
+
+struct aesd_lf_circular_buffer
+{
+    /**
+     * Read only after aesd_lf_circular_buffer_init()
+     */
+    enum aesd_lf_producer_mode mode;
+    /**
+     * Next ticket to hand to a producer, only written by producers
+     */
+    _Alignas(AESD_LF_CACHE_LINE) _Atomic uint64_t head;
+    /**
+     * Number of entries published, every ticket below it is readable.  Written by producers in
+     * ticket order and read by consumers, on its own line so consumers polling it don't slow the
+     * ticket counter
+     */
+    _Alignas(AESD_LF_CACHE_LINE) _Atomic uint64_t published;
+    /**
+     * Entry for ticket t is stored at entry[t % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED]
+     */
+    _Alignas(AESD_LF_CACHE_LINE) struct aesd_lf_slot entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+extern void aesd_lf_circular_buffer_init(struct aesd_lf_circular_buffer *buffer, enum aesd_lf_producer_mode mode);
+
+extern void aesd_lf_circular_buffer_add_entry(struct aesd_lf_circular_buffer *buffer,
+            const struct aesd_buffer_entry *add_entry);
+
+extern bool aesd_lf_circular_buffer_find_entry_offset_for_fpos(struct aesd_lf_circular_buffer *buffer,
+            size_t char_offset, struct aesd_buffer_entry *entry_rtn, size_t *entry_offset_byte_rtn);
+
+#endif /* AESD_CIRCULAR_BUFFER_LOCKFREE_H */
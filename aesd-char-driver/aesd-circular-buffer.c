@@ -58,27 +58,232 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     return NULL;
 }
 
+/**
+* Removes the entry at buffer->out_offs.  The entry is copied to @param evicted_rtn when not NULL,
+* otherwise it is passed to buffer->release when set
+*/
+static void aesd_circular_buffer_evict_oldest(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *evicted_rtn)
+{
+    struct aesd_buffer_entry *oldest = &buffer->entry[buffer->out_offs];
+
+    buffer->total_bytes -= oldest->size;
+    if (evicted_rtn)
+        *evicted_rtn = *oldest;
+    else if (buffer->release && oldest->buffptr)
+        buffer->release(oldest);
+    oldest->buffptr = NULL;
+    oldest->size = 0;
+
+    buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->full = false;
+}
+
+/**
+* @return the number of entries currently stored in @param buffer
+*/
+static uint8_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs) %
+        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* @return the timestamp of the newest entry of @param buffer, 0 if it is empty
+*/
+static uint64_t aesd_circular_buffer_newest_timestamp(const struct aesd_circular_buffer *buffer)
+{
+    if (!aesd_circular_buffer_count(buffer))
+        return 0;
+    return buffer->entry[(buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1) %
+        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].timestamp_ns;
+}
+
+/**
+* Stores the @param count entries at @param entries, all of which fit without overwriting, starting
+* at buffer->in_offs, then advances in_offs once and applies buffer->max_bytes.
+* Timestamps are raised to at least @param timestamp_ns, that of the entry added before them.
+* Entries evicted by the byte limit are appended to @param evicted_rtn at *evicted_count when
+* evicted_rtn is not NULL, otherwise passed to buffer->release
+*/
+static void aesd_circular_buffer_store(struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entries, uint8_t count, uint64_t timestamp_ns,
+            struct aesd_buffer_entry *evicted_rtn, size_t *evicted_count)
+{
+    uint8_t first = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->in_offs;
+    uint8_t index, slot;
+
+    if (first > count)
+        first = count;
+    memcpy(&buffer->entry[buffer->in_offs], entries, first * sizeof(*entries));
+    memcpy(&buffer->entry[0], entries + first, (count - first) * sizeof(*entries));
+    for (index = 0; index < count; index++) {
+        slot = (buffer->in_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        buffer->entry[slot].seq = buffer->next_seq++;
+        // Keep timestamps ordered so aesd_circular_buffer_find_entry_index_for_time() can bisect
+        if (buffer->entry[slot].timestamp_ns < timestamp_ns)
+            buffer->entry[slot].timestamp_ns = timestamp_ns;
+        timestamp_ns = buffer->entry[slot].timestamp_ns;
+        buffer->total_bytes += entries[index].size;
+    }
+
+    buffer->in_offs = (buffer->in_offs + count) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    // Mark buffer as full if in and out meet
+    if (count && buffer->in_offs == buffer->out_offs)
+        buffer->full = true;
+
+    // Enforce the byte limit, oldest first, never evicting the entry just added
+    while (buffer->max_bytes && buffer->total_bytes > buffer->max_bytes &&
+            (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED != buffer->in_offs)
+        aesd_circular_buffer_evict_oldest(buffer, evicted_rtn ? &evicted_rtn[(*evicted_count)++] : NULL);
+
+    if (buffer->total_bytes > buffer->high_water_bytes)
+        buffer->high_water_bytes = buffer->total_bytes;
+}
+
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
 * If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
-* new start location.
+* new start location.  If buffer->max_bytes is set, further oldest entries are then evicted until
+* the buffer holds at most max_bytes, keeping at least the new entry.
+* Evicted entries are passed to buffer->release when set.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
 */
 void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
-    buffer->entry[buffer->in_offs] = *add_entry;
+    aesd_circular_buffer_add_entries(buffer, add_entry, 1);
+}
+
+/**
+* Same as aesd_circular_buffer_add_entry(), but evicted entries are handed back to the caller
+* instead of being passed to buffer->release, so the caller can release them after dropping its lock.
+* @param evicted_rtn an array of at least AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries which
+*      receives the evicted entries, oldest first
+* @return the number of entries stored in evicted_rtn
+*/
+size_t aesd_circular_buffer_add_entry_evict(struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *add_entry, struct aesd_buffer_entry *evicted_rtn)
+{
+    size_t evicted_count = 0;
+    uint64_t timestamp_ns = aesd_circular_buffer_newest_timestamp(buffer);
 
-    // If full, move out offset forward (overwrite oldest)
+    // If full, drop the oldest entry so its slot can be overwritten
     if (buffer->full)
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        aesd_circular_buffer_evict_oldest(buffer, &evicted_rtn[evicted_count++]);
+    aesd_circular_buffer_store(buffer, add_entry, 1, timestamp_ns, evicted_rtn, &evicted_count);
+    return evicted_count;
+}
 
-    // Advance in offset
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+/**
+* Sets buffer->max_bytes to @param max_bytes and evicts the oldest entries until the buffer holds at
+* most max_bytes, keeping at least the newest entry, as the next add would.
+* Any necessary locking must be handled by the caller
+* @param evicted_rtn an array of at least AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries which
+*      receives the evicted entries, oldest first, for the caller to release after dropping its lock
+* @return the number of entries stored in evicted_rtn
+*/
+size_t aesd_circular_buffer_set_max_bytes(struct aesd_circular_buffer *buffer, size_t max_bytes,
+            struct aesd_buffer_entry *evicted_rtn)
+{
+    size_t evicted_count = 0;
 
-    // Mark buffer as full if in and out meet
-    if (buffer->in_offs == buffer->out_offs)
-        buffer->full = true;
+    buffer->max_bytes = max_bytes;
+    while (max_bytes && buffer->total_bytes > max_bytes &&
+            (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED != buffer->in_offs)
+        aesd_circular_buffer_evict_oldest(buffer, &evicted_rtn[evicted_count++]);
+    return evicted_count;
+}
+
+/**
+* Adds the @param count entries at @param entries to @param buffer in order, with the same result as
+* calling aesd_circular_buffer_add_entry() for each of them, but moving buffer->in_offs once.
+* Every entry evicted is passed to buffer->release when set, including entries of @param entries
+* which would be overwritten by later entries of the same call and so are never stored.
+* Ownership of the memory referenced by stored entries moves to the buffer.
+* Any necessary locking must be handled by the caller
+*/
+void aesd_circular_buffer_add_entries(struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entries, size_t count)
+{
+    size_t skipped = 0;
+    uint8_t stored;
+    // Taken before evicting, a batch may replace every entry and must still not go back in time
+    uint64_t timestamp_ns = aesd_circular_buffer_newest_timestamp(buffer);
+
+    // Like no call to aesd_circular_buffer_add_entry(), nothing to evict even if max_bytes was lowered
+    if (!count)
+        return;
+
+    // Only the last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries can survive this call
+    if (count > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+        skipped = count - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    stored = count - skipped;
+
+    // Evict the existing entries the new ones overwrite, then the new ones which never get stored
+    while (aesd_circular_buffer_count(buffer) + stored > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+        aesd_circular_buffer_evict_oldest(buffer, NULL);
+    for (; skipped; skipped--, entries++) {
+        struct aesd_buffer_entry overwritten = *entries;
+
+        overwritten.seq = buffer->next_seq++;
+        if (overwritten.timestamp_ns < timestamp_ns)
+            overwritten.timestamp_ns = timestamp_ns;
+        timestamp_ns = overwritten.timestamp_ns;
+        if (buffer->release && overwritten.buffptr)
+            buffer->release(&overwritten);
+    }
+
+    aesd_circular_buffer_store(buffer, entries, stored, timestamp_ns, NULL, NULL);
+}
+
+/**
+* Finds the oldest entry of @param buffer with a sequence number of at least @param seq.
+* Sequence numbers in the buffer are consecutive, so this is computed rather than searched.
+* Any necessary locking must be handled by the caller
+* @return the zero referenced index of the entry counting from the oldest entry, as used for
+*      struct aesd_seekto write_cmd, or -1 if every entry in the buffer is older than seq
+*/
+int aesd_circular_buffer_find_entry_index_for_seq(const struct aesd_circular_buffer *buffer, uint64_t seq)
+{
+    uint8_t count = aesd_circular_buffer_count(buffer);
+    uint64_t oldest_seq;
+
+    if (!count)
+        return -1;
+
+    oldest_seq = buffer->entry[buffer->out_offs].seq;
+    if (seq <= oldest_seq)
+        return 0;
+    if (seq - oldest_seq >= count)
+        return -1;
+    return seq - oldest_seq;
+}
+
+/**
+* Finds the oldest entry of @param buffer with a timestamp of at least @param timestamp_ns, using a
+* binary search over the entries from oldest to newest.
+* Any necessary locking must be handled by the caller
+* @return the zero referenced index of the entry counting from the oldest entry, or -1 if every
+*      entry in the buffer is older than timestamp_ns
+*/
+int aesd_circular_buffer_find_entry_index_for_time(const struct aesd_circular_buffer *buffer,
+            uint64_t timestamp_ns)
+{
+    uint8_t low = 0, high = aesd_circular_buffer_count(buffer), mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (buffer->entry[(buffer->out_offs + mid) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].timestamp_ns <
+                timestamp_ns)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low < aesd_circular_buffer_count(buffer) ? low : -1;
 }
 
 /**
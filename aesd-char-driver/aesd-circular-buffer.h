@@ -28,6 +28,17 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Assigned by the buffer when the entry is added: 0 for the first entry added after
+     * aesd_circular_buffer_init(), then one more for each entry added, including entries evicted
+     * before they were ever stored
+     */
+    uint64_t seq;
+    /**
+     * Time the entry was received, in nanoseconds, set by the caller before adding the entry.
+     * The buffer raises it if needed so timestamps never decrease from oldest to newest
+     */
+    uint64_t timestamp_ns;
 };
 
 struct aesd_circular_buffer
@@ -49,6 +60,28 @@ struct aesd_circular_buffer
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Sum of the sizes of the entries currently stored
+     */
+    size_t total_bytes;
+    /**
+     * Largest value of total_bytes seen since the buffer was initialized
+     */
+    size_t high_water_bytes;
+    /**
+     * When non zero, the oldest entries are evicted until total_bytes is at most max_bytes.
+     * The most recently added entry is always kept, even when larger than max_bytes
+     */
+    size_t max_bytes;
+    /**
+     * When set, called for every entry evicted by aesd_circular_buffer_add_entry() or
+     * aesd_circular_buffer_add_entries() so the caller can release the memory it references
+     */
+    void (*release)(struct aesd_buffer_entry *entry);
+    /**
+     * Sequence number the next entry added will receive
+     */
+    uint64_t next_seq;
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
@@ -56,6 +89,20 @@ extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos
 
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern size_t aesd_circular_buffer_add_entry_evict(struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *add_entry, struct aesd_buffer_entry *evicted_rtn);
+
+extern size_t aesd_circular_buffer_set_max_bytes(struct aesd_circular_buffer *buffer, size_t max_bytes,
+            struct aesd_buffer_entry *evicted_rtn);
+
+extern void aesd_circular_buffer_add_entries(struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entries, size_t count);
+
+extern int aesd_circular_buffer_find_entry_index_for_seq(const struct aesd_circular_buffer *buffer, uint64_t seq);
+
+extern int aesd_circular_buffer_find_entry_index_for_time(const struct aesd_circular_buffer *buffer,
+            uint64_t timestamp_ns);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
 /**
@@ -15,6 +15,7 @@
 #include <linux/types.h>
 #else
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #endif
 
@@ -33,14 +34,118 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * One range read by AESDCHAR_IOCREADV: up to length bytes starting at the position described
+ * the same way as struct aesd_seekto.  A range may continue into the following write commands
+ */
+struct aesd_seek_range {
+    uint32_t write_cmd;
+    uint32_t write_cmd_offset;
+    uint32_t length;
+};
+
+#define AESDCHAR_READV_MAX_RANGES 64
+#define AESDCHAR_READV_MAX_IOV    64
+
+/**
+ * Argument of AESDCHAR_IOCREADV.  The ranges are copied back to back into the iovec segments.
+ * If any range starts outside the buffer the call fails with EINVAL and copies nothing
+ */
+struct aesd_readv {
+    /**
+     * Userspace pointer to nr_ranges struct aesd_seek_range
+     */
+    uint64_t ranges;
+    /**
+     * Userspace pointer to iovcnt struct iovec
+     */
+    uint64_t iov;
+    uint32_t nr_ranges;
+    uint32_t iovcnt;
+    /**
+     * Set by the driver to the total number of bytes copied, which is short when a range runs
+     * past the end of the buffer or the iovec fills up
+     */
+    uint64_t bytes_read;
+};
+
+#define AESDCHAR_STATS_MAX_ENTRIES 10
+
+/**
+ * Filled by AESDCHAR_IOCGSTATS
+ */
+struct aesd_stats {
+    /**
+     * Number of write commands in the buffer, and valid members of entry_size
+     */
+    uint32_t entry_count;
+    uint32_t reserved;
+    /**
+     * Sum of the sizes of all write commands in the buffer
+     */
+    uint64_t total_bytes;
+    /**
+     * Size of each write command, oldest first
+     */
+    uint64_t entry_size[AESDCHAR_STATS_MAX_ENTRIES];
+    /**
+     * Number of write() and read() calls handled since the driver was loaded
+     */
+    uint64_t writes;
+    uint64_t reads;
+};
+
+#define AESDCHAR_SEEK_SINCE_SEQ  0
+#define AESDCHAR_SEEK_SINCE_TIME 1
+
+/**
+ * Argument of AESDCHAR_IOCSEEKSINCE, used by replay clients to resume after a reconnect
+ */
+struct aesd_seek_since {
+    /**
+     * AESDCHAR_SEEK_SINCE_SEQ to resume at sequence number value, AESDCHAR_SEEK_SINCE_TIME to
+     * resume at the first command received at or after value, in nanoseconds since the epoch
+     */
+    uint32_t by;
+    uint32_t reserved;
+    uint64_t value;
+    /**
+     * Set by the driver to the sequence number and receive time of the command at the new file
+     * position.  When no command matches, the position moves to the end of the data, seq is the
+     * sequence number the next command will get and timestamp_ns is 0
+     */
+    uint64_t seq;
+    uint64_t timestamp_ns;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+/**
+ * Enable (non zero) or disable (zero) follow mode on an open file.  In follow mode a read at
+ * the end of data blocks until another command is written, unless the file was opened with
+ * O_NONBLOCK in which case it fails with EAGAIN.  The file position is also moved back by the
+ * size of any commands evicted from the buffer, so it keeps pointing at the same data.
+ */
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+/**
+ * Read several ranges into a user iovec in one call, without moving the file position
+ */
+#define AESDCHAR_IOCREADV _IOWR(AESD_IOC_MAGIC, 3, struct aesd_readv)
+/**
+ * Obtain the buffer contents summary and counters in struct aesd_stats
+ */
+#define AESDCHAR_IOCGSTATS _IOR(AESD_IOC_MAGIC, 4, struct aesd_stats)
+/**
+ * Move the file position to the start of the oldest command at or after a sequence number or
+ * receive time.  Each device numbers its commands from 0 in the order they are written
+ */
+#define AESDCHAR_IOCSEEKSINCE _IOWR(AESD_IOC_MAGIC, 5, struct aesd_seek_since)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 5
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,113 @@
+/**
+ * @file aesd_latency.c
+ * @brief Latency histograms for the aesdchar file operations, exported through debugfs
+ *
+ * aesdchar/aesdcharN/latency lists the count, total, maximum and histogram
+ * of each operation.  Writing anything to the file resets it.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+#include "aesd_latency.h"
+
+static const char * const aesd_latency_op_names[AESD_LATENCY_NR_OPS] = {
+    [AESD_LATENCY_READ] = "read",
+    [AESD_LATENCY_WRITE] = "write",
+    [AESD_LATENCY_IOCTL] = "ioctl",
+    [AESD_LATENCY_LOCK] = "lock",
+};
+
+/**
+ * Account one call of @param op which took @param ns nanoseconds in @param latency
+ */
+void aesd_latency_record(struct aesd_latency *latency, enum aesd_latency_op op, u64 ns)
+{
+    struct aesd_latency_hist *hist = &latency->op[op];
+    unsigned int bucket = ns ? ilog2(ns) : 0;
+    s64 max = atomic64_read(&hist->max_ns);
+
+    if (bucket >= AESD_LATENCY_BUCKETS)
+        bucket = AESD_LATENCY_BUCKETS - 1;
+
+    atomic64_inc(&hist->count);
+    atomic64_add(ns, &hist->total_ns);
+    atomic64_inc(&hist->bucket[bucket]);
+    while ((s64)ns > max) {
+        s64 old = atomic64_cmpxchg(&hist->max_ns, max, ns);
+
+        if (old == max)
+            break;
+        max = old;
+    }
+}
+
+void aesd_latency_reset(struct aesd_latency *latency)
+{
+    int op, bucket;
+
+    for (op = 0; op < AESD_LATENCY_NR_OPS; op++) {
+        struct aesd_latency_hist *hist = &latency->op[op];
+
+        atomic64_set(&hist->count, 0);
+        atomic64_set(&hist->total_ns, 0);
+        atomic64_set(&hist->max_ns, 0);
+        for (bucket = 0; bucket < AESD_LATENCY_BUCKETS; bucket++)
+            atomic64_set(&hist->bucket[bucket], 0);
+    }
+}
+
+static int aesd_latency_show(struct seq_file *s, void *unused)
+{
+    struct aesd_latency *latency = s->private;
+    int op, bucket;
+
+    for (op = 0; op < AESD_LATENCY_NR_OPS; op++) {
+        struct aesd_latency_hist *hist = &latency->op[op];
+
+        seq_printf(s, "%s: count %lld total_ns %lld max_ns %lld\n", aesd_latency_op_names[op],
+                   atomic64_read(&hist->count), atomic64_read(&hist->total_ns),
+                   atomic64_read(&hist->max_ns));
+        for (bucket = 0; bucket < AESD_LATENCY_BUCKETS; bucket++) {
+            s64 count = atomic64_read(&hist->bucket[bucket]);
+
+            if (count)
+                seq_printf(s, "  >= %llu ns: %lld\n", bucket ? 1ULL << bucket : 0ULL, count);
+        }
+    }
+    return 0;
+}
+
+static int aesd_latency_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, aesd_latency_show, inode->i_private);
+}
+
+static ssize_t aesd_latency_write(struct file *file, const char __user *buf, size_t count,
+                                  loff_t *ppos)
+{
+    struct seq_file *s = file->private_data;
+
+    aesd_latency_reset(s->private);
+    return count;
+}
+
+static const struct file_operations aesd_latency_fops = {
+    .owner =   THIS_MODULE,
+    .open =    aesd_latency_open,
+    .read =    seq_read,
+    .write =   aesd_latency_write,
+    .llseek =  seq_lseek,
+    .release = single_release,
+};
+
+/**
+ * Create the latency file for @param latency in debugfs directory @param parent
+ */
+void aesd_latency_debugfs_create(struct aesd_latency *latency, struct dentry *parent)
+{
+    debugfs_create_file("latency", 0644, parent, latency, &aesd_latency_fops);
+}
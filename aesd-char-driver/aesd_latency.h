@@ -0,0 +1,51 @@
+/*
+ * aesd_latency.h
+ *
+ *  @brief Per device latency histograms for the aesdchar file operations
+ *
+ *  Each operation keeps a call count, total and maximum latency and a log2
+ *  histogram: bucket n counts calls which took from 2^n to 2^(n+1) - 1 ns,
+ *  bucket 0 also counts calls under 1 ns and the last bucket everything
+ *  above its lower bound.  Recording is lock free so it can be done with or
+ *  without the device lock held.
+ */
+
+#ifndef AESD_CHAR_DRIVER_AESD_LATENCY_H_
+#define AESD_CHAR_DRIVER_AESD_LATENCY_H_
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+
+#define AESD_LATENCY_BUCKETS 32
+
+enum aesd_latency_op {
+    AESD_LATENCY_READ,
+    AESD_LATENCY_WRITE,
+    AESD_LATENCY_IOCTL,
+    /**
+     * Time spent waiting for the device lock
+     */
+    AESD_LATENCY_LOCK,
+    AESD_LATENCY_NR_OPS,
+};
+
+struct aesd_latency_hist
+{
+    atomic64_t count;
+    atomic64_t total_ns;
+    atomic64_t max_ns;
+    atomic64_t bucket[AESD_LATENCY_BUCKETS];
+};
+
+struct aesd_latency
+{
+    struct aesd_latency_hist op[AESD_LATENCY_NR_OPS];
+};
+
+struct dentry;
+
+void aesd_latency_record(struct aesd_latency *latency, enum aesd_latency_op op, u64 ns);
+void aesd_latency_reset(struct aesd_latency *latency);
+void aesd_latency_debugfs_create(struct aesd_latency *latency, struct dentry *parent);
+
+#endif /* AESD_CHAR_DRIVER_AESD_LATENCY_H_ */
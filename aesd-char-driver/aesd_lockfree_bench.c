@@ -0,0 +1,129 @@
+/**
+ * @file aesd_lockfree_bench.c
+ * @brief Throughput of the lock free circular buffer against the mutex protected one
+ *
+ * Producers add entries and consumers look up random offsets for a fixed
+ * time, first with aesd-circular-buffer.c behind a pthread mutex, then with
+ * aesd-circular-buffer-lockfree.c.  Reports adds and lookups per second.
+ *
+ * Usage: aesd_lockfree_bench [-p producers] [-c consumers] [-d seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "aesd-circular-buffer.h"
+#include "aesd-circular-buffer-lockfree.h"
+
+static const char bench_entry[] = "benchmark entry of typical aesdsocket packet size\n";
+
+static struct aesd_circular_buffer locked_buffer;
+static pthread_mutex_t locked_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct aesd_lf_circular_buffer lf_buffer;
+static atomic_bool bench_stop;
+static bool bench_lockfree;
+
+struct bench_counter {
+    unsigned long long ops;
+    unsigned int seed;
+};
+
+static void *bench_producer(void *arg)
+{
+    struct bench_counter *counter = arg;
+    struct aesd_buffer_entry entry = { .buffptr = bench_entry, .size = sizeof(bench_entry) - 1 };
+
+    while (!atomic_load_explicit(&bench_stop, memory_order_relaxed)) {
+        if (bench_lockfree) {
+            aesd_lf_circular_buffer_add_entry(&lf_buffer, &entry);
+        } else {
+            pthread_mutex_lock(&locked_mutex);
+            aesd_circular_buffer_add_entry(&locked_buffer, &entry);
+            pthread_mutex_unlock(&locked_mutex);
+        }
+        counter->ops++;
+    }
+    return NULL;
+}
+
+static void *bench_consumer(void *arg)
+{
+    struct bench_counter *counter = arg;
+    size_t span = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * (sizeof(bench_entry) - 1);
+
+    while (!atomic_load_explicit(&bench_stop, memory_order_relaxed)) {
+        size_t offset = rand_r(&counter->seed) % span, offset_rtn;
+
+        if (bench_lockfree) {
+            struct aesd_buffer_entry entry;
+            aesd_lf_circular_buffer_find_entry_offset_for_fpos(&lf_buffer, offset, &entry, &offset_rtn);
+        } else {
+            pthread_mutex_lock(&locked_mutex);
+            aesd_circular_buffer_find_entry_offset_for_fpos(&locked_buffer, offset, &offset_rtn);
+            pthread_mutex_unlock(&locked_mutex);
+        }
+        counter->ops++;
+    }
+    return NULL;
+}
+
+static void run(const char *name, unsigned int producers, unsigned int consumers, unsigned int seconds)
+{
+    pthread_t tids[producers + consumers];
+    struct bench_counter counters[producers + consumers];
+    unsigned long long adds = 0, lookups = 0;
+    unsigned int t;
+
+    memset(counters, 0, sizeof(counters));
+    atomic_store(&bench_stop, false);
+    for (t = 0; t < producers + consumers; t++) {
+        counters[t].seed = t + 1;
+        pthread_create(&tids[t], NULL, t < producers ? bench_producer : bench_consumer, &counters[t]);
+    }
+    sleep(seconds);
+    atomic_store(&bench_stop, true);
+    for (t = 0; t < producers + consumers; t++) {
+        pthread_join(tids[t], NULL);
+        if (t < producers)
+            adds += counters[t].ops;
+        else
+            lookups += counters[t].ops;
+    }
+
+    printf("%-8s %u producers %u consumers: %12.0f adds/s %12.0f lookups/s\n", name, producers, consumers,
+           (double)adds / seconds, (double)lookups / seconds);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int producers = 1, consumers = 1, seconds = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:c:d:")) != -1) {
+        switch (opt) {
+        case 'p': producers = strtoul(optarg, NULL, 0); break;
+        case 'c': consumers = strtoul(optarg, NULL, 0); break;
+        case 'd': seconds = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p producers] [-c consumers] [-d seconds]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (producers == 0 || seconds == 0) {
+        fprintf(stderr, "producers and seconds must be non zero\n");
+        return EXIT_FAILURE;
+    }
+
+    aesd_circular_buffer_init(&locked_buffer);
+    bench_lockfree = false;
+    run("mutex", producers, consumers, seconds);
+
+    aesd_lf_circular_buffer_init(&lf_buffer, producers > 1 ? AESD_LF_MULTI_PRODUCER : AESD_LF_SINGLE_PRODUCER);
+    bench_lockfree = true;
+    run(producers > 1 ? "mpsc" : "spsc", producers, consumers, seconds);
+    return EXIT_SUCCESS;
+}
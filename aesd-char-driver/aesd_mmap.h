@@ -0,0 +1,84 @@
+/*
+ * aesd_mmap.h
+ *
+ *  @brief Layout of the read-only mapping exported by the aesdchar driver
+ *
+ *  The mapping starts with a header page followed by a data area of
+ *  AESD_MMAP_DATA_SIZE bytes.  Every committed write command is copied into
+ *  the data area, which is used as a byte ring addressed by a monotonic
+ *  stream position.  The header is updated with a seqlock style generation
+ *  counter: it is odd while the driver is updating the mapping, and readers
+ *  must retry any snapshot taken while it was odd or which changed while
+ *  they were copying.
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#include "aesd-circular-buffer.h"
+
+#define AESD_MMAP_MAGIC     0x41455344 /* "AESD" */
+#define AESD_MMAP_VERSION   1
+
+/**
+ * Size of the data area following the header page, a multiple of any supported page size
+ */
+#define AESD_MMAP_DATA_SIZE (256 * 1024)
+
+/**
+ * Value of aesd_mmap_entry.pos for a slot with no data in the data area, either because
+ * the slot is empty or because the command was larger than AESD_MMAP_DATA_SIZE
+ */
+#define AESD_MMAP_POS_NONE  ((uint64_t)~0ULL)
+
+struct aesd_mmap_entry {
+    /**
+     * Stream position of the first byte of this command, found in the data area at
+     * offset pos % data_size.  The bytes are only valid while head - pos <= data_size
+     */
+    uint64_t pos;
+    /**
+     * Number of bytes in this command
+     */
+    uint64_t size;
+};
+
+struct aesd_mmap_header {
+    uint32_t magic;
+    uint32_t version;
+    /**
+     * Offset of the data area from the start of the mapping (the page size)
+     */
+    uint32_t data_offset;
+    /**
+     * Size of the data area in bytes
+     */
+    uint32_t data_size;
+    /**
+     * Incremented before and after each update, odd while an update is in progress
+     */
+    uint64_t generation;
+    /**
+     * Stream position one past the last byte copied into the data area
+     */
+    uint64_t head;
+    /**
+     * Copies of the circular buffer in_offs, out_offs and full members
+     */
+    uint32_t in_offs;
+    uint32_t out_offs;
+    uint32_t full;
+    uint32_t reserved;
+    /**
+     * One descriptor per circular buffer slot, indexed like aesd_circular_buffer.entry
+     */
+    struct aesd_mmap_entry entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+#endif /* AESD_MMAP_H */
@@ -8,7 +8,7 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+/* AESD_DEBUG is defined by building with make DEBUG=y */
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -23,8 +23,14 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+#define AESD_NR_DEVS 1     /* default number of aesdcharN minors */
+#define AESD_MAX_DEVS 64   /* upper bound for the aesd_nr_devs module parameter */
+
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
 #include "aesd-circular-buffer.h"
+#include "aesd_latency.h"
 
 ssize_t aesd_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos);
 ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos);
@@ -34,6 +40,8 @@ int aesd_init_module(void);
 void aesd_cleanup_module(void);
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence);
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma);
+__poll_t aesd_poll(struct file *filp, poll_table *wait);
 
 struct aesd_dev
 {
@@ -41,6 +49,54 @@ struct aesd_dev
     struct aesd_buffer_entry working_entry; 
     struct mutex lock;                    
     struct cdev cdev;                     
+    /**
+     * vmalloc_user() area exported read-only through aesd_mmap(), a header page
+     * followed by AESD_MMAP_DATA_SIZE bytes of entry data.  See aesd_mmap.h
+     */
+    void *mmap_area;
+    /**
+     * Woken each time a command is committed to buffer
+     */
+    wait_queue_head_t readq;
+    /**
+     * Number of commands committed since load, used as the readq wake condition
+     */
+    unsigned long committed;
+    /**
+     * Total bytes of commands evicted from buffer since load
+     */
+    loff_t evicted_bytes;
+    /**
+     * Module wide sequence number of the command in each buffer slot, used to
+     * interleave the devices by commit order in the merged view
+     */
+    uint64_t entry_seq[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * Number of write() and read() calls handled, reported by AESDCHAR_IOCGSTATS
+     */
+    uint64_t writes;
+    uint64_t reads;
+    /**
+     * Latency histograms of the file operations and lock waits, in debugfs
+     */
+    struct aesd_latency latency;
+};
+
+/**
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    /**
+     * Set by AESDCHAR_IOCFOLLOW: reads at the end of data block until a command is
+     * committed, and the file position follows evictions from the buffer
+     */
+    bool follow;
+    /**
+     * dev->evicted_bytes at the time the file position was last adjusted
+     */
+    loff_t evicted_seen;
 };
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
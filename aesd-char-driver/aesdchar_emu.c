@@ -0,0 +1,467 @@
+/**
+ * @file aesdchar_emu.c
+ * @brief Userspace emulation of the aesdchar driver file operations
+ *
+ * Each function mirrors the matching handler in main.c, with the kernel
+ * primitives swapped for their userspace counterparts: the device mutex is a
+ * pthread mutex, the follow mode wait queue a condition variable, and
+ * copy_to_user()/copy_from_user() plain memcpy().  Keep the two in step when
+ * changing either.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include "aesdchar_emu.h"
+#include "aesd_ioctl.h"
+#include "aesd-circular-buffer.h"
+
+#define AESD_EMU_MAX_FILES 1024
+/**
+ * Handles start here so they are never mistaken for, or closed as, real descriptors
+ */
+#define AESD_EMU_FD_BASE   (1 << 20)
+
+struct aesd_emu_dev
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry working_entry;
+    pthread_mutex_t lock;
+    pthread_cond_t readq;
+    unsigned long committed;
+    off_t evicted_bytes;
+    uint64_t writes;
+    uint64_t reads;
+};
+
+struct aesd_emu_file
+{
+    bool used;
+    int flags;
+    off_t pos;
+    bool follow;
+    off_t evicted_seen;
+};
+
+static struct aesd_emu_dev aesd_emu_device = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .readq = PTHREAD_COND_INITIALIZER,
+};
+
+static struct aesd_emu_file aesd_emu_files[AESD_EMU_MAX_FILES];
+static pthread_mutex_t aesd_emu_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct aesd_emu_file *aesd_emu_file_get(int fd)
+{
+    int idx = fd - AESD_EMU_FD_BASE;
+
+    if (idx < 0 || idx >= AESD_EMU_MAX_FILES || !aesd_emu_files[idx].used) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &aesd_emu_files[idx];
+}
+
+int aesd_emu_open(const char *path, int flags, ...)
+{
+    int idx;
+
+    (void)path;
+    pthread_mutex_lock(&aesd_emu_files_lock);
+    for (idx = 0; idx < AESD_EMU_MAX_FILES; idx++) {
+        if (!aesd_emu_files[idx].used) {
+            memset(&aesd_emu_files[idx], 0, sizeof(aesd_emu_files[idx]));
+            aesd_emu_files[idx].used = true;
+            aesd_emu_files[idx].flags = flags;
+            pthread_mutex_unlock(&aesd_emu_files_lock);
+            return AESD_EMU_FD_BASE + idx;
+        }
+    }
+    pthread_mutex_unlock(&aesd_emu_files_lock);
+    errno = EMFILE;
+    return -1;
+}
+
+int aesd_emu_close(int fd)
+{
+    struct aesd_emu_file *file = aesd_emu_file_get(fd);
+
+    if (!file)
+        return -1;
+    pthread_mutex_lock(&aesd_emu_files_lock);
+    file->used = false;
+    pthread_mutex_unlock(&aesd_emu_files_lock);
+    return 0;
+}
+
+static off_t aesd_emu_follow_pos(const struct aesd_emu_file *file, off_t pos)
+{
+    off_t evicted = aesd_emu_device.evicted_bytes - file->evicted_seen;
+
+    return pos > evicted ? pos - evicted : 0;
+}
+
+ssize_t aesd_emu_read(int fd, void *buf, size_t count)
+{
+    struct aesd_emu_file *file = aesd_emu_file_get(fd);
+    struct aesd_emu_dev *dev = &aesd_emu_device;
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset;
+    size_t bytes_to_read;
+    unsigned long committed;
+    ssize_t retval = 0;
+
+    if (!file)
+        return -1;
+
+    pthread_mutex_lock(&dev->lock);
+    dev->reads++;
+
+    for (;;) {
+        if (file->follow) {
+            file->pos = aesd_emu_follow_pos(file, file->pos);
+            file->evicted_seen = dev->evicted_bytes;
+        }
+
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, file->pos, &entry_offset);
+        if (entry)
+            break;
+
+        if (!file->follow)
+            goto out;
+        if (file->flags & O_NONBLOCK) {
+            errno = EAGAIN;
+            retval = -1;
+            goto out;
+        }
+
+        committed = dev->committed;
+        while (dev->committed == committed)
+            pthread_cond_wait(&dev->readq, &dev->lock);
+    }
+
+    bytes_to_read = entry->size - entry_offset;
+    if (bytes_to_read > count)
+        bytes_to_read = count;
+
+    memcpy(buf, entry->buffptr + entry_offset, bytes_to_read);
+    file->pos += bytes_to_read;
+    retval = bytes_to_read;
+
+out:
+    pthread_mutex_unlock(&dev->lock);
+    return retval;
+}
+
+ssize_t aesd_emu_write(int fd, const void *buf, size_t count)
+{
+    struct aesd_emu_file *file = aesd_emu_file_get(fd);
+    struct aesd_emu_dev *dev = &aesd_emu_device;
+    const char *newline_ptr;
+    char *grown;
+    size_t write_size, new_size;
+    struct aesd_buffer_entry entry = {0};
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t evicted_count = 0, index;
+
+    if (!file)
+        return -1;
+
+    newline_ptr = memchr(buf, '\n', count);
+    write_size = newline_ptr ? (size_t)(newline_ptr - (const char *)buf) + 1 : count;
+
+    pthread_mutex_lock(&dev->lock);
+    dev->writes++;
+
+    new_size = dev->working_entry.size + write_size;
+    grown = realloc((void *)dev->working_entry.buffptr, new_size ? new_size : 1);
+    if (!grown) {
+        pthread_mutex_unlock(&dev->lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(grown + dev->working_entry.size, buf, write_size);
+    dev->working_entry.buffptr = grown;
+    dev->working_entry.size = new_size;
+
+    if (newline_ptr) {
+        struct timespec now;
+
+        entry = dev->working_entry;
+        dev->working_entry.buffptr = NULL;
+        dev->working_entry.size = 0;
+        clock_gettime(CLOCK_REALTIME, &now);
+        entry.timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+        evicted_count = aesd_circular_buffer_add_entry_evict(&dev->buffer, &entry, evicted);
+        for (index = 0; index < evicted_count; index++)
+            dev->evicted_bytes += evicted[index].size;
+        dev->committed++;
+        pthread_cond_broadcast(&dev->readq);
+    }
+
+    pthread_mutex_unlock(&dev->lock);
+    for (index = 0; index < evicted_count; index++)
+        free((void *)evicted[index].buffptr);
+    /* like the driver, bytes after the first newline are accepted but dropped */
+    return count;
+}
+
+off_t aesd_emu_lseek(int fd, off_t offset, int whence)
+{
+    struct aesd_emu_file *file = aesd_emu_file_get(fd);
+    struct aesd_emu_dev *dev = &aesd_emu_device;
+    off_t newpos;
+
+    if (!file)
+        return -1;
+
+    pthread_mutex_lock(&dev->lock);
+    switch (whence) {
+    case SEEK_SET: newpos = offset; break;
+    case SEEK_CUR: newpos = file->pos + offset; break;
+    case SEEK_END: newpos = (off_t)dev->buffer.total_bytes + offset; break;
+    default: newpos = -1; break;
+    }
+    /* same bounds as fixed_size_llseek() */
+    if (newpos < 0 || newpos > (off_t)dev->buffer.total_bytes) {
+        pthread_mutex_unlock(&dev->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    file->pos = newpos;
+    file->evicted_seen = dev->evicted_bytes;
+    pthread_mutex_unlock(&dev->lock);
+    return newpos;
+}
+
+static uint8_t aesd_emu_entry_count(struct aesd_emu_dev *dev)
+{
+    if (dev->buffer.full)
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    return (dev->buffer.in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - dev->buffer.out_offs) %
+        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+static int aesd_emu_seekto_pos(struct aesd_emu_dev *dev, uint32_t write_cmd, uint32_t write_cmd_offset,
+                               off_t *pos)
+{
+    size_t total_offset = 0;
+    uint8_t idx, current_idx;
+
+    if (write_cmd >= aesd_emu_entry_count(dev))
+        return -EINVAL;
+
+    current_idx = dev->buffer.out_offs;
+    for (idx = 0; idx < write_cmd; idx++) {
+        total_offset += dev->buffer.entry[current_idx].size;
+        current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+
+    if (write_cmd_offset >= dev->buffer.entry[current_idx].size)
+        return -EINVAL;
+
+    *pos = total_offset + write_cmd_offset;
+    return 0;
+}
+
+static void aesd_emu_ioctl_seek_since(struct aesd_emu_dev *dev, struct aesd_emu_file *file,
+                                     struct aesd_seek_since *since)
+{
+    struct aesd_buffer_entry *entry;
+    off_t pos = dev->buffer.total_bytes;
+    int index;
+
+    if (since->by == AESDCHAR_SEEK_SINCE_SEQ)
+        index = aesd_circular_buffer_find_entry_index_for_seq(&dev->buffer, since->value);
+    else
+        index = aesd_circular_buffer_find_entry_index_for_time(&dev->buffer, since->value);
+
+    if (index < 0) {
+        since->seq = dev->buffer.next_seq;
+        since->timestamp_ns = 0;
+    } else {
+        aesd_emu_seekto_pos(dev, index, 0, &pos);
+        entry = &dev->buffer.entry[(dev->buffer.out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        since->seq = entry->seq;
+        since->timestamp_ns = entry->timestamp_ns;
+    }
+    file->pos = pos;
+    file->evicted_seen = dev->evicted_bytes;
+}
+
+static int aesd_emu_ioctl_readv(struct aesd_emu_dev *dev, struct aesd_readv *readv)
+{
+    const struct aesd_seek_range *ranges = (const struct aesd_seek_range *)(uintptr_t)readv->ranges;
+    const struct iovec *iov = (const struct iovec *)(uintptr_t)readv->iov;
+    uint32_t r, seg = 0;
+    size_t seg_used = 0;
+    int retval = 0;
+
+    if (readv->nr_ranges > AESDCHAR_READV_MAX_RANGES || readv->iovcnt > AESDCHAR_READV_MAX_IOV)
+        return -EINVAL;
+
+    for (r = 0; r < readv->nr_ranges; r++) {
+        off_t pos;
+
+        retval = aesd_emu_seekto_pos(dev, ranges[r].write_cmd, ranges[r].write_cmd_offset, &pos);
+        if (retval)
+            return retval;
+    }
+    readv->bytes_read = 0;
+    dev->reads++;
+    for (r = 0; r < readv->nr_ranges && seg < readv->iovcnt; r++) {
+        size_t remaining = ranges[r].length;
+        off_t pos;
+
+        aesd_emu_seekto_pos(dev, ranges[r].write_cmd, ranges[r].write_cmd_offset, &pos);
+
+        while (remaining && seg < readv->iovcnt) {
+            struct aesd_buffer_entry *entry;
+            size_t entry_offset, chunk;
+
+            entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, pos, &entry_offset);
+            if (!entry)
+                break;
+
+            chunk = entry->size - entry_offset;
+            if (chunk > remaining)
+                chunk = remaining;
+            if (chunk > iov[seg].iov_len - seg_used)
+                chunk = iov[seg].iov_len - seg_used;
+            memcpy((char *)iov[seg].iov_base + seg_used, entry->buffptr + entry_offset, chunk);
+            pos += chunk;
+            remaining -= chunk;
+            readv->bytes_read += chunk;
+            seg_used += chunk;
+            if (seg_used == iov[seg].iov_len) {
+                seg++;
+                seg_used = 0;
+            }
+        }
+    }
+    return retval;
+}
+
+static void aesd_emu_ioctl_stats(struct aesd_emu_dev *dev, struct aesd_stats *stats)
+{
+    uint8_t idx, current_idx;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->entry_count = aesd_emu_entry_count(dev);
+    stats->total_bytes = dev->buffer.total_bytes;
+    current_idx = dev->buffer.out_offs;
+    for (idx = 0; idx < stats->entry_count; idx++) {
+        stats->entry_size[idx] = dev->buffer.entry[current_idx].size;
+        current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    stats->writes = dev->writes;
+    stats->reads = dev->reads;
+}
+
+int aesd_emu_ioctl(int fd, unsigned long request, ...)
+{
+    struct aesd_emu_file *file = aesd_emu_file_get(fd);
+    struct aesd_emu_dev *dev = &aesd_emu_device;
+    va_list args;
+    void *arg;
+    int retval = 0;
+
+    if (!file)
+        return -1;
+
+    va_start(args, request);
+    arg = va_arg(args, void *);
+    va_end(args);
+
+    pthread_mutex_lock(&dev->lock);
+    switch (request) {
+    case AESDCHAR_IOCSEEKTO: {
+        struct aesd_seekto *seekto = arg;
+        off_t pos;
+
+        retval = aesd_emu_seekto_pos(dev, seekto->write_cmd, seekto->write_cmd_offset, &pos);
+        if (!retval) {
+            file->pos = pos;
+            file->evicted_seen = dev->evicted_bytes;
+        }
+        break;
+    }
+    case AESDCHAR_IOCFOLLOW:
+        file->follow = *(uint32_t *)arg != 0;
+        file->evicted_seen = dev->evicted_bytes;
+        break;
+    case AESDCHAR_IOCREADV:
+        retval = aesd_emu_ioctl_readv(dev, arg);
+        break;
+    case AESDCHAR_IOCGSTATS:
+        aesd_emu_ioctl_stats(dev, arg);
+        break;
+    case AESDCHAR_IOCSEEKSINCE: {
+        struct aesd_seek_since *since = arg;
+
+        if (since->by != AESDCHAR_SEEK_SINCE_SEQ && since->by != AESDCHAR_SEEK_SINCE_TIME)
+            retval = -EINVAL;
+        else
+            aesd_emu_ioctl_seek_since(dev, file, since);
+        break;
+    }
+    default:
+        retval = -ENOTTY;
+        break;
+    }
+    pthread_mutex_unlock(&dev->lock);
+
+    if (retval) {
+        errno = -retval;
+        return -1;
+    }
+    return 0;
+}
+
+int aesd_emu_fsync(int fd)
+{
+    return aesd_emu_file_get(fd) ? 0 : -1;
+}
+
+void aesd_emu_set_max_bytes(size_t max_bytes)
+{
+    struct aesd_emu_dev *dev = &aesd_emu_device;
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t evicted_count, index;
+
+    pthread_mutex_lock(&dev->lock);
+    evicted_count = aesd_circular_buffer_set_max_bytes(&dev->buffer, max_bytes, evicted);
+    for (index = 0; index < evicted_count; index++)
+        dev->evicted_bytes += evicted[index].size;
+    pthread_mutex_unlock(&dev->lock);
+
+    for (index = 0; index < evicted_count; index++)
+        free((void *)evicted[index].buffptr);
+}
+
+void aesd_emu_reset(void)
+{
+    struct aesd_emu_dev *dev = &aesd_emu_device;
+    struct aesd_buffer_entry *entry;
+    uint8_t index;
+
+    pthread_mutex_lock(&dev->lock);
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, index) {
+        free((void *)entry->buffptr);
+    }
+    free((void *)dev->working_entry.buffptr);
+    aesd_circular_buffer_init(&dev->buffer);
+    dev->working_entry.buffptr = NULL;
+    dev->working_entry.size = 0;
+    dev->committed = 0;
+    dev->evicted_bytes = 0;
+    dev->writes = 0;
+    dev->reads = 0;
+    pthread_mutex_unlock(&dev->lock);
+}
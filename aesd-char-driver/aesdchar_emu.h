@@ -0,0 +1,49 @@
+/*
+ * aesdchar_emu.h
+ *
+ *  @brief Userspace emulation of the aesdchar device
+ *
+ *  Implements the read, write, llseek and ioctl semantics of main.c on top of
+ *  aesd-circular-buffer.c, with the same calling conventions as the POSIX
+ *  calls used on /dev/aesdchar: functions return -1 and set errno on failure.
+ *  Handles returned by aesd_emu_open() are only valid with these functions.
+ *  All opens share one emulated device, as with minor 0 of the driver.
+ */
+
+#ifndef AESDCHAR_EMU_H
+#define AESDCHAR_EMU_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Open the emulated device.  @param path is accepted for symmetry with open(2) and ignored.
+ * O_NONBLOCK in @param flags is honoured by follow mode reads
+ */
+int aesd_emu_open(const char *path, int flags, ...);
+int aesd_emu_close(int fd);
+ssize_t aesd_emu_read(int fd, void *buf, size_t count);
+ssize_t aesd_emu_write(int fd, const void *buf, size_t count);
+off_t aesd_emu_lseek(int fd, off_t offset, int whence);
+/**
+ * Supports every request in aesd_ioctl.h
+ */
+int aesd_emu_ioctl(int fd, unsigned long request, ...);
+/**
+ * Nothing is persisted, provided so callers can keep their fsync() calls
+ */
+int aesd_emu_fsync(int fd);
+
+/**
+ * Set the byte limit of the emulated buffer, like the debugfs max_bytes file.  A lowered limit
+ * evicts the oldest commands immediately
+ */
+void aesd_emu_set_max_bytes(size_t max_bytes);
+
+/**
+ * Free every stored command and return the emulated device to its freshly loaded state.
+ * No handle may be in use
+ */
+void aesd_emu_reset(void);
+
+#endif /* AESDCHAR_EMU_H */
@@ -0,0 +1,130 @@
+/**
+ * @file aesdchar_emu_bench.c
+ * @brief Throughput benchmark of the aesdchar file operations using the userspace emulation
+ *
+ * Runs the access pattern of aesdsocket against aesdchar_emu: each thread writes
+ * a command, then reads the whole buffer back, with a configurable share of
+ * iterations using AESDCHAR_IOCSEEKTO first.  Run under perf record to profile
+ * the driver hot paths without loading the module.
+ *
+ * Usage: aesdchar_emu_bench [-t threads] [-n iterations] [-s command_size] [-k seek_every]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include "aesdchar_emu.h"
+#include "aesd_ioctl.h"
+
+struct bench_args {
+    unsigned int iterations;
+    size_t command_size;
+    unsigned int seek_every;
+    unsigned long long bytes_read;
+    int failed;
+};
+
+static void *bench_thread(void *arg)
+{
+    struct bench_args *args = arg;
+    char *command = malloc(args->command_size);
+    char read_buf[1024];
+    unsigned int i;
+    ssize_t n;
+    int fd;
+
+    if (!command) {
+        args->failed = 1;
+        return NULL;
+    }
+    memset(command, 'x', args->command_size - 1);
+    command[args->command_size - 1] = '\n';
+
+    fd = aesd_emu_open("/dev/aesdchar", O_RDWR);
+    if (fd < 0) {
+        args->failed = 1;
+        free(command);
+        return NULL;
+    }
+
+    for (i = 0; i < args->iterations; i++) {
+        if (aesd_emu_write(fd, command, args->command_size) != (ssize_t)args->command_size) {
+            args->failed = 1;
+            break;
+        }
+
+        if (args->seek_every && i % args->seek_every == 0) {
+            struct aesd_seekto seekto = { .write_cmd = 0, .write_cmd_offset = 0 };
+            aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto);
+        } else {
+            aesd_emu_lseek(fd, 0, SEEK_SET);
+        }
+        while ((n = aesd_emu_read(fd, read_buf, sizeof(read_buf))) > 0)
+            args->bytes_read += n;
+    }
+
+    aesd_emu_close(fd);
+    free(command);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int threads = 4, iterations = 100000, seek_every = 4, t;
+    size_t command_size = 64;
+    struct bench_args *args;
+    pthread_t *tids;
+    struct timespec start, end;
+    unsigned long long bytes_read = 0;
+    double elapsed;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "t:n:s:k:")) != -1) {
+        switch (opt) {
+        case 't': threads = strtoul(optarg, NULL, 0); break;
+        case 'n': iterations = strtoul(optarg, NULL, 0); break;
+        case 's': command_size = strtoul(optarg, NULL, 0); break;
+        case 'k': seek_every = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-n iterations] [-s command_size] [-k seek_every]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (threads == 0 || command_size == 0) {
+        fprintf(stderr, "threads and command_size must be non zero\n");
+        return EXIT_FAILURE;
+    }
+
+    args = calloc(threads, sizeof(*args));
+    tids = calloc(threads, sizeof(*tids));
+    if (!args || !tids)
+        return EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < threads; t++) {
+        args[t].iterations = iterations;
+        args[t].command_size = command_size;
+        args[t].seek_every = seek_every;
+        pthread_create(&tids[t], NULL, bench_thread, &args[t]);
+    }
+    for (t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        bytes_read += args[t].bytes_read;
+        failed |= args[t].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%u threads, %u iterations of %zu byte commands: %.3f s, %.0f write+readback/s, %.1f MB/s read\n",
+           threads, iterations, command_size, elapsed,
+           threads * (double)iterations / elapsed, bytes_read / elapsed / 1e6);
+
+    aesd_emu_reset();
+    free(args);
+    free(tids);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,274 @@
+/**
+ * @file aesdchar_mmap_test.c
+ * @brief Userspace consistency test for the aesdchar mmap interface
+ *
+ * Forks writer processes which append self describing commands to the
+ * device while the parent repeatedly snapshots the read-only mapping and
+ * verifies every command it can see.  Each command has the form
+ * "aesdmm w=WW n=NNNNNNNN <payload>\n" where the payload length and
+ * contents are a function of the writer and command number, so a torn or
+ * misplaced copy is detected without any other channel to the writers.
+ *
+ * Usage: aesdchar_mmap_test [-d device] [-w writers] [-n commands] [-s max_payload]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "aesd_mmap.h"
+
+#define DEFAULT_DEVICE      "/dev/aesdchar"
+#define CMD_PREFIX_FMT      "aesdmm w=%02u n=%08u "
+#define CMD_PREFIX_LEN      23
+
+static size_t payload_len(unsigned int writer, unsigned int num, size_t max_payload)
+{
+    return (writer * 131u + num * 17u) % (max_payload + 1);
+}
+
+static char payload_char(unsigned int writer, unsigned int num, size_t i)
+{
+    return 'a' + (writer + num + i) % 26;
+}
+
+static size_t format_cmd(char *buf, unsigned int writer, unsigned int num, size_t max_payload)
+{
+    size_t len = snprintf(buf, CMD_PREFIX_LEN + 1, CMD_PREFIX_FMT, writer, num);
+    size_t plen = payload_len(writer, num, max_payload);
+    size_t i;
+
+    for (i = 0; i < plen; i++)
+        buf[len++] = payload_char(writer, num, i);
+    buf[len++] = '\n';
+    return len;
+}
+
+static int run_writer(const char *device, unsigned int writer, unsigned int commands, size_t max_payload)
+{
+    char *buf = malloc(CMD_PREFIX_LEN + max_payload + 2);
+    unsigned int num;
+    int fd;
+
+    if (!buf)
+        return EXIT_FAILURE;
+
+    fd = open(device, O_WRONLY);
+    if (fd < 0) {
+        perror("writer open");
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    for (num = 0; num < commands; num++) {
+        size_t len = format_cmd(buf, writer, num, max_payload);
+        if (write(fd, buf, len) != (ssize_t)len) {
+            perror("writer write");
+            close(fd);
+            free(buf);
+            return EXIT_FAILURE;
+        }
+    }
+
+    close(fd);
+    free(buf);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Verify a single command copied out of the mapping
+ * @return true if the command is well formed and matches what its writer produced
+ */
+static bool check_cmd(const char *cmd, size_t size, size_t max_payload)
+{
+    unsigned int writer, num;
+    size_t i, plen;
+
+    if (size < CMD_PREFIX_LEN + 1 || cmd[size - 1] != '\n')
+        return false;
+    if (sscanf(cmd, "aesdmm w=%2u n=%8u ", &writer, &num) != 2)
+        return false;
+
+    plen = payload_len(writer, num, max_payload);
+    if (size != CMD_PREFIX_LEN + plen + 1)
+        return false;
+    for (i = 0; i < plen; i++) {
+        if (cmd[CMD_PREFIX_LEN + i] != payload_char(writer, num, i))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Take a consistent copy of the header and of every command still present in the data area
+ * @return the number of commands copied into @param cmds, or -1 on a header invariant violation
+ */
+static int snapshot(const struct aesd_mmap_header *hdr, const char *data,
+                    struct aesd_mmap_header *copy, char *cmds[], size_t sizes[], uint64_t cmd_pos[])
+{
+    for (;;) {
+        uint64_t gen = atomic_load_explicit((_Atomic uint64_t *)&hdr->generation, memory_order_acquire);
+        unsigned int count, i, idx;
+        uint64_t expected_pos = AESD_MMAP_POS_NONE;
+        int copied = 0;
+
+        if (gen & 1)
+            continue;
+
+        memcpy(copy, hdr, sizeof(*copy));
+        count = copy->full ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED :
+            (copy->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - copy->out_offs) %
+                AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+        for (i = 0, idx = copy->out_offs; i < count && idx < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+                i++, idx = (idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) {
+            const struct aesd_mmap_entry *e = &copy->entry[idx];
+            size_t start, first;
+
+            if (e->pos == AESD_MMAP_POS_NONE) {
+                expected_pos = AESD_MMAP_POS_NONE;
+                continue;
+            }
+            if (expected_pos != AESD_MMAP_POS_NONE && e->pos != expected_pos) {
+                copied = -1;
+                break;
+            }
+            expected_pos = e->pos + e->size;
+            if (e->size > copy->data_size || e->pos + e->size > copy->head)
+                continue; /* torn copy, rejected by the generation check below */
+            if (copy->head - e->pos > copy->data_size)
+                continue; /* overwritten in the data area by newer commands */
+
+            start = e->pos % copy->data_size;
+            first = e->size < copy->data_size - start ? e->size : copy->data_size - start;
+            memcpy(cmds[copied], data + start, first);
+            memcpy(cmds[copied] + first, data, e->size - first);
+            cmd_pos[copied] = e->pos;
+            sizes[copied++] = e->size;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit((_Atomic uint64_t *)&hdr->generation, memory_order_relaxed) == gen)
+            return copied;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = DEFAULT_DEVICE;
+    unsigned int writers = 2, commands = 1000, w;
+    size_t max_payload = 200;
+    struct aesd_mmap_header copy;
+    char *cmds[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t sizes[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    uint64_t cmd_pos[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    unsigned long snapshots = 0, verified = 0, failures = 0;
+    uint64_t last_gen = 0, last_head = 0, start_head;
+    long page_size = sysconf(_SC_PAGESIZE);
+    const struct aesd_mmap_header *hdr;
+    int opt, fd, running, status, rc = EXIT_SUCCESS;
+    void *map;
+
+    while ((opt = getopt(argc, argv, "d:w:n:s:")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'w': writers = strtoul(optarg, NULL, 0); break;
+        case 'n': commands = strtoul(optarg, NULL, 0); break;
+        case 's': max_payload = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device] [-w writers] [-n commands] [-s max_payload]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (writers > 99 || max_payload > AESD_MMAP_DATA_SIZE / 2) {
+        fprintf(stderr, "At most 99 writers and %d byte payloads are supported\n", AESD_MMAP_DATA_SIZE / 2);
+        return EXIT_FAILURE;
+    }
+
+    fd = open(device, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return EXIT_FAILURE;
+    }
+    map = mmap(NULL, page_size + AESD_MMAP_DATA_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    hdr = map;
+    if (hdr->magic != AESD_MMAP_MAGIC || hdr->version != AESD_MMAP_VERSION ||
+            hdr->data_offset != page_size || hdr->data_size != AESD_MMAP_DATA_SIZE) {
+        fprintf(stderr, "Unexpected mmap header layout\n");
+        munmap(map, page_size + AESD_MMAP_DATA_SIZE);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    for (w = 0; w < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; w++)
+        cmds[w] = malloc(AESD_MMAP_DATA_SIZE);
+
+    /* commands written before the test started aren't in our format */
+    snapshot(hdr, (const char *)map + hdr->data_offset, &copy, cmds, sizes, cmd_pos);
+    start_head = copy.head;
+
+    for (w = 0; w < writers; w++) {
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(run_writer(device, w, commands, max_payload));
+        if (pid < 0) {
+            perror("fork");
+            writers = w;
+            rc = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    running = writers;
+    while (running > 0) {
+        int copied, i;
+
+        while (waitpid(-1, &status, WNOHANG) > 0) {
+            running--;
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                rc = EXIT_FAILURE;
+        }
+
+        copied = snapshot(hdr, (const char *)map + hdr->data_offset, &copy, cmds, sizes, cmd_pos);
+        snapshots++;
+        if (copied < 0 || copy.generation < last_gen || copy.head < last_head) {
+            fprintf(stderr, "Header invariant violated at generation %llu\n",
+                    (unsigned long long)copy.generation);
+            failures++;
+            continue;
+        }
+        last_gen = copy.generation;
+        last_head = copy.head;
+
+        for (i = 0; i < copied; i++) {
+            if (cmd_pos[i] < start_head)
+                continue;
+            if (check_cmd(cmds[i], sizes[i], max_payload)) {
+                verified++;
+            } else {
+                fprintf(stderr, "Corrupt command of %zu bytes at generation %llu\n",
+                        sizes[i], (unsigned long long)copy.generation);
+                failures++;
+            }
+        }
+    }
+
+    printf("%lu snapshots, %lu commands verified, %lu failures\n", snapshots, verified, failures);
+
+    for (w = 0; w < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; w++)
+        free(cmds[w]);
+    munmap(map, page_size + AESD_MMAP_DATA_SIZE);
+    close(fd);
+    return failures ? EXIT_FAILURE : rc;
+}
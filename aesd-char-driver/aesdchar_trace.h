@@ -0,0 +1,108 @@
+/*
+ * aesdchar_trace.h
+ *
+ *  @brief Tracepoints of the aesdchar driver
+ *
+ *  Enable with e.g.
+ *  echo 1 > /sys/kernel/tracing/events/aesdchar/enable
+ *  Each device is identified by its minor number.  Exit events carry the
+ *  return value and the time spent in the call, including any wait for the
+ *  device lock or, for follow mode reads, for a command to be written.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(_AESDCHAR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _AESDCHAR_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(aesd_io_enter,
+    TP_PROTO(unsigned int minor, size_t count, loff_t pos),
+    TP_ARGS(minor, count, pos),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(size_t, count)
+        __field(loff_t, pos)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->count = count;
+        __entry->pos = pos;
+    ),
+    TP_printk("minor=%u count=%zu pos=%lld", __entry->minor, __entry->count, __entry->pos)
+);
+
+DEFINE_EVENT(aesd_io_enter, aesd_read_enter,
+    TP_PROTO(unsigned int minor, size_t count, loff_t pos),
+    TP_ARGS(minor, count, pos));
+
+DEFINE_EVENT(aesd_io_enter, aesd_write_enter,
+    TP_PROTO(unsigned int minor, size_t count, loff_t pos),
+    TP_ARGS(minor, count, pos));
+
+TRACE_EVENT(aesd_ioctl_enter,
+    TP_PROTO(unsigned int minor, unsigned int cmd),
+    TP_ARGS(minor, cmd),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, cmd)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->cmd = cmd;
+    ),
+    TP_printk("minor=%u cmd=0x%x", __entry->minor, __entry->cmd)
+);
+
+DECLARE_EVENT_CLASS(aesd_op_exit,
+    TP_PROTO(unsigned int minor, long ret, u64 latency_ns),
+    TP_ARGS(minor, ret, latency_ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(long, ret)
+        __field(u64, latency_ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+    TP_printk("minor=%u ret=%ld latency_ns=%llu", __entry->minor, __entry->ret, __entry->latency_ns)
+);
+
+DEFINE_EVENT(aesd_op_exit, aesd_read_exit,
+    TP_PROTO(unsigned int minor, long ret, u64 latency_ns),
+    TP_ARGS(minor, ret, latency_ns));
+
+DEFINE_EVENT(aesd_op_exit, aesd_write_exit,
+    TP_PROTO(unsigned int minor, long ret, u64 latency_ns),
+    TP_ARGS(minor, ret, latency_ns));
+
+DEFINE_EVENT(aesd_op_exit, aesd_ioctl_exit,
+    TP_PROTO(unsigned int minor, long ret, u64 latency_ns),
+    TP_ARGS(minor, ret, latency_ns));
+
+TRACE_EVENT(aesd_lock_acquired,
+    TP_PROTO(unsigned int minor, u64 wait_ns),
+    TP_ARGS(minor, wait_ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("minor=%u wait_ns=%llu", __entry->minor, __entry->wait_ns)
+);
+
+#endif /* _AESDCHAR_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesdchar_trace
+#include <trace/define_trace.h>
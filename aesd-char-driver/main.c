@@ -20,16 +20,62 @@
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/moduleparam.h>
+#include <linux/sort.h>
+#include <linux/uio.h>
+#include <linux/build_bug.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
+#include "aesd_mmap.h"
 #include "aesd-circular-buffer.h"
+#define CREATE_TRACE_POINTS
+#include "aesdchar_trace.h"
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
+int aesd_nr_devs = AESD_NR_DEVS;
+bool aesd_merged_view = false;
+unsigned long aesd_max_bytes = 0;
+
+module_param(aesd_nr_devs, int, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of aesdcharN devices, each with its own buffer and lock");
+module_param(aesd_merged_view, bool, S_IRUGO);
+MODULE_PARM_DESC(aesd_merged_view, "Add a read only minor after the aesdcharN devices interleaving them in commit order");
+module_param(aesd_max_bytes, ulong, S_IRUGO);
+MODULE_PARM_DESC(aesd_max_bytes, "Initial byte limit of each device buffer, 0 for no limit besides the entry count");
 
 MODULE_AUTHOR("Dan Walkes");
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev *aesd_devices;
+static struct cdev aesd_merged_cdev;
+static atomic64_t aesd_seq = ATOMIC64_INIT(0);
+static struct dentry *aesd_debugfs_root;
+
+static unsigned int aesd_dev_minor(const struct aesd_dev *dev)
+{
+    return MINOR(dev->cdev.dev);
+}
+
+/**
+ * mutex_lock_interruptible() on dev->lock, recording the time spent waiting for it
+ * @return 0 once the lock is held or -ERESTARTSYS if interrupted
+ */
+static int aesd_lock_interruptible(struct aesd_dev *dev)
+{
+    u64 start = ktime_get_ns(), wait_ns;
+
+    if (mutex_lock_interruptible(&dev->lock))
+        return -ERESTARTSYS;
+    wait_ns = ktime_get_ns() - start;
+    aesd_latency_record(&dev->latency, AESD_LATENCY_LOCK, wait_ns);
+    trace_aesd_lock_acquired(aesd_dev_minor(dev), wait_ns);
+    return 0;
+}
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
@@ -38,8 +84,13 @@ int aesd_open(struct inode *inode, struct file *filp)
      * TODO: handle open
      */
     struct aesd_dev *dev;
+    struct aesd_file *fctx;
     dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev;
+    fctx = kzalloc(sizeof(*fctx), GFP_KERNEL);
+    if (!fctx)
+        return -ENOMEM;
+    fctx->dev = dev;
+    filp->private_data = fctx;
     return 0;
 }
 
@@ -49,10 +100,22 @@ int aesd_release(struct inode *inode, struct file *filp)
     /**
      * TODO: handle release
      */
+    kfree(filp->private_data);
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
+/**
+ * @return the follow mode file position @param pos of @param fctx moved back by the bytes evicted
+ * from the device buffer since it was last adjusted.  Must be called with dev->lock held
+ */
+static loff_t aesd_follow_pos(const struct aesd_file *fctx, loff_t pos)
+{
+    loff_t evicted = fctx->dev->evicted_bytes - fctx->evicted_seen;
+
+    return pos > evicted ? pos - evicted : 0;
+}
+
+static ssize_t aesd_do_read(struct file *filp, char __user *buf, size_t count,
                 loff_t *f_pos)
 {
     ssize_t retval = 0;
@@ -60,18 +123,42 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
     /**
      * TODO: handle read
      */
-    struct aesd_dev *dev = filp->private_data;
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
     struct aesd_buffer_entry *entry;
     size_t entry_offset;
     size_t bytes_to_read;
+    unsigned long committed;
 
-    if (mutex_lock_interruptible(&dev->lock))
+    if (aesd_lock_interruptible(dev))
         return -ERESTARTSYS;
+    dev->reads++;
 
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &entry_offset);
-    if (!entry) {
-        retval = 0;
-        goto out;
+    for (;;) {
+        if (fctx->follow) {
+            *f_pos = aesd_follow_pos(fctx, *f_pos);
+            fctx->evicted_seen = dev->evicted_bytes;
+        }
+
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &entry_offset);
+        if (entry)
+            break;
+
+        if (!fctx->follow) {
+            retval = 0;
+            goto out;
+        }
+        if (filp->f_flags & O_NONBLOCK) {
+            retval = -EAGAIN;
+            goto out;
+        }
+
+        committed = dev->committed;
+        mutex_unlock(&dev->lock);
+        if (wait_event_interruptible(dev->readq, READ_ONCE(dev->committed) != committed))
+            return -ERESTARTSYS;
+        if (aesd_lock_interruptible(dev))
+            return -ERESTARTSYS;
     }
 
     bytes_to_read = entry->size - entry_offset;
@@ -91,15 +178,70 @@ out:
     return retval;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
+ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
+                loff_t *f_pos)
+{
+    struct aesd_file *fctx = filp->private_data;
+    unsigned int minor = aesd_dev_minor(fctx->dev);
+    u64 start, latency_ns;
+    ssize_t retval;
+
+    trace_aesd_read_enter(minor, count, *f_pos);
+    start = ktime_get_ns();
+    retval = aesd_do_read(filp, buf, count, f_pos);
+    latency_ns = ktime_get_ns() - start;
+    aesd_latency_record(&fctx->dev->latency, AESD_LATENCY_READ, latency_ns);
+    trace_aesd_read_exit(minor, retval, latency_ns);
+    return retval;
+}
+
+/**
+ * Copy a newly committed @param entry, stored in slot @param slot of the circular buffer, into the
+ * mmap data area and refresh the header from the current buffer state.
+ * Must be called with dev->lock held, after aesd_circular_buffer_add_entry_evict()
+ */
+static void aesd_mmap_publish(struct aesd_dev *dev, uint8_t slot, const struct aesd_buffer_entry *entry)
+{
+    struct aesd_mmap_header *hdr = dev->mmap_area;
+    char *data = (char *)dev->mmap_area + PAGE_SIZE;
+    uint64_t head = hdr->head;
+
+    WRITE_ONCE(hdr->generation, hdr->generation + 1);
+    smp_wmb();
+
+    if (entry->size <= AESD_MMAP_DATA_SIZE) {
+        size_t start = head % AESD_MMAP_DATA_SIZE;
+        size_t first = min_t(size_t, entry->size, AESD_MMAP_DATA_SIZE - start);
+
+        memcpy(data + start, entry->buffptr, first);
+        memcpy(data, entry->buffptr + first, entry->size - first);
+        hdr->entry[slot].pos = head;
+        WRITE_ONCE(hdr->head, head + entry->size);
+    } else {
+        hdr->entry[slot].pos = AESD_MMAP_POS_NONE;
+    }
+    hdr->entry[slot].size = entry->size;
+    hdr->in_offs = dev->buffer.in_offs;
+    hdr->out_offs = dev->buffer.out_offs;
+    hdr->full = dev->buffer.full;
+
+    smp_wmb();
+    WRITE_ONCE(hdr->generation, hdr->generation + 1);
+}
+
+static ssize_t aesd_do_write(struct file *filp, const char __user *buf, size_t count,
                    loff_t *f_pos)
 {
-    struct aesd_dev *dev = filp->private_data;
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
     ssize_t retval = count;
     const char *newline_ptr;
     char *new_buff = NULL;
     size_t write_size, new_size;
     struct aesd_buffer_entry entry = {0};
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t evicted_count = 0, index;
+    uint8_t slot;
 
     new_buff = kmalloc(count, GFP_KERNEL);
     if (!new_buff)
@@ -112,10 +254,11 @@ ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
 
     newline_ptr = memchr(new_buff, '\n', count);
 
-    if (mutex_lock_interruptible(&dev->lock)) {
+    if (aesd_lock_interruptible(dev)) {
         kfree(new_buff);
         return -ERESTARTSYS;
     }
+    dev->writes++;
 
     if (!newline_ptr) {
         new_size = dev->working_entry.size + count;
@@ -144,94 +287,409 @@ ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
 
     entry.buffptr = dev->working_entry.buffptr;
     entry.size = dev->working_entry.size;
+    entry.timestamp_ns = ktime_get_real_ns();
     dev->working_entry.buffptr = NULL;
     dev->working_entry.size = 0;
 
-    if (dev->buffer.full) {
-        struct aesd_buffer_entry *oldest = &dev->buffer.entry[dev->buffer.out_offs];
-        if (oldest->buffptr)
-            kfree(oldest->buffptr);
-    }
-
-    aesd_circular_buffer_add_entry(&dev->buffer, &entry);
+    slot = dev->buffer.in_offs;
+    dev->entry_seq[slot] = atomic64_inc_return(&aesd_seq);
+    evicted_count = aesd_circular_buffer_add_entry_evict(&dev->buffer, &entry, evicted);
+    for (index = 0; index < evicted_count; index++)
+        dev->evicted_bytes += evicted[index].size;
+    aesd_mmap_publish(dev, slot, &entry);
+    WRITE_ONCE(dev->committed, dev->committed + 1);
+    wake_up_interruptible(&dev->readq);
 
 out_unlock:
     mutex_unlock(&dev->lock);
+    // Readers may only hold evicted entries under dev->lock, so they can be freed outside it
+    for (index = 0; index < evicted_count; index++)
+        kfree(evicted[index].buffptr);
     kfree(new_buff);
     return retval;
 }
 
+ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
+                   loff_t *f_pos)
+{
+    struct aesd_file *fctx = filp->private_data;
+    unsigned int minor = aesd_dev_minor(fctx->dev);
+    u64 start, latency_ns;
+    ssize_t retval;
+
+    trace_aesd_write_enter(minor, count, *f_pos);
+    start = ktime_get_ns();
+    retval = aesd_do_write(filp, buf, count, f_pos);
+    latency_ns = ktime_get_ns() - start;
+    aesd_latency_record(&fctx->dev->latency, AESD_LATENCY_WRITE, latency_ns);
+    trace_aesd_write_exit(minor, retval, latency_ns);
+    return retval;
+}
+
 
 loff_t aesd_llseek(struct file *filp, loff_t off, int whence)
 {
-    struct aesd_dev *dev = filp->private_data;
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
     loff_t newpos;
-    size_t total_size = 0;
-    uint8_t idx;
-    struct aesd_buffer_entry *entry;
 
-    if (mutex_lock_interruptible(&dev->lock))
+    if (aesd_lock_interruptible(dev))
         return -ERESTARTSYS;
 
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, idx) {
-        total_size += entry->size;
-    }
-
-    newpos = fixed_size_llseek(filp, off, whence, total_size);
+    newpos = fixed_size_llseek(filp, off, whence, dev->buffer.total_bytes);
+    fctx->evicted_seen = dev->evicted_bytes;
 
     mutex_unlock(&dev->lock);
     return newpos;
 }
 
-long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+static long aesd_ioctl_follow(struct file *filp, unsigned long arg)
+{
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
+    uint32_t enable;
+
+    if (copy_from_user(&enable, (const void __user *)arg, sizeof(enable)))
+        return -EFAULT;
+
+    if (aesd_lock_interruptible(dev))
+        return -ERESTARTSYS;
+    fctx->follow = enable != 0;
+    fctx->evicted_seen = dev->evicted_bytes;
+    mutex_unlock(&dev->lock);
+    return 0;
+}
+
+/**
+ * @return the number of write commands currently held in the buffer of @param dev
+ */
+static uint8_t aesd_entry_count(struct aesd_dev *dev)
+{
+    if (dev->buffer.full)
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    return (dev->buffer.in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - dev->buffer.out_offs) %
+        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+ * Translate zero referenced @param write_cmd and @param write_cmd_offset into a position in the
+ * concatenated contents of the buffer of @param dev, stored in @param pos.
+ * Must be called with dev->lock held
+ * @return 0 on success or -EINVAL if the command or offset is not in the buffer
+ */
+static int aesd_seekto_pos(struct aesd_dev *dev, uint32_t write_cmd, uint32_t write_cmd_offset,
+                           loff_t *pos)
 {
-    struct aesd_dev *dev = filp->private_data;
-    struct aesd_seekto seekto;
     struct aesd_buffer_entry *entry;
     size_t total_offset = 0;
     uint8_t idx, current_idx;
 
-    if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC)
-        return -ENOTTY;
+    if (write_cmd >= aesd_entry_count(dev))
+        return -EINVAL;
 
-    if (cmd != AESDCHAR_IOCSEEKTO)
-        return -ENOTTY;
+    current_idx = dev->buffer.out_offs;
+
+    for (idx = 0; idx < write_cmd; idx++) {
+        entry = &dev->buffer.entry[current_idx];
+        total_offset += entry->size;
+        current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+
+    entry = &dev->buffer.entry[current_idx];
+    if (write_cmd_offset >= entry->size)
+        return -EINVAL;
+
+    *pos = total_offset + write_cmd_offset;
+    return 0;
+}
+
+static long aesd_ioctl_seekto(struct file *filp, unsigned long arg)
+{
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
+    struct aesd_seekto seekto;
+    loff_t pos;
+    int retval;
 
     if (copy_from_user(&seekto, (const void __user *)arg, sizeof(seekto)))
         return -EFAULT;
 
-    if (mutex_lock_interruptible(&dev->lock))
+    if (aesd_lock_interruptible(dev))
         return -ERESTARTSYS;
 
-    uint8_t valid_entries = dev->buffer.full ?
-        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : dev->buffer.in_offs;
+    retval = aesd_seekto_pos(dev, seekto.write_cmd, seekto.write_cmd_offset, &pos);
+    if (!retval) {
+        filp->f_pos = pos;
+        fctx->evicted_seen = dev->evicted_bytes;
+    }
 
-    if (seekto.write_cmd >= valid_entries) {
-        mutex_unlock(&dev->lock);
+    mutex_unlock(&dev->lock);
+    return retval;
+}
+
+static long aesd_ioctl_seek_since(struct file *filp, unsigned long arg)
+{
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
+    struct aesd_seek_since since;
+    struct aesd_buffer_entry *entry;
+    loff_t pos = 0;
+    int index;
+    long retval = 0;
+
+    if (copy_from_user(&since, (const void __user *)arg, sizeof(since)))
+        return -EFAULT;
+    if (since.by != AESDCHAR_SEEK_SINCE_SEQ && since.by != AESDCHAR_SEEK_SINCE_TIME)
         return -EINVAL;
-    }
 
-    current_idx = dev->buffer.out_offs;
+    if (aesd_lock_interruptible(dev))
+        return -ERESTARTSYS;
 
-    for (idx = 0; idx < seekto.write_cmd; idx++) {
-        entry = &dev->buffer.entry[current_idx];
-        total_offset += entry->size;
-        current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    if (since.by == AESDCHAR_SEEK_SINCE_SEQ)
+        index = aesd_circular_buffer_find_entry_index_for_seq(&dev->buffer, since.value);
+    else
+        index = aesd_circular_buffer_find_entry_index_for_time(&dev->buffer, since.value);
+
+    if (index < 0) {
+        pos = dev->buffer.total_bytes;
+        since.seq = dev->buffer.next_seq;
+        since.timestamp_ns = 0;
+    } else {
+        aesd_seekto_pos(dev, index, 0, &pos);
+        entry = &dev->buffer.entry[(dev->buffer.out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        since.seq = entry->seq;
+        since.timestamp_ns = entry->timestamp_ns;
     }
+    filp->f_pos = pos;
+    fctx->evicted_seen = dev->evicted_bytes;
 
-    entry = &dev->buffer.entry[current_idx];
-    if (seekto.write_cmd_offset >= entry->size) {
-        mutex_unlock(&dev->lock);
+    mutex_unlock(&dev->lock);
+
+    if (copy_to_user((void __user *)arg, &since, sizeof(since)))
+        retval = -EFAULT;
+    return retval;
+}
+
+/**
+ * Copy each range of a struct aesd_readv into the user iovec, filling segments back to back.
+ * Every range start is checked before anything is copied, so a bad one fails the call with
+ * -EINVAL and nothing copied.  A range running past the end of the buffer is cut short there and
+ * copying stops once the iovec is full; bytes_read tells how much of the iovec is valid
+ */
+static long aesd_ioctl_readv(struct file *filp, unsigned long arg)
+{
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
+    struct aesd_readv __user *uarg = (struct aesd_readv __user *)arg;
+    struct aesd_readv readv;
+    struct aesd_seek_range *ranges;
+    struct iovec *iov;
+    uint64_t bytes_read = 0;
+    uint32_t r, seg = 0;
+    size_t seg_used = 0;
+    long retval = 0;
+
+    if (copy_from_user(&readv, uarg, sizeof(readv)))
+        return -EFAULT;
+    if (readv.nr_ranges > AESDCHAR_READV_MAX_RANGES || readv.iovcnt > AESDCHAR_READV_MAX_IOV)
         return -EINVAL;
+
+    ranges = kmalloc_array(readv.nr_ranges, sizeof(*ranges), GFP_KERNEL);
+    iov = kmalloc_array(readv.iovcnt, sizeof(*iov), GFP_KERNEL);
+    if ((readv.nr_ranges && !ranges) || (readv.iovcnt && !iov)) {
+        retval = -ENOMEM;
+        goto out_free;
+    }
+    if (copy_from_user(ranges, u64_to_user_ptr(readv.ranges), readv.nr_ranges * sizeof(*ranges)) ||
+        copy_from_user(iov, u64_to_user_ptr(readv.iov), readv.iovcnt * sizeof(*iov))) {
+        retval = -EFAULT;
+        goto out_free;
+    }
+
+    if (aesd_lock_interruptible(dev)) {
+        retval = -ERESTARTSYS;
+        goto out_free;
+    }
+    for (r = 0; r < readv.nr_ranges; r++) {
+        loff_t pos;
+
+        retval = aesd_seekto_pos(dev, ranges[r].write_cmd, ranges[r].write_cmd_offset, &pos);
+        if (retval) {
+            mutex_unlock(&dev->lock);
+            goto out_free;
+        }
+    }
+    dev->reads++;
+
+    for (r = 0; r < readv.nr_ranges && seg < readv.iovcnt; r++) {
+        size_t remaining = ranges[r].length;
+        loff_t pos;
+
+        // Checked above, under the same lock
+        aesd_seekto_pos(dev, ranges[r].write_cmd, ranges[r].write_cmd_offset, &pos);
+
+        while (remaining && seg < readv.iovcnt) {
+            struct aesd_buffer_entry *entry;
+            size_t entry_offset, chunk;
+
+            entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, pos, &entry_offset);
+            if (!entry)
+                break;
+
+            chunk = min3(remaining, entry->size - entry_offset, iov[seg].iov_len - seg_used);
+            if (copy_to_user((char __user *)iov[seg].iov_base + seg_used,
+                             entry->buffptr + entry_offset, chunk)) {
+                retval = -EFAULT;
+                break;
+            }
+            pos += chunk;
+            remaining -= chunk;
+            bytes_read += chunk;
+            seg_used += chunk;
+            if (seg_used == iov[seg].iov_len) {
+                seg++;
+                seg_used = 0;
+            }
+        }
+        if (retval)
+            break;
     }
 
-    total_offset += seekto.write_cmd_offset;
-    filp->f_pos = total_offset;
+    mutex_unlock(&dev->lock);
+
+    // Reported even when a copy faulted, so the caller knows how much of the iovec it can use
+    if (put_user(bytes_read, &uarg->bytes_read))
+        retval = -EFAULT;
+
+out_free:
+    kfree(ranges);
+    kfree(iov);
+    return retval;
+}
+
+static long aesd_ioctl_stats(struct file *filp, unsigned long arg)
+{
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
+    struct aesd_stats stats;
+    uint8_t idx, current_idx;
+
+    BUILD_BUG_ON(AESDCHAR_STATS_MAX_ENTRIES < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    memset(&stats, 0, sizeof(stats));
+
+    if (aesd_lock_interruptible(dev))
+        return -ERESTARTSYS;
+
+    stats.entry_count = aesd_entry_count(dev);
+    stats.total_bytes = dev->buffer.total_bytes;
+    current_idx = dev->buffer.out_offs;
+    for (idx = 0; idx < stats.entry_count; idx++) {
+        stats.entry_size[idx] = dev->buffer.entry[current_idx].size;
+        current_idx = (current_idx + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    stats.writes = dev->writes;
+    stats.reads = dev->reads;
 
     mutex_unlock(&dev->lock);
+
+    if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+        return -EFAULT;
     return 0;
 }
 
+static long aesd_do_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC)
+        return -ENOTTY;
+    if (_IOC_NR(cmd) > AESDCHAR_IOC_MAXNR)
+        return -ENOTTY;
+
+    switch (cmd) {
+    case AESDCHAR_IOCSEEKTO:
+        return aesd_ioctl_seekto(filp, arg);
+    case AESDCHAR_IOCFOLLOW:
+        return aesd_ioctl_follow(filp, arg);
+    case AESDCHAR_IOCREADV:
+        return aesd_ioctl_readv(filp, arg);
+    case AESDCHAR_IOCGSTATS:
+        return aesd_ioctl_stats(filp, arg);
+    case AESDCHAR_IOCSEEKSINCE:
+        return aesd_ioctl_seek_since(filp, arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct aesd_file *fctx = filp->private_data;
+    unsigned int minor = aesd_dev_minor(fctx->dev);
+    u64 start, latency_ns;
+    long retval;
+
+    trace_aesd_ioctl_enter(minor, cmd);
+    start = ktime_get_ns();
+    retval = aesd_do_ioctl(filp, cmd, arg);
+    latency_ns = ktime_get_ns() - start;
+    aesd_latency_record(&fctx->dev->latency, AESD_LATENCY_IOCTL, latency_ns);
+    trace_aesd_ioctl_exit(minor, retval, latency_ns);
+    return retval;
+}
+
+/**
+ * Map the header page and entry data area of the device read-only into the caller.
+ * The mapping must start at offset 0 and may not be larger than the exported area
+ */
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
+    unsigned long len = vma->vm_end - vma->vm_start;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+    if (vma->vm_pgoff != 0 || len > PAGE_SIZE + AESD_MMAP_DATA_SIZE)
+        return -EINVAL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    return remap_vmalloc_range(vma, dev->mmap_area, 0);
+}
+
+/**
+ * Report the file readable whenever aesd_read() would not block: always outside follow mode, where
+ * a read at the end returns 0 at once, and in follow mode when a command is available at the file
+ * position, adjusted for evictions the same way aesd_read() does.  Always writable
+ */
+__poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+    struct aesd_file *fctx = filp->private_data;
+    struct aesd_dev *dev = fctx->dev;
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset;
+    loff_t pos;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    if (!fctx->follow)
+        return mask | EPOLLIN | EPOLLRDNORM;
+
+    poll_wait(filp, &dev->readq, wait);
+
+    mutex_lock(&dev->lock);
+    pos = aesd_follow_pos(fctx, filp->f_pos);
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, pos, &entry_offset);
+    if (entry)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    mutex_unlock(&dev->lock);
+
+    return mask;
+}
+
 struct file_operations aesd_fops = {
     .owner =           THIS_MODULE,
     .read =            aesd_read,
@@ -240,71 +698,359 @@ struct file_operations aesd_fops = {
     .release =         aesd_release,
     .llseek =          aesd_llseek,
     .unlocked_ioctl =  aesd_ioctl,
+    .mmap =            aesd_mmap,
+    .poll =            aesd_poll,
+};
+
+/**
+ * One command of one device, as seen by the merged view
+ */
+struct aesd_merge_item {
+    uint64_t seq;
+    size_t size;
+    int devidx;
+    uint8_t slot;
+};
+
+static int aesd_merge_item_cmp(const void *a, const void *b)
+{
+    const struct aesd_merge_item *ia = a, *ib = b;
+
+    if (ia->seq == ib->seq)
+        return 0;
+    return ia->seq < ib->seq ? -1 : 1;
+}
+
+/**
+ * Record the sequence number and size of every command of every device into @param items,
+ * taking each device lock in turn so writers to other devices are never blocked.
+ * @return the number of items, sorted by commit order, or a negative errno
+ */
+static int aesd_merge_snapshot(struct aesd_merge_item *items)
+{
+    int nitems = 0, devidx;
+
+    for (devidx = 0; devidx < aesd_nr_devs; devidx++) {
+        struct aesd_dev *dev = &aesd_devices[devidx];
+        uint8_t slot;
+
+        if (aesd_lock_interruptible(dev))
+            return -ERESTARTSYS;
+        for (slot = 0; slot < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; slot++) {
+            if (!dev->buffer.entry[slot].buffptr)
+                continue;
+            items[nitems].seq = dev->entry_seq[slot];
+            items[nitems].size = dev->buffer.entry[slot].size;
+            items[nitems].devidx = devidx;
+            items[nitems].slot = slot;
+            nitems++;
+        }
+        mutex_unlock(&dev->lock);
+    }
+
+    sort(items, nitems, sizeof(*items), aesd_merge_item_cmp, NULL);
+    return nitems;
+}
+
+static int aesd_merged_open(struct inode *inode, struct file *filp)
+{
+    PDEBUG("merged open");
+    filp->private_data = NULL;
+    return 0;
+}
+
+static int aesd_merged_release(struct inode *inode, struct file *filp)
+{
+    PDEBUG("merged release");
+    return 0;
+}
+
+/**
+ * Read the commands of all devices as if concatenated in commit order.  The item found for
+ * *f_pos is re-validated under its device lock, and the lookup retried if a writer replaced it
+ */
+static ssize_t aesd_merged_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+    struct aesd_merge_item *items;
+    ssize_t retval;
+    loff_t start;
+    int nitems, i;
+
+    items = kmalloc_array(aesd_nr_devs * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+                          sizeof(*items), GFP_KERNEL);
+    if (!items)
+        return -ENOMEM;
+
+retry:
+    nitems = aesd_merge_snapshot(items);
+    if (nitems < 0) {
+        retval = nitems;
+        goto out;
+    }
+
+    retval = 0;
+    start = 0;
+    for (i = 0; i < nitems; start += items[i].size, i++) {
+        struct aesd_dev *dev;
+        struct aesd_buffer_entry *entry;
+        size_t entry_offset, bytes_to_read;
+
+        if (*f_pos >= start + items[i].size)
+            continue;
+
+        dev = &aesd_devices[items[i].devidx];
+        if (aesd_lock_interruptible(dev)) {
+            retval = -ERESTARTSYS;
+            goto out;
+        }
+        entry = &dev->buffer.entry[items[i].slot];
+        if (!entry->buffptr || dev->entry_seq[items[i].slot] != items[i].seq) {
+            mutex_unlock(&dev->lock);
+            goto retry;
+        }
+
+        entry_offset = *f_pos - start;
+        bytes_to_read = min(entry->size - entry_offset, count);
+        if (copy_to_user(buf, entry->buffptr + entry_offset, bytes_to_read)) {
+            retval = -EFAULT;
+        } else {
+            *f_pos += bytes_to_read;
+            retval = bytes_to_read;
+        }
+        mutex_unlock(&dev->lock);
+        break;
+    }
+
+out:
+    kfree(items);
+    return retval;
+}
+
+static loff_t aesd_merged_llseek(struct file *filp, loff_t off, int whence)
+{
+    loff_t total_size = 0;
+    int devidx;
+
+    for (devidx = 0; devidx < aesd_nr_devs; devidx++) {
+        struct aesd_dev *dev = &aesd_devices[devidx];
+
+        if (aesd_lock_interruptible(dev))
+            return -ERESTARTSYS;
+        total_size += dev->buffer.total_bytes;
+        mutex_unlock(&dev->lock);
+    }
+
+    return fixed_size_llseek(filp, off, whence, total_size);
+}
+
+struct file_operations aesd_merged_fops = {
+    .owner =           THIS_MODULE,
+    .read =            aesd_merged_read,
+    .open =            aesd_merged_open,
+    .release =         aesd_merged_release,
+    .llseek =          aesd_merged_llseek,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static void aesd_mmap_init(struct aesd_dev *dev)
+{
+    struct aesd_mmap_header *hdr = dev->mmap_area;
+    uint8_t idx;
+
+    hdr->magic = AESD_MMAP_MAGIC;
+    hdr->version = AESD_MMAP_VERSION;
+    hdr->data_offset = PAGE_SIZE;
+    hdr->data_size = AESD_MMAP_DATA_SIZE;
+    for (idx = 0; idx < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; idx++)
+        hdr->entry[idx].pos = AESD_MMAP_POS_NONE;
+}
+
+static int aesd_setup_cdev(struct aesd_dev *dev, int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %d", err, index);
     }
     return err;
 }
 
+static int aesd_max_bytes_get(void *data, u64 *val)
+{
+    struct aesd_dev *dev = data;
+
+    mutex_lock(&dev->lock);
+    *val = dev->buffer.max_bytes;
+    mutex_unlock(&dev->lock);
+    return 0;
+}
+
+/**
+ * Set the byte limit of the device at @param data and evict down to it right away, under dev->lock
+ * like every other eviction, so the mmap header and evicted_bytes stay in step with the buffer
+ */
+static int aesd_max_bytes_set(void *data, u64 val)
+{
+    struct aesd_dev *dev = data;
+    struct aesd_mmap_header *hdr = dev->mmap_area;
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t evicted_count, index;
+
+    if (aesd_lock_interruptible(dev))
+        return -ERESTARTSYS;
+    evicted_count = aesd_circular_buffer_set_max_bytes(&dev->buffer, val, evicted);
+    if (evicted_count) {
+        for (index = 0; index < evicted_count; index++)
+            dev->evicted_bytes += evicted[index].size;
+        WRITE_ONCE(hdr->generation, hdr->generation + 1);
+        smp_wmb();
+        hdr->out_offs = dev->buffer.out_offs;
+        hdr->full = dev->buffer.full;
+        smp_wmb();
+        WRITE_ONCE(hdr->generation, hdr->generation + 1);
+    }
+    mutex_unlock(&dev->lock);
+
+    for (index = 0; index < evicted_count; index++)
+        kfree(evicted[index].buffptr);
+    return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(aesd_max_bytes_fops, aesd_max_bytes_get, aesd_max_bytes_set, "%llu\n");
+
+/**
+ * Expose the buffer memory accounting of device @param index under debugfs as
+ * aesdchar/aesdchar<index>/{total_bytes,high_water_bytes,max_bytes}.  max_bytes is writable and
+ * a lowered limit evicts the oldest entries immediately.  aesdchar/aesdchar<index>/latency holds
+ * the operation latency histograms, see aesd_latency.c
+ */
+static void aesd_debugfs_add(struct aesd_dev *dev, int index)
+{
+    char name[16];
+    struct dentry *dir;
+
+    snprintf(name, sizeof(name), "aesdchar%d", index);
+    dir = debugfs_create_dir(name, aesd_debugfs_root);
+    debugfs_create_size_t("total_bytes", 0444, dir, &dev->buffer.total_bytes);
+    debugfs_create_size_t("high_water_bytes", 0444, dir, &dev->buffer.high_water_bytes);
+    debugfs_create_file_unsafe("max_bytes", 0644, dir, dev, &aesd_max_bytes_fops);
+    aesd_latency_debugfs_create(&dev->latency, dir);
+}
+
+static void aesd_cleanup_device(struct aesd_dev *dev)
+{
+    struct aesd_buffer_entry *entry;
+    uint8_t index;
 
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, index) {
+        if (entry->buffptr)
+            kfree(entry->buffptr);
+    }
+    if (dev->working_entry.buffptr)
+        kfree(dev->working_entry.buffptr);
+    vfree(dev->mmap_area);
+}
 
 int aesd_init_module(void)
 {
     dev_t dev = 0;
-    int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    int result, nr_minors, i;
+
+    if (aesd_nr_devs < 1 || aesd_nr_devs > AESD_MAX_DEVS) {
+        printk(KERN_WARNING "aesd_nr_devs must be between 1 and %d\n", AESD_MAX_DEVS);
+        return -EINVAL;
+    }
+    nr_minors = aesd_nr_devs + (aesd_merged_view ? 1 : 0);
+
+    result = alloc_chrdev_region(&dev, aesd_minor, nr_minors,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
+
+    aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+    if (!aesd_devices) {
+        result = -ENOMEM;
+        goto fail_region;
+    }
+
+    aesd_debugfs_root = debugfs_create_dir("aesdchar", NULL);
 
     /**
      * TODO: initialize the AESD specific portion of the device
      */
-    mutex_init(&aesd_device.lock);
-    aesd_circular_buffer_init(&aesd_device.buffer);
+    for (i = 0; i < aesd_nr_devs; i++) {
+        struct aesd_dev *aesd_device = &aesd_devices[i];
+
+        mutex_init(&aesd_device->lock);
+        init_waitqueue_head(&aesd_device->readq);
+        aesd_circular_buffer_init(&aesd_device->buffer);
+        aesd_device->buffer.max_bytes = aesd_max_bytes;
+        aesd_device->mmap_area = vmalloc_user(PAGE_SIZE + AESD_MMAP_DATA_SIZE);
+        if (!aesd_device->mmap_area) {
+            result = -ENOMEM;
+            goto fail_devices;
+        }
+        aesd_mmap_init(aesd_device);
 
-    result = aesd_setup_cdev(&aesd_device);
+        result = aesd_setup_cdev(aesd_device, i);
+        if (result) {
+            vfree(aesd_device->mmap_area);
+            goto fail_devices;
+        }
+        aesd_debugfs_add(aesd_device, i);
+    }
 
-    if( result ) {
-        unregister_chrdev_region(dev, 1);
+    if (aesd_merged_view) {
+        cdev_init(&aesd_merged_cdev, &aesd_merged_fops);
+        aesd_merged_cdev.owner = THIS_MODULE;
+        result = cdev_add(&aesd_merged_cdev, MKDEV(aesd_major, aesd_minor + aesd_nr_devs), 1);
+        if (result) {
+            printk(KERN_ERR "Error %d adding aesd merged cdev", result);
+            goto fail_devices;
+        }
     }
-    return result;
+    return 0;
 
+fail_devices:
+    // The debugfs files point into aesd_devices, remove them before anything they read is freed
+    debugfs_remove_recursive(aesd_debugfs_root);
+    while (i-- > 0) {
+        cdev_del(&aesd_devices[i].cdev);
+        aesd_cleanup_device(&aesd_devices[i]);
+    }
+    kfree(aesd_devices);
+fail_region:
+    unregister_chrdev_region(dev, nr_minors);
+    return result;
 }
 
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
+    int i;
+
+    debugfs_remove_recursive(aesd_debugfs_root);
+
+    if (aesd_merged_view)
+        cdev_del(&aesd_merged_cdev);
 
-    cdev_del(&aesd_device.cdev);
+    for (i = 0; i < aesd_nr_devs; i++)
+        cdev_del(&aesd_devices[i].cdev);
 
     /**
      * TODO: cleanup AESD specific poritions here as necessary
      */
-    struct aesd_buffer_entry *entry;
-    uint8_t index;
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, index) {
-        if (entry->buffptr)
-            kfree(entry->buffptr);
-    }
-    if (aesd_device.working_entry.buffptr)
-        kfree(aesd_device.working_entry.buffptr);
+    for (i = 0; i < aesd_nr_devs; i++)
+        aesd_cleanup_device(&aesd_devices[i]);
+    kfree(aesd_devices);
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, aesd_nr_devs + (aesd_merged_view ? 1 : 0));
 }
 
 
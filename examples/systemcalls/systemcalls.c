@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "systemcalls.h"
 #include <stdlib.h>
 #include <stdbool.h>
@@ -5,8 +6,66 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <spawn.h>
+#include <string.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+extern char **environ;
+
+/**
+ * Start @param command, whose first element is the full path of the program and which is NULL
+ * terminated, with posix_spawn().  Unlike fork() this does not copy the page tables of the caller,
+ * glibc uses a vfork style clone, so the cost does not grow with the caller's memory.
+ * @param outputfile if not NULL is truncated or created and used as the standard output
+ * @return the pid of the child, or -1 if it could not be started, including when the program
+ *   could not be executed
+ */
+static pid_t spawn_command(const char *outputfile, char *const command[])
+{
+    posix_spawn_file_actions_t actions, *actionsp = NULL;
+    pid_t pid;
+    int ret;
+
+    if (outputfile) {
+        if (posix_spawn_file_actions_init(&actions) != 0)
+            return -1;
+        actionsp = &actions;
+        ret = posix_spawn_file_actions_addopen(actionsp, STDOUT_FILENO, outputfile,
+                                               O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (ret != 0) {
+            posix_spawn_file_actions_destroy(actionsp);
+            return -1;
+        }
+    }
+
+    ret = posix_spawn(&pid, command[0], actionsp, NULL, command, environ);
+    if (actionsp)
+        posix_spawn_file_actions_destroy(actionsp);
+    return ret == 0 ? pid : -1;
+}
+
+/**
+ * Wait for @param pid, retrying if interrupted by a signal
+ * @return true if it exited with status 0
+ */
+static bool wait_success(pid_t pid)
+{
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
 
 
 /**
@@ -43,8 +102,8 @@ int ret = system(cmd);
 *   The first is always the full path to the command to execute with execv()
 *   The remaining arguments are a list of arguments to pass to the command in execv()
 * @return true if the command @param ... with arguments @param arguments were executed successfully
-*   using the execv() call, false if an error occurred, either in invocation of the
-*   fork, waitpid, or execv() command, or if a non-zero return value was returned
+*   using posix_spawn(), false if an error occurred, either in invocation of
+*   posix_spawn() or waitpid(), or if a non-zero return value was returned
 *   by the command issued in @param arguments with the specified arguments.
 */
 
@@ -64,26 +123,15 @@ bool do_exec(int count, ...)
     //command[count] = command[count];
 
 /*
- * TODO:
- *   Execute a system command by calling fork, execv(),
- *   and wait instead of system (see LSP page 161).
- *   Use the command[0] as the full path to the command to execute
- *   (first argument to execv), and use the remaining arguments
- *   as second argument to the execv() command.
- *
+ * The command is started with posix_spawn() rather than fork() and execv(), so the
+ * latency does not depend on the size of this process, and waited for with waitpid().
+ * Use the command[0] as the full path to the command to execute.
 */
 
 va_end(args);
-pid_t pid = fork();
+    pid_t pid = spawn_command(NULL, command);
     if (pid < 0) return false;
-    if (pid == 0) {
-        execv(command[0], command);
-        exit(1);
-    }
-
-    int status;
-    waitpid(pid, &status, 0);
-    return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return wait_success(pid);
 }
 
 
@@ -105,26 +153,318 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
     command[count] = NULL;
     va_end(args);
 
-    pid_t pid = fork();
+    pid_t pid = spawn_command(outputfile, command);
     if (pid < 0) {
         return false;
-    } else if (pid == 0) {
-        int fd = open(outputfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd < 0) {
-            perror("open");
-            exit(1);
+    }
+    return wait_success(pid);
+}
+
+/**
+ * Reap the children of @param requests started by do_exec_batch() with waitpid(), for kernels
+ * without pidfd support
+ */
+static void reap_batch_waitpid(struct exec_request *requests, size_t count, pid_t *pids)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (pids[i] < 0)
+            continue;
+        while (waitpid(pids[i], &requests[i].status, 0) < 0) {
+            if (errno != EINTR) {
+                requests[i].status = -1;
+                break;
+            }
+        }
+    }
+}
+
+/**
+* @param requests - The commands to run, all started concurrently before any is waited for.
+*   Each request's status is set to its wait status, or -1 if it could not be started.
+* @param count - The number of entries in @param requests
+* @return true if every command was started and exited with status 0
+*
+* Children are reaped in the order they exit through pidfds, polled together and collected with
+* waitid(P_PIDFD), so one slow command does not delay collecting the others.
+*/
+bool do_exec_batch(struct exec_request *requests, size_t count)
+{
+    pid_t *pids = calloc(count, sizeof(*pids));
+    struct pollfd *fds = calloc(count, sizeof(*fds));
+    size_t i, running = 0;
+    bool success = true;
+
+    if (count && (!pids || !fds)) {
+        free(pids);
+        free(fds);
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        pids[i] = spawn_command(requests[i].outputfile, requests[i].argv);
+        requests[i].status = -1;
+        fds[i].fd = -1;
+        fds[i].events = POLLIN;
+        if (pids[i] < 0) {
+            success = false;
+            continue;
         }
+        fds[i].fd = syscall(SYS_pidfd_open, pids[i], 0);
+        if (fds[i].fd < 0)
+            break;
+        running++;
+    }
+
+    if (i < count) {
+        // No pidfd support, fall back to waiting for each child in turn
+        while (++i < count) {
+            pids[i] = spawn_command(requests[i].outputfile, requests[i].argv);
+            requests[i].status = -1;
+            fds[i].fd = -1;
+            if (pids[i] < 0)
+                success = false;
+        }
+        for (i = 0; i < count; i++) {
+            if (fds[i].fd >= 0)
+                close(fds[i].fd);
+        }
+        reap_batch_waitpid(requests, count, pids);
+        running = 0;
+    }
+
+    while (running > 0) {
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            siginfo_t info;
 
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP)))
+                continue;
+            info.si_pid = 0;
+            if (waitid(P_PIDFD, fds[i].fd, &info, WEXITED) == 0) {
+                requests[i].status = info.si_code == CLD_EXITED ? W_EXITCODE(info.si_status, 0)
+                                                                : info.si_status;
+            }
+            close(fds[i].fd);
+            // poll() ignores negative fds, so finished children drop out of the set
+            fds[i].fd = -1;
+            pids[i] = -1;
+            running--;
+        }
+    }
 
-        execv(command[0], command);
-        exit(1);
-    } else {
-        int status;
-        waitpid(pid, &status, 0);
-        return (WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    if (running > 0) {
+        for (i = 0; i < count; i++) {
+            if (fds[i].fd >= 0)
+                close(fds[i].fd);
+        }
+        reap_batch_waitpid(requests, count, pids);
     }
+
+    for (i = 0; i < count; i++) {
+        int status = requests[i].status;
+
+        if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            success = false;
+    }
+    free(pids);
+    free(fds);
+    return success;
+}
+
+/**
+ * Start the @param count stages of a pipeline, connecting the standard output of each to the
+ * standard input of the next with a pipe.  The last stage writes to @param outputfile if not NULL,
+ * to a pipe returned in @param out_rd if that is not NULL, otherwise to the inherited stdout.
+ * A stage which cannot be started has its pid set to -1 and the next stage sees end of file.
+ * @return true if every stage was started and any requested pipe created
+ */
+static bool start_pipeline(size_t count, char *const *const stages[], const char *outputfile,
+                           int *out_rd, pid_t *pids)
+{
+    bool success = true;
+    int prev_rd = -1;
+
+    if (out_rd)
+        *out_rd = -1;
+
+    for (size_t i = 0; i < count; i++) {
+        posix_spawn_file_actions_t actions;
+        bool last = i == count - 1;
+        int fds[2] = { -1, -1 };
+        int ret = 0;
+
+        pids[i] = -1;
+        // Pipes are close on exec so each child only keeps the ends dup2()ed onto stdin and stdout
+        if ((!last || out_rd) && pipe2(fds, O_CLOEXEC) < 0)
+            success = false;
+
+        if (posix_spawn_file_actions_init(&actions) == 0) {
+            if (i > 0 && prev_rd < 0)
+                ret = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+            else if (prev_rd >= 0)
+                ret = posix_spawn_file_actions_adddup2(&actions, prev_rd, STDIN_FILENO);
+            if (ret == 0 && fds[1] >= 0)
+                ret = posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+            else if (ret == 0 && last && outputfile)
+                ret = posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, outputfile,
+                                                       O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (ret == 0 && (last || fds[1] >= 0) &&
+                posix_spawn(&pids[i], stages[i][0], &actions, NULL, stages[i], environ) != 0)
+                pids[i] = -1;
+            posix_spawn_file_actions_destroy(&actions);
+        }
+        if (pids[i] < 0)
+            success = false;
+
+        if (prev_rd >= 0)
+            close(prev_rd);
+        if (fds[1] >= 0)
+            close(fds[1]);
+        prev_rd = fds[0];
+    }
+
+    if (out_rd)
+        *out_rd = prev_rd;
+    else if (prev_rd >= 0)
+        close(prev_rd);
+    return success;
+}
+
+/**
+ * Wait for every started stage in @param pids, storing its wait status, or -1 for a stage which
+ * was not started, in @param statuses if not NULL
+ * @return true if every stage exited with status 0
+ */
+static bool wait_pipeline(size_t count, const pid_t *pids, int *statuses)
+{
+    bool success = true;
+
+    for (size_t i = 0; i < count; i++) {
+        int status = -1;
+
+        if (pids[i] >= 0) {
+            while (waitpid(pids[i], &status, 0) < 0) {
+                if (errno != EINTR) {
+                    status = -1;
+                    break;
+                }
+            }
+        }
+        if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            success = false;
+        if (statuses)
+            statuses[i] = status;
+    }
+    return success;
 }
 
+/**
+* @param outputfile - The full path to the file to write with the output of the last stage, or
+*   NULL to leave it on this process's stdout.  The last stage opens it itself, so the output is
+*   written to the file without passing through this process.
+* @param count - The number of stages in @param stages
+* @param stages - @param count NULL terminated argument lists, each starting with the full path of
+*   the command.  The stdout of each stage is piped to the stdin of the next.
+* @param statuses - If not NULL, receives the wait status of each stage, -1 for a stage which could
+*   not be started
+* @return true if every stage was started and exited with status 0, like a shell's pipefail
+*/
+bool do_exec_pipeline(const char *outputfile, size_t count, char *const *const stages[], int *statuses)
+{
+    pid_t pids[count ? count : 1];
+    bool success = start_pipeline(count, stages, outputfile, NULL, pids);
 
+    return wait_pipeline(count, pids, statuses) && success;
+}
+
+/**
+* Run a pipeline as do_exec_pipeline() and capture the output of the last stage into @param buf.
+* @param len - On entry the size of @param buf, on return the total length of the output, which
+*   is larger than the size of @param buf if the output was truncated.  Output beyond the buffer is
+*   read and discarded so the last stage never blocks.
+*/
+bool do_exec_pipeline_capture(char *buf, size_t *len, size_t count, char *const *const stages[],
+                              int *statuses)
+{
+    pid_t pids[count ? count : 1];
+    size_t size = *len, total = 0;
+    char discard[4096];
+    bool success;
+    int rd;
+
+    success = start_pipeline(count, stages, NULL, &rd, pids);
+    while (rd >= 0) {
+        char *dest = total < size ? buf + total : discard;
+        size_t room = total < size ? size - total : sizeof(discard);
+        ssize_t ret = read(rd, dest, room);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            if (ret < 0)
+                success = false;
+            break;
+        }
+        total += ret;
+    }
+    if (rd >= 0)
+        close(rd);
+
+    *len = total;
+    return wait_pipeline(count, pids, statuses) && success;
+}
+
+/**
+* Run a pipeline as do_exec_pipeline() and move the output of the last stage to @param out_fd, an
+* open file, socket or pipe, with splice() so it is not copied through this process.  Falls back
+* to read() and write() where @param out_fd does not support splice().
+*/
+bool do_exec_pipeline_fd(int out_fd, size_t count, char *const *const stages[], int *statuses)
+{
+    pid_t pids[count ? count : 1];
+    bool success, use_splice = true;
+    char buf[4096];
+    int rd;
+
+    success = start_pipeline(count, stages, NULL, &rd, pids);
+    while (rd >= 0) {
+        ssize_t ret;
+
+        if (use_splice) {
+            ret = splice(rd, NULL, out_fd, NULL, 1 << 16, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (ret < 0 && errno == EINVAL) {
+                use_splice = false;
+                continue;
+            }
+        } else {
+            ret = read(rd, buf, sizeof(buf));
+            for (ssize_t done = 0; ret > 0 && done < ret; ) {
+                ssize_t written = write(out_fd, buf + done, ret - done);
+
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written < 0) {
+                    ret = -1;
+                    break;
+                }
+                done += written;
+            }
+        }
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            if (ret < 0)
+                success = false;
+            break;
+        }
+    }
+    // Closing the pipe early makes the last stage fail with SIGPIPE rather than block
+    if (rd >= 0)
+        close(rd);
+
+    return wait_pipeline(count, pids, statuses) && success;
+}
@@ -7,3 +7,24 @@ bool do_system(const char *command);
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * One command for do_exec_batch()
+ */
+struct exec_request {
+    /* Full path of the command followed by its arguments, NULL terminated */
+    char *const *argv;
+    /* File to redirect the standard output to, NULL to inherit it */
+    const char *outputfile;
+    /* Set to the wait status of the command, or -1 if it could not be started */
+    int status;
+};
+
+bool do_exec_batch(struct exec_request *requests, size_t count);
+
+bool do_exec_pipeline(const char *outputfile, size_t count, char *const *const stages[], int *statuses);
+
+bool do_exec_pipeline_capture(char *buf, size_t *len, size_t count, char *const *const stages[],
+                              int *statuses);
+
+bool do_exec_pipeline_fd(int out_fd, size_t count, char *const *const stages[], int *statuses);
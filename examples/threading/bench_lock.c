@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "bench_lock.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Ticket lock spins this many times before yielding, so an oversubscribed CPU still makes progress */
+#define TICKET_SPINS_BEFORE_YIELD 128
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static int mutex_init(struct bench_lock *lock)
+{
+    return pthread_mutex_init(&lock->mutex, NULL);
+}
+
+/**
+ * glibc's adaptive mutex spins for a while before sleeping, which helps short critical sections
+ */
+static int adaptive_mutex_init(struct bench_lock *lock)
+{
+    pthread_mutexattr_t attr;
+    int ret = pthread_mutexattr_init(&attr);
+
+    if (ret != 0)
+        return ret;
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+    ret = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+#endif
+    if (ret == 0)
+        ret = pthread_mutex_init(&lock->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return ret;
+}
+
+static void mutex_lock(struct bench_lock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+static void mutex_unlock(struct bench_lock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+static void mutex_destroy(struct bench_lock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+}
+
+static int spin_init(struct bench_lock *lock)
+{
+    return pthread_spin_init(&lock->spin, PTHREAD_PROCESS_PRIVATE);
+}
+
+static void spin_lock(struct bench_lock *lock)
+{
+    pthread_spin_lock(&lock->spin);
+}
+
+static void spin_unlock(struct bench_lock *lock)
+{
+    pthread_spin_unlock(&lock->spin);
+}
+
+static void spin_destroy(struct bench_lock *lock)
+{
+    pthread_spin_destroy(&lock->spin);
+}
+
+static int rwlock_init(struct bench_lock *lock)
+{
+    return pthread_rwlock_init(&lock->rwlock, NULL);
+}
+
+/**
+ * Every acquisition takes the write side, as aesdsocket's critical sections all modify shared state
+ */
+static void rwlock_lock(struct bench_lock *lock)
+{
+    pthread_rwlock_wrlock(&lock->rwlock);
+}
+
+static void rwlock_unlock(struct bench_lock *lock)
+{
+    pthread_rwlock_unlock(&lock->rwlock);
+}
+
+static void rwlock_destroy(struct bench_lock *lock)
+{
+    pthread_rwlock_destroy(&lock->rwlock);
+}
+
+static int ticket_init(struct bench_lock *lock)
+{
+    atomic_init(&lock->ticket.next, 0);
+    atomic_init(&lock->ticket.owner, 0);
+    return 0;
+}
+
+static void ticket_lock(struct bench_lock *lock)
+{
+    unsigned int ticket = atomic_fetch_add_explicit(&lock->ticket.next, 1, memory_order_relaxed);
+    unsigned int spins = 0;
+
+    while (atomic_load_explicit(&lock->ticket.owner, memory_order_acquire) != ticket) {
+        if (++spins % TICKET_SPINS_BEFORE_YIELD == 0)
+            sched_yield();
+        else
+            cpu_relax();
+    }
+}
+
+static void ticket_unlock(struct bench_lock *lock)
+{
+    atomic_fetch_add_explicit(&lock->ticket.owner, 1, memory_order_release);
+}
+
+static void ticket_destroy(struct bench_lock *lock)
+{
+    (void)lock;
+}
+
+static int futex_init(struct bench_lock *lock)
+{
+    atomic_init(&lock->futex.state, 0);
+    return 0;
+}
+
+static long futex(atomic_int *uaddr, int op, int val)
+{
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/**
+ * The three state mutex from Drepper's "Futexes Are Tricky"
+ */
+static void futex_lock(struct bench_lock *lock)
+{
+    int state = 0;
+
+    if (atomic_compare_exchange_strong_explicit(&lock->futex.state, &state, 1,
+                                                memory_order_acquire, memory_order_relaxed))
+        return;
+    // Mark the lock contended so the owner wakes us, then sleep until it is free
+    if (state != 2)
+        state = atomic_exchange_explicit(&lock->futex.state, 2, memory_order_acquire);
+    while (state != 0) {
+        futex(&lock->futex.state, FUTEX_WAIT_PRIVATE, 2);
+        state = atomic_exchange_explicit(&lock->futex.state, 2, memory_order_acquire);
+    }
+}
+
+static void futex_unlock(struct bench_lock *lock)
+{
+    if (atomic_exchange_explicit(&lock->futex.state, 0, memory_order_release) == 2)
+        futex(&lock->futex.state, FUTEX_WAKE_PRIVATE, 1);
+}
+
+static void futex_destroy(struct bench_lock *lock)
+{
+    (void)lock;
+}
+
+const struct bench_lock_ops bench_lock_types[] = {
+    { "mutex", mutex_init, mutex_lock, mutex_unlock, mutex_destroy },
+    { "adaptive", adaptive_mutex_init, mutex_lock, mutex_unlock, mutex_destroy },
+    { "spin", spin_init, spin_lock, spin_unlock, spin_destroy },
+    { "ticket", ticket_init, ticket_lock, ticket_unlock, ticket_destroy },
+    { "rwlock", rwlock_init, rwlock_lock, rwlock_unlock, rwlock_destroy },
+    { "futex", futex_init, futex_lock, futex_unlock, futex_destroy },
+    { NULL, NULL, NULL, NULL, NULL },
+};
+
+const struct bench_lock_ops *bench_lock_find(const char *name)
+{
+    const struct bench_lock_ops *ops;
+
+    for (ops = bench_lock_types; ops->name; ops++) {
+        if (strcmp(ops->name, name) == 0)
+            return ops;
+    }
+    return NULL;
+}
+
+int bench_lock_init(struct bench_lock *lock, const struct bench_lock_ops *ops)
+{
+    lock->ops = ops;
+    return ops->init(lock);
+}
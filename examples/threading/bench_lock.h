@@ -0,0 +1,80 @@
+#ifndef BENCH_LOCK_H
+#define BENCH_LOCK_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * Lock types compared by lock_bench, behind a common interface so the benchmark
+ * loop is the same for each of them.
+ */
+
+/**
+ * Ticket lock: threads take a ticket and acquire in ticket order, so waiters are
+ * served first come first served.
+ */
+struct bench_ticket_lock {
+    atomic_uint next;
+    atomic_uint owner;
+};
+
+/**
+ * Futex based mutex: 0 unlocked, 1 locked, 2 locked with waiters.  Uncontended lock
+ * and unlock are a single atomic operation, waiters sleep in the kernel.
+ */
+struct bench_futex_lock {
+    atomic_int state;
+};
+
+struct bench_lock {
+    const struct bench_lock_ops *ops;
+    union {
+        pthread_mutex_t mutex;
+        pthread_spinlock_t spin;
+        pthread_rwlock_t rwlock;
+        struct bench_ticket_lock ticket;
+        struct bench_futex_lock futex;
+    };
+};
+
+struct bench_lock_ops {
+    const char *name;
+    int (*init)(struct bench_lock *lock);
+    void (*lock)(struct bench_lock *lock);
+    void (*unlock)(struct bench_lock *lock);
+    void (*destroy)(struct bench_lock *lock);
+};
+
+/**
+ * All lock types, terminated by an entry with a NULL name
+ */
+extern const struct bench_lock_ops bench_lock_types[];
+
+/**
+ * @return the lock type called @param name, NULL if there is none
+ */
+const struct bench_lock_ops *bench_lock_find(const char *name);
+
+/**
+ * Initialise @param lock as a lock of type @param ops
+ * @return 0 on success, an errno value on failure
+ */
+int bench_lock_init(struct bench_lock *lock, const struct bench_lock_ops *ops);
+
+static inline void bench_lock_lock(struct bench_lock *lock)
+{
+    lock->ops->lock(lock);
+}
+
+static inline void bench_lock_unlock(struct bench_lock *lock)
+{
+    lock->ops->unlock(lock);
+}
+
+static inline void bench_lock_destroy(struct bench_lock *lock)
+{
+    lock->ops->destroy(lock);
+}
+
+#endif /* BENCH_LOCK_H */
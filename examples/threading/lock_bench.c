@@ -0,0 +1,286 @@
+/**
+ * @file lock_bench.c
+ * @brief Lock contention benchmark over the lock types in bench_lock.h
+ *
+ * Usage: lock_bench [-t threads] [-H hold_ns] [-T think_ns] [-d duration_ms] [-l lock[,lock...]]
+ * Each thread repeatedly thinks for think_ns outside the lock, acquires it, holds it for hold_ns
+ * and releases it, busy waiting for both so the times are not rounded up to a scheduler tick.
+ * For each lock type, all of them by default, prints the acquisitions per second, the fairness
+ * of the acquisitions between threads and percentiles of the time spent waiting for the lock.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "bench_lock.h"
+
+/*
+ * Wait latency histogram: values below WAIT_LINEAR_BUCKETS ns have a bucket each, above that
+ * every power of two is split into WAIT_SUB_BUCKETS buckets, giving about 12% resolution
+ */
+#define WAIT_SUB_BITS       3
+#define WAIT_SUB_BUCKETS    (1 << WAIT_SUB_BITS)
+#define WAIT_LINEAR_BUCKETS (2 * WAIT_SUB_BUCKETS)
+#define WAIT_BUCKETS        (WAIT_LINEAR_BUCKETS + (64 - WAIT_SUB_BITS - 1) * WAIT_SUB_BUCKETS)
+#define MAX_LOCK_TYPES      16
+
+struct bench_thread {
+    pthread_t thread;
+    struct bench_config *config;
+    uint64_t acquisitions;
+    uint64_t wait_max_ns;
+    uint64_t wait_hist[WAIT_BUCKETS];
+};
+
+struct bench_config {
+    struct bench_lock lock;
+    unsigned int threads;
+    uint64_t hold_ns;
+    uint64_t think_ns;
+    pthread_barrier_t start;
+    atomic_int stop;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Busy wait for @param ns nanoseconds, standing in for work done in or out of the lock
+ */
+static void spin_for(uint64_t ns)
+{
+    uint64_t end;
+
+    if (ns == 0)
+        return;
+    end = now_ns() + ns;
+    while (now_ns() < end)
+        ;
+}
+
+static unsigned int wait_bucket(uint64_t ns)
+{
+    unsigned int msb;
+
+    if (ns < WAIT_LINEAR_BUCKETS)
+        return ns;
+    msb = 63 - __builtin_clzll(ns);
+    return WAIT_LINEAR_BUCKETS + (msb - WAIT_SUB_BITS - 1) * WAIT_SUB_BUCKETS +
+           ((ns >> (msb - WAIT_SUB_BITS)) & (WAIT_SUB_BUCKETS - 1));
+}
+
+/**
+ * @return the smallest latency counted in @param bucket
+ */
+static uint64_t wait_bucket_floor(unsigned int bucket)
+{
+    unsigned int msb, sub;
+
+    if (bucket < WAIT_LINEAR_BUCKETS)
+        return bucket;
+    msb = (bucket - WAIT_LINEAR_BUCKETS) / WAIT_SUB_BUCKETS + WAIT_SUB_BITS + 1;
+    sub = (bucket - WAIT_LINEAR_BUCKETS) % WAIT_SUB_BUCKETS;
+    return (1ULL << msb) + ((uint64_t)sub << (msb - WAIT_SUB_BITS));
+}
+
+static void *bench_thread_func(void *arg)
+{
+    struct bench_thread *t = arg;
+    struct bench_config *config = t->config;
+
+    pthread_barrier_wait(&config->start);
+    while (!atomic_load_explicit(&config->stop, memory_order_relaxed)) {
+        uint64_t start, waited;
+
+        spin_for(config->think_ns);
+        start = now_ns();
+        bench_lock_lock(&config->lock);
+        waited = now_ns() - start;
+        spin_for(config->hold_ns);
+        bench_lock_unlock(&config->lock);
+
+        t->acquisitions++;
+        t->wait_hist[wait_bucket(waited)]++;
+        if (waited > t->wait_max_ns)
+            t->wait_max_ns = waited;
+    }
+    return NULL;
+}
+
+/**
+ * @return the latency below which @param fraction of the @param total samples in @param hist fall
+ */
+static uint64_t wait_percentile(const uint64_t *hist, uint64_t total, double fraction)
+{
+    uint64_t target = (uint64_t)(total * fraction), seen = 0;
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < WAIT_BUCKETS; bucket++) {
+        seen += hist[bucket];
+        if (seen > target)
+            return wait_bucket_floor(bucket);
+    }
+    return wait_bucket_floor(WAIT_BUCKETS - 1);
+}
+
+/**
+ * Run the benchmark for @param duration_ms with the lock type @param ops and print one line of results
+ * @return 0 on success, -1 on error
+ */
+static int run_bench(struct bench_config *config, const struct bench_lock_ops *ops, unsigned int duration_ms)
+{
+    static uint64_t hist[WAIT_BUCKETS];
+    struct bench_thread *threads = calloc(config->threads, sizeof(*threads));
+    uint64_t total = 0, min = UINT64_MAX, max = 0, wait_max = 0, start, elapsed;
+    double sum_squares = 0;
+    unsigned int i, started;
+    int ret;
+
+    if (!threads) {
+        perror("calloc");
+        return -1;
+    }
+    ret = bench_lock_init(&config->lock, ops);
+    if (ret != 0) {
+        fprintf(stderr, "%s: init failed: %s\n", ops->name, strerror(ret));
+        free(threads);
+        return -1;
+    }
+    atomic_store(&config->stop, 0);
+    pthread_barrier_init(&config->start, NULL, config->threads + 1);
+
+    for (started = 0; started < config->threads; started++) {
+        threads[started].config = config;
+        if (pthread_create(&threads[started].thread, NULL, bench_thread_func, &threads[started]) != 0) {
+            // Threads already waiting at the barrier can never be released, give up entirely
+            fprintf(stderr, "pthread_create failed after %u threads\n", started);
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&config->start);
+    start = now_ns();
+    usleep(duration_ms * 1000);
+    atomic_store(&config->stop, 1);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i].thread, NULL);
+    elapsed = now_ns() - start;
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < config->threads; i++) {
+        struct bench_thread *t = &threads[i];
+        unsigned int bucket;
+
+        total += t->acquisitions;
+        sum_squares += (double)t->acquisitions * t->acquisitions;
+        if (t->acquisitions < min)
+            min = t->acquisitions;
+        if (t->acquisitions > max)
+            max = t->acquisitions;
+        if (t->wait_max_ns > wait_max)
+            wait_max = t->wait_max_ns;
+        for (bucket = 0; bucket < WAIT_BUCKETS; bucket++)
+            hist[bucket] += t->wait_hist[bucket];
+    }
+
+    // Jain's fairness index: 1 when every thread acquired equally often, 1/threads when one did all
+    printf("%-10s %12.0f %8.3f %10.3f %10llu %10llu %10llu %12llu\n", ops->name,
+           total * 1e9 / elapsed,
+           sum_squares > 0 ? (double)total * total / (config->threads * sum_squares) : 0.0,
+           max > 0 ? (double)min / max : 0.0,
+           (unsigned long long)wait_percentile(hist, total, 0.5),
+           (unsigned long long)wait_percentile(hist, total, 0.99),
+           (unsigned long long)wait_percentile(hist, total, 0.999),
+           (unsigned long long)wait_max);
+
+    pthread_barrier_destroy(&config->start);
+    bench_lock_destroy(&config->lock);
+    free(threads);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-H hold_ns] [-T think_ns] [-d duration_ms] [-l lock[,lock...]]\n",
+            prog);
+    fprintf(stderr, "Lock types:");
+    for (const struct bench_lock_ops *ops = bench_lock_types; ops->name; ops++)
+        fprintf(stderr, " %s", ops->name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_config config = {
+        .threads = 4,
+        .hold_ns = 100,
+        .think_ns = 1000,
+    };
+    unsigned int duration_ms = 1000;
+    const struct bench_lock_ops *selected[MAX_LOCK_TYPES];
+    unsigned int i, nr_selected = 0;
+    char *locks = NULL, *name, *saveptr;
+    int opt, ret = 0;
+
+    for (const struct bench_lock_ops *ops = bench_lock_types; ops->name && nr_selected < MAX_LOCK_TYPES; ops++)
+        selected[nr_selected++] = ops;
+
+    while ((opt = getopt(argc, argv, "t:H:T:d:l:")) != -1) {
+        switch (opt) {
+        case 't':
+            config.threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            config.hold_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'T':
+            config.think_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            locks = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.threads < 1 || duration_ms < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (locks) {
+        nr_selected = 0;
+        for (name = strtok_r(locks, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+            if (nr_selected == MAX_LOCK_TYPES || !(selected[nr_selected++] = bench_lock_find(name))) {
+                fprintf(stderr, "Unknown lock type %s\n", name);
+                usage(argv[0]);
+                return 1;
+            }
+        }
+    }
+
+    printf("threads %u hold_ns %llu think_ns %llu duration_ms %u cpus %ld\n", config.threads,
+           (unsigned long long)config.hold_ns, (unsigned long long)config.think_ns, duration_ms,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-10s %12s %8s %10s %10s %10s %10s %12s\n", "lock", "acq_per_s", "jain", "min/max",
+           "p50_ns", "p99_ns", "p999_ns", "max_ns");
+    for (i = 0; i < nr_selected; i++) {
+        if (run_bench(&config, selected[i], duration_ms) < 0)
+            ret = 1;
+    }
+    return ret;
+}
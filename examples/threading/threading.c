@@ -77,3 +77,28 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int
     return true;
 }
 
+
+struct threadpool_future *start_task_obtaining_mutex(struct threadpool *pool, pthread_mutex_t *mutex,
+                                                     int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    struct thread_data* tdata = malloc(sizeof(struct thread_data));
+    if (tdata == NULL) {
+        ERROR_LOG("Failed to allocate memory for thread_data\n");
+        return NULL;
+    }
+
+    tdata->mutex = mutex;
+    tdata->wait_to_obtain_ms = wait_to_obtain_ms;
+    tdata->wait_to_release_ms = wait_to_release_ms;
+    tdata->thread_complete_success = false;
+
+    // threadfunc returns tdata, which becomes the result of the future
+    struct threadpool_future *future = threadpool_submit(pool, threadfunc, tdata);
+    if (future == NULL) {
+        ERROR_LOG("threadpool_submit failed\n");
+        free(tdata);
+        return NULL;
+    }
+
+    return future;
+}
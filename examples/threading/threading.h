@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <pthread.h>
+#include "threadpool.h"
 
 /**
  * This structure should be dynamically allocated and passed as
@@ -49,3 +50,15 @@ struct thread_data{
 */
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms);
 
+
+/**
+* Queue a task on @param pool which behaves like the thread started by start_thread_obtaining_mutex:
+* it sleeps @param wait_to_obtain_ms milliseconds, obtains @param mutex, holds it for
+* @param wait_to_release_ms milliseconds, then releases it.  Runs on an existing worker of
+* @param pool rather than a new thread.
+* @return a future whose result, from threadpool_future_get(), is the dynamically allocated
+* thread_data structure with thread_complete_success set, to be freed by the caller.  NULL if the
+* task could not be queued.
+*/
+struct threadpool_future *start_task_obtaining_mutex(struct threadpool *pool, pthread_mutex_t *mutex,
+                                                     int wait_to_obtain_ms, int wait_to_release_ms);
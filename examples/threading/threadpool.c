@@ -0,0 +1,399 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "threadpool.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define ERROR_LOG(msg,...) fprintf(stderr, "threadpool ERROR: " msg "\n" , ##__VA_ARGS__)
+
+/* Initial number of tasks per deque, doubled whenever one fills up */
+#define DEQUE_INITIAL_CAPACITY 64
+
+struct threadpool_future {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    void *result;
+};
+
+struct threadpool_task {
+    threadpool_func func;
+    void *arg;
+    /* NULL for detached tasks */
+    struct threadpool_future *future;
+};
+
+/**
+ * Ring buffer of tasks: the owner pushes and pops at the bottom, thieves take from the top
+ */
+struct threadpool_deque {
+    pthread_mutex_t lock;
+    struct threadpool_task *tasks;
+    unsigned int capacity;
+    unsigned int top;
+    unsigned int count;
+};
+
+struct threadpool_worker {
+    struct threadpool *pool;
+    pthread_t thread;
+    unsigned int index;
+    struct threadpool_deque deque;
+};
+
+struct threadpool {
+    struct threadpool_worker *workers;
+    unsigned int nr_workers;
+    /* Worker the next task submitted from outside the pool is queued on */
+    atomic_uint next_worker;
+    /* Tasks queued and not yet taken by a worker */
+    atomic_uint queued;
+    /*
+     * Workers sleeping on wake.  A submitter increments queued then reads idle, a worker
+     * increments idle then reads queued, so one of them always sees the other.
+     */
+    atomic_uint idle;
+    atomic_bool shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+/* Worker running on this thread, NULL outside of any pool */
+static __thread struct threadpool_worker *current_worker;
+
+static int deque_init(struct threadpool_deque *deque)
+{
+    deque->tasks = malloc(DEQUE_INITIAL_CAPACITY * sizeof(*deque->tasks));
+    if (!deque->tasks)
+        return -1;
+    deque->capacity = DEQUE_INITIAL_CAPACITY;
+    deque->top = 0;
+    deque->count = 0;
+    pthread_mutex_init(&deque->lock, NULL);
+    return 0;
+}
+
+static void deque_destroy(struct threadpool_deque *deque)
+{
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->tasks);
+}
+
+/**
+ * Add @param task at the bottom of @param deque, growing it if full
+ * @return 0 on success, -1 if out of memory
+ */
+static int deque_push(struct threadpool_deque *deque, const struct threadpool_task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        struct threadpool_task *tasks = malloc(2 * deque->capacity * sizeof(*tasks));
+        unsigned int i;
+
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (i = 0; i < deque->count; i++)
+            tasks[i] = deque->tasks[(deque->top + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity *= 2;
+        deque->top = 0;
+    }
+    deque->tasks[(deque->top + deque->count) % deque->capacity] = *task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+/**
+ * Take a task from the bottom of @param deque when @param bottom, the newest, which is still hot in
+ * the owner's cache, or from the top, the oldest, when stealing
+ * @return true if a task was stored in @param task_rtn
+ */
+static bool deque_take(struct threadpool_deque *deque, bool bottom, struct threadpool_task *task_rtn)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        if (bottom) {
+            *task_rtn = deque->tasks[(deque->top + deque->count - 1) % deque->capacity];
+        } else {
+            *task_rtn = deque->tasks[deque->top];
+            deque->top = (deque->top + 1) % deque->capacity;
+        }
+        deque->count--;
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * Find a task for @param worker: its own newest task, else the oldest task of another worker,
+ * starting with its neighbour so thieves spread over the victims
+ */
+static bool find_task(struct threadpool_worker *worker, struct threadpool_task *task_rtn)
+{
+    struct threadpool *pool = worker->pool;
+    unsigned int i;
+
+    if (deque_take(&worker->deque, true, task_rtn))
+        goto found;
+    for (i = 1; i < pool->nr_workers; i++) {
+        struct threadpool_worker *victim = &pool->workers[(worker->index + i) % pool->nr_workers];
+
+        if (deque_take(&victim->deque, false, task_rtn))
+            goto found;
+    }
+    return false;
+
+found:
+    atomic_fetch_sub(&pool->queued, 1);
+    return true;
+}
+
+static void run_task(const struct threadpool_task *task)
+{
+    void *result = task->func(task->arg);
+    struct threadpool_future *future = task->future;
+
+    if (future) {
+        pthread_mutex_lock(&future->lock);
+        future->result = result;
+        future->done = true;
+        pthread_cond_signal(&future->cond);
+        pthread_mutex_unlock(&future->lock);
+    }
+}
+
+static void *worker_func(void *arg)
+{
+    struct threadpool_worker *worker = arg;
+    struct threadpool *pool = worker->pool;
+    struct threadpool_task task;
+
+    current_worker = worker;
+    for (;;) {
+        if (find_task(worker, &task)) {
+            run_task(&task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->idle, 1);
+        while (atomic_load(&pool->queued) == 0 && !atomic_load(&pool->shutdown))
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        atomic_fetch_sub(&pool->idle, 1);
+        // Only exit once drained, tasks queued during shutdown still run
+        if (atomic_load(&pool->queued) == 0 && atomic_load(&pool->shutdown)) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+static bool queue_task(struct threadpool *pool, const struct threadpool_task *task)
+{
+    struct threadpool_worker *worker = current_worker;
+
+    // Workers may keep submitting while the pool drains, so their tasks can finish
+    if (!worker || worker->pool != pool) {
+        if (atomic_load(&pool->shutdown))
+            return false;
+        worker = &pool->workers[atomic_fetch_add(&pool->next_worker, 1) % pool->nr_workers];
+    }
+    // Count the task before it is visible, a worker taking it at once must not wrap the count
+    atomic_fetch_add(&pool->queued, 1);
+    if (deque_push(&worker->deque, task) < 0) {
+        atomic_fetch_sub(&pool->queued, 1);
+        return false;
+    }
+    if (atomic_load(&pool->idle) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return true;
+}
+
+struct threadpool_future *threadpool_submit(struct threadpool *pool, threadpool_func func, void *arg)
+{
+    struct threadpool_future *future = malloc(sizeof(*future));
+    struct threadpool_task task = { func, arg, future };
+
+    if (!future)
+        return NULL;
+    pthread_mutex_init(&future->lock, NULL);
+    pthread_cond_init(&future->cond, NULL);
+    future->done = false;
+    future->result = NULL;
+
+    if (!queue_task(pool, &task)) {
+        pthread_cond_destroy(&future->cond);
+        pthread_mutex_destroy(&future->lock);
+        free(future);
+        return NULL;
+    }
+    return future;
+}
+
+bool threadpool_submit_detached(struct threadpool *pool, threadpool_func func, void *arg)
+{
+    struct threadpool_task task = { func, arg, NULL };
+
+    return queue_task(pool, &task);
+}
+
+bool threadpool_future_done(struct threadpool_future *future)
+{
+    bool done;
+
+    pthread_mutex_lock(&future->lock);
+    done = future->done;
+    pthread_mutex_unlock(&future->lock);
+    return done;
+}
+
+void *threadpool_future_get(struct threadpool_future *future)
+{
+    void *result;
+
+    pthread_mutex_lock(&future->lock);
+    while (!future->done)
+        pthread_cond_wait(&future->cond, &future->lock);
+    result = future->result;
+    pthread_mutex_unlock(&future->lock);
+
+    pthread_cond_destroy(&future->cond);
+    pthread_mutex_destroy(&future->lock);
+    free(future);
+    return result;
+}
+
+unsigned int threadpool_size(const struct threadpool *pool)
+{
+    return pool->nr_workers;
+}
+
+/**
+ * Set up @param attr to bind worker @param index to the n-th CPU of the calling thread's affinity
+ * mask, n being @param index modulo the number of CPUs in the mask
+ * @return 0 on success, an errno value on failure
+ */
+static int pin_attr(pthread_attr_t *attr, unsigned int index)
+{
+    cpu_set_t allowed, cpus;
+    int cpu, nr_allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        return errno;
+    nr_allowed = CPU_COUNT(&allowed);
+    if (nr_allowed == 0)
+        return EINVAL;
+    index %= nr_allowed;
+    // CPU numbers can have gaps, so count set bits rather than indexing by number
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+            break;
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+}
+
+/**
+ * Wake the first @param nr_started workers of @param pool to drain and exit, join them and free
+ * the pool
+ */
+static void threadpool_destroy(struct threadpool *pool, unsigned int nr_started)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->shutdown, true);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < nr_started; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (i = 0; i < pool->nr_workers; i++)
+        deque_destroy(&pool->workers[i].deque);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+struct threadpool *threadpool_create(unsigned int nr_workers, bool pin_cpus)
+{
+    struct threadpool *pool = calloc(1, sizeof(*pool));
+    unsigned int i, started;
+
+    if (!pool)
+        return NULL;
+    if (nr_workers == 0) {
+        long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        nr_workers = nr_cpus > 0 ? nr_cpus : 1;
+    }
+    pool->workers = calloc(nr_workers, sizeof(*pool->workers));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    for (i = 0; i < nr_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (deque_init(&pool->workers[i].deque) < 0) {
+            // Only the deques created so far are destroyed
+            pool->nr_workers = i;
+            threadpool_destroy(pool, 0);
+            return NULL;
+        }
+    }
+    pool->nr_workers = nr_workers;
+
+    for (started = 0; started < nr_workers; started++) {
+        struct threadpool_worker *worker = &pool->workers[started];
+        pthread_attr_t attr;
+        bool pinned = false;
+        int rc;
+
+        // Pinning only costs locality if it fails, so the worker is then started unpinned
+        if (pin_cpus && (rc = pthread_attr_init(&attr)) == 0) {
+            rc = pin_attr(&attr, started);
+            if (rc == 0)
+                rc = pthread_create(&worker->thread, &attr, worker_func, worker);
+            pthread_attr_destroy(&attr);
+            pinned = rc == 0;
+        }
+        if (pin_cpus && !pinned)
+            ERROR_LOG("Failed to pin worker %u: %d", started, rc);
+        rc = pinned ? 0 : pthread_create(&worker->thread, NULL, worker_func, worker);
+        if (rc != 0) {
+            ERROR_LOG("pthread_create failed: %d", rc);
+            threadpool_destroy(pool, started);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void threadpool_shutdown(struct threadpool *pool)
+{
+    threadpool_destroy(pool, pool->nr_workers);
+}
@@ -0,0 +1,68 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+/**
+ * Work stealing thread pool.
+ *
+ * Each worker owns a deque of tasks.  Tasks submitted from a worker go to the bottom of its own
+ * deque and are run newest first, tasks submitted from other threads are spread over the workers
+ * round robin.  An idle worker steals the oldest task from the top of another worker's deque
+ * before going to sleep.
+ */
+
+struct threadpool;
+struct threadpool_future;
+
+/**
+ * A task: called with the argument given at submission, its return value is the result of the
+ * task's future
+ */
+typedef void *(*threadpool_func)(void *arg);
+
+/**
+ * Create a pool of @param nr_workers threads, one per online CPU if 0.  With @param pin_cpus
+ * worker n is bound to the n-th CPU (modulo their count) the caller is allowed to run on, and
+ * started unpinned if that fails.
+ * @return the pool, NULL on failure
+ */
+struct threadpool *threadpool_create(unsigned int nr_workers, bool pin_cpus);
+
+/**
+ * Queue @param func to be called with @param arg on a worker of @param pool
+ * @return a future to wait for the result with threadpool_future_get(), NULL if the task could
+ *   not be queued because of a memory allocation failure or because the pool is shutting down
+ */
+struct threadpool_future *threadpool_submit(struct threadpool *pool, threadpool_func func, void *arg);
+
+/**
+ * Queue @param func like threadpool_submit() for a task whose result is not needed
+ * @return true if the task was queued
+ */
+bool threadpool_submit_detached(struct threadpool *pool, threadpool_func func, void *arg);
+
+/**
+ * @return true if the task of @param future has completed, without waiting
+ */
+bool threadpool_future_done(struct threadpool_future *future);
+
+/**
+ * Wait for the task of @param future to complete and free the future
+ * @return the value the task returned
+ */
+void *threadpool_future_get(struct threadpool_future *future);
+
+/**
+ * @return the number of workers of @param pool
+ */
+unsigned int threadpool_size(const struct threadpool *pool);
+
+/**
+ * Stop accepting tasks, wait for every queued and running task to complete, including tasks
+ * those submit while draining, then join the workers and free @param pool
+ */
+void threadpool_shutdown(struct threadpool *pool);
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,148 @@
+/**
+ * @file threadpool_bench.c
+ * @brief Task dispatch latency of the thread pool against a pthread_create() per task
+ *
+ * Usage: threadpool_bench [tasks] [workers]
+ * Runs @param tasks empty tasks (default 10000) one at a time, measuring the time from submission
+ * to the task starting and to its result being collected, then all at once for throughput.  The
+ * pool has @param workers threads, one per CPU by default.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "threadpool.h"
+
+struct bench_task {
+    uint64_t submitted_ns;
+    uint64_t started_ns;
+};
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *bench_task_func(void *arg)
+{
+    struct bench_task *task = arg;
+
+    task->started_ns = now_ns();
+    return task;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Sort @param samples and print their mean, median and 99th percentile as @param name
+ */
+static void print_latency(const char *name, uint64_t *samples, size_t count)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        total += samples[i];
+    qsort(samples, count, sizeof(*samples), compare_u64);
+    printf("%-28s %10.0f %10llu %10llu\n", name, (double)total / count,
+           (unsigned long long)samples[count / 2], (unsigned long long)samples[count * 99 / 100]);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t nr_tasks = argc > 1 ? strtoul(argv[1], NULL, 0) : 10000;
+    unsigned int nr_workers = argc > 2 ? strtoul(argv[2], NULL, 0) : 0;
+    struct bench_task *tasks = calloc(nr_tasks, sizeof(*tasks));
+    uint64_t *dispatch = calloc(nr_tasks, sizeof(*dispatch));
+    uint64_t *round_trip = calloc(nr_tasks, sizeof(*round_trip));
+    struct threadpool_future **futures = calloc(nr_tasks, sizeof(*futures));
+    pthread_t *threads = calloc(nr_tasks, sizeof(*threads));
+    struct threadpool *pool;
+    uint64_t start;
+    size_t i;
+
+    if (nr_tasks == 0 || !tasks || !dispatch || !round_trip || !futures || !threads) {
+        fprintf(stderr, "Usage: %s [tasks] [workers]\n", argv[0]);
+        return 1;
+    }
+    pool = threadpool_create(nr_workers, false);
+    if (!pool) {
+        fprintf(stderr, "threadpool_create failed\n");
+        return 1;
+    }
+
+    printf("tasks %zu workers %u\n", nr_tasks, threadpool_size(pool));
+    printf("%-28s %10s %10s %10s\n", "latency_ns", "mean", "p50", "p99");
+
+    for (i = 0; i < nr_tasks; i++) {
+        struct threadpool_future *future;
+
+        tasks[i].submitted_ns = now_ns();
+        future = threadpool_submit(pool, bench_task_func, &tasks[i]);
+        if (!future || threadpool_future_get(future) != &tasks[i]) {
+            fprintf(stderr, "threadpool_submit failed\n");
+            return 1;
+        }
+        round_trip[i] = now_ns() - tasks[i].submitted_ns;
+        dispatch[i] = tasks[i].started_ns - tasks[i].submitted_ns;
+    }
+    print_latency("threadpool dispatch", dispatch, nr_tasks);
+    print_latency("threadpool submit+get", round_trip, nr_tasks);
+
+    for (i = 0; i < nr_tasks; i++) {
+        tasks[i].submitted_ns = now_ns();
+        if (pthread_create(&threads[i], NULL, bench_task_func, &tasks[i]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+        pthread_join(threads[i], NULL);
+        round_trip[i] = now_ns() - tasks[i].submitted_ns;
+        dispatch[i] = tasks[i].started_ns - tasks[i].submitted_ns;
+    }
+    print_latency("pthread_create dispatch", dispatch, nr_tasks);
+    print_latency("pthread_create create+join", round_trip, nr_tasks);
+
+    printf("%-28s %10s\n", "burst", "tasks_per_s");
+    start = now_ns();
+    for (i = 0; i < nr_tasks; i++) {
+        futures[i] = threadpool_submit(pool, bench_task_func, &tasks[i]);
+        if (!futures[i]) {
+            fprintf(stderr, "threadpool_submit failed\n");
+            return 1;
+        }
+    }
+    for (i = 0; i < nr_tasks; i++)
+        threadpool_future_get(futures[i]);
+    printf("%-28s %10.0f\n", "threadpool", nr_tasks * 1e9 / (now_ns() - start));
+
+    start = now_ns();
+    for (i = 0; i < nr_tasks; i++) {
+        if (pthread_create(&threads[i], NULL, bench_task_func, &tasks[i]) != 0) {
+            // Too many threads at once, join what was started and report the rate so far
+            nr_tasks = i;
+            break;
+        }
+    }
+    for (i = 0; i < nr_tasks; i++)
+        pthread_join(threads[i], NULL);
+    printf("%-28s %10.0f\n", "pthread_create", nr_tasks * 1e9 / (now_ns() - start));
+
+    threadpool_shutdown(pool);
+    free(threads);
+    free(futures);
+    free(round_trip);
+    free(dispatch);
+    free(tasks);
+    return 0;
+}
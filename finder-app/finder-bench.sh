@@ -0,0 +1,63 @@
+#!/bin/sh
+# Compare finder.sh against the native finder on a generated tree
+# Usage: finder-bench.sh [numfiles] [files_per_dir] [benchdir]
+# Defaults to 1000000 files, 1000 per directory, under /tmp/aeld-finder-bench.
+# The tree is kept between runs with the same size, its size is recorded in benchdir.size.
+
+set -e
+set -u
+
+NUMFILES=${1:-1000000}
+PERDIR=${2:-1000}
+BENCHDIR=${3:-/tmp/aeld-finder-bench}
+SEARCHSTR=AELD_IS_FUN
+FINDER_APP_DIR=$(realpath "$(dirname "$0")")
+
+if [ ! -x "${FINDER_APP_DIR}/finder" ]
+then
+    make -C "${FINDER_APP_DIR}" finder
+fi
+
+if [ "$(cat "${BENCHDIR}.size" 2>/dev/null)" != "${NUMFILES} ${PERDIR}" ]
+then
+    echo "Generating ${NUMFILES} files in ${BENCHDIR}"
+    rm -rf "${BENCHDIR}"
+    mkdir -p "${BENCHDIR}"
+    i=0
+    while [ $i -lt "${NUMFILES}" ]
+    do
+        dir="${BENCHDIR}/d$((i / PERDIR / 100))/d$((i / PERDIR))"
+        mkdir -p "$dir"
+        j=0
+        while [ $j -lt "${PERDIR}" ] && [ $i -lt "${NUMFILES}" ]
+        do
+            # One matching line in every other file, among lines which do not match
+            if [ $((i % 2)) -eq 0 ]
+            then
+                printf 'line one\n%s %d\nline three\n' "${SEARCHSTR}" $i > "$dir/f$i.txt"
+            else
+                printf 'line one\nline two %d\n' $i > "$dir/f$i.txt"
+            fi
+            i=$((i + 1))
+            j=$((j + 1))
+        done
+    done
+    echo "${NUMFILES} ${PERDIR}" > "${BENCHDIR}.size"
+fi
+
+# Drop the page cache when allowed so the first run is not the only cold one
+sync
+echo 3 > /proc/sys/vm/drop_caches 2>/dev/null || true
+
+run() {
+    name=$1
+    shift
+    start=$(date +%s.%N)
+    result=$("$@")
+    end=$(date +%s.%N)
+    echo "${name}: $(awk "BEGIN { printf \"%.3f\", $end - $start }") s: ${result}"
+}
+
+run "finder.sh" "${FINDER_APP_DIR}/finder.sh" "${BENCHDIR}" "${SEARCHSTR}"
+run "finder   " "${FINDER_APP_DIR}/finder" "${BENCHDIR}" "${SEARCHSTR}"
+run "finder -j1" "${FINDER_APP_DIR}/finder" -j 1 "${BENCHDIR}" "${SEARCHSTR}"
@@ -46,14 +46,27 @@ then
     fi
 fi
 
-# Use writer from PATH
+# Escape backslashes, tabs and newlines of $1 as writer -b manifest fields expect
+TAB=$(printf '\t')
+manifest_escape()
+{
+    printf '%s.\n' "$1" | sed -e 's/\\/\\\\/g' -e "s/${TAB}/\\\\t/g" -e '$!s/$/\\n/' -e '$s/\.$//' | tr -d '\n'
+}
+
+# Use writer from PATH, creating all files from one process in batch mode
+ESCAPEDSTR=$(manifest_escape "$WRITESTR")
 for i in $( seq 1 $NUMFILES)
 do
-    writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+    printf '%s\t%s\n' "$(manifest_escape "$WRITEDIR/${username}$i.txt")" "$ESCAPEDSTR"
+done | writer -b
 
-# Run finder.sh from PATH, save output to /tmp/assignment4-result.txt
-finder.sh "$WRITEDIR" "$WRITESTR" > /tmp/assignment4-result.txt
+# Run the native finder from PATH when installed, finder.sh otherwise, save output to /tmp/assignment4-result.txt
+if command -v finder > /dev/null
+then
+    finder "$WRITEDIR" "$WRITESTR" > /tmp/assignment4-result.txt
+else
+    finder.sh "$WRITEDIR" "$WRITESTR" > /tmp/assignment4-result.txt
+fi
 
 OUTPUTSTRING=$(cat /tmp/assignment4-result.txt)
 
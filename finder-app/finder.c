@@ -0,0 +1,474 @@
+/**
+ * @file finder.c
+ * @brief Native replacement for finder.sh
+ *
+ * Walks <directory> once with a pool of threads, counting the regular files
+ * like `find -type f | wc -l` and the lines containing <search_string> like
+ * `grep -rF | wc -l`, and prints the same line as finder.sh.
+ *
+ * Directories are listed with getdents64.  Each worker owns a deque of work
+ * items: directories to list, and batches of files from a listed directory.
+ * A worker pushes and pops at the back of its own deque and, when it runs
+ * dry, steals from the front of another worker's deque, so a wide directory
+ * is split across threads as soon as it is listed.
+ *
+ * The search string is matched as a fixed string, as finder.sh does.  Like
+ * GNU grep 3.5 and later, a file containing a NUL byte is reported on stderr
+ * if it matches and adds no matching lines.
+ *
+ * Usage: finder [-j threads] <directory> <search_string>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define FILE_BATCH      256
+#define GETDENTS_SIZE   (64 * 1024)
+#define READ_SIZE       (128 * 1024)
+#define MAX_THREADS     256
+
+struct linux_dirent64 {
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+/**
+ * An open directory shared by the file batches listed from it, closed by the last one
+ */
+struct dir_handle {
+    int fd;
+    atomic_int refs;
+    char *path;
+};
+
+enum work_type { WORK_DIR, WORK_FILES };
+
+struct work {
+    enum work_type type;
+    /* WORK_DIR: path of the directory to list */
+    char *path;
+    /* WORK_FILES: names relative to dir */
+    struct dir_handle *dir;
+    size_t nr_names;
+    char *names[FILE_BATCH];
+};
+
+struct deque {
+    pthread_mutex_t lock;
+    struct work **items;
+    size_t head, tail, capacity;
+};
+
+struct worker {
+    pthread_t thread;
+    unsigned int index;
+    unsigned int seed;
+    struct deque queue;
+    unsigned long long files;
+    unsigned long long lines;
+    char *read_buf;
+    size_t read_capacity;
+    char *dents;
+};
+
+static struct worker *workers;
+static unsigned int nr_workers;
+static const char *needle;
+static size_t needle_len;
+/* Work items pushed but not yet finished, the walk is over when it drops to 0 */
+static atomic_long pending;
+
+static void *xmalloc(size_t size)
+{
+    void *ptr = malloc(size);
+
+    if (!ptr) {
+        fprintf(stderr, "finder: out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void deque_push(struct deque *q, struct work *item)
+{
+    atomic_fetch_add(&pending, 1);
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->capacity) {
+        // Compact before growing, thieves leave free space at the front
+        if (q->head > 0) {
+            memmove(q->items, q->items + q->head, (q->tail - q->head) * sizeof(*q->items));
+            q->tail -= q->head;
+            q->head = 0;
+        }
+        if (q->tail == q->capacity) {
+            q->capacity = q->capacity ? q->capacity * 2 : 64;
+            q->items = realloc(q->items, q->capacity * sizeof(*q->items));
+            if (!q->items) {
+                fprintf(stderr, "finder: out of memory\n");
+                exit(1);
+            }
+        }
+    }
+    q->items[q->tail++] = item;
+    pthread_mutex_unlock(&q->lock);
+}
+
+/**
+ * @return the newest item of @param q for its owner, or the oldest for a thief when @param steal
+ */
+static struct work *deque_pop(struct deque *q, bool steal)
+{
+    struct work *item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail)
+        item = steal ? q->items[q->head++] : q->items[--q->tail];
+    if (q->head == q->tail)
+        q->head = q->tail = 0;
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void dir_handle_put(struct dir_handle *dir)
+{
+    if (atomic_fetch_sub(&dir->refs, 1) == 1) {
+        close(dir->fd);
+        free(dir->path);
+        free(dir);
+    }
+}
+
+/**
+ * Count the lines of [@param start, @param end) which contain the search string
+ */
+static unsigned long long count_matching_lines(const char *start, const char *end)
+{
+    unsigned long long lines = 0;
+    const char *pos = start;
+
+    if (needle_len == 0) {
+        // An empty pattern matches every line, including an unterminated last one
+        while ((pos = memchr(pos, '\n', end - pos)) != NULL) {
+            lines++;
+            pos++;
+        }
+        return lines + (end > start && end[-1] != '\n');
+    }
+
+    while (pos < end) {
+        const char *hit = memmem(pos, end - pos, needle, needle_len);
+        const char *newline;
+
+        if (!hit)
+            break;
+        lines++;
+        newline = memchr(hit + needle_len - 1, '\n', end - (hit + needle_len - 1));
+        if (!newline)
+            break;
+        pos = newline + 1;
+    }
+    return lines;
+}
+
+/**
+ * Count the matching lines of file @param name in @param dir.  Complete lines are searched
+ * straight from the read buffer, a partial last line is carried over to the next read
+ */
+static unsigned long long search_file(struct worker *self, struct dir_handle *dir, const char *name)
+{
+    unsigned long long lines = 0;
+    size_t carry = 0;
+    bool binary = false;
+    ssize_t n;
+    int fd;
+
+    fd = openat(dir->fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_NOCTTY);
+    if (fd < 0) {
+        fprintf(stderr, "finder: %s/%s: %s\n", dir->path, name, strerror(errno));
+        return 0;
+    }
+
+    for (;;) {
+        const char *last_newline;
+
+        if (carry == self->read_capacity) {
+            // A single line longer than the buffer
+            self->read_capacity *= 2;
+            self->read_buf = realloc(self->read_buf, self->read_capacity);
+            if (!self->read_buf) {
+                fprintf(stderr, "finder: out of memory\n");
+                exit(1);
+            }
+        }
+        n = read(fd, self->read_buf + carry, self->read_capacity - carry);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "finder: %s/%s: %s\n", dir->path, name, strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            lines += count_matching_lines(self->read_buf, self->read_buf + carry);
+            break;
+        }
+        if (!binary && memchr(self->read_buf + carry, '\0', n))
+            binary = true;
+
+        n += carry;
+        last_newline = memrchr(self->read_buf, '\n', n);
+        if (!last_newline) {
+            carry = n;
+            continue;
+        }
+        lines += count_matching_lines(self->read_buf, last_newline + 1);
+        if (binary && lines)
+            break;
+        carry = self->read_buf + n - (last_newline + 1);
+        memmove(self->read_buf, last_newline + 1, carry);
+    }
+
+    close(fd);
+    if (binary) {
+        if (lines)
+            fprintf(stderr, "finder: %s/%s: binary file matches\n", dir->path, name);
+        return 0;
+    }
+    return lines;
+}
+
+static void process_files(struct worker *self, struct work *item)
+{
+    size_t i;
+
+    for (i = 0; i < item->nr_names; i++) {
+        self->lines += search_file(self, item->dir, item->names[i]);
+        free(item->names[i]);
+    }
+    dir_handle_put(item->dir);
+}
+
+static struct work *new_files_batch(struct dir_handle *dir)
+{
+    struct work *item = xmalloc(sizeof(*item));
+
+    item->type = WORK_FILES;
+    item->path = NULL;
+    item->dir = dir;
+    item->nr_names = 0;
+    atomic_fetch_add(&dir->refs, 1);
+    return item;
+}
+
+/**
+ * List directory @param path, queueing its subdirectories and its regular files in batches
+ */
+static void process_dir(struct worker *self, const char *path)
+{
+    struct dir_handle *dir;
+    struct work *batch = NULL;
+    long nread;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+    dir = xmalloc(sizeof(*dir));
+    dir->fd = fd;
+    dir->path = strdup(path);
+    atomic_init(&dir->refs, 1);
+
+    while ((nread = syscall(SYS_getdents64, fd, self->dents, GETDENTS_SIZE)) > 0) {
+        long pos;
+
+        for (pos = 0; pos < nread; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(self->dents + pos);
+            unsigned char type = d->d_type;
+
+            pos += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+                continue;
+
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+
+                if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                    continue;
+                type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+            }
+
+            if (type == DT_DIR) {
+                struct work *sub = xmalloc(sizeof(*sub));
+                size_t len = strlen(path) + strlen(d->d_name) + 2;
+
+                sub->type = WORK_DIR;
+                sub->path = xmalloc(len);
+                snprintf(sub->path, len, "%s/%s", path, d->d_name);
+                deque_push(&self->queue, sub);
+            } else if (type == DT_REG) {
+                self->files++;
+                if (!batch)
+                    batch = new_files_batch(dir);
+                batch->names[batch->nr_names++] = strdup(d->d_name);
+                if (batch->nr_names == FILE_BATCH) {
+                    deque_push(&self->queue, batch);
+                    batch = NULL;
+                }
+            }
+        }
+    }
+    if (nread < 0)
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+
+    if (batch)
+        deque_push(&self->queue, batch);
+    dir_handle_put(dir);
+}
+
+static struct work *find_work(struct worker *self)
+{
+    struct work *item = deque_pop(&self->queue, false);
+    unsigned int attempt;
+
+    for (attempt = 0; !item && attempt < nr_workers * 2; attempt++) {
+        unsigned int victim = rand_r(&self->seed) % nr_workers;
+
+        if (victim != self->index)
+            item = deque_pop(&workers[victim].queue, true);
+    }
+    return item;
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *self = arg;
+    unsigned int idle = 0;
+
+    self->read_capacity = READ_SIZE;
+    self->read_buf = xmalloc(self->read_capacity);
+    self->dents = xmalloc(GETDENTS_SIZE);
+
+    while (atomic_load(&pending) > 0) {
+        struct work *item = find_work(self);
+
+        if (!item) {
+            // Other workers may still be listing directories which will produce work
+            if (++idle < 64) {
+                sched_yield();
+            } else {
+                struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000 };
+                nanosleep(&ts, NULL);
+            }
+            continue;
+        }
+        idle = 0;
+
+        if (item->type == WORK_DIR) {
+            process_dir(self, item->path);
+            free(item->path);
+        } else {
+            process_files(self, item);
+        }
+        free(item);
+        atomic_fetch_sub(&pending, 1);
+    }
+
+    free(self->read_buf);
+    free(self->dents);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long files = 0, lines = 0;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    struct work *root;
+    struct stat st;
+    unsigned int i;
+    int opt;
+
+    nr_workers = nr_cpus > 0 ? nr_cpus : 1;
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        switch (opt) {
+        case 'j':
+            nr_workers = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printf("Error: Must provide 2 arguments <directory> <search_string>\n");
+            return 1;
+        }
+    }
+    if (nr_workers < 1)
+        nr_workers = 1;
+    if (nr_workers > MAX_THREADS)
+        nr_workers = MAX_THREADS;
+
+    if (argc - optind < 2) {
+        printf("Error: Must provide 2 arguments <directory> <search_string>\n");
+        return 1;
+    }
+    if (argc - optind > 2) {
+        printf("Error: Many Arguements provided <directory> <search_string>\n");
+        return 1;
+    }
+    if (stat(argv[optind], &st) < 0 || !S_ISDIR(st.st_mode)) {
+        printf("Error: %s is not a directory\n", argv[optind]);
+        return 1;
+    }
+    needle = argv[optind + 1];
+    needle_len = strlen(needle);
+
+    workers = calloc(nr_workers, sizeof(*workers));
+    if (!workers) {
+        fprintf(stderr, "finder: out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < nr_workers; i++) {
+        workers[i].index = i;
+        workers[i].seed = i + 1;
+        pthread_mutex_init(&workers[i].queue.lock, NULL);
+    }
+
+    root = xmalloc(sizeof(*root));
+    root->type = WORK_DIR;
+    root->path = strdup(argv[optind]);
+    // Trailing slashes would be doubled in the paths of subdirectories
+    for (i = strlen(root->path); i > 1 && root->path[i - 1] == '/'; i--)
+        root->path[i - 1] = '\0';
+    deque_push(&workers[0].queue, root);
+
+    for (i = 0; i < nr_workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "finder: pthread_create failed\n");
+            return 1;
+        }
+    }
+    for (i = 0; i < nr_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        files += workers[i].files;
+        lines += workers[i].lines;
+        free(workers[i].queue.items);
+        pthread_mutex_destroy(&workers[i].queue.lock);
+    }
+    free(workers);
+
+    printf("The number of files are %llu and the number of matching lines are %llu\n", files, lines);
+    return 0;
+}
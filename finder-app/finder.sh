@@ -25,6 +25,7 @@ fi
 
 file=$(find "$filesdir" -type f | wc -l)
 
-found=$(grep -r "$searchstr" "$filesdir" | wc -l)
+# Fixed string match, the same rule as the native finder
+found=$(grep -rF -- "$searchstr" "$filesdir" | wc -l)
 
 echo "The number of files are $file and the number of matching lines are $found"
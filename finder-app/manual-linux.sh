@@ -106,6 +106,7 @@ make CROSS_COMPILE=${CROSS_COMPILE}
 mkdir -p "${OUTDIR}/rootfs/home/conf"
 cp ${FINDER_APP_DIR}/finder.sh \
    ${FINDER_APP_DIR}/writer \
+   ${FINDER_APP_DIR}/finder \
    ${FINDER_APP_DIR}/finder-test.sh \
    ${FINDER_APP_DIR}/autorun-qemu.sh \
    "${OUTDIR}/rootfs/home/"
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Compare one writer process per file against a single writer -b batch
+# Usage: writer-bench.sh [numfiles] [benchdir]
+# Defaults to 100000 files under /tmp/aeld-writer-bench.
+
+set -e
+set -u
+
+NUMFILES=${1:-100000}
+BENCHDIR=${2:-/tmp/aeld-writer-bench}
+WRITESTR=AELD_IS_FUN
+FINDER_APP_DIR=$(realpath "$(dirname "$0")")
+WRITER="${FINDER_APP_DIR}/writer"
+
+if [ ! -x "${WRITER}" ]
+then
+    make -C "${FINDER_APP_DIR}" writer
+fi
+
+run() {
+    name=$1
+    shift
+    rm -rf "${BENCHDIR}"
+    mkdir -p "${BENCHDIR}"
+    start=$(date +%s.%N)
+    "$@"
+    end=$(date +%s.%N)
+    echo "${name}: $(awk "BEGIN { printf \"%.3f\", $end - $start }") s: $(ls "${BENCHDIR}" | wc -l) files"
+}
+
+per_exec() {
+    i=1
+    while [ $i -le "${NUMFILES}" ]
+    do
+        "${WRITER}" "${BENCHDIR}/f$i.txt" "${WRITESTR}"
+        i=$((i + 1))
+    done
+}
+
+# The manifest is generated up front so only the writing is timed
+seq 1 "${NUMFILES}" | awk -v dir="${BENCHDIR}" -v str="${WRITESTR}" \
+    '{ printf "%s/f%d.txt\t%s\n", dir, $1, str }' > "${BENCHDIR}.manifest"
+
+run "per exec  " per_exec
+run "writer -b " "${WRITER}" -b "${BENCHDIR}.manifest"
+run "writer -b -j1" "${WRITER}" -b -j 1 "${BENCHDIR}.manifest"
+
+rm -rf "${BENCHDIR}" "${BENCHDIR}.manifest"
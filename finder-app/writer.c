@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <syslog.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -5,43 +6,607 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
-int main(int argc, char *argv[]) {
-    openlog("writer", LOG_PID, LOG_USER);
+/* Payloads at least this large are written with O_DIRECT in batch mode */
+#define DIRECT_IO_THRESHOLD (1024 * 1024)
+#define DIRECT_IO_ALIGN     4096
+#define MAX_THREADS         256
+/* Chunk size for streaming copies when the kernel cannot copy for us */
+#define STREAM_CHUNK        (1024 * 1024)
 
-    if (argc != 3) {
-        syslog(LOG_ERR, "Invalid arguments: expected <file> <string>");
-        closelog();
-        return 1;
+/**
+ * One file to create in batch mode
+ */
+struct batch_item {
+    char *path;
+    char *content;
+    size_t len;
+};
+
+struct batch {
+    struct batch_item *items;
+    size_t count;
+    size_t capacity;
+    /* Index of the next item a worker should write */
+    atomic_size_t next;
+    atomic_size_t failed;
+    bool atomic;
+};
+
+/**
+ * Write @param len bytes of @param buf to @param fd, retrying partial writes
+ * @return 0 on success, -1 with errno set on error
+ */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += written;
+        len -= written;
     }
+    return 0;
+}
 
-    const char *writefile = argv[1];
-    const char *writestr  = argv[2];
+/**
+ * Write the block aligned part of @param content with O_DIRECT, bypassing the page cache, and the
+ * rest with a regular write.  Falls back to buffered writes if the filesystem rejects O_DIRECT
+ * @return 0 on success, -1 with errno set on error
+ */
+static int write_direct(int fd, const char *content, size_t len)
+{
+    size_t aligned_len = len - len % DIRECT_IO_ALIGN;
+    int flags = fcntl(fd, F_GETFL);
+    void *aligned;
+    int ret = 0;
 
-    syslog(LOG_DEBUG, "Writing \"%s\" to %s", writestr, writefile);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_DIRECT) < 0)
+        return write_all(fd, content, len);
 
-    int fd = open(writefile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        syslog(LOG_ERR, "Error %s: %s is not opening", writefile, strerror(errno));
-        closelog();
-        return 1;
+    if (posix_memalign(&aligned, DIRECT_IO_ALIGN, aligned_len) != 0) {
+        fcntl(fd, F_SETFL, flags);
+        return write_all(fd, content, len);
+    }
+    memcpy(aligned, content, aligned_len);
+    ret = write_all(fd, aligned, aligned_len);
+    free(aligned);
+    if (ret < 0 && errno == EINVAL) {
+        // Not supported by this filesystem, start over with buffered writes
+        fcntl(fd, F_SETFL, flags);
+        if (lseek(fd, 0, SEEK_SET) < 0 || ftruncate(fd, 0) < 0)
+            return -1;
+        return write_all(fd, content, len);
     }
 
-    ssize_t written = write(fd, writestr, strlen(writestr));
-    if (written < 0) {
-        syslog(LOG_ERR, "Error writing to %s: %s", writefile, strerror(errno));
-        close(fd);
-        closelog();
-        return 1;
+    // The tail is not a multiple of the block size, so it cannot use O_DIRECT
+    if (ret == 0 && fcntl(fd, F_SETFL, flags) == 0)
+        ret = write_all(fd, content + aligned_len, len - aligned_len);
+    return ret;
+}
+
+/**
+ * A file being written, either in place or through a temporary file which replaces it on commit
+ */
+struct output {
+    const char *path;
+    /* Temporary file in the same directory as path, NULL when writing in place */
+    char *tmp_path;
+    int fd;
+};
+
+/**
+ * Open @param path for writing into @param out.  With @param atomic the data goes to a temporary
+ * file next to @param path, so readers see either the old or the complete new file
+ * @return 0 on success, -1 with errno set on error
+ */
+static int output_open(struct output *out, const char *path, bool atomic)
+{
+    int err;
+
+    out->path = path;
+    out->tmp_path = NULL;
+    if (!atomic) {
+        out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    } else if (asprintf(&out->tmp_path, "%s.XXXXXX", path) < 0) {
+        out->tmp_path = NULL;
+        out->fd = -1;
+        errno = ENOMEM;
+    } else {
+        mode_t mask = umask(0);
+
+        umask(mask);
+        out->fd = mkostemp(out->tmp_path, O_CLOEXEC);
+        // mkostemp creates the file 0600, give it the mode open() would have
+        if (out->fd >= 0 && fchmod(out->fd, 0644 & ~mask) < 0) {
+            err = errno;
+            close(out->fd);
+            unlink(out->tmp_path);
+            out->fd = -1;
+            errno = err;
+        }
     }
 
-    if (close(fd) < 0) {
-        syslog(LOG_ERR, "Error:  %s: %s is not closing", writefile, strerror(errno));
-        closelog();
-        return 1;
+    if (out->fd < 0) {
+        err = errno;
+        syslog(LOG_ERR, "Error %s: %s is not opening", path, strerror(err));
+        free(out->tmp_path);
+        errno = err;
+        return -1;
     }
+    return 0;
+}
 
-    closelog();
+/**
+ * Discard @param out after a failed write, removing any temporary file
+ */
+static void output_abort(struct output *out)
+{
+    int err = errno;
+
+    close(out->fd);
+    if (out->tmp_path) {
+        unlink(out->tmp_path);
+        free(out->tmp_path);
+    }
+    errno = err;
+}
+
+/**
+ * Close @param out.  A temporary file is flushed to disk and renamed over the destination
+ * @return 0 on success, -1 with errno set on error
+ */
+static int output_commit(struct output *out)
+{
+    int err;
+
+    if (out->tmp_path && fsync(out->fd) < 0) {
+        err = errno;
+        syslog(LOG_ERR, "Error writing to %s: %s", out->path, strerror(err));
+        output_abort(out);
+        errno = err;
+        return -1;
+    }
+
+    if (close(out->fd) < 0) {
+        err = errno;
+        syslog(LOG_ERR, "Error:  %s: %s is not closing", out->path, strerror(err));
+        if (out->tmp_path) {
+            unlink(out->tmp_path);
+            free(out->tmp_path);
+        }
+        errno = err;
+        return -1;
+    }
+
+    if (out->tmp_path) {
+        if (rename(out->tmp_path, out->path) < 0) {
+            err = errno;
+            syslog(LOG_ERR, "Error renaming %s to %s: %s", out->tmp_path, out->path, strerror(err));
+            unlink(out->tmp_path);
+            free(out->tmp_path);
+            errno = err;
+            return -1;
+        }
+        free(out->tmp_path);
+    }
     return 0;
 }
 
+/**
+ * Create or truncate @param path and write @param len bytes of @param content to it, logging any
+ * error against the file.  @param direct allows O_DIRECT for payloads of DIRECT_IO_THRESHOLD or more,
+ * @param atomic replaces the file through a temporary file
+ * @return 0 on success, -1 with errno set on error
+ */
+static int write_file(const char *path, const char *content, size_t len, bool direct, bool atomic)
+{
+    struct output out;
+    int ret, err;
+
+    syslog(LOG_DEBUG, "Writing %zu bytes to %s", len, path);
+
+    if (output_open(&out, path, atomic) < 0)
+        return -1;
+
+    if (direct && len >= DIRECT_IO_THRESHOLD)
+        ret = write_direct(out.fd, content, len);
+    else
+        ret = write_all(out.fd, content, len);
+    if (ret < 0) {
+        err = errno;
+        syslog(LOG_ERR, "Error writing to %s: %s", path, strerror(err));
+        output_abort(&out);
+        errno = err;
+        return -1;
+    }
+
+    return output_commit(&out);
+}
+
+/**
+ * Copy @param in_fd to @param out_fd through a user space buffer, the fallback for every other copy
+ * @return the number of bytes copied, -1 with errno set on error
+ */
+static off_t copy_read_write(int out_fd, int in_fd)
+{
+    char *buf = malloc(STREAM_CHUNK);
+    off_t total = 0;
+
+    if (!buf)
+        return -1;
+    for (;;) {
+        ssize_t len = read(in_fd, buf, STREAM_CHUNK);
+
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len <= 0 || write_all(out_fd, buf, len) < 0) {
+            int err = errno;
+
+            free(buf);
+            errno = err;
+            return len == 0 ? total : -1;
+        }
+        total += len;
+    }
+}
+
+/**
+ * Whether a copy_file_range() or splice() error means the file pair is not supported by the call,
+ * rather than an I/O error
+ */
+static bool copy_unsupported(int err)
+{
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+}
+
+/**
+ * Copy the regular file @param in_fd from its current offset to @param out_fd with
+ * copy_file_range(), which lets the filesystem share or copy the blocks without user space
+ * @return the number of bytes copied, -1 with errno set on error
+ */
+static off_t copy_file(int out_fd, int in_fd)
+{
+    off_t total = 0;
+
+    for (;;) {
+        ssize_t len = copy_file_range(in_fd, NULL, out_fd, NULL, STREAM_CHUNK * 64, 0);
+
+        if (len == 0)
+            return total;
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (!copy_unsupported(errno))
+                return -1;
+            // Both offsets have advanced past what was copied so far, carry on from there
+            len = copy_read_write(out_fd, in_fd);
+            return len < 0 ? -1 : total + len;
+        }
+        total += len;
+    }
+}
+
+/**
+ * Move the pipe @param in_fd to @param out_fd with splice(), avoiding a copy through user space
+ * @return the number of bytes copied, -1 with errno set on error
+ */
+static off_t copy_pipe(int out_fd, int in_fd)
+{
+    off_t total = 0;
+
+    for (;;) {
+        ssize_t len = splice(in_fd, NULL, out_fd, NULL, STREAM_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (len == 0)
+            return total;
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (!copy_unsupported(errno))
+                return -1;
+            len = copy_read_write(out_fd, in_fd);
+            return len < 0 ? -1 : total + len;
+        }
+        total += len;
+    }
+}
+
+/**
+ * Create or truncate @param path with the contents read from @param in_fd until end of file.
+ * Regular files are preallocated and copied with copy_file_range(), pipes are spliced and anything
+ * else is read and written.  @param atomic replaces the file through a temporary file
+ * @return 0 on success, -1 with errno set on error
+ */
+static int stream_file(const char *path, int in_fd, bool atomic)
+{
+    struct output out;
+    struct stat st;
+    off_t copied, size = -1;
+    int err;
+
+    if (fstat(in_fd, &st) < 0) {
+        syslog(LOG_ERR, "Error reading input for %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (S_ISREG(st.st_mode)) {
+        off_t pos = lseek(in_fd, 0, SEEK_CUR);
+
+        if (pos >= 0 && pos <= st.st_size)
+            size = st.st_size - pos;
+    }
+    syslog(LOG_DEBUG, "Streaming %jd bytes to %s", (intmax_t)size, path);
+
+    if (output_open(&out, path, atomic) < 0)
+        return -1;
+
+    // Reserve the blocks up front so a full disk fails now and the file is not fragmented
+    if (size > 0 && fallocate(out.fd, 0, 0, size) < 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+        err = errno;
+        syslog(LOG_ERR, "Error allocating %jd bytes for %s: %s", (intmax_t)size, path, strerror(err));
+        output_abort(&out);
+        errno = err;
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode))
+        copied = copy_file(out.fd, in_fd);
+    else if (S_ISFIFO(st.st_mode))
+        copied = copy_pipe(out.fd, in_fd);
+    else
+        copied = copy_read_write(out.fd, in_fd);
+
+    // Drop any preallocated space the input did not fill, in case it shrank while being copied
+    if (copied < 0 || (size > 0 && copied != size && ftruncate(out.fd, copied) < 0)) {
+        err = errno;
+        syslog(LOG_ERR, "Error writing to %s: %s", path, strerror(err));
+        output_abort(&out);
+        errno = err;
+        return -1;
+    }
+
+    return output_commit(&out);
+}
+
+/**
+ * Decode the escapes \n, \t and \\ of a manifest line in place
+ * @return the decoded length
+ */
+static size_t unescape(char *str)
+{
+    char *in = str, *out = str;
+
+    while (*in) {
+        if (in[0] == '\\' && in[1]) {
+            in++;
+            *out++ = *in == 'n' ? '\n' : *in == 't' ? '\t' : *in;
+            in++;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+    return out - str;
+}
+
+/**
+ * Read the manifest @param manifest into @param batch: one file per line, the path, a tab, then the
+ * content, both with \n, \t and \\ escapes.  Lines without a tab are logged and counted as failures
+ * @return 0 on success, -1 if the manifest cannot be read
+ */
+static int read_manifest(FILE *manifest, struct batch *batch)
+{
+    char *line = NULL;
+    size_t line_capacity = 0, lineno = 0;
+    ssize_t line_len;
+
+    while ((line_len = getline(&line, &line_capacity, manifest)) >= 0) {
+        struct batch_item *item;
+        char *tab;
+
+        lineno++;
+        if (line_len > 0 && line[line_len - 1] == '\n')
+            line[--line_len] = '\0';
+        if (line_len == 0)
+            continue;
+
+        tab = strchr(line, '\t');
+        if (!tab) {
+            syslog(LOG_ERR, "Manifest line %zu: expected <file><TAB><string>", lineno);
+            fprintf(stderr, "writer: manifest line %zu: expected <file><TAB><string>\n", lineno);
+            atomic_fetch_add(&batch->failed, 1);
+            continue;
+        }
+        *tab = '\0';
+
+        if (batch->count == batch->capacity) {
+            size_t capacity = batch->capacity ? batch->capacity * 2 : 1024;
+            struct batch_item *items = realloc(batch->items, capacity * sizeof(*items));
+
+            if (!items) {
+                syslog(LOG_ERR, "Out of memory reading manifest");
+                free(line);
+                return -1;
+            }
+            batch->items = items;
+            batch->capacity = capacity;
+        }
+        item = &batch->items[batch->count];
+        item->path = strdup(line);
+        item->content = strdup(tab + 1);
+        if (!item->path || !item->content) {
+            syslog(LOG_ERR, "Out of memory reading manifest");
+            free(item->path);
+            free(item->content);
+            free(line);
+            return -1;
+        }
+        unescape(item->path);
+        item->len = unescape(item->content);
+        batch->count++;
+    }
+
+    free(line);
+    if (ferror(manifest)) {
+        syslog(LOG_ERR, "Error reading manifest: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void *batch_worker(void *arg)
+{
+    struct batch *batch = arg;
+    size_t index;
+
+    while ((index = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        struct batch_item *item = &batch->items[index];
+
+        if (write_file(item->path, item->content, item->len, true, batch->atomic) < 0) {
+            fprintf(stderr, "writer: %s: %s\n", item->path, strerror(errno));
+            atomic_fetch_add(&batch->failed, 1);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Create every file listed in @param manifest_path ("-" for stdin) using @param threads threads,
+ * through temporary files with @param atomic
+ * @return the process exit status, 1 if any file failed
+ */
+static int run_batch(const char *manifest_path, unsigned int threads, bool atomic)
+{
+    struct batch batch = { .atomic = atomic };
+    pthread_t tids[MAX_THREADS];
+    FILE *manifest = stdin;
+    unsigned int started = 0, t;
+    size_t i;
+    int ret;
+
+    if (strcmp(manifest_path, "-") != 0) {
+        manifest = fopen(manifest_path, "r");
+        if (!manifest) {
+            syslog(LOG_ERR, "Error %s: %s is not opening", manifest_path, strerror(errno));
+            return 1;
+        }
+    }
+    ret = read_manifest(manifest, &batch);
+    if (manifest != stdin)
+        fclose(manifest);
+
+    if (ret == 0) {
+        if (threads > batch.count)
+            threads = batch.count ? batch.count : 1;
+        for (t = 1; t < threads; t++) {
+            if (pthread_create(&tids[started], NULL, batch_worker, &batch) != 0)
+                break;
+            started++;
+        }
+        // The main thread works too, so a failed pthread_create only costs parallelism
+        batch_worker(&batch);
+        for (t = 0; t < started; t++)
+            pthread_join(tids[t], NULL);
+        syslog(LOG_INFO, "Batch of %zu files written, %zu failed", batch.count, atomic_load(&batch.failed));
+    }
+
+    for (i = 0; i < batch.count; i++) {
+        free(batch.items[i].path);
+        free(batch.items[i].content);
+    }
+    free(batch.items);
+    return ret == 0 && atomic_load(&batch.failed) == 0 ? 0 : 1;
+}
+
+static void usage(void)
+{
+    syslog(LOG_ERR, "Invalid arguments: expected <file> <string>, [-t] [-c source] <file> "
+           "or -b [-t] [-j threads] [manifest]");
+}
+
+int main(int argc, char *argv[]) {
+    openlog("writer", LOG_PID, LOG_USER);
+
+    if (argc == 3 && (argv[1][0] != '-' || argv[1][1] == '\0')) {
+        const char *writefile = argv[1];
+        const char *writestr  = argv[2];
+        int ret = write_file(writefile, writestr, strlen(writestr), false, false);
+
+        closelog();
+        return ret < 0 ? 1 : 0;
+    }
+
+    // Options are only parsed when the first argument is one, so any <string> can still be written
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int threads = nr_cpus > 0 ? nr_cpus : 1;
+    const char *source = NULL;
+    bool batch = false, atomic = false;
+    int opt, ret;
+
+    if (argc == 1 || argv[1][0] != '-' || argv[1][1] == '\0')
+        goto invalid;
+    while ((opt = getopt(argc, argv, "+bc:j:t")) != -1) {
+        switch (opt) {
+        case 'b':
+            batch = true;
+            break;
+        case 'c':
+            source = optarg;
+            break;
+        case 'j':
+            threads = strtoul(optarg, NULL, 0);
+            if (threads < 1)
+                goto invalid;
+            break;
+        case 't':
+            atomic = true;
+            break;
+        default:
+            goto invalid;
+        }
+    }
+
+    if (batch) {
+        if (source || argc - optind > 1)
+            goto invalid;
+        if (threads > MAX_THREADS)
+            threads = MAX_THREADS;
+        ret = run_batch(optind < argc ? argv[optind] : "-", threads, atomic);
+    } else if (argc - optind == 2 && !source) {
+        ret = write_file(argv[optind], argv[optind + 1], strlen(argv[optind + 1]), false, atomic) < 0;
+    } else if (argc - optind == 1) {
+        int in_fd = STDIN_FILENO;
+
+        if (source && strcmp(source, "-") != 0) {
+            in_fd = open(source, O_RDONLY | O_CLOEXEC);
+            if (in_fd < 0) {
+                syslog(LOG_ERR, "Error %s: %s is not opening", source, strerror(errno));
+                closelog();
+                return 1;
+            }
+        }
+        ret = stream_file(argv[optind], in_fd, atomic) < 0;
+        if (in_fd != STDIN_FILENO)
+            close(in_fd);
+    } else {
+        goto invalid;
+    }
+
+    closelog();
+    return ret;
+
+invalid:
+    usage();
+    closelog();
+    return 1;
+}
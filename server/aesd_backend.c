@@ -0,0 +1,174 @@
+/**
+ * @file aesd_backend.c
+ * @brief The storage backends of aesdsocket, see aesd_backend.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "aesd_backend.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "aesd_log.h"
+#include "../aesd-char-driver/aesdchar_emu.h"
+
+static int start_nothing(const struct aesd_backend_options *options)
+{
+    (void)options;
+    return 0;
+}
+
+/**
+ * Check the device at @param options->path can be opened, so a missing driver fails at startup
+ */
+static int start_chardev(const struct aesd_backend_options *options)
+{
+    int fd = open(options->path, O_RDWR);
+
+    if (fd < 0)
+        return -1;
+    close(fd);
+    return 0;
+}
+
+static void stop_nothing(const struct aesd_backend_options *options)
+{
+    (void)options;
+}
+
+/**
+ * Create the file at @param options->path with @param open_fn, emptying it unless options->keep_data
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int start_file_with(int (*open_fn)(const char *, int, ...), int (*close_fn)(int),
+                           const struct aesd_backend_options *options)
+{
+    int fd = open_fn(options->path, O_CREAT | O_RDWR | (options->keep_data ? 0 : O_TRUNC), 0666);
+
+    if (fd < 0)
+        return -1;
+    close_fn(fd);
+    return 0;
+}
+
+static int start_file(const struct aesd_backend_options *options)
+{
+    return start_file_with(open, close, options);
+}
+
+static void stop_file(const struct aesd_backend_options *options)
+{
+    if (!options->keep_data)
+        remove(options->path);
+}
+
+static int start_log(const struct aesd_backend_options *options)
+{
+    struct aesd_log_stats stats;
+
+    aesd_log_set_compress(options->compress);
+    if (start_file_with(aesd_log_open, aesd_log_close, options) < 0)
+        return -1;
+    if (options->keep_data) {
+        aesd_log_get_stats(&stats);
+        syslog(LOG_INFO, "Recovered %llu bytes from %s, truncated %llu bytes of torn records",
+               (unsigned long long)stats.raw_bytes, options->path, (unsigned long long)stats.truncated_bytes);
+    }
+    return 0;
+}
+
+static void stop_log(const struct aesd_backend_options *options)
+{
+    aesd_log_reset();
+    stop_file(options);
+}
+
+static void stop_memory(const struct aesd_backend_options *options)
+{
+    (void)options;
+    aesd_emu_reset();
+}
+
+static const struct aesd_backend chardev_backend = {
+    .name = "chardev",
+    .default_path = "/dev/aesdchar",
+    .start = start_chardev,
+    .stop = stop_nothing,
+    .open = open,
+    .close = close,
+    .read = read,
+    .write = write,
+    .lseek = lseek,
+    .ioctl = ioctl,
+    .fsync = fsync,
+};
+
+static const struct aesd_backend memory_backend = {
+    .name = "memory",
+    .default_path = "aesdchar_emu",
+    .start = start_nothing,
+    .stop = stop_memory,
+    .open = aesd_emu_open,
+    .close = aesd_emu_close,
+    .read = aesd_emu_read,
+    .write = aesd_emu_write,
+    .lseek = aesd_emu_lseek,
+    .ioctl = aesd_emu_ioctl,
+    .fsync = aesd_emu_fsync,
+};
+
+static const struct aesd_backend file_backend = {
+    .name = "file",
+    .default_path = "/var/tmp/aesdsocketdata",
+    .stable_offsets = true,
+    .is_file = true,
+    .start = start_file,
+    .stop = stop_file,
+    .open = open,
+    .close = close,
+    .read = read,
+    .write = write,
+    .lseek = lseek,
+    .ioctl = ioctl,
+    .fsync = fsync,
+};
+
+static const struct aesd_backend log_backend = {
+    .name = "log",
+    .default_path = "/var/tmp/aesdsocketdata",
+    .stable_offsets = true,
+    .is_file = true,
+    .start = start_log,
+    .stop = stop_log,
+    .open = aesd_log_open,
+    .close = aesd_log_close,
+    .read = aesd_log_read,
+    .write = aesd_log_write,
+    .lseek = aesd_log_lseek,
+    .ioctl = aesd_log_ioctl,
+    .fsync = aesd_log_fsync,
+};
+
+const struct aesd_backend *const aesd_backends[] = {
+    &chardev_backend,
+    &memory_backend,
+    &file_backend,
+    &log_backend,
+    NULL,
+};
+
+const struct aesd_backend *aesd_backend_find(const char *name)
+{
+    size_t i;
+
+    for (i = 0; aesd_backends[i]; i++) {
+        if (strcmp(aesd_backends[i]->name, name) == 0)
+            return aesd_backends[i];
+    }
+    return NULL;
+}
@@ -0,0 +1,79 @@
+/*
+ * aesd_backend.h
+ *
+ *  @brief Storage backends aesdsocket keeps its data in, chosen at startup
+ *
+ *  Every backend is a table of calls with the conventions of the POSIX calls
+ *  on /dev/aesdchar, so aesdsocket serves all of them the same way and one
+ *  binary can run any, selected by name.  Callers open a descriptor once per
+ *  connection and keep it, positioning it with lseek() or the
+ *  AESDCHAR_IOCSEEKTO ioctl before each read, rather than reopening the path
+ *  for every packet.
+ *
+ *  "chardev"  /dev/aesdchar, the aesdchar kernel driver
+ *  "memory"   the in-process emulation of the driver, aesdchar_emu.h
+ *  "file"     a plain file appended to and read with the POSIX calls
+ *  "log"      a file of checksummed records grouped into optionally
+ *             compressed segments, aesd_log.h, recovered after a crash
+ */
+
+#ifndef AESD_BACKEND_H
+#define AESD_BACKEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+struct aesd_backend_options {
+    /* Where the data is kept, NULL for the default_path of the backend */
+    const char *path;
+    /* Keep data already stored at startup and leave it behind on stop */
+    bool keep_data;
+    /* Compress the segments of "log" */
+    bool compress;
+};
+
+struct aesd_backend {
+    const char *name;
+    const char *default_path;
+    /**
+     * Offsets only grow as data is appended, so a reply may be read in pieces between appends.
+     * The device backends instead shift every offset as a write pushes out the oldest command
+     */
+    bool stable_offsets;
+    /**
+     * The data is a file, which aesdsocket appends a timestamp line to periodically
+     */
+    bool is_file;
+    /**
+     * Prepare the storage at @param options->path before any open
+     * @return 0 on success, -1 with errno set on failure
+     */
+    int (*start)(const struct aesd_backend_options *options);
+    /**
+     * Release the storage once every descriptor is closed, removing it unless options->keep_data
+     */
+    void (*stop)(const struct aesd_backend_options *options);
+    int (*open)(const char *path, int flags, ...);
+    int (*close)(int fd);
+    ssize_t (*read)(int fd, void *buf, size_t count);
+    ssize_t (*write)(int fd, const void *buf, size_t count);
+    off_t (*lseek)(int fd, off_t offset, int whence);
+    /**
+     * Requests of aesd_ioctl.h, failing with ENOTTY on the file backends
+     */
+    int (*ioctl)(int fd, unsigned long request, ...);
+    int (*fsync)(int fd);
+};
+
+/**
+ * Every backend, terminated by NULL
+ */
+extern const struct aesd_backend *const aesd_backends[];
+
+/**
+ * @return the backend called @param name, NULL if there is none
+ */
+const struct aesd_backend *aesd_backend_find(const char *name);
+
+#endif /* AESD_BACKEND_H */
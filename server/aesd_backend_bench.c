@@ -0,0 +1,160 @@
+/**
+ * @file aesd_backend_bench.c
+ * @brief Side by side cost of the aesdsocket storage backends
+ *
+ * Usage: aesd_backend_bench [-n packets] [-s size] [-z] [backend...]
+ * Appends @param packets (default 10000) newline terminated packets of @param size bytes (default
+ * 64) to each backend, all of aesd_backend.h by default, the way aesdsocket does for every packet
+ * received: a write and an fsync on the descriptor the connection keeps open.  The same appends
+ * reopening the backend for every packet, as aesdsocket used to, show what the persistent
+ * descriptor saves.  Reading all the data back from the start, as the reply to each packet does,
+ * is timed last.  File backends write /var/tmp/aesd_backend_bench.data, the log compressed with -z.
+ * A backend that cannot be started, "chardev" without the driver loaded, is skipped.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "aesd_backend.h"
+
+#define FILE_PATH "/var/tmp/aesd_backend_bench.data"
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Append @param packets copies of the @param size bytes @param packet through @param backend,
+ * opening it once or for every packet as @param reopen says
+ * @return packets per second, or -1 on error
+ */
+static double run_appends(const struct aesd_backend *backend, const char *path, const char *packet,
+                          size_t size, unsigned long packets, bool reopen)
+{
+    double start = now_s();
+    unsigned long i;
+    int fd = -1;
+
+    for (i = 0; i < packets; i++) {
+        if (fd < 0 && (fd = backend->open(path, O_RDWR | O_APPEND)) < 0)
+            return -1;
+        if (backend->write(fd, packet, size) != (ssize_t)size)
+            break;
+        backend->fsync(fd);
+        if (reopen) {
+            backend->close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0)
+        backend->close(fd);
+    return i == packets ? packets / (now_s() - start) : -1;
+}
+
+/**
+ * Read everything @param backend holds from the start, @param rounds times
+ * @return megabytes per second, or -1 on error
+ */
+static double run_readback(const struct aesd_backend *backend, const char *path, unsigned rounds)
+{
+    static char buf[64 * 1024];
+    double start = now_s(), total = 0;
+    int fd = backend->open(path, O_RDONLY);
+    ssize_t n = 0;
+    unsigned i;
+
+    if (fd < 0)
+        return -1;
+    for (i = 0; i < rounds && n >= 0; i++) {
+        if (backend->lseek(fd, 0, SEEK_SET) != 0)
+            n = -1;
+        while (n >= 0 && (n = backend->read(fd, buf, sizeof(buf))) > 0)
+            total += n;
+    }
+    backend->close(fd);
+    return n < 0 ? -1 : total / (now_s() - start) / 1e6;
+}
+
+static void run_backend(const struct aesd_backend *backend, const char *packet, size_t size,
+                        unsigned long packets, bool compress)
+{
+    struct aesd_backend_options options = {
+        .path = backend->is_file ? FILE_PATH : backend->default_path,
+        .compress = compress,
+    };
+    double persistent, reopened, readback;
+
+    if (backend->start(&options) < 0) {
+        printf("%-10s skipped, %s: %s\n", backend->name, options.path, strerror(errno));
+        return;
+    }
+    persistent = run_appends(backend, options.path, packet, size, packets, false);
+    reopened = run_appends(backend, options.path, packet, size, packets, true);
+    readback = run_readback(backend, options.path, 10);
+    if (persistent < 0 || reopened < 0 || readback < 0)
+        printf("%-10s failed: %s\n", backend->name, strerror(errno));
+    else
+        printf("%-10s %14.0f %14.0f %14.1f\n", backend->name, persistent, reopened, readback);
+    backend->stop(&options);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long packets = 10000;
+    size_t i, size = 64;
+    bool compress = false;
+    char *packet;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:z")) != -1) {
+        switch (opt) {
+        case 'n':
+            packets = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            compress = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n packets] [-s size] [-z] [backend...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (size == 0 || !(packet = malloc(size))) {
+        fprintf(stderr, "Invalid packet size %zu\n", size);
+        return 1;
+    }
+    for (i = 0; i < size; i++)
+        packet[i] = 'a' + i % 26;
+    packet[size - 1] = '\n';
+
+    printf("%zu byte packets, %lu per run\n", size, packets);
+    printf("%-10s %14s %14s %14s\n", "backend", "packets/s", "reopen pkts/s", "readback MB/s");
+    if (optind == argc) {
+        for (i = 0; aesd_backends[i]; i++)
+            run_backend(aesd_backends[i], packet, size, packets, compress);
+    }
+    for (; optind < argc; optind++) {
+        const struct aesd_backend *backend = aesd_backend_find(argv[optind]);
+
+        if (backend)
+            run_backend(backend, packet, size, packets, compress);
+        else
+            fprintf(stderr, "Unknown backend %s\n", argv[optind]);
+    }
+    free(packet);
+    return 0;
+}
@@ -0,0 +1,224 @@
+/**
+ * @file aesd_compress_bench.c
+ * @brief Compression ratio and CPU cost of the block compressed aesdsocket data file
+ *
+ * Usage: aesd_compress_bench [-m megabytes] [-r reads] [file]
+ * Compresses @param file, a copy of /var/tmp/aesdsocketdata or any other sample, or by default
+ * @param megabytes (default 16) of the data aesdsocket stores: short newline terminated packets
+ * like those of the assignment tests with a timestamp line every few packets.  For each block size
+ * it reports the compression ratio and speed, then writes the data through aesd_log and times
+ * @param reads (default 10000) reads of 64 bytes at random offsets, each of which has to
+ * decompress its block.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "aesd_lz4.h"
+#include "aesd_log.h"
+
+#define LOG_PATH  "/tmp/aesd_compress_bench.data"
+#define READ_SIZE 64
+
+static const size_t block_sizes[] = { 4096, 16384, 65536, 262144, 1048576 };
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Fill @param data with @param len bytes of packets and timestamps as aesdsocket would store them
+ */
+static void make_workload(char *data, size_t len)
+{
+    static const char *const words[] = { "swrite", "abcdef", "AESD", "writer", "sensor", "test" };
+    time_t t = 1791000000;
+    size_t pos = 0, packet = 0;
+
+    while (pos < len) {
+        char line[128];
+        int n;
+
+        if (packet % 8 == 0) {
+            struct tm tm;
+
+            t += 10;
+            gmtime_r(&t, &tm);
+            n = strftime(line, sizeof(line), "timestamp:%a, %d %b %Y %T %z\n", &tm);
+        } else {
+            n = snprintf(line, sizeof(line), "%s%zu value=%d\n", words[rand() % 6], packet, rand() % 1000);
+        }
+        if ((size_t)n > len - pos)
+            n = len - pos;
+        memcpy(data + pos, line, n);
+        pos += n;
+        packet++;
+    }
+}
+
+static int load_file(const char *path, char **data, size_t *len)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    *len = st.st_size;
+    *data = malloc(*len ? *len : 1);
+    if (!*data || read(fd, *data, *len) != (ssize_t)*len) {
+        perror(path);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/**
+ * Compress and decompress @param data block by block
+ * @return 0 on success, -1 if a block did not round trip
+ */
+static int run_codec(const char *data, size_t len, size_t block_size, char *compressed, char *out)
+{
+    size_t pos, stored = 0;
+    double start, compress_s, decompress_s;
+    size_t *block_len = malloc((len / block_size + 1) * sizeof(*block_len));
+    size_t bound = aesd_lz4_compress_bound(block_size), i;
+
+    start = now_s();
+    for (pos = 0, i = 0; pos < len; pos += block_size, i++) {
+        size_t n = len - pos < block_size ? len - pos : block_size;
+        ssize_t c = aesd_lz4_compress(data + pos, n, compressed + stored, bound);
+
+        if (c < 0)
+            return -1;
+        block_len[i] = c;
+        stored += c;
+    }
+    compress_s = now_s() - start;
+
+    start = now_s();
+    stored = 0;
+    for (pos = 0, i = 0; pos < len; pos += block_size, i++) {
+        size_t n = len - pos < block_size ? len - pos : block_size;
+
+        if (aesd_lz4_decompress(compressed + stored, block_len[i], out + pos, n) != (ssize_t)n)
+            return -1;
+        stored += block_len[i];
+    }
+    decompress_s = now_s() - start;
+    free(block_len);
+    if (memcmp(data, out, len) != 0)
+        return -1;
+
+    printf("%10zu %8.2f %14.0f %16.0f", block_size, (double)len / stored,
+           len / compress_s / 1e6, len / decompress_s / 1e6);
+    return 0;
+}
+
+/**
+ * Store @param data through aesd_log with @param block_size blocks and time @param reads random reads
+ * @return 0 on success, -1 on error
+ */
+static int run_log(const char *data, size_t len, size_t block_size, size_t reads)
+{
+    struct aesd_log_stats stats;
+    char buf[READ_SIZE];
+    double start;
+    size_t i;
+    int fd;
+
+    aesd_log_reset();
+    aesd_log_set_block_size(block_size);
+    aesd_log_set_compress(true);
+    fd = aesd_log_open(LOG_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || aesd_log_write(fd, data, len) != (ssize_t)len) {
+        perror("aesd_log");
+        return -1;
+    }
+    start = now_s();
+    for (i = 0; i < reads; i++) {
+        off_t offset = ((size_t)rand() * RAND_MAX + rand()) % (len - READ_SIZE);
+
+        if (aesd_log_lseek(fd, offset, SEEK_SET) != offset ||
+            aesd_log_read(fd, buf, READ_SIZE) != READ_SIZE || memcmp(buf, data + offset, READ_SIZE) != 0) {
+            fprintf(stderr, "aesd_log read at %lld failed\n", (long long)offset);
+            return -1;
+        }
+    }
+    start = now_s() - start;
+    aesd_log_get_stats(&stats);
+    printf(" %12.2f %14.1f\n", (double)stats.raw_bytes / stats.stored_bytes, start / reads * 1e6);
+    aesd_log_close(fd);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = 16, reads = 10000, len, i;
+    char *data, *compressed, *out;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:r:")) != -1) {
+        switch (opt) {
+        case 'm':
+            megabytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            reads = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-m megabytes] [-r reads] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        if (load_file(argv[optind], &data, &len) < 0)
+            return 1;
+    } else {
+        len = megabytes * 1024 * 1024;
+        data = malloc(len);
+        if (!data)
+            return 1;
+        make_workload(data, len);
+    }
+    if (len <= READ_SIZE) {
+        fprintf(stderr, "Need more than %d bytes of data\n", READ_SIZE);
+        return 1;
+    }
+    compressed = malloc(aesd_lz4_compress_bound(len) + len / block_sizes[0] * 16);
+    out = malloc(len);
+    if (!compressed || !out)
+        return 1;
+
+    printf("bytes %zu reads %zu\n", len, reads);
+    printf("%10s %8s %14s %16s %12s %14s\n", "block", "ratio", "compress_MB_s", "decompress_MB_s",
+           "file_ratio", "read_us");
+    for (i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+        if (run_codec(data, len, block_sizes[i], compressed, out) < 0) {
+            fprintf(stderr, "Round trip failed with %zu byte blocks\n", block_sizes[i]);
+            return 1;
+        }
+        if (run_log(data, len, block_sizes[i], reads) < 0)
+            return 1;
+    }
+    aesd_log_reset();
+    unlink(LOG_PATH);
+    free(data);
+    free(compressed);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * aesd_crc32c.h
+ *
+ *  @brief CRC32C (Castagnoli) checksums of the aesdsocket data records
+ *
+ *  Uses the SSE4.2 crc32 instruction on x86-64 and the ARMv8 CRC32
+ *  extension on AArch64 when the CPU has them, a slice-by-8 table otherwise.
+ *  The choice is made once, on first use.
+ */
+
+#ifndef AESD_CRC32C_H
+#define AESD_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Extend @param crc, 0 to start or the result of a previous call, with @param len bytes of @param buf
+ * @return the CRC32C of all the bytes so far, aesd_crc32c(0, "123456789", 9) is 0xe3069283
+ */
+uint32_t aesd_crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * The table driven implementation, for comparison with the accelerated one
+ */
+uint32_t aesd_crc32c_sw(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * @return the name of the implementation aesd_crc32c() uses
+ */
+const char *aesd_crc32c_impl(void);
+
+#endif /* AESD_CRC32C_H */
@@ -0,0 +1,253 @@
+/**
+ * @file aesd_fanout.c
+ * @brief Reference counted fan-out of appended data to bounded subscriber queues, see aesd_fanout.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "aesd_fanout.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/queue.h>
+
+struct aesd_fanout_msg {
+    atomic_uint refs;
+    size_t len;
+    char data[];
+};
+
+struct aesd_fanout_sub {
+    LIST_ENTRY(aesd_fanout_sub) entries;
+    enum aesd_fanout_policy policy;
+    int event_fd;
+    /* Ring of max_msgs references, count of them from head queued */
+    struct aesd_fanout_msg **ring;
+    size_t head;
+    size_t count;
+    size_t bytes;
+    struct aesd_fanout_sub_stats stats;
+};
+
+struct aesd_fanout {
+    /* Protects the subscriber list and every queue */
+    pthread_mutex_t lock;
+    size_t max_msgs;
+    size_t max_bytes;
+    LIST_HEAD(, aesd_fanout_sub) subs;
+};
+
+struct aesd_fanout *aesd_fanout_create(size_t max_msgs, size_t max_bytes)
+{
+    struct aesd_fanout *fanout = calloc(1, sizeof(*fanout));
+
+    if (!fanout)
+        return NULL;
+    pthread_mutex_init(&fanout->lock, NULL);
+    fanout->max_msgs = max_msgs ? max_msgs : 1;
+    fanout->max_bytes = max_bytes;
+    LIST_INIT(&fanout->subs);
+    return fanout;
+}
+
+void aesd_fanout_destroy(struct aesd_fanout *fanout)
+{
+    pthread_mutex_destroy(&fanout->lock);
+    free(fanout);
+}
+
+void aesd_fanout_msg_put(struct aesd_fanout_msg *msg)
+{
+    if (atomic_fetch_sub_explicit(&msg->refs, 1, memory_order_acq_rel) == 1)
+        free(msg);
+}
+
+const void *aesd_fanout_msg_data(const struct aesd_fanout_msg *msg, size_t *len)
+{
+    *len = msg->len;
+    return msg->data;
+}
+
+/**
+ * Release everything queued on @param sub
+ */
+static void sub_clear(struct aesd_fanout *fanout, struct aesd_fanout_sub *sub)
+{
+    while (sub->count > 0) {
+        aesd_fanout_msg_put(sub->ring[sub->head]);
+        sub->head = (sub->head + 1) % fanout->max_msgs;
+        sub->count--;
+    }
+    sub->bytes = 0;
+}
+
+static void sub_wake(struct aesd_fanout_sub *sub)
+{
+    uint64_t one = 1;
+
+    // Only fails once the counter is about to overflow, when it is readable anyway
+    if (write(sub->event_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+struct aesd_fanout_sub *aesd_fanout_subscribe(struct aesd_fanout *fanout, enum aesd_fanout_policy policy)
+{
+    struct aesd_fanout_sub *sub = calloc(1, sizeof(*sub));
+
+    if (!sub)
+        return NULL;
+    sub->ring = calloc(fanout->max_msgs, sizeof(*sub->ring));
+    sub->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!sub->ring || sub->event_fd < 0) {
+        int err = sub->ring ? errno : ENOMEM;
+
+        if (sub->event_fd >= 0)
+            close(sub->event_fd);
+        free(sub->ring);
+        free(sub);
+        errno = err;
+        return NULL;
+    }
+    sub->policy = policy;
+    pthread_mutex_lock(&fanout->lock);
+    LIST_INSERT_HEAD(&fanout->subs, sub, entries);
+    pthread_mutex_unlock(&fanout->lock);
+    return sub;
+}
+
+void aesd_fanout_unsubscribe(struct aesd_fanout *fanout, struct aesd_fanout_sub *sub)
+{
+    pthread_mutex_lock(&fanout->lock);
+    LIST_REMOVE(sub, entries);
+    pthread_mutex_unlock(&fanout->lock);
+    sub_clear(fanout, sub);
+    close(sub->event_fd);
+    free(sub->ring);
+    free(sub);
+}
+
+int aesd_fanout_sub_fd(const struct aesd_fanout_sub *sub)
+{
+    return sub->event_fd;
+}
+
+/**
+ * Queue @param msg on @param sub, applying its policy if that overflows the queue
+ * @return true if queued, false if @param sub is cut off
+ */
+static bool sub_push(struct aesd_fanout *fanout, struct aesd_fanout_sub *sub, struct aesd_fanout_msg *msg)
+{
+    while (!sub->stats.cut_off && sub->count > 0 &&
+           (sub->count == fanout->max_msgs || sub->bytes + msg->len > fanout->max_bytes)) {
+        struct aesd_fanout_msg *oldest = sub->ring[sub->head];
+
+        // What is queued still goes out, so the subscriber has everything up to the gap
+        if (sub->policy == AESD_FANOUT_DISCONNECT) {
+            sub->stats.cut_off = true;
+            break;
+        }
+        sub->stats.dropped++;
+        sub->stats.dropped_bytes += oldest->len;
+        sub->bytes -= oldest->len;
+        sub->head = (sub->head + 1) % fanout->max_msgs;
+        sub->count--;
+        aesd_fanout_msg_put(oldest);
+    }
+    if (sub->stats.cut_off) {
+        sub->stats.dropped++;
+        sub->stats.dropped_bytes += msg->len;
+        return false;
+    }
+    atomic_fetch_add_explicit(&msg->refs, 1, memory_order_relaxed);
+    sub->ring[(sub->head + sub->count) % fanout->max_msgs] = msg;
+    sub->count++;
+    sub->bytes += msg->len;
+    // A queue that was not empty already woke its reader, which drains it to empty before sleeping
+    if (sub->count == 1)
+        sub_wake(sub);
+    return true;
+}
+
+int aesd_fanout_publish(struct aesd_fanout *fanout, const void *data, size_t len)
+{
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+
+    return aesd_fanout_publishv(fanout, &iov, 1);
+}
+
+int aesd_fanout_publishv(struct aesd_fanout *fanout, const struct iovec *iov, int iovcnt)
+{
+    struct aesd_fanout_msg *msg;
+    struct aesd_fanout_sub *sub;
+    size_t len = 0;
+    int i, reached = 0;
+
+    for (i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    pthread_mutex_lock(&fanout->lock);
+    if (LIST_EMPTY(&fanout->subs) || len == 0) {
+        pthread_mutex_unlock(&fanout->lock);
+        return 0;
+    }
+    msg = malloc(sizeof(*msg) + len);
+    if (!msg) {
+        pthread_mutex_unlock(&fanout->lock);
+        return -1;
+    }
+    // The publisher holds one reference while queueing so no subscriber can free it meanwhile
+    atomic_init(&msg->refs, 1);
+    msg->len = 0;
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0)
+            continue;
+        memcpy(msg->data + msg->len, iov[i].iov_base, iov[i].iov_len);
+        msg->len += iov[i].iov_len;
+    }
+    LIST_FOREACH(sub, &fanout->subs, entries) {
+        if (sub_push(fanout, sub, msg))
+            reached++;
+    }
+    pthread_mutex_unlock(&fanout->lock);
+    aesd_fanout_msg_put(msg);
+    return reached;
+}
+
+struct aesd_fanout_msg *aesd_fanout_next(struct aesd_fanout *fanout, struct aesd_fanout_sub *sub, bool *cut_off)
+{
+    struct aesd_fanout_msg *msg = NULL;
+    uint64_t value;
+
+    pthread_mutex_lock(&fanout->lock);
+    *cut_off = false;
+    if (sub->count > 0) {
+        msg = sub->ring[sub->head];
+        sub->head = (sub->head + 1) % fanout->max_msgs;
+        sub->count--;
+        sub->bytes -= msg->len;
+        sub->stats.delivered++;
+        sub->stats.delivered_bytes += msg->len;
+    } else if (sub->stats.cut_off) {
+        *cut_off = true;
+    } else {
+        // Empty under the lock, the next publish wakes the reader again
+        if (read(sub->event_fd, &value, sizeof(value)) < 0)
+            value = 0;
+    }
+    pthread_mutex_unlock(&fanout->lock);
+    return msg;
+}
+
+void aesd_fanout_get_stats(struct aesd_fanout *fanout, const struct aesd_fanout_sub *sub,
+                           struct aesd_fanout_sub_stats *stats)
+{
+    pthread_mutex_lock(&fanout->lock);
+    *stats = sub->stats;
+    stats->queued = sub->count;
+    stats->queued_bytes = sub->bytes;
+    pthread_mutex_unlock(&fanout->lock);
+}
@@ -0,0 +1,115 @@
+/*
+ * aesd_fanout.h
+ *
+ *  @brief Fan-out of the data appended to aesdsocket to subscribed connections
+ *
+ *  Every publish copies the bytes once into a reference counted message and
+ *  queues a reference to it on each subscriber, so N subscribers cost one
+ *  copy and N pointers.  Each subscriber drains its own queue at its own
+ *  pace.  A queue holds at most the message and byte limits given to
+ *  aesd_fanout_create(), or a single message larger than the byte limit; a
+ *  publish that would overflow it either drops the oldest queued messages or
+ *  cuts the subscriber off after what it has queued, as the subscriber chose
+ *  when subscribing.  Publishers never wait for subscribers.
+ *
+ *  A subscriber is woken through a file descriptor, aesd_fanout_sub_fd(),
+ *  that polls readable whenever its queue goes from empty to non-empty, so it
+ *  can wait on its connection at the same time.
+ */
+
+#ifndef AESD_FANOUT_H
+#define AESD_FANOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+struct aesd_fanout;
+struct aesd_fanout_sub;
+struct aesd_fanout_msg;
+
+enum aesd_fanout_policy {
+    /**
+     * Make room by discarding the oldest queued messages, for readers that want the latest data
+     */
+    AESD_FANOUT_DROP_OLDEST,
+    /**
+     * Cut the subscriber off once it has taken what is queued, for readers that must see every
+     * byte up to where they stop
+     */
+    AESD_FANOUT_DISCONNECT,
+};
+
+struct aesd_fanout_sub_stats {
+    uint64_t delivered;
+    uint64_t delivered_bytes;
+    uint64_t dropped;
+    uint64_t dropped_bytes;
+    /* Messages and bytes queued now */
+    uint32_t queued;
+    uint32_t queued_bytes;
+    bool cut_off;
+};
+
+/**
+ * Create a fan-out whose subscribers queue at most @param max_msgs messages and @param max_bytes bytes
+ * @return the fan-out, NULL if out of memory
+ */
+struct aesd_fanout *aesd_fanout_create(size_t max_msgs, size_t max_bytes);
+
+/**
+ * Free @param fanout, which must have no subscribers left
+ */
+void aesd_fanout_destroy(struct aesd_fanout *fanout);
+
+/**
+ * Add a subscriber to @param fanout receiving everything published from now on
+ * @return the subscriber, NULL on failure with errno set
+ */
+struct aesd_fanout_sub *aesd_fanout_subscribe(struct aesd_fanout *fanout, enum aesd_fanout_policy policy);
+
+/**
+ * Remove @param sub from @param fanout, releasing what it still had queued
+ */
+void aesd_fanout_unsubscribe(struct aesd_fanout *fanout, struct aesd_fanout_sub *sub);
+
+/**
+ * @return a descriptor that polls readable when @param sub may have messages or was cut off.
+ *   aesd_fanout_next() clears it
+ */
+int aesd_fanout_sub_fd(const struct aesd_fanout_sub *sub);
+
+/**
+ * Queue @param len bytes of @param data to every subscriber of @param fanout
+ * @return the number of subscribers it was queued to, -1 if out of memory
+ */
+int aesd_fanout_publish(struct aesd_fanout *fanout, const void *data, size_t len);
+
+/**
+ * Queue the @param iovcnt buffers of @param iov to every subscriber of @param fanout as one message
+ * @return the number of subscribers it was queued to, -1 if out of memory
+ */
+int aesd_fanout_publishv(struct aesd_fanout *fanout, const struct iovec *iov, int iovcnt);
+
+/**
+ * Take the oldest message queued to @param sub, the reference to it passes to the caller
+ * @return the message, NULL if there is none, and *@param cut_off true if also none will come as
+ *   @param sub was cut off
+ */
+struct aesd_fanout_msg *aesd_fanout_next(struct aesd_fanout *fanout, struct aesd_fanout_sub *sub, bool *cut_off);
+
+/**
+ * @return the bytes of @param msg, storing their number in *@param len
+ */
+const void *aesd_fanout_msg_data(const struct aesd_fanout_msg *msg, size_t *len);
+
+/**
+ * Release a reference to @param msg, freeing it with the last
+ */
+void aesd_fanout_msg_put(struct aesd_fanout_msg *msg);
+
+void aesd_fanout_get_stats(struct aesd_fanout *fanout, const struct aesd_fanout_sub *sub,
+                           struct aesd_fanout_sub_stats *stats);
+
+#endif /* AESD_FANOUT_H */
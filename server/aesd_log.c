@@ -0,0 +1,859 @@
+/**
+ * @file aesd_log.c
+ * @brief Checksummed, optionally compressed storage of the aesdsocket data file
+ *
+ * The file is a run of records.  The data lives in segments, each either a
+ * run of DATA records or one BLOCK record; the last segment is the open run
+ * the next write appends to, also kept in memory.
+ *
+ * A full run is compressed without ever leaving the file in a state recovery
+ * cannot read: the BLOCK record is appended after the run and synced, then a
+ * SKIP record header is written over the run's first header and the rest of
+ * the run punched out of the file.  A crash before the SKIP header lands
+ * leaves a run followed by a BLOCK record holding the same data, which the
+ * scan recognises and finishes sealing.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "aesd_log.h"
+#include "aesd_lz4.h"
+#include "aesd_crc32c.h"
+
+#define AESD_LOG_MAX_FILES 1024
+/**
+ * Handles start here so they are never mistaken for, or closed as, real descriptors
+ */
+#define AESD_LOG_FD_BASE   (1 << 21)
+/* Bytes read at a time by the scan on open */
+#define AESD_LOG_SCAN_CHUNK (1024 * 1024)
+
+#define RECORD_HEADER_SIZE sizeof(struct aesd_log_record_header)
+
+struct aesd_log_segment {
+    off_t raw_offset;
+    /* Offset of the segment's first record in the file */
+    off_t file_offset;
+    uint32_t raw_len;
+    /* Bytes of its records, headers included */
+    uint32_t file_len;
+    /* One BLOCK record rather than a run of DATA records */
+    bool compressed;
+};
+
+struct aesd_log {
+    pthread_mutex_t lock;
+    /* The file, -1 until the first open loads it */
+    int fd;
+    size_t block_size;
+    bool compress;
+    struct aesd_log_segment *segments;
+    size_t nr_segments;
+    size_t segments_capacity;
+    /* Data bytes in the closed segments */
+    off_t sealed_raw;
+    /* End of the last valid record */
+    off_t file_end;
+    /* First record of the open run, file_end while it is empty */
+    off_t run_file_offset;
+    /* Data of the open run */
+    char *tail;
+    size_t tail_len;
+    size_t tail_capacity;
+    /* Records being written or read */
+    char *scratch;
+    size_t scratch_capacity;
+    /* Data of the closed segment last read, cache_segment is its index or -1 */
+    char *cache;
+    size_t cache_capacity;
+    ssize_t cache_segment;
+    /* Bytes covered by SKIP records */
+    uint64_t dead_bytes;
+    uint64_t nr_blocks;
+    uint64_t blocks_decompressed;
+    uint64_t truncated_bytes;
+};
+
+struct aesd_log_file {
+    bool used;
+    off_t pos;
+};
+
+static struct aesd_log aesd_log = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+    .block_size = AESD_LOG_DEFAULT_BLOCK_SIZE,
+    .cache_segment = -1,
+};
+
+static struct aesd_log_file aesd_log_files[AESD_LOG_MAX_FILES];
+
+static struct aesd_log_file *aesd_log_file_get(int fd)
+{
+    int idx = fd - AESD_LOG_FD_BASE;
+
+    if (idx < 0 || idx >= AESD_LOG_MAX_FILES || !aesd_log_files[idx].used) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &aesd_log_files[idx];
+}
+
+/**
+ * Grow *@param buf to at least @param size bytes, keeping its contents
+ * @return 0 on success, -1 with errno set if out of memory
+ */
+static int reserve(char **buf, size_t *capacity, size_t size)
+{
+    char *grown;
+
+    if (size <= *capacity)
+        return 0;
+    grown = realloc(*buf, size);
+    if (!grown) {
+        errno = ENOMEM;
+        return -1;
+    }
+    *buf = grown;
+    *capacity = size;
+    return 0;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t written = pwrite(fd, p, len, offset);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            return -1;
+        p += written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+/**
+ * Read up to @param len bytes at @param offset, fewer only at the end of the file
+ * @return the number of bytes read, -1 on error
+ */
+static ssize_t pread_full(int fd, void *buf, size_t len, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pread(fd, (char *)buf + done, len - done, offset + done);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static int pread_all(int fd, void *buf, size_t len, off_t offset)
+{
+    ssize_t n = pread_full(fd, buf, len, offset);
+
+    if (n >= 0 && (size_t)n != len)
+        errno = EIO;
+    return n >= 0 && (size_t)n == len ? 0 : -1;
+}
+
+/**
+ * @return the checksum of the record with @param header and the @param len payload bytes at @param payload
+ */
+static uint32_t record_crc(const struct aesd_log_record_header *header, const void *payload, size_t len)
+{
+    struct aesd_log_record_header zeroed = *header;
+
+    zeroed.crc = 0;
+    return aesd_crc32c(aesd_crc32c(0, &zeroed, sizeof(zeroed)), payload, len);
+}
+
+/**
+ * Decode and check the header at @param data, followed by @param avail bytes of its payload
+ * @return the payload length, or -1 if this is not a valid record or not all of it is available
+ */
+static ssize_t parse_record(const char *data, size_t avail, struct aesd_log_record_header *header)
+{
+    struct aesd_log_record_header raw;
+    size_t checked;
+
+    memcpy(&raw, data, sizeof(raw));
+    header->magic = le16toh(raw.magic);
+    header->type = le16toh(raw.type);
+    header->length = le32toh(raw.length);
+    header->crc = le32toh(raw.crc);
+    if (header->magic != AESD_LOG_MAGIC || header->type < AESD_LOG_RECORD_DATA ||
+        header->type > AESD_LOG_RECORD_SKIP)
+        return -1;
+    checked = header->type == AESD_LOG_RECORD_SKIP ? 0 : header->length;
+    if (checked > avail || record_crc(&raw, data + sizeof(raw), checked) != header->crc)
+        return -1;
+    return header->length;
+}
+
+/**
+ * Fill @param header for a record of @param type with the @param len payload bytes of @param iov
+ */
+static void make_header(struct aesd_log_record_header *header, uint16_t type, const struct iovec *iov,
+                        int iovcnt, size_t len)
+{
+    uint32_t crc;
+    int i;
+
+    header->magic = htole16(AESD_LOG_MAGIC);
+    header->type = htole16(type);
+    header->length = htole32(len);
+    header->crc = 0;
+    crc = aesd_crc32c(0, header, sizeof(*header));
+    for (i = 0; i < iovcnt; i++)
+        crc = aesd_crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+    header->crc = htole32(crc);
+}
+
+/**
+ * Append a record of @param type whose payload is @param iovcnt buffers at log->file_end
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int append_record(struct aesd_log *log, uint16_t type, const struct iovec *payload, int iovcnt)
+{
+    struct aesd_log_record_header header;
+    struct iovec iov[4];
+    size_t len = 0, total;
+    off_t offset = log->file_end;
+    int i, n = 1;
+
+    for (i = 0; i < iovcnt; i++) {
+        len += payload[i].iov_len;
+        iov[n++] = payload[i];
+    }
+    make_header(&header, type, payload, iovcnt, len);
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    total = sizeof(header) + len;
+
+    while (total > 0) {
+        ssize_t written = pwritev(log->fd, iov, n, offset);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            return -1;
+        offset += written;
+        total -= written;
+        // Skip the buffers written in full and the written part of the next one
+        for (i = 0; written > 0 && i < n; i++) {
+            size_t part = (size_t)written < iov[i].iov_len ? (size_t)written : iov[i].iov_len;
+
+            iov[i].iov_base = (char *)iov[i].iov_base + part;
+            iov[i].iov_len -= part;
+            written -= part;
+        }
+    }
+    log->file_end = offset;
+    return 0;
+}
+
+/**
+ * Turn the @param len bytes of records at @param offset into dead space, giving the disk blocks
+ * back to the file system where it supports hole punching
+ */
+static int write_skip(struct aesd_log *log, off_t offset, size_t len)
+{
+    struct aesd_log_record_header header;
+
+    make_header(&header, AESD_LOG_RECORD_SKIP, NULL, 0, len - sizeof(header));
+    if (pwrite_all(log->fd, &header, sizeof(header), offset) < 0)
+        return -1;
+    fallocate(log->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset + sizeof(header), len - sizeof(header));
+    log->dead_bytes += len;
+    return 0;
+}
+
+/**
+ * Make room in the index for one more segment, so adding it after changing the file cannot fail
+ * @return 0 on success, -1 with errno set if out of memory
+ */
+static int reserve_segment(struct aesd_log *log)
+{
+    size_t capacity = log->segments_capacity ? 2 * log->segments_capacity : 64;
+    struct aesd_log_segment *segments;
+
+    if (log->nr_segments < log->segments_capacity)
+        return 0;
+    segments = realloc(log->segments, capacity * sizeof(*segments));
+    if (!segments) {
+        errno = ENOMEM;
+        return -1;
+    }
+    log->segments = segments;
+    log->segments_capacity = capacity;
+    return 0;
+}
+
+/**
+ * Add a segment after those in the index, for which reserve_segment() made room
+ */
+static void add_segment(struct aesd_log *log, off_t file_offset, uint32_t file_len, uint32_t raw_len, bool compressed)
+{
+    struct aesd_log_segment *segment = &log->segments[log->nr_segments++];
+
+    segment->raw_offset = log->sealed_raw;
+    segment->file_offset = file_offset;
+    segment->raw_len = raw_len;
+    segment->file_len = file_len;
+    segment->compressed = compressed;
+    log->sealed_raw += raw_len;
+    if (compressed)
+        log->nr_blocks++;
+}
+
+/**
+ * Close the open run as a segment of its own, empty it and start the next run at log->file_end
+ */
+static int close_run(struct aesd_log *log)
+{
+    if (reserve_segment(log) < 0)
+        return -1;
+    add_segment(log, log->run_file_offset, log->file_end - log->run_file_offset, log->tail_len, false);
+    log->tail_len = 0;
+    log->run_file_offset = log->file_end;
+    return 0;
+}
+
+/**
+ * Replace the open run with a BLOCK record of its data compressed, or close it as it is
+ * if compression does not make it smaller
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int seal_run(struct aesd_log *log)
+{
+    size_t run_len = log->file_end - log->run_file_offset, bound = aesd_lz4_compress_bound(log->tail_len);
+    struct aesd_log_block block = {
+        .raw_offset = htole64(log->sealed_raw),
+        .raw_len = htole32(log->tail_len),
+    };
+    off_t block_offset = log->file_end, run_offset = log->run_file_offset;
+    struct iovec payload[2];
+    ssize_t compressed;
+
+    if (!log->compress || log->tail_len == 0)
+        return close_run(log);
+    if (reserve_segment(log) < 0 || reserve(&log->scratch, &log->scratch_capacity, bound) < 0)
+        return -1;
+    compressed = aesd_lz4_compress(log->tail, log->tail_len, log->scratch, bound);
+    if (compressed < 0 || RECORD_HEADER_SIZE + sizeof(block) + compressed >= run_len)
+        return close_run(log);
+
+    payload[0].iov_base = &block;
+    payload[0].iov_len = sizeof(block);
+    payload[1].iov_base = log->scratch;
+    payload[1].iov_len = compressed;
+    if (append_record(log, AESD_LOG_RECORD_BLOCK, payload, 2) < 0)
+        return -1;
+    // The run may only be dropped once the block holding its data is on disk, if that cannot be
+    // ensured the run stays and the scan on the next open drops it instead
+    if (fdatasync(log->fd) == 0)
+        write_skip(log, run_offset, run_len);
+    add_segment(log, block_offset, log->file_end - block_offset, log->tail_len, true);
+    log->tail_len = 0;
+    log->run_file_offset = log->file_end;
+    return 0;
+}
+
+/**
+ * Drop the index and start over with an empty log in the already open file
+ */
+static void clear_index(struct aesd_log *log)
+{
+    log->nr_segments = 0;
+    log->sealed_raw = 0;
+    log->file_end = 0;
+    log->run_file_offset = 0;
+    log->tail_len = 0;
+    log->cache_segment = -1;
+    log->dead_bytes = 0;
+    log->nr_blocks = 0;
+    log->truncated_bytes = 0;
+}
+
+/**
+ * Bytes of the file buffered by the scan
+ */
+struct scan_buf {
+    char *data;
+    size_t capacity;
+    off_t offset;
+    size_t len;
+};
+
+/**
+ * Make the @param len bytes at @param offset available in @param buf, reading ahead
+ * @return those bytes, or NULL if the file ends first or on error
+ */
+static const char *scan_get(int fd, struct scan_buf *buf, off_t offset, size_t len)
+{
+    ssize_t n;
+
+    if (offset >= buf->offset && offset + len <= buf->offset + buf->len)
+        return buf->data + (offset - buf->offset);
+    if (reserve(&buf->data, &buf->capacity, len > AESD_LOG_SCAN_CHUNK ? len : AESD_LOG_SCAN_CHUNK) < 0)
+        return NULL;
+    n = pread_full(fd, buf->data, buf->capacity, offset);
+    buf->offset = offset;
+    buf->len = n > 0 ? n : 0;
+    return buf->len >= len ? buf->data : NULL;
+}
+
+/**
+ * Add the BLOCK record of @param len bytes at @param record, read from log->file_end, to the index.
+ * A block holding the data of the open run means a crash came before its SKIP record was written,
+ * which is done now.
+ * @return 0 on success, -1 if the block is not valid here
+ */
+static int scan_block(struct aesd_log *log, const char *record, size_t len)
+{
+    struct aesd_log_block block;
+    off_t block_offset = log->file_end;
+
+    if (len < sizeof(block))
+        return -1;
+    memcpy(&block, record + RECORD_HEADER_SIZE, sizeof(block));
+    block.raw_offset = le64toh(block.raw_offset);
+    block.raw_len = le32toh(block.raw_len);
+    log->file_end += RECORD_HEADER_SIZE + len;
+
+    if (log->tail_len > 0 && block.raw_offset == (uint64_t)log->sealed_raw && block.raw_len == log->tail_len) {
+        if (write_skip(log, log->run_file_offset, block_offset - log->run_file_offset) < 0)
+            return -1;
+        log->tail_len = 0;
+    } else if (log->tail_len > 0 && close_run(log) < 0) {
+        return -1;
+    }
+    if (block.raw_offset != (uint64_t)log->sealed_raw || reserve_segment(log) < 0)
+        return -1;
+    add_segment(log, block_offset, RECORD_HEADER_SIZE + len, block.raw_len, true);
+    log->run_file_offset = log->file_end;
+    return 0;
+}
+
+/**
+ * Build the index of the file open on log->fd, truncating it after the last valid record
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int load_index(struct aesd_log *log)
+{
+    struct scan_buf buf = { .offset = 0 };
+    struct aesd_log_record_header header;
+    struct stat st;
+    int rc = -1;
+
+    clear_index(log);
+    if (fstat(log->fd, &st) < 0)
+        return -1;
+    posix_fadvise(log->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    while (st.st_size - log->file_end >= (off_t)RECORD_HEADER_SIZE) {
+        const char *record = scan_get(log->fd, &buf, log->file_end, RECORD_HEADER_SIZE);
+        size_t avail;
+        ssize_t len;
+
+        if (!record)
+            break;
+        // Only SKIP records are checked without reading their payload
+        memcpy(&header, record, sizeof(header));
+        if (le16toh(header.type) != AESD_LOG_RECORD_SKIP) {
+            avail = le32toh(header.length);
+            if (avail > st.st_size - log->file_end - RECORD_HEADER_SIZE)
+                break;
+            record = scan_get(log->fd, &buf, log->file_end, RECORD_HEADER_SIZE + avail);
+            if (!record)
+                break;
+        } else {
+            avail = 0;
+        }
+        len = parse_record(record, avail, &header);
+        if (len < 0)
+            break;
+
+        if (header.type == AESD_LOG_RECORD_SKIP) {
+            if (len > st.st_size - log->file_end - (off_t)RECORD_HEADER_SIZE)
+                break;
+            log->file_end += RECORD_HEADER_SIZE + len;
+            log->dead_bytes += RECORD_HEADER_SIZE + len;
+            if (log->tail_len == 0)
+                log->run_file_offset = log->file_end;
+        } else if (header.type == AESD_LOG_RECORD_BLOCK) {
+            if (scan_block(log, record, len) < 0) {
+                log->file_end -= RECORD_HEADER_SIZE + len;
+                break;
+            }
+        } else {
+            if (log->tail_len >= log->block_size && close_run(log) < 0)
+                goto out;
+            if (log->tail_len == 0)
+                log->run_file_offset = log->file_end;
+            if (reserve(&log->tail, &log->tail_capacity, log->tail_len + len) < 0)
+                goto out;
+            memcpy(log->tail + log->tail_len, record + RECORD_HEADER_SIZE, len);
+            log->tail_len += len;
+            log->file_end += RECORD_HEADER_SIZE + len;
+        }
+    }
+    if (log->tail_len == 0)
+        log->run_file_offset = log->file_end;
+    log->truncated_bytes = st.st_size - log->file_end;
+    if (st.st_size > log->file_end && ftruncate(log->fd, log->file_end) < 0)
+        goto out;
+    rc = 0;
+out:
+    posix_fadvise(log->fd, 0, 0, POSIX_FADV_NORMAL);
+    free(buf.data);
+    return rc;
+}
+
+/**
+ * Make closed segment @param idx the cached one, decompressing or parsing it if needed
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int load_segment(struct aesd_log *log, size_t idx)
+{
+    const struct aesd_log_segment *segment = &log->segments[idx];
+    struct aesd_log_record_header header;
+    size_t pos, raw = 0;
+    ssize_t len;
+
+    if (log->cache_segment == (ssize_t)idx)
+        return 0;
+    log->cache_segment = -1;
+    if (reserve(&log->cache, &log->cache_capacity, segment->raw_len) < 0 ||
+        reserve(&log->scratch, &log->scratch_capacity, segment->file_len) < 0 ||
+        pread_all(log->fd, log->scratch, segment->file_len, segment->file_offset) < 0)
+        return -1;
+
+    for (pos = 0; pos < segment->file_len; pos += RECORD_HEADER_SIZE + len) {
+        if (segment->file_len - pos < RECORD_HEADER_SIZE)
+            goto corrupt;
+        len = parse_record(log->scratch + pos, segment->file_len - pos - RECORD_HEADER_SIZE, &header);
+        if (len < 0)
+            goto corrupt;
+        if (segment->compressed) {
+            const char *data = log->scratch + pos + RECORD_HEADER_SIZE + sizeof(struct aesd_log_block);
+
+            if (header.type != AESD_LOG_RECORD_BLOCK || (size_t)len < sizeof(struct aesd_log_block) ||
+                aesd_lz4_decompress(data, len - sizeof(struct aesd_log_block), log->cache, segment->raw_len) !=
+                (ssize_t)segment->raw_len)
+                goto corrupt;
+            log->blocks_decompressed++;
+            raw = segment->raw_len;
+        } else {
+            if (header.type != AESD_LOG_RECORD_DATA || raw + len > segment->raw_len)
+                goto corrupt;
+            memcpy(log->cache + raw, log->scratch + pos + RECORD_HEADER_SIZE, len);
+            raw += len;
+        }
+    }
+    if (raw != segment->raw_len)
+        goto corrupt;
+    log->cache_segment = idx;
+    return 0;
+
+corrupt:
+    errno = EIO;
+    return -1;
+}
+
+/**
+ * @return the index of the closed segment holding data offset @param pos, which is below log->sealed_raw
+ */
+static size_t find_segment(const struct aesd_log *log, off_t pos)
+{
+    size_t lo = 0, hi = log->nr_segments - 1;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+
+        if (log->segments[mid].raw_offset <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+int aesd_log_open(const char *path, int flags, ...)
+{
+    struct aesd_log *log = &aesd_log;
+    mode_t mode = 0;
+    int idx;
+
+    if (flags & O_CREAT) {
+        va_list ap;
+
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+
+    pthread_mutex_lock(&log->lock);
+    if (log->fd < 0) {
+        log->fd = open(path, O_RDWR | O_CLOEXEC | (flags & (O_CREAT | O_TRUNC)), mode);
+        if (log->fd < 0)
+            goto err;
+        if (load_index(log) < 0) {
+            int saved = errno;
+
+            close(log->fd);
+            log->fd = -1;
+            errno = saved;
+            goto err;
+        }
+    } else if (flags & O_TRUNC) {
+        if (ftruncate(log->fd, 0) < 0)
+            goto err;
+        clear_index(log);
+    }
+
+    for (idx = 0; idx < AESD_LOG_MAX_FILES; idx++) {
+        if (!aesd_log_files[idx].used) {
+            aesd_log_files[idx].used = true;
+            aesd_log_files[idx].pos = 0;
+            pthread_mutex_unlock(&log->lock);
+            return AESD_LOG_FD_BASE + idx;
+        }
+    }
+    errno = EMFILE;
+err:
+    pthread_mutex_unlock(&log->lock);
+    return -1;
+}
+
+int aesd_log_close(int fd)
+{
+    struct aesd_log_file *file;
+
+    pthread_mutex_lock(&aesd_log.lock);
+    file = aesd_log_file_get(fd);
+    if (file)
+        file->used = false;
+    pthread_mutex_unlock(&aesd_log.lock);
+    return file ? 0 : -1;
+}
+
+ssize_t aesd_log_read(int fd, void *buf, size_t count)
+{
+    struct aesd_log *log = &aesd_log;
+    struct aesd_log_file *file;
+    off_t size;
+    size_t done = 0;
+
+    pthread_mutex_lock(&log->lock);
+    file = aesd_log_file_get(fd);
+    if (!file)
+        goto err;
+    size = log->sealed_raw + log->tail_len;
+    while (done < count && file->pos < size) {
+        size_t n;
+
+        if (file->pos >= log->sealed_raw) {
+            n = size - file->pos;
+            if (n > count - done)
+                n = count - done;
+            memcpy((char *)buf + done, log->tail + (file->pos - log->sealed_raw), n);
+        } else {
+            size_t idx = find_segment(log, file->pos);
+            const struct aesd_log_segment *segment = &log->segments[idx];
+
+            // Return what was read so far, the error repeats on the next call
+            if (load_segment(log, idx) < 0) {
+                if (done > 0)
+                    break;
+                goto err;
+            }
+            n = segment->raw_offset + segment->raw_len - file->pos;
+            if (n > count - done)
+                n = count - done;
+            memcpy((char *)buf + done, log->cache + (file->pos - segment->raw_offset), n);
+        }
+        file->pos += n;
+        done += n;
+    }
+    pthread_mutex_unlock(&log->lock);
+    return done;
+
+err:
+    pthread_mutex_unlock(&log->lock);
+    return -1;
+}
+
+ssize_t aesd_log_write(int fd, const void *buf, size_t count)
+{
+    struct aesd_log *log = &aesd_log;
+    size_t done = 0;
+
+    pthread_mutex_lock(&log->lock);
+    if (!aesd_log_file_get(fd))
+        goto err;
+    if (reserve(&log->tail, &log->tail_capacity, log->block_size) < 0)
+        goto err;
+    while (done < count) {
+        struct iovec payload;
+        size_t n;
+
+        // A run loaded from a log written with larger segments may already be full
+        if (log->tail_len >= log->block_size && seal_run(log) < 0)
+            goto partial;
+        n = log->block_size - log->tail_len;
+        if (n > count - done)
+            n = count - done;
+        payload.iov_base = (char *)buf + done;
+        payload.iov_len = n;
+        if (log->tail_len == 0)
+            log->run_file_offset = log->file_end;
+        if (append_record(log, AESD_LOG_RECORD_DATA, &payload, 1) < 0)
+            goto partial;
+        memcpy(log->tail + log->tail_len, (const char *)buf + done, n);
+        log->tail_len += n;
+        done += n;
+    }
+    if (log->tail_len >= log->block_size)
+        seal_run(log);
+    pthread_mutex_unlock(&log->lock);
+    return done;
+
+partial:
+    if (done > 0) {
+        pthread_mutex_unlock(&log->lock);
+        return done;
+    }
+err:
+    pthread_mutex_unlock(&log->lock);
+    return -1;
+}
+
+off_t aesd_log_lseek(int fd, off_t offset, int whence)
+{
+    struct aesd_log *log = &aesd_log;
+    struct aesd_log_file *file;
+    off_t pos = -1;
+
+    pthread_mutex_lock(&log->lock);
+    file = aesd_log_file_get(fd);
+    if (!file)
+        goto out;
+    switch (whence) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = file->pos + offset;
+        break;
+    case SEEK_END:
+        pos = log->sealed_raw + log->tail_len + offset;
+        break;
+    }
+    if (pos < 0) {
+        errno = EINVAL;
+        pos = -1;
+        goto out;
+    }
+    file->pos = pos;
+out:
+    pthread_mutex_unlock(&log->lock);
+    return pos;
+}
+
+int aesd_log_ioctl(int fd, unsigned long request, ...)
+{
+    struct aesd_log_file *file;
+
+    (void)request;
+    pthread_mutex_lock(&aesd_log.lock);
+    file = aesd_log_file_get(fd);
+    pthread_mutex_unlock(&aesd_log.lock);
+    if (file)
+        errno = ENOTTY;
+    return -1;
+}
+
+int aesd_log_fsync(int fd)
+{
+    struct aesd_log_file *file;
+    int rc = -1;
+
+    pthread_mutex_lock(&aesd_log.lock);
+    file = aesd_log_file_get(fd);
+    if (file)
+        rc = fsync(aesd_log.fd);
+    pthread_mutex_unlock(&aesd_log.lock);
+    return rc;
+}
+
+void aesd_log_set_block_size(size_t block_size)
+{
+    pthread_mutex_lock(&aesd_log.lock);
+    aesd_log.block_size = block_size > 0 && block_size <= UINT32_MAX ? block_size : AESD_LOG_DEFAULT_BLOCK_SIZE;
+    pthread_mutex_unlock(&aesd_log.lock);
+}
+
+void aesd_log_set_compress(bool compress)
+{
+    pthread_mutex_lock(&aesd_log.lock);
+    aesd_log.compress = compress;
+    pthread_mutex_unlock(&aesd_log.lock);
+}
+
+void aesd_log_get_stats(struct aesd_log_stats *stats)
+{
+    struct aesd_log *log = &aesd_log;
+
+    pthread_mutex_lock(&log->lock);
+    stats->raw_bytes = log->sealed_raw + log->tail_len;
+    stats->stored_bytes = log->file_end - log->dead_bytes;
+    stats->blocks = log->nr_blocks;
+    stats->blocks_decompressed = log->blocks_decompressed;
+    stats->truncated_bytes = log->truncated_bytes;
+    pthread_mutex_unlock(&log->lock);
+}
+
+void aesd_log_reset(void)
+{
+    struct aesd_log *log = &aesd_log;
+
+    pthread_mutex_lock(&log->lock);
+    if (log->fd >= 0)
+        close(log->fd);
+    log->fd = -1;
+    clear_index(log);
+    free(log->segments);
+    free(log->tail);
+    free(log->scratch);
+    free(log->cache);
+    log->segments = NULL;
+    log->segments_capacity = 0;
+    log->tail = log->scratch = log->cache = NULL;
+    log->tail_capacity = log->scratch_capacity = log->cache_capacity = 0;
+    log->blocks_decompressed = 0;
+    memset(aesd_log_files, 0, sizeof(aesd_log_files));
+    pthread_mutex_unlock(&log->lock);
+}
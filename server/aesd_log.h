@@ -0,0 +1,123 @@
+/*
+ * aesd_log.h
+ *
+ *  @brief Checksummed, optionally compressed storage of the aesdsocket data file
+ *
+ *  Every write is appended as one or more AESD_LOG_RECORD_DATA records, a
+ *  struct aesd_log_record_header holding the length and CRC32C of the record
+ *  followed by the bytes written.  Opening a log scans those records and
+ *  truncates the file at the first one that is torn or fails its checksum,
+ *  so a log written by a process that crashed reopens with every record
+ *  that reached the disk intact.
+ *
+ *  Records are grouped into segments of aesd_log_set_block_size() bytes of
+ *  data.  With aesd_log_set_compress(), each full segment is replaced by one
+ *  AESD_LOG_RECORD_BLOCK record holding its data LZ4 compressed.  An
+ *  in-memory index of the segments lets a read at any offset decompress or
+ *  parse only the segment holding it.
+ *
+ *  The functions follow the calling conventions of the POSIX calls they
+ *  replace, like aesdchar_emu.h: they return -1 and set errno on failure and
+ *  handles returned by aesd_log_open() are only valid with these functions.
+ *  All opens share one log, the first open decides its path.  Writes always
+ *  append.
+ */
+
+#ifndef AESD_LOG_H
+#define AESD_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define AESD_LOG_MAGIC              0xae5d
+#define AESD_LOG_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+enum aesd_log_record_type {
+    /**
+     * Payload is data written to the log
+     */
+    AESD_LOG_RECORD_DATA = 1,
+    /**
+     * Payload is a struct aesd_log_block then the LZ4 block of the data of the DATA records it
+     * replaces, which a SKIP record covers once this record is on disk
+     */
+    AESD_LOG_RECORD_BLOCK = 2,
+    /**
+     * Payload is dead space, its checksum covers only the header
+     */
+    AESD_LOG_RECORD_SKIP = 3,
+};
+
+/**
+ * Header of each record in the file, little endian
+ */
+struct aesd_log_record_header {
+    uint16_t magic;
+    uint16_t type;
+    /**
+     * Bytes of payload following the header
+     */
+    uint32_t length;
+    /**
+     * CRC32C of the header, with this field 0, followed by the payload
+     */
+    uint32_t crc;
+};
+
+struct aesd_log_block {
+    /**
+     * Offset in the data of the first byte of the block, and number of bytes it holds
+     */
+    uint64_t raw_offset;
+    uint32_t raw_len;
+    uint32_t reserved;
+};
+
+struct aesd_log_stats {
+    /* Bytes of data, as read back */
+    uint64_t raw_bytes;
+    /* Bytes of the file holding them, records replaced by compressed blocks excluded */
+    uint64_t stored_bytes;
+    /* Compressed blocks */
+    uint64_t blocks;
+    /* Blocks decompressed to serve reads */
+    uint64_t blocks_decompressed;
+    /* Bytes of torn or corrupt records the last load truncated */
+    uint64_t truncated_bytes;
+};
+
+/**
+ * Open the log stored at @param path, scanning and repairing it on the first open.
+ * O_CREAT and O_TRUNC in @param flags behave as with open(2), the mode following them is honoured
+ */
+int aesd_log_open(const char *path, int flags, ...);
+int aesd_log_close(int fd);
+ssize_t aesd_log_read(int fd, void *buf, size_t count);
+ssize_t aesd_log_write(int fd, const void *buf, size_t count);
+off_t aesd_log_lseek(int fd, off_t offset, int whence);
+/**
+ * The log is a plain file, every request fails with ENOTTY as ioctl(2) on one would
+ */
+int aesd_log_ioctl(int fd, unsigned long request, ...);
+int aesd_log_fsync(int fd);
+
+/**
+ * Set the number of data bytes of the segments written from now on, which must not exceed 4 GiB
+ */
+void aesd_log_set_block_size(size_t block_size);
+
+/**
+ * Compress the segments written from now on when @param compress
+ */
+void aesd_log_set_compress(bool compress);
+
+void aesd_log_get_stats(struct aesd_log_stats *stats);
+
+/**
+ * Forget the index and close the file, the next open scans it again.  No handle may be in use
+ */
+void aesd_log_reset(void);
+
+#endif /* AESD_LOG_H */
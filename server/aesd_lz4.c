@@ -0,0 +1,200 @@
+/**
+ * @file aesd_lz4.c
+ * @brief LZ4 block format compressor and decompressor
+ *
+ * A block is a run of sequences, each a token byte whose high nibble is the
+ * literal length and low nibble the match length less MINMATCH, optional
+ * length extension bytes, the literals, then a little endian 16 bit match
+ * offset and more extension bytes.  The last sequence has literals only.
+ * The compressor is the greedy single hash table search of LZ4's fast mode,
+ * trading some ratio for speed as the reference implementation does.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "aesd_lz4.h"
+
+#define MINMATCH     4
+/* The last match must start this far from the end of the input */
+#define MFLIMIT      12
+/* The last bytes of the input are always literals */
+#define LASTLITERALS 5
+#define MAX_OFFSET   65535
+/* 4096 positions, 16 KiB on the stack like LZ4's default LZ4_MEMORY_USAGE */
+#define HASH_LOG     12
+/* Literals searched before the search starts skipping ahead on incompressible data */
+#define SKIP_TRIGGER 6
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/**
+ * @return the number of extension bytes encoding a length of @param len in a token nibble
+ */
+static inline size_t length_bytes(size_t len)
+{
+    return len >= 15 ? (len - 15) / 255 + 1 : 0;
+}
+
+/**
+ * Write the extension bytes of a length of @param len, already known to be at least 15, at @param op
+ */
+static uint8_t *put_length(uint8_t *op, size_t len)
+{
+    len -= 15;
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+/**
+ * Write a sequence of @param lit_len literals at @param literals, followed by a match of
+ * @param match_len bytes at @param offset back unless @param match_len is 0
+ * @return the end of the sequence, or NULL if it does not fit before @param oend
+ */
+static uint8_t *put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *literals, size_t lit_len,
+                             size_t offset, size_t match_len)
+{
+    size_t ml = match_len ? match_len - MINMATCH : 0;
+    size_t need = 1 + length_bytes(lit_len) + lit_len + (match_len ? 2 + length_bytes(ml) : 0);
+
+    if (need > (size_t)(oend - op))
+        return NULL;
+    *op++ = (lit_len >= 15 ? 15 : lit_len) << 4 | (ml >= 15 ? 15 : ml);
+    if (lit_len >= 15)
+        op = put_length(op, lit_len);
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    if (!match_len)
+        return op;
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if (ml >= 15)
+        op = put_length(op, ml);
+    return op;
+}
+
+size_t aesd_lz4_compress_bound(size_t src_len)
+{
+    return src_len + src_len / 255 + 16;
+}
+
+ssize_t aesd_lz4_compress(const void *src, size_t src_len, void *dst, size_t dst_cap)
+{
+    const uint8_t *in = src;
+    uint8_t *op = dst, *oend = op + dst_cap;
+    uint32_t table[1 << HASH_LOG];
+    size_t ip = 0, anchor = 0;
+
+    // Inputs too short to hold a match are all literals
+    if (src_len > MFLIMIT) {
+        size_t mflimit = src_len - MFLIMIT, match_limit = src_len - LASTLITERALS;
+
+        memset(table, 0, sizeof(table));
+        while (ip <= mflimit) {
+            uint32_t h = hash32(read32(in + ip));
+            size_t candidate = table[h], len;
+
+            table[h] = ip;
+            if (candidate >= ip || ip - candidate > MAX_OFFSET || read32(in + candidate) != read32(in + ip)) {
+                ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+                continue;
+            }
+            while (ip > anchor && candidate > 0 && in[ip - 1] == in[candidate - 1]) {
+                ip--;
+                candidate--;
+            }
+            len = MINMATCH;
+            while (ip + len < match_limit && in[candidate + len] == in[ip + len])
+                len++;
+
+            op = put_sequence(op, oend, in + anchor, ip - anchor, ip - candidate, len);
+            if (!op)
+                return -1;
+            ip += len;
+            anchor = ip;
+            // The bytes just matched are likely to repeat, remember the end of the match
+            if (ip <= mflimit)
+                table[hash32(read32(in + ip - 2))] = ip - 2;
+        }
+    }
+
+    op = put_sequence(op, oend, in + anchor, src_len - anchor, 0, 0);
+    if (!op)
+        return -1;
+    return op - (uint8_t *)dst;
+}
+
+/**
+ * Add the extension bytes of a length nibble of 15 at *@param ip to *@param len
+ * @return 0 on success, -1 if they run past @param iend
+ */
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+
+    do {
+        if (*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+ssize_t aesd_lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap)
+{
+    const uint8_t *ip = src, *iend = ip + src_len;
+    uint8_t *op = dst, *oend = op + dst_cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4, match_len = token & 15, offset;
+        const uint8_t *match;
+
+        if (lit_len == 15 && get_length(&ip, iend, &lit_len) < 0)
+            return -1;
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend)
+            break;
+
+        if (iend - ip < 2)
+            return -1;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst))
+            return -1;
+        if (match_len == 15 && get_length(&ip, iend, &match_len) < 0)
+            return -1;
+        match_len += MINMATCH;
+        if (match_len > (size_t)(oend - op))
+            return -1;
+        match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+            op += match_len;
+        } else {
+            // Overlapping copy, each byte may be one written by this match
+            while (match_len--)
+                *op++ = *match++;
+        }
+    }
+    return op - (uint8_t *)dst;
+}
@@ -0,0 +1,37 @@
+/*
+ * aesd_lz4.h
+ *
+ *  @brief LZ4 block format compression for the aesdsocket data
+ *
+ *  A small self contained implementation of the LZ4 block format, so blocks
+ *  written here can be decoded by LZ4_decompress_safe() of liblz4 and the
+ *  other way round.  Only single blocks are handled, without the LZ4 frame
+ *  format: callers record the uncompressed length themselves.
+ */
+
+#ifndef AESD_LZ4_H
+#define AESD_LZ4_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @return the largest compressed size of @param src_len bytes, so a destination of this size
+ * never makes aesd_lz4_compress() fail
+ */
+size_t aesd_lz4_compress_bound(size_t src_len);
+
+/**
+ * Compress @param src_len bytes of @param src into @param dst, which has room for @param dst_cap bytes
+ * @return the compressed size, or -1 if it does not fit in @param dst_cap
+ */
+ssize_t aesd_lz4_compress(const void *src, size_t src_len, void *dst, size_t dst_cap);
+
+/**
+ * Decompress the block of @param src_len bytes at @param src into @param dst, which has room for
+ * @param dst_cap bytes.  Malformed input is detected rather than read or written out of bounds.
+ * @return the decompressed size, or -1 if the block is malformed or does not fit in @param dst_cap
+ */
+ssize_t aesd_lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_cap);
+
+#endif /* AESD_LZ4_H */
@@ -0,0 +1,187 @@
+/**
+ * @file aesd_recovery_bench.c
+ * @brief Startup recovery time of the aesdsocket data file
+ *
+ * Usage: aesd_recovery_bench [-m megabytes] [-s size] [-z] [path]
+ * Writes @param megabytes (default 1024) of log lines through aesd_log to @param path,
+ * /var/tmp/aesd_recovery_bench.data by default, in writes of @param size bytes (default 1024,
+ * the most aesdsocket writes per received chunk), block compressed with -z.  It then times the
+ * scan aesdsocket -k runs on startup with the file in the page cache and evicted from it, and
+ * again after tearing the last record, which the scan has to truncate.  The CRC32C throughput
+ * that bounds the scan is reported first.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "aesd_log.h"
+#include "aesd_crc32c.h"
+
+#define DEFAULT_PATH "/var/tmp/aesd_recovery_bench.data"
+#define CRC_BYTES    (64 * 1024 * 1024)
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_crc(void)
+{
+    char *data = malloc(CRC_BYTES);
+    volatile uint32_t crc;
+    double start;
+    size_t i;
+
+    if (!data)
+        return;
+    for (i = 0; i < CRC_BYTES; i++)
+        data[i] = i * 31;
+    start = now_s();
+    crc = aesd_crc32c(0, data, CRC_BYTES);
+    printf("%-24s %10.2f GB/s\n", aesd_crc32c_impl(), CRC_BYTES / (now_s() - start) / 1e9);
+    start = now_s();
+    crc = aesd_crc32c_sw(0, data, CRC_BYTES);
+    printf("%-24s %10.2f GB/s\n", "slice-by-8", CRC_BYTES / (now_s() - start) / 1e9);
+    (void)crc;
+    free(data);
+}
+
+/**
+ * Open @param path as aesdsocket -k does and print the time taken as @param name
+ * @return 0 on success, -1 on error
+ */
+static int run_open(const char *path, const char *name, struct aesd_log_stats *stats)
+{
+    double start;
+    int fd;
+
+    aesd_log_reset();
+    start = now_s();
+    fd = aesd_log_open(path, O_RDWR);
+    start = now_s() - start;
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    aesd_log_get_stats(stats);
+    printf("%-24s %10.3f s %10.0f MB/s %12llu %12llu\n", name, start, stats->raw_bytes / start / 1e6,
+           (unsigned long long)stats->raw_bytes, (unsigned long long)stats->truncated_bytes);
+    aesd_log_close(fd);
+    return 0;
+}
+
+/**
+ * Drop @param path from the page cache, so the next scan reads it from the disk
+ */
+static void evict(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = 1024, size = 1024, written = 0, len;
+    const char *path = DEFAULT_PATH;
+    struct aesd_log_stats stats;
+    struct stat st;
+    bool compress = false;
+    char *packet;
+    double start;
+    int opt, fd;
+
+    while ((opt = getopt(argc, argv, "m:s:z")) != -1) {
+        switch (opt) {
+        case 'm':
+            megabytes = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            compress = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-m megabytes] [-s size] [-z] [path]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        path = argv[optind];
+    packet = malloc(size);
+    if (megabytes == 0 || size < 2 || !packet) {
+        fprintf(stderr, "megabytes must be positive and size at least 2\n");
+        return 1;
+    }
+    len = megabytes * 1024 * 1024;
+
+    printf("%-24s %10s\n", "crc32c", "throughput");
+    run_crc();
+
+    aesd_log_reset();
+    aesd_log_set_compress(compress);
+    fd = aesd_log_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    start = now_s();
+    while (written < len) {
+        size_t n = len - written < size ? len - written : size, i;
+
+        for (i = 0; i < n; i++)
+            packet[i] = 'a' + (written + i) % 26;
+        packet[n - 1] = '\n';
+        if (aesd_log_write(fd, packet, n) != (ssize_t)n) {
+            perror("aesd_log_write");
+            return 1;
+        }
+        written += n;
+    }
+    aesd_log_fsync(fd);
+    printf("%-24s %10.0f MB/s\n", "write", len / (now_s() - start) / 1e6);
+    // End on a DATA record, not a compressed block that was synced before anything after it
+    if (aesd_log_write(fd, packet, size) != (ssize_t)size) {
+        perror("aesd_log_write");
+        return 1;
+    }
+    aesd_log_close(fd);
+
+    printf("%-24s %12s %15s %12s %12s\n", "recovery", "time", "recovered", "raw_bytes", "truncated");
+    if (run_open(path, "page cache", &stats) < 0)
+        return 1;
+    evict(path);
+    if (run_open(path, "cold", &stats) < 0)
+        return 1;
+
+    // Tear the last record in two, as a crash in the middle of writing it would
+    aesd_log_reset();
+    if (stat(path, &st) < 0 || truncate(path, st.st_size - size / 2) < 0) {
+        perror(path);
+        return 1;
+    }
+    evict(path);
+    if (run_open(path, "cold torn record", &stats) < 0)
+        return 1;
+
+    aesd_log_reset();
+    unlink(path);
+    free(packet);
+    return 0;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file aesd_sched.c
+ * @brief Per client token buckets and FIFO turns for aesdsocket, see aesd_sched.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "aesd_sched.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+/**
+ * A token bucket kept as the time it will be full again: taking n bytes pushes that time n / rate
+ * seconds later, and the bucket is short of tokens while it lies more than burst / rate seconds
+ * ahead
+ */
+struct aesd_sched_bucket {
+    uint64_t full_at_ns;
+};
+
+struct aesd_sched_rate {
+    /* Bytes per second, 0 for no limit */
+    uint64_t rate;
+    /* Time to refill the whole burst */
+    uint64_t burst_ns;
+};
+
+struct aesd_sched_client {
+    LIST_ENTRY(aesd_sched_client) entries;
+    struct aesd_sched_bucket in;
+    struct aesd_sched_bucket out;
+    /* connections counts the references */
+    struct aesd_sched_stats stats;
+    /* When the last connection closed */
+    uint64_t idle_since_ns;
+};
+
+/**
+ * A connection queued for a turn, on its own stack, signalled alone when the turn is its own
+ */
+struct aesd_sched_waiter {
+    TAILQ_ENTRY(aesd_sched_waiter) entries;
+    pthread_cond_t cond;
+    bool granted;
+};
+
+struct aesd_sched {
+    pthread_mutex_t lock;
+    /* Throttled transfers wait on it, to be woken by aesd_sched_shutdown() */
+    pthread_cond_t wake;
+    struct aesd_sched_rate in;
+    struct aesd_sched_rate out;
+    bool shutdown;
+    LIST_HEAD(, aesd_sched_client) clients;
+    /* Clients without connections */
+    unsigned int idle_clients;
+    /* A turn is in progress, waiters queue for it in order of arrival */
+    bool busy;
+    TAILQ_HEAD(, aesd_sched_waiter) waiters;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void rate_init(struct aesd_sched_rate *rate, uint64_t bytes_per_s, uint64_t burst)
+{
+    rate->rate = bytes_per_s;
+    rate->burst_ns = bytes_per_s && burst ? burst * NSEC_PER_SEC / bytes_per_s : NSEC_PER_SEC;
+}
+
+struct aesd_sched *aesd_sched_create(const struct aesd_sched_limits *limits)
+{
+    struct aesd_sched *sched = calloc(1, sizeof(*sched));
+    pthread_condattr_t attr;
+
+    if (!sched)
+        return NULL;
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sched->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    rate_init(&sched->in, limits->in_rate, limits->in_burst);
+    rate_init(&sched->out, limits->out_rate, limits->out_burst);
+    LIST_INIT(&sched->clients);
+    TAILQ_INIT(&sched->waiters);
+    return sched;
+}
+
+void aesd_sched_shutdown(struct aesd_sched *sched)
+{
+    pthread_mutex_lock(&sched->lock);
+    sched->shutdown = true;
+    pthread_cond_broadcast(&sched->wake);
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void aesd_sched_destroy(struct aesd_sched *sched)
+{
+    struct aesd_sched_client *client;
+
+    while ((client = LIST_FIRST(&sched->clients))) {
+        LIST_REMOVE(client, entries);
+        free(client);
+    }
+    pthread_cond_destroy(&sched->wake);
+    pthread_mutex_destroy(&sched->lock);
+    free(sched);
+}
+
+/**
+ * Forget the client of @param sched that has been idle longest
+ */
+static void evict_idle_client(struct aesd_sched *sched)
+{
+    struct aesd_sched_client *client, *oldest = NULL;
+
+    LIST_FOREACH(client, &sched->clients, entries) {
+        if (client->stats.connections == 0 && (!oldest || client->idle_since_ns < oldest->idle_since_ns))
+            oldest = client;
+    }
+    if (oldest) {
+        LIST_REMOVE(oldest, entries);
+        free(oldest);
+        sched->idle_clients--;
+    }
+}
+
+struct aesd_sched_client *aesd_sched_join(struct aesd_sched *sched, struct in_addr addr)
+{
+    struct aesd_sched_client *client;
+
+    pthread_mutex_lock(&sched->lock);
+    LIST_FOREACH(client, &sched->clients, entries) {
+        if (client->stats.addr.s_addr == addr.s_addr)
+            break;
+    }
+    if (client && client->stats.connections == 0)
+        sched->idle_clients--;
+    if (!client) {
+        if (sched->idle_clients >= AESD_SCHED_MAX_IDLE_CLIENTS)
+            evict_idle_client(sched);
+        client = calloc(1, sizeof(*client));
+        if (!client) {
+            pthread_mutex_unlock(&sched->lock);
+            return NULL;
+        }
+        client->stats.addr = addr;
+        LIST_INSERT_HEAD(&sched->clients, client, entries);
+    }
+    client->stats.connections++;
+    pthread_mutex_unlock(&sched->lock);
+    return client;
+}
+
+void aesd_sched_leave(struct aesd_sched *sched, struct aesd_sched_client *client)
+{
+    pthread_mutex_lock(&sched->lock);
+    if (--client->stats.connections == 0) {
+        client->idle_since_ns = now_ns();
+        sched->idle_clients++;
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/**
+ * Take @param bytes from @param bucket at time @param now
+ * @return the time from @param now until the bucket is no longer short of tokens, 0 if it is not
+ */
+static uint64_t charge(struct aesd_sched *sched, const struct aesd_sched_rate *rate,
+                       struct aesd_sched_bucket *bucket, size_t bytes, uint64_t now)
+{
+    if (rate->rate == 0 || sched->shutdown)
+        return 0;
+    if (bucket->full_at_ns < now)
+        bucket->full_at_ns = now;
+    bucket->full_at_ns += bytes * NSEC_PER_SEC / rate->rate;
+    if (bucket->full_at_ns - now <= rate->burst_ns)
+        return 0;
+    return bucket->full_at_ns - rate->burst_ns - now;
+}
+
+/**
+ * Take @param bytes from @param bucket, then wait until it is no longer short of tokens
+ * @return the time waited
+ */
+static uint64_t throttle(struct aesd_sched *sched, const struct aesd_sched_rate *rate,
+                         struct aesd_sched_bucket *bucket, size_t bytes)
+{
+    uint64_t now = now_ns(), start = now, delay = charge(sched, rate, bucket, bytes, now), deadline;
+
+    if (!delay)
+        return 0;
+
+    deadline = now + delay;
+    while (!sched->shutdown && now < deadline) {
+        struct timespec ts = {
+            .tv_sec = deadline / NSEC_PER_SEC,
+            .tv_nsec = deadline % NSEC_PER_SEC,
+        };
+
+        pthread_cond_timedwait(&sched->wake, &sched->lock, &ts);
+        now = now_ns();
+    }
+    return now - start;
+}
+
+void aesd_sched_throttle_in(struct aesd_sched *sched, struct aesd_sched_client *client, size_t bytes)
+{
+    uint64_t waited;
+
+    pthread_mutex_lock(&sched->lock);
+    client->stats.bytes_in += bytes;
+    waited = throttle(sched, &sched->in, &client->in, bytes);
+    if (waited) {
+        client->stats.throttled_in++;
+        client->stats.throttled_in_ns += waited;
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void aesd_sched_throttle_out(struct aesd_sched *sched, struct aesd_sched_client *client, size_t bytes)
+{
+    uint64_t waited;
+
+    pthread_mutex_lock(&sched->lock);
+    client->stats.bytes_out += bytes;
+    waited = throttle(sched, &sched->out, &client->out, bytes);
+    if (waited) {
+        client->stats.throttled_out++;
+        client->stats.throttled_out_ns += waited;
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+uint64_t aesd_sched_charge_out(struct aesd_sched *sched, struct aesd_sched_client *client, size_t bytes)
+{
+    uint64_t delay;
+
+    pthread_mutex_lock(&sched->lock);
+    client->stats.bytes_out += bytes;
+    delay = charge(sched, &sched->out, &client->out, bytes, now_ns());
+    if (delay) {
+        client->stats.throttled_out++;
+        client->stats.throttled_out_ns += delay;
+    }
+    pthread_mutex_unlock(&sched->lock);
+    return delay;
+}
+
+void aesd_sched_turn_begin(struct aesd_sched *sched, struct aesd_sched_client *client)
+{
+    uint64_t start = now_ns();
+
+    pthread_mutex_lock(&sched->lock);
+    if (!sched->busy) {
+        sched->busy = true;
+    } else {
+        struct aesd_sched_waiter waiter = { .granted = false };
+
+        pthread_cond_init(&waiter.cond, NULL);
+        TAILQ_INSERT_TAIL(&sched->waiters, &waiter, entries);
+        while (!waiter.granted)
+            pthread_cond_wait(&waiter.cond, &sched->lock);
+        pthread_cond_destroy(&waiter.cond);
+    }
+    if (client) {
+        client->stats.turns++;
+        client->stats.turn_wait_ns += now_ns() - start;
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void aesd_sched_turn_end(struct aesd_sched *sched)
+{
+    struct aesd_sched_waiter *next;
+
+    pthread_mutex_lock(&sched->lock);
+    next = TAILQ_FIRST(&sched->waiters);
+    if (next) {
+        // The turn passes straight to the next waiter, busy stays set so no newcomer can barge in
+        TAILQ_REMOVE(&sched->waiters, next, entries);
+        next->granted = true;
+        pthread_cond_signal(&next->cond);
+    } else {
+        sched->busy = false;
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void aesd_sched_get_stats(struct aesd_sched *sched, const struct aesd_sched_client *client,
+                          struct aesd_sched_stats *stats)
+{
+    pthread_mutex_lock(&sched->lock);
+    *stats = client->stats;
+    pthread_mutex_unlock(&sched->lock);
+}
+
+void aesd_sched_foreach(struct aesd_sched *sched, void (*func)(const struct aesd_sched_stats *stats, void *arg),
+                        void *arg)
+{
+    struct aesd_sched_client *client;
+
+    pthread_mutex_lock(&sched->lock);
+    LIST_FOREACH(client, &sched->clients, entries)
+        func(&client->stats, arg);
+    pthread_mutex_unlock(&sched->lock);
+}
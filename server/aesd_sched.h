@@ -0,0 +1,125 @@
+/*
+ * aesd_sched.h
+ *
+ *  @brief Per client rate limits and round robin access to the aesdsocket data
+ *
+ *  Connections from the same client address share two token buckets, one for
+ *  the bytes they send and one for the bytes sent back to them.  A transfer
+ *  takes its bytes from the bucket even when that leaves it short and then
+ *  waits until the bucket has refilled the shortfall, so a client sending or
+ *  reading faster than its rate is slowed to it, without holding anything
+ *  other connections need, and TCP flow control pushes back on it.  A client
+ *  is remembered after its last connection closes, so reconnecting does not
+ *  refill its buckets or reset its counters, until it is the longest idle of
+ *  more than AESD_SCHED_MAX_IDLE_CLIENTS.
+ *
+ *  Access to the data goes by turns.  A connection wanting a turn queues
+ *  behind those already waiting and turns are handed over in queue order, so
+ *  while connections compete every one of them gets a turn before any gets a
+ *  second, however often it asks.
+ */
+
+#ifndef AESD_SCHED_H
+#define AESD_SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define AESD_SCHED_MAX_IDLE_CLIENTS 1024
+
+struct aesd_sched;
+struct aesd_sched_client;
+
+struct aesd_sched_limits {
+    /* Bytes per second received from and sent to each client address, 0 for no limit */
+    uint64_t in_rate;
+    uint64_t out_rate;
+    /* Bytes a client may transfer at once after being idle, one second's worth if 0 */
+    uint64_t in_burst;
+    uint64_t out_burst;
+};
+
+struct aesd_sched_stats {
+    struct in_addr addr;
+    /* Open connections from addr, 0 for a client remembered after they closed */
+    uint32_t connections;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    /* Transfers that had to wait for their bucket, and the total time waited */
+    uint64_t throttled_in;
+    uint64_t throttled_out;
+    uint64_t throttled_in_ns;
+    uint64_t throttled_out_ns;
+    /* Turns taken, and the total time spent queued for them */
+    uint64_t turns;
+    uint64_t turn_wait_ns;
+};
+
+/**
+ * Create a scheduler applying @param limits to every client address
+ * @return the scheduler, NULL if out of memory
+ */
+struct aesd_sched *aesd_sched_create(const struct aesd_sched_limits *limits);
+
+/**
+ * Wake every throttled transfer and let further ones through unthrottled, so connections notice
+ * the exit request in time.  Turns still work as before
+ */
+void aesd_sched_shutdown(struct aesd_sched *sched);
+
+/**
+ * Free @param sched, with every connection gone
+ */
+void aesd_sched_destroy(struct aesd_sched *sched);
+
+/**
+ * Register a connection from @param addr
+ * @return its client, shared with the other connections from @param addr past and present, NULL
+ *   if out of memory
+ */
+struct aesd_sched_client *aesd_sched_join(struct aesd_sched *sched, struct in_addr addr);
+
+/**
+ * Unregister a connection of @param client
+ */
+void aesd_sched_leave(struct aesd_sched *sched, struct aesd_sched_client *client);
+
+/**
+ * Account @param bytes received from @param client, waiting while its bucket is short
+ */
+void aesd_sched_throttle_in(struct aesd_sched *sched, struct aesd_sched_client *client, size_t bytes);
+
+/**
+ * Account @param bytes about to be sent to @param client, waiting while its bucket is short
+ */
+void aesd_sched_throttle_out(struct aesd_sched *sched, struct aesd_sched_client *client, size_t bytes);
+
+/**
+ * Account @param bytes about to be sent to @param client like aesd_sched_throttle_out(), without
+ * waiting, for callers serving many connections from one thread
+ * @return the nanoseconds to hold the send back for, 0 to send at once
+ */
+uint64_t aesd_sched_charge_out(struct aesd_sched *sched, struct aesd_sched_client *client, size_t bytes);
+
+/**
+ * Wait for a turn and take it for @param client, which is NULL for the server's own work
+ */
+void aesd_sched_turn_begin(struct aesd_sched *sched, struct aesd_sched_client *client);
+
+/**
+ * End the current turn, handing it to the longest waiting connection
+ */
+void aesd_sched_turn_end(struct aesd_sched *sched);
+
+void aesd_sched_get_stats(struct aesd_sched *sched, const struct aesd_sched_client *client,
+                          struct aesd_sched_stats *stats);
+
+/**
+ * Call @param func with the counters of every client remembered and @param arg.  @param func
+ * runs with the scheduler locked and must not call back into it
+ */
+void aesd_sched_foreach(struct aesd_sched *sched, void (*func)(const struct aesd_sched_stats *stats, void *arg),
+                        void *arg);
+
+#endif /* AESD_SCHED_H */
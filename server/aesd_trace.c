@@ -0,0 +1,300 @@
+/**
+ * @file aesd_trace.c
+ * @brief Lock free per thread rings of phase timings, dumped as Chrome trace JSON, see aesd_trace.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "aesd_trace.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static const char *const phase_names[AESD_TRACE_PHASES] = {
+    [AESD_TRACE_STARTUP] = "startup",
+    [AESD_TRACE_DAEMONIZE] = "daemonize",
+    [AESD_TRACE_BACKEND_START] = "backend start",
+    [AESD_TRACE_GETADDRINFO] = "getaddrinfo",
+    [AESD_TRACE_LISTEN] = "bind and listen",
+    [AESD_TRACE_FIRST_ACCEPT] = "first accept",
+    [AESD_TRACE_PACKET] = "packet",
+    [AESD_TRACE_RECV] = "recv",
+    [AESD_TRACE_THROTTLE] = "throttle",
+    [AESD_TRACE_TURN_WAIT] = "turn wait",
+    [AESD_TRACE_WRITE] = "write",
+    [AESD_TRACE_FSYNC] = "fsync",
+    [AESD_TRACE_REPLY_READ] = "reply read",
+    [AESD_TRACE_SEND] = "send",
+    [AESD_TRACE_FRAMES] = "binary frames",
+};
+
+/**
+ * One phase.  The owner thread writes seq odd, the fields, then seq even, so a dump reading the
+ * same even seq before and after the fields has read them whole
+ */
+struct trace_event {
+    atomic_uint_least64_t seq;
+    atomic_uint_least64_t start_ns;
+    atomic_uint_least64_t dur_ns;
+    atomic_uint_least64_t bytes;
+    atomic_uint phase;
+};
+
+struct trace_ring {
+    struct trace_ring *next;
+    /* Next on the free list once the owner thread exited, protected by trace.lock */
+    struct trace_ring *next_free;
+    pid_t tid;
+    _Atomic(const char *) name;
+    /* Events recorded so far, the last mask + 1 of them are held */
+    atomic_uint_least64_t head;
+    /* First event of the current owner, earlier ones belong to a thread that exited */
+    uint64_t base;
+    uint64_t mask;
+    struct trace_event events[];
+};
+
+static struct {
+    /* Protects rings, free_rings and ring_events */
+    pthread_mutex_t lock;
+    struct trace_ring *rings;
+    /* Rings of exited threads, reused before allocating new ones */
+    struct trace_ring *free_rings;
+    size_t ring_events;
+    atomic_bool enabled;
+    /* Bumped by every shutdown, so threads drop rings from before it */
+    atomic_uint generation;
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread struct trace_ring *tls_ring;
+static __thread unsigned tls_generation;
+static __thread const char *tls_name;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int aesd_trace_enable(size_t ring_events)
+{
+    size_t events = 1;
+
+    while (events < ring_events)
+        events *= 2;
+    pthread_mutex_lock(&trace.lock);
+    if (atomic_load(&trace.enabled)) {
+        pthread_mutex_unlock(&trace.lock);
+        return -1;
+    }
+    trace.ring_events = events;
+    atomic_store(&trace.enabled, true);
+    pthread_mutex_unlock(&trace.lock);
+    return 0;
+}
+
+void aesd_trace_shutdown(void)
+{
+    struct trace_ring *ring;
+
+    pthread_mutex_lock(&trace.lock);
+    atomic_store(&trace.enabled, false);
+    atomic_fetch_add(&trace.generation, 1);
+    trace.free_rings = NULL;
+    while ((ring = trace.rings)) {
+        trace.rings = ring->next;
+        free(ring);
+    }
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/**
+ * Thread exit destructor of ring_key, puts the ring @param arg of the exiting thread on the free
+ * list unless a shutdown already freed it.  Its events stay in dumps until another thread reuses it
+ */
+static void release_ring(void *arg)
+{
+    struct trace_ring *ring = arg;
+
+    pthread_mutex_lock(&trace.lock);
+    if (tls_ring == ring && tls_generation == atomic_load(&trace.generation)) {
+        ring->next_free = trace.free_rings;
+        trace.free_rings = ring;
+    }
+    pthread_mutex_unlock(&trace.lock);
+    tls_ring = NULL;
+}
+
+static void create_ring_key(void)
+{
+    if (pthread_key_create(&ring_key, release_ring) != 0)
+        abort();
+}
+
+/**
+ * @return the ring of the calling thread, taking over the ring of an exited thread or registering
+ *   a new one on its first event, NULL if recording stopped or out of memory
+ */
+static struct trace_ring *thread_ring(void)
+{
+    unsigned generation = atomic_load_explicit(&trace.generation, memory_order_acquire);
+    struct trace_ring *ring = NULL;
+
+    if (tls_ring && tls_generation == generation)
+        return tls_ring;
+    pthread_once(&ring_key_once, create_ring_key);
+    pthread_mutex_lock(&trace.lock);
+    if (atomic_load(&trace.enabled)) {
+        ring = trace.free_rings;
+        if (ring) {
+            trace.free_rings = ring->next_free;
+            ring->base = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        } else {
+            ring = calloc(1, sizeof(*ring) + trace.ring_events * sizeof(ring->events[0]));
+            if (ring) {
+                ring->mask = trace.ring_events - 1;
+                ring->next = trace.rings;
+                trace.rings = ring;
+            }
+        }
+    }
+    if (ring) {
+        ring->tid = syscall(SYS_gettid);
+        atomic_store(&ring->name, tls_name);
+        tls_ring = ring;
+        tls_generation = atomic_load(&trace.generation);
+        pthread_setspecific(ring_key, ring);
+    }
+    pthread_mutex_unlock(&trace.lock);
+    return ring;
+}
+
+uint64_t aesd_trace_begin(void)
+{
+    return atomic_load_explicit(&trace.enabled, memory_order_relaxed) ? now_ns() : 0;
+}
+
+void aesd_trace_end(enum aesd_trace_phase phase, uint64_t start_ns, uint64_t bytes)
+{
+    struct trace_ring *ring;
+    struct trace_event *event;
+    uint64_t end_ns, index;
+
+    if (start_ns == 0)
+        return;
+    end_ns = now_ns();
+    ring = thread_ring();
+    if (!ring)
+        return;
+    index = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    event = &ring->events[index & ring->mask];
+    atomic_store_explicit(&event->seq, 2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&event->start_ns, start_ns, memory_order_relaxed);
+    atomic_store_explicit(&event->dur_ns, end_ns - start_ns, memory_order_relaxed);
+    atomic_store_explicit(&event->bytes, bytes, memory_order_relaxed);
+    atomic_store_explicit(&event->phase, phase, memory_order_relaxed);
+    atomic_store_explicit(&event->seq, 2 * index + 2, memory_order_release);
+    atomic_store_explicit(&ring->head, index + 1, memory_order_release);
+}
+
+void aesd_trace_thread_name(const char *name)
+{
+    tls_name = name;
+    if (tls_ring && tls_generation == atomic_load(&trace.generation))
+        atomic_store(&tls_ring->name, name);
+}
+
+/**
+ * Write the events @param ring holds to @param file as part of the traceEvents array, each
+ * preceded by a comma unless *@param first
+ * @return the number of events written
+ */
+static size_t dump_ring(FILE *file, struct trace_ring *ring, pid_t pid, bool *first)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t index = head > ring->mask + 1 ? head - ring->mask - 1 : 0;
+
+    if (index < ring->base)
+        index = ring->base;
+    const char *name = atomic_load(&ring->name);
+    size_t written = 0;
+
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            *first ? "" : ",", pid, ring->tid, name ? name : "thread", ring->tid);
+    *first = false;
+    for (; index < head; index++) {
+        struct trace_event *event = &ring->events[index & ring->mask];
+        uint64_t seq = atomic_load_explicit(&event->seq, memory_order_acquire);
+        uint64_t start_ns = atomic_load_explicit(&event->start_ns, memory_order_relaxed);
+        uint64_t dur_ns = atomic_load_explicit(&event->dur_ns, memory_order_relaxed);
+        uint64_t bytes = atomic_load_explicit(&event->bytes, memory_order_relaxed);
+        unsigned phase = atomic_load_explicit(&event->phase, memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+        // Overwritten meanwhile by a thread that lapped the ring
+        if (seq != 2 * index + 2 || atomic_load_explicit(&event->seq, memory_order_relaxed) != seq ||
+            phase >= AESD_TRACE_PHASES)
+            continue;
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"aesdsocket\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu",
+                phase_names[phase], pid, ring->tid,
+                (unsigned long long)(start_ns / 1000), (unsigned long long)(start_ns % 1000),
+                (unsigned long long)(dur_ns / 1000), (unsigned long long)(dur_ns % 1000));
+        if (bytes)
+            fprintf(file, ",\"args\":{\"bytes\":%llu}", (unsigned long long)bytes);
+        fputc('}', file);
+        written++;
+    }
+    return written;
+}
+
+ssize_t aesd_trace_dump(const char *path)
+{
+    size_t len = strlen(path) + sizeof(".tmp");
+    char *tmp_path = malloc(len);
+    struct trace_ring *ring;
+    size_t written = 0;
+    bool first = true;
+    FILE *file;
+    int err;
+
+    if (!tmp_path)
+        return -1;
+    snprintf(tmp_path, len, "%s.tmp", path);
+    file = fopen(tmp_path, "w");
+    if (!file) {
+        err = errno;
+        free(tmp_path);
+        errno = err;
+        return -1;
+    }
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+    pthread_mutex_lock(&trace.lock);
+    for (ring = trace.rings; ring; ring = ring->next)
+        written += dump_ring(file, ring, getpid(), &first);
+    pthread_mutex_unlock(&trace.lock);
+    fputs("\n]}\n", file);
+
+    err = ferror(file) ? EIO : 0;
+    if (fclose(file) != 0 && !err)
+        err = errno;
+    if (!err && rename(tmp_path, path) != 0)
+        err = errno;
+    if (err)
+        remove(tmp_path);
+    free(tmp_path);
+    errno = err;
+    return err ? -1 : (ssize_t)written;
+}
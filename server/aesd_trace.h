@@ -0,0 +1,92 @@
+/*
+ * aesd_trace.h
+ *
+ *  @brief Per phase timing of aesdsocket, dumped as a Chrome trace
+ *
+ *  Once enabled, every thread records the phases it runs, startup steps and
+ *  each step of serving a packet, into a ring of its own: the last
+ *  ring_events of them, older ones overwritten.  Recording takes no lock,
+ *  the only shared state touched is the enabled flag, and costs two clock
+ *  reads per phase.  A thread registers its ring under a lock the first time
+ *  it records, and gives it back when it exits for the next thread to take
+ *  over, so there are only as many rings as threads ever alive at once.  The
+ *  events of an exited thread are dumped until its ring is taken over.
+ *
+ *  aesd_trace_dump() writes what the rings hold, while threads keep
+ *  recording, as a Chrome trace event file that chrome://tracing and
+ *  https://ui.perfetto.dev open: one complete ("X") event per phase on the
+ *  track of the thread that ran it, times in microseconds of
+ *  CLOCK_MONOTONIC.  An event being overwritten while dumped is skipped.
+ *
+ *  Disabled, aesd_trace_begin() returns 0 and aesd_trace_end() ignores it.
+ */
+
+#ifndef AESD_TRACE_H
+#define AESD_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define AESD_TRACE_DEFAULT_RING_EVENTS 8192
+
+enum aesd_trace_phase {
+    /* Startup, from main() to listening */
+    AESD_TRACE_STARTUP,
+    AESD_TRACE_DAEMONIZE,
+    AESD_TRACE_BACKEND_START,
+    AESD_TRACE_GETADDRINFO,
+    AESD_TRACE_LISTEN,
+    /* From listening to the first connection accepted */
+    AESD_TRACE_FIRST_ACCEPT,
+    /* Serving a text packet, from its receive to its reply sent, the phases below nest in it */
+    AESD_TRACE_PACKET,
+    AESD_TRACE_RECV,
+    /* Waiting out a rate limit */
+    AESD_TRACE_THROTTLE,
+    /* Waiting for a turn at the data */
+    AESD_TRACE_TURN_WAIT,
+    AESD_TRACE_WRITE,
+    AESD_TRACE_FSYNC,
+    AESD_TRACE_REPLY_READ,
+    AESD_TRACE_SEND,
+    /* Handling a batch of binary frames */
+    AESD_TRACE_FRAMES,
+    AESD_TRACE_PHASES,
+};
+
+/**
+ * Start recording, keeping the last @param ring_events phases of each thread, rounded up to a power of two
+ * @return 0 on success, -1 if already enabled
+ */
+int aesd_trace_enable(size_t ring_events);
+
+/**
+ * @return the start time of a phase to pass to aesd_trace_end(), 0 if recording is disabled
+ */
+uint64_t aesd_trace_begin(void);
+
+/**
+ * Record that @param phase ran on this thread from @param start_ns, returned by aesd_trace_begin(),
+ * to now.  @param bytes, if not 0, is shown with it
+ */
+void aesd_trace_end(enum aesd_trace_phase phase, uint64_t start_ns, uint64_t bytes);
+
+/**
+ * Name the track of the calling thread in dumps, @param name must outlive the trace
+ */
+void aesd_trace_thread_name(const char *name);
+
+/**
+ * Write the phases every ring holds to @param path, replacing it whole once written
+ * @return the number of events written, -1 with errno set on failure
+ */
+ssize_t aesd_trace_dump(const char *path);
+
+/**
+ * Stop recording and free every ring.  No thread may be recording
+ */
+void aesd_trace_shutdown(void);
+
+#endif /* AESD_TRACE_H */
@@ -2,19 +2,54 @@
  * @file aesdsocket.c
  * @brief Multi-threaded socket server for AESD assignment 8
  *
- * Supports both character device mode (/dev/aesdchar)
- * and file mode (/var/tmp/aesdsocketdata) depending on
- * USE_AESD_CHAR_DEVICE define.
+ * Stores the data in one of the backends of aesd_backend.h, selected with
+ * -s: the aesdchar device, its in-process emulation, a plain file or the
+ * checksummed log of aesd_log, block compressed with -z.  Without -s the
+ * build switches pick the default: USE_AESD_CHAR_DEVICE the device or the
+ * log, USE_AESD_EMU the emulation, USE_AESD_COMPRESS compression.  Each
+ * connection opens the backend once and keeps the descriptor.
+ *
+ * The file backends start from an empty file and remove it on exit
+ * unless run with -k, which keeps the data across restarts, with the log
+ * recovering every intact record after a crash.  They also get a
+ * timestamp line appended every TIMESTAMP_INTSEC seconds.
+ *
+ * Connections take turns at the data in the order they asked, through
+ * aesd_sched, and long replies are read back a chunk per turn, so one
+ * client cannot hold the data while others wait.  -i and -o limit the
+ * bytes per second received from and sent to each client address, -b
+ * sets the burst allowed above those rates.  Binary mode clients can
+ * read the per client counters with AESD_OP_CLIENT_STATS.
+ *
+ * A connection sending AESD_PROTO_SUBSCRIBE is pushed every packet appended
+ * from then on through aesd_fanout, which copies each packet once however
+ * many subscribers there are and bounds what each may fall behind by.
+ * Subscribed connections are then served together by one thread, which
+ * polls them all and never blocks on a slow one.
+ *
+ * -T path records the time each startup step and each phase of serving a
+ * packet takes through aesd_trace, and writes the latest of them to path
+ * as a Chrome trace on every SIGUSR1 and on exit.
  */
 
+#ifndef USE_AESD_EMU
+#define USE_AESD_EMU 0
+#endif
+
 #ifndef USE_AESD_CHAR_DEVICE
 #define USE_AESD_CHAR_DEVICE 1
 #endif
 
-#if USE_AESD_CHAR_DEVICE
-#define FILE_PATH "/dev/aesdchar"
+#ifndef USE_AESD_COMPRESS
+#define USE_AESD_COMPRESS 0
+#endif
+
+#if USE_AESD_EMU
+#define DEFAULT_BACKEND "memory"
+#elif USE_AESD_CHAR_DEVICE
+#define DEFAULT_BACKEND "chardev"
 #else
-#define FILE_PATH "/var/tmp/aesdsocketdata"
+#define DEFAULT_BACKEND "log"
 #endif
 
 #include <stdio.h>
@@ -24,6 +59,7 @@
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <syslog.h>
 #include <signal.h>
@@ -33,34 +69,98 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <sys/queue.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include "../aesd-char-driver/aesd_ioctl.h"
+#include "aesdsocket_proto.h"
+#include "aesdsocket_parse.h"
+#include "aesd_lz4.h"
+#include "aesd_sched.h"
+#include "aesd_fanout.h"
+#include "aesd_backend.h"
+#include "aesd_trace.h"
+#include <endian.h>
 
 #define PORT             "9000"
 #define BUFFER_SIZE      1024
 #define TIMESTAMP_INTSEC 10
+/* Bytes of a reply read back per turn at the data */
+#define SEND_CHUNK          (16 * BUFFER_SIZE)
+/* Packets, and bytes, a subscriber may fall behind by before it loses some or is disconnected */
+#define SUBSCRIBER_QUEUE_PACKETS 1024
+#define SUBSCRIBER_QUEUE_BYTES   (1024 * 1024)
 
 static int  g_server_socket = -1;
 static bool g_exit_flag     = false;
 pthread_mutex_t g_mutex     = PTHREAD_MUTEX_INITIALIZER;
 
+/* Signalled when the last client thread leaves g_thread_list_head */
+static pthread_cond_t g_clients_done = PTHREAD_COND_INITIALIZER;
+/* Rate limits, and the turns every access to the data is made in */
+static struct aesd_sched *g_sched;
+/* Subscribed connections, every packet appended is published to */
+static struct aesd_fanout *g_fanout;
+/* Where the data is kept, every call on a data descriptor goes through g_backend */
+static const struct aesd_backend *g_backend;
+static struct aesd_backend_options g_backend_options;
+/* Where -T dumps the trace, NULL when not tracing, and the signal asking for a dump */
+static char *g_trace_path;
+static sigset_t g_trace_signals;
+
 typedef struct client_thread_s {
-    pthread_t thread_id;
     int client_fd;
     struct sockaddr_in client_addr;
+    /* Descriptor of the data, open for the life of the connection */
+    int data_fd;
+    struct aesd_sched_client *sched_client;
+    /* Start of a text packet appended but not yet newline terminated, so not yet published */
+    char *unpublished;
+    size_t unpublished_len;
     SLIST_ENTRY(client_thread_s) entries;
 } client_thread_t;
 
+/* Connected clients, protected by g_mutex */
 SLIST_HEAD(slisthead, client_thread_s) g_thread_list_head =
     SLIST_HEAD_INITIALIZER(g_thread_list_head);
 
+/* A subscribed connection, served by subscriber_thread_func() */
+typedef struct subscriber_s {
+    client_thread_t *tinfo;
+    struct aesd_fanout_sub *sub;
+    /* Message being sent, NULL between messages, and how much of it has gone out */
+    struct aesd_fanout_msg *msg;
+    const char *data;
+    size_t len;
+    size_t sent;
+    /* CLOCK_MONOTONIC time the client's send rate holds msg back until */
+    uint64_t send_after_ns;
+    SLIST_ENTRY(subscriber_s) entries;
+} subscriber_t;
+
+/* Subscribers handed over and not yet picked up, and the request to stop, protected by g_mutex */
+static SLIST_HEAD(, subscriber_s) g_new_subscribers = SLIST_HEAD_INITIALIZER(g_new_subscribers);
+static bool g_subscribers_stop;
+/* Wakes subscriber_thread_func() for either */
+static int g_subscriber_wake = -1;
+
 void* client_thread_func(void* thread_param);
-#if !USE_AESD_CHAR_DEVICE
 void* timestamp_thread_func(void* arg);
-#endif
+void* trace_dump_thread_func(void* arg);
 void  cleanup_and_exit(int signum);
 void  graceful_shutdown(void);
 int   setup_server_socket(const char* port);
 void  daemonize(void);
+void  send_from_position(client_thread_t *tinfo, int fd);
+static int send_all(int client_fd, const char *data, size_t len);
+static void turn_begin(struct aesd_sched_client *client);
+static void throttle_in(client_thread_t *tinfo, size_t bytes);
+static void throttle_out(client_thread_t *tinfo, size_t bytes);
+void  serve_binary(client_thread_t *tinfo, const char *pending, size_t pending_len);
+void* subscriber_thread_func(void* arg);
+static int hand_to_subscriber_thread(client_thread_t *tinfo, struct aesd_fanout_sub *sub);
+static void close_client(client_thread_t *tinfo);
+static ssize_t append_data(client_thread_t *tinfo, int fd, const void *data, size_t len);
 
 void cleanup_and_exit(int signum)
 {
@@ -96,27 +196,125 @@ int main(int argc, char *argv[])
     signal(SIGINT, cleanup_and_exit);
     signal(SIGTERM, cleanup_and_exit);
 
-    int daemon_mode = (argc == 2 && strcmp(argv[1], "-d") == 0);
-    if (daemon_mode)
+    bool daemon_mode = false;
+    const char *backend_name = DEFAULT_BACKEND;
+    struct aesd_sched_limits limits = {0};
+    pthread_t trace_thread;
+    uint64_t startup, first_accept, traced;
+    int opt;
+
+    g_backend_options.compress = USE_AESD_COMPRESS;
+    while ((opt = getopt(argc, argv, "dks:zi:o:b:T:")) != -1) {
+        switch (opt) {
+        case 'd':
+            daemon_mode = true;
+            break;
+        case 'k':
+            g_backend_options.keep_data = true;
+            break;
+        case 's':
+            backend_name = optarg;
+            break;
+        case 'z':
+            g_backend_options.compress = true;
+            break;
+        case 'i':
+            limits.in_rate = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            limits.out_rate = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            limits.in_burst = limits.out_burst = strtoull(optarg, NULL, 0);
+            break;
+        case 'T': {
+            // Daemonizing changes to /, so keep a relative path to where we were started
+            char *cwd = optarg[0] == '/' ? NULL : get_current_dir_name();
+
+            free(g_trace_path);
+            if (optarg[0] == '/')
+                g_trace_path = strdup(optarg);
+            else if (!cwd || asprintf(&g_trace_path, "%s/%s", cwd, optarg) < 0)
+                g_trace_path = NULL;
+            free(cwd);
+            if (!g_trace_path) {
+                syslog(LOG_ERR, "Failed to resolve the trace path %s", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+        default:
+            syslog(LOG_ERR, "Usage: %s [-d] [-k] [-s chardev|memory|file|log] [-z] [-i bytes_per_s] [-o bytes_per_s] "
+                   "[-b burst_bytes] [-T trace_path]", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (g_trace_path) {
+        aesd_trace_enable(AESD_TRACE_DEFAULT_RING_EVENTS);
+        // Every thread inherits SIGUSR1 blocked, only trace_dump_thread_func() takes it
+        sigemptyset(&g_trace_signals);
+        sigaddset(&g_trace_signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &g_trace_signals, NULL);
+    }
+    aesd_trace_thread_name("main");
+    startup = aesd_trace_begin();
+    g_backend = aesd_backend_find(backend_name);
+    if (!g_backend) {
+        syslog(LOG_ERR, "Unknown backend %s", backend_name);
+        return EXIT_FAILURE;
+    }
+    g_backend_options.path = g_backend->default_path;
+    if (daemon_mode) {
+        traced = aesd_trace_begin();
         daemonize();
+        aesd_trace_end(AESD_TRACE_DAEMONIZE, traced, 0);
+    }
+    // After daemonize(), whose forks would leave it behind
+    if (g_trace_path && pthread_create(&trace_thread, NULL, trace_dump_thread_func, NULL) != 0) {
+        syslog(LOG_ERR, "Failed to start the trace dump thread");
+        return EXIT_FAILURE;
+    }
 
-#if !USE_AESD_CHAR_DEVICE
-    int fd = open(FILE_PATH, O_CREAT | O_RDWR | O_TRUNC, 0666);
-    if (fd < 0) {
-        syslog(LOG_ERR, "Failed to open/create %s: %s", FILE_PATH, strerror(errno));
+    g_sched = aesd_sched_create(&limits);
+    if (!g_sched) {
+        syslog(LOG_ERR, "aesd_sched_create failed");
         return EXIT_FAILURE;
     }
-    close(fd);
+    g_fanout = aesd_fanout_create(SUBSCRIBER_QUEUE_PACKETS, SUBSCRIBER_QUEUE_BYTES);
+    if (!g_fanout) {
+        syslog(LOG_ERR, "aesd_fanout_create failed");
+        return EXIT_FAILURE;
+    }
+    pthread_t subscriber_thread;
+    g_subscriber_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_subscriber_wake < 0 || pthread_create(&subscriber_thread, NULL, subscriber_thread_func, NULL) != 0) {
+        syslog(LOG_ERR, "Failed to start the subscriber thread");
+        return EXIT_FAILURE;
+    }
+
+    traced = aesd_trace_begin();
+    if (g_backend->start(&g_backend_options) < 0) {
+        syslog(LOG_ERR, "Failed to open/create %s: %s", g_backend_options.path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    aesd_trace_end(AESD_TRACE_BACKEND_START, traced, 0);
+    syslog(LOG_INFO, "Storing data with the %s backend in %s", g_backend->name, g_backend_options.path);
 
     pthread_t timer_thread;
-    pthread_create(&timer_thread, NULL, timestamp_thread_func, NULL);
-#endif
+    if (g_backend->is_file)
+        pthread_create(&timer_thread, NULL, timestamp_thread_func, NULL);
 
     g_server_socket = setup_server_socket(PORT);
     if (g_server_socket < 0) {
         syslog(LOG_ERR, "setup_server_socket failed");
         g_exit_flag = true;
     }
+    // Detached, graceful_shutdown() waits for g_thread_list_head to empty instead of joining
+    pthread_attr_t client_attr;
+    pthread_attr_init(&client_attr);
+    pthread_attr_setdetachstate(&client_attr, PTHREAD_CREATE_DETACHED);
+    aesd_trace_end(AESD_TRACE_STARTUP, startup, 0);
+    first_accept = aesd_trace_begin();
 
     while (!g_exit_flag) {
         struct sockaddr_in client_addr;
@@ -128,6 +326,8 @@ int main(int argc, char *argv[])
                 syslog(LOG_ERR, "accept failed: %s", strerror(errno));
             continue;
         }
+        aesd_trace_end(AESD_TRACE_FIRST_ACCEPT, first_accept, 0);
+        first_accept = 0;
 
         client_thread_t *new_node = malloc(sizeof(client_thread_t));
         if (!new_node) {
@@ -137,24 +337,61 @@ int main(int argc, char *argv[])
         }
         new_node->client_fd  = client_fd;
         new_node->client_addr = client_addr;
+        new_node->data_fd = -1;
+        new_node->sched_client = aesd_sched_join(g_sched, client_addr.sin_addr);
+        new_node->unpublished = NULL;
+        new_node->unpublished_len = 0;
+        if (!new_node->sched_client) {
+            syslog(LOG_ERR, "aesd_sched_join failed for client");
+            free(new_node);
+            close(client_fd);
+            continue;
+        }
 
+        /*
+         * A connection blocks its thread in recv() for as long as the client stays connected, so
+         * each one gets its own thread rather than holding a worker of a fixed pool
+         */
+        pthread_mutex_lock(&g_mutex);
         SLIST_INSERT_HEAD(&g_thread_list_head, new_node, entries);
-        int rc = pthread_create(&new_node->thread_id, NULL, client_thread_func, (void*)new_node);
+        pthread_mutex_unlock(&g_mutex);
+        pthread_t client_thread;
+        int rc = pthread_create(&client_thread, &client_attr, client_thread_func, new_node);
         if (rc != 0) {
             syslog(LOG_ERR, "pthread_create failed: %s", strerror(rc));
+            pthread_mutex_lock(&g_mutex);
             SLIST_REMOVE(&g_thread_list_head, new_node, client_thread_s, entries);
+            pthread_mutex_unlock(&g_mutex);
+            aesd_sched_leave(g_sched, new_node->sched_client);
             free(new_node);
             close(client_fd);
         }
     }
 
     graceful_shutdown();
+    pthread_attr_destroy(&client_attr);
 
-#if !USE_AESD_CHAR_DEVICE
-    pthread_join(timer_thread, NULL);
-    remove(FILE_PATH);
-#endif
+    // Every subscriber was closed with the other clients
+    pthread_mutex_lock(&g_mutex);
+    g_subscribers_stop = true;
+    pthread_mutex_unlock(&g_mutex);
+    eventfd_write(g_subscriber_wake, 1);
+    pthread_join(subscriber_thread, NULL);
+    close(g_subscriber_wake);
 
+    if (g_backend->is_file)
+        pthread_join(timer_thread, NULL);
+    g_backend->stop(&g_backend_options);
+    if (g_trace_path) {
+        // A last dump of everything up to the exit
+        pthread_kill(trace_thread, SIGUSR1);
+        pthread_join(trace_thread, NULL);
+        aesd_trace_shutdown();
+        free(g_trace_path);
+    }
+
+    aesd_fanout_destroy(g_fanout);
+    aesd_sched_destroy(g_sched);
     pthread_mutex_destroy(&g_mutex);
     closelog();
     return 0;
@@ -167,97 +404,860 @@ void* client_thread_func(void* thread_param)
     syslog(LOG_INFO, "Accepted connection from %s", ip_str);
 
     char buffer[BUFFER_SIZE];
-    ssize_t bytes_received;
+    ssize_t bytes_received = 0;
+    uint64_t packet_start = 0, traced;
 
-    while (!g_exit_flag) {
+    aesd_trace_thread_name("client");
+    int fd = g_backend->open(g_backend_options.path, O_RDWR | O_APPEND);
+    if (fd < 0)
+        syslog(LOG_ERR, "Failed to open %s: %s", g_backend_options.path, strerror(errno));
+    tinfo->data_fd = fd;
+
+    while (fd >= 0 && !g_exit_flag) {
+        // Every way through the loop ends the packet here
+        aesd_trace_end(AESD_TRACE_PACKET, packet_start, bytes_received);
+        traced = aesd_trace_begin();
         bytes_received = recv(tinfo->client_fd, buffer, BUFFER_SIZE, 0);
+        aesd_trace_end(AESD_TRACE_RECV, traced, bytes_received > 0 ? bytes_received : 0);
+        packet_start = 0;
         if (bytes_received <= 0)
             break;
+        packet_start = aesd_trace_begin();
+        throttle_in(tinfo, bytes_received);
 
-        pthread_mutex_lock(&g_mutex);
-        int fd = open(FILE_PATH, O_RDWR | O_APPEND);
-        if (fd < 0) {
-            syslog(LOG_ERR, "Failed to open %s: %s", FILE_PATH, strerror(errno));
-            pthread_mutex_unlock(&g_mutex);
+        turn_begin(tinfo->sched_client);
+        struct aesd_text_command cmd;
+        aesd_parse_text_command(buffer, bytes_received, &cmd);
+
+        /* Switch to the binary framed protocol, anything after the hello line is its first frames */
+        if (cmd.kind == AESD_TEXT_BINARY_HELLO)
+        {
+            aesd_sched_turn_end(g_sched);
+            aesd_trace_end(AESD_TRACE_PACKET, packet_start, bytes_received);
+            packet_start = 0;
+            serve_binary(tinfo, buffer + cmd.hello_len, bytes_received - cmd.hello_len);
             break;
         }
-                /* Check for AESDCHAR_IOCSEEKTO:X,Y command */
-        if (strncmp(buffer, "AESDCHAR_IOCSEEKTO:", 19) == 0)
+        /*
+         * Subscribe within the turn, so the subscriber receives exactly what is appended after
+         * everything this connection sent before
+         */
+        if (cmd.kind == AESD_TEXT_SUBSCRIBE)
         {
-            struct aesd_seekto seekto;
-            unsigned int write_cmd = 0, write_cmd_offset = 0;
+            struct aesd_fanout_sub *sub = aesd_fanout_subscribe(g_fanout, cmd.drop ? AESD_FANOUT_DROP_OLDEST
+                                                                                   : AESD_FANOUT_DISCONNECT);
 
-            if (sscanf(buffer + 19, "%u,%u", &write_cmd, &write_cmd_offset) == 2)
-            {
-                seekto.write_cmd = write_cmd;
-                seekto.write_cmd_offset = write_cmd_offset;
+            aesd_sched_turn_end(g_sched);
+            aesd_trace_end(AESD_TRACE_PACKET, packet_start, bytes_received);
+            packet_start = 0;
+            if (!sub) {
+                syslog(LOG_ERR, "Failed to subscribe %s: %s", ip_str, strerror(errno));
+                break;
+            }
+            // Nothing is read from the data any more, only pushed from the fan-out
+            g_backend->close(fd);
+            tinfo->data_fd = fd = -1;
+            if (hand_to_subscriber_thread(tinfo, sub) == 0)
+                return NULL;
+            syslog(LOG_ERR, "Out of memory handing %s to the subscriber thread", ip_str);
+            aesd_fanout_unsubscribe(g_fanout, sub);
+            break;
+        }
 
-                if (ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) == -1)
-                {
-                    syslog(LOG_ERR, "ioctl AESDCHAR_IOCSEEKTO failed: %s", strerror(errno));
-                }
-                else
-                {
-                    /* Read from same FD to preserve new seek offset */
-                    char read_buf[BUFFER_SIZE];
-                    ssize_t read_size;
-                    lseek(fd, 0, SEEK_CUR); // ensure correct position
-
-                    while ((read_size = read(fd, read_buf, sizeof(read_buf))) > 0)
-                    {
-                        if (send(tinfo->client_fd, read_buf, read_size, 0) == -1)
-                        {
-                            syslog(LOG_ERR, "Send failed: %s", strerror(errno));
-                            break;
-                        }
-                    }
-                }
+        /* AESDCHAR_IOCSEEKTO:X,Y command */
+        if (cmd.kind == AESD_TEXT_SEEKTO)
+        {
+            if (g_backend->ioctl(fd, AESDCHAR_IOCSEEKTO, &cmd.seekto) == -1)
+            {
+                syslog(LOG_ERR, "ioctl AESDCHAR_IOCSEEKTO failed: %s", strerror(errno));
+                aesd_sched_turn_end(g_sched);
             }
             else
             {
-                syslog(LOG_ERR, "Malformed AESDCHAR_IOCSEEKTO command");
+                send_from_position(tinfo, fd);
             }
+            continue; /* Skip normal write path */
+        }
 
-            close(fd);
-            pthread_mutex_unlock(&g_mutex);
+        /* AESDCHAR_IOCSEEKSINCE:seq,N or AESDCHAR_IOCSEEKSINCE:time,NS command */
+        if (cmd.kind == AESD_TEXT_SEEK_SINCE)
+        {
+            if (g_backend->ioctl(fd, AESDCHAR_IOCSEEKSINCE, &cmd.since) == -1)
+            {
+                syslog(LOG_ERR, "ioctl AESDCHAR_IOCSEEKSINCE failed: %s", strerror(errno));
+                aesd_sched_turn_end(g_sched);
+            }
+            else
+            {
+                syslog(LOG_DEBUG, "Replaying from sequence number %llu", (unsigned long long)cmd.since.seq);
+                send_from_position(tinfo, fd);
+            }
             continue; /* Skip normal write path */
         }
 
+        if (cmd.kind == AESD_TEXT_MALFORMED)
+        {
+            syslog(LOG_ERR, "Malformed %s command",
+                   cmd.malformed == AESD_TEXT_SEEKTO ? "AESDCHAR_IOCSEEKTO" : "AESDCHAR_IOCSEEKSINCE");
+            aesd_sched_turn_end(g_sched);
+            continue; /* Skip normal write path */
+        }
 
-        write(fd, buffer, bytes_received);
-        fsync(fd);
+        traced = aesd_trace_begin();
+        append_data(tinfo, fd, buffer, bytes_received);
+        aesd_trace_end(AESD_TRACE_WRITE, traced, bytes_received);
+        traced = aesd_trace_begin();
+        g_backend->fsync(fd);
+        aesd_trace_end(AESD_TRACE_FSYNC, traced, 0);
 
-        if (memchr(buffer, '\n', bytes_received)) {
-            close(fd);
-            fd = open(FILE_PATH, O_RDONLY);
-            if (fd >= 0) {
-                ssize_t n;
-                while ((n = read(fd, buffer, BUFFER_SIZE)) > 0)
-                    send(tinfo->client_fd, buffer, n, 0);
-                close(fd);
-            }
+        /* A complete packet is answered with all the data, read back from the start */
+        if (!memchr(buffer, '\n', bytes_received)) {
+            aesd_sched_turn_end(g_sched);
+        } else if (g_backend->lseek(fd, 0, SEEK_SET) == (off_t)-1) {
+            syslog(LOG_ERR, "Failed to rewind %s: %s", g_backend_options.path, strerror(errno));
+            aesd_sched_turn_end(g_sched);
         } else {
-            close(fd);
+            send_from_position(tinfo, fd);
         }
-
-        pthread_mutex_unlock(&g_mutex);
     }
+    aesd_trace_end(AESD_TRACE_PACKET, packet_start, bytes_received);
+
+    close_client(tinfo);
+    return NULL;
+}
+
+/**
+ * Close the connection of @param tinfo, and its data descriptor if still open, and free it.  The
+ * last step of serving a client, on whichever thread served it last
+ */
+static void close_client(client_thread_t *tinfo)
+{
+    char *ip_str = inet_ntoa(tinfo->client_addr.sin_addr);
 
+    if (tinfo->data_fd >= 0)
+        g_backend->close(tinfo->data_fd);
     shutdown(tinfo->client_fd, SHUT_RDWR);
     close(tinfo->client_fd);
     syslog(LOG_INFO, "Closed connection from %s", ip_str);
 
+    struct aesd_sched_stats stats;
+    aesd_sched_get_stats(g_sched, tinfo->sched_client, &stats);
+    if (stats.throttled_in || stats.throttled_out)
+        syslog(LOG_INFO, "Client %s throttled so far: %llu receives for %llu ms, %llu sends for %llu ms",
+               ip_str, (unsigned long long)stats.throttled_in, (unsigned long long)(stats.throttled_in_ns / 1000000),
+               (unsigned long long)stats.throttled_out, (unsigned long long)(stats.throttled_out_ns / 1000000));
+    aesd_sched_leave(g_sched, tinfo->sched_client);
+
     pthread_mutex_lock(&g_mutex);
     SLIST_REMOVE(&g_thread_list_head, tinfo, client_thread_s, entries);
+    if (SLIST_EMPTY(&g_thread_list_head))
+        pthread_cond_broadcast(&g_clients_done);
     pthread_mutex_unlock(&g_mutex);
 
+    free(tinfo->unpublished);
     free(tinfo);
+}
+
+/**
+ * Wait for a turn at the data for @param client, NULL for the server itself, recording the wait
+ */
+static void turn_begin(struct aesd_sched_client *client)
+{
+    uint64_t traced = aesd_trace_begin();
+
+    aesd_sched_turn_begin(g_sched, client);
+    aesd_trace_end(AESD_TRACE_TURN_WAIT, traced, 0);
+}
+
+/**
+ * Count @param bytes received from the client of @param tinfo, waiting out its receive rate
+ */
+static void throttle_in(client_thread_t *tinfo, size_t bytes)
+{
+    uint64_t traced = aesd_trace_begin();
+
+    aesd_sched_throttle_in(g_sched, tinfo->sched_client, bytes);
+    aesd_trace_end(AESD_TRACE_THROTTLE, traced, bytes);
+}
+
+/**
+ * Count @param bytes about to be sent to the client of @param tinfo, waiting out its send rate
+ */
+static void throttle_out(client_thread_t *tinfo, size_t bytes)
+{
+    uint64_t traced = aesd_trace_begin();
+
+    aesd_sched_throttle_out(g_sched, tinfo->sched_client, bytes);
+    aesd_trace_end(AESD_TRACE_THROTTLE, traced, bytes);
+}
+
+/**
+ * Publish the packets @param data completes to the subscribers, with the start of the first held
+ * in @param tinfo, and hold on to the start of any packet it leaves unterminated.  A packet longer
+ * than a subscriber queue is published in pieces of that size
+ */
+static void publish_packets(client_thread_t *tinfo, const char *data, size_t len)
+{
+    const char *newline = memrchr(data, '\n', len);
+    size_t complete = newline ? newline + 1 - data : 0;
+    struct iovec iov[2] = {
+        { .iov_base = tinfo->unpublished, .iov_len = tinfo->unpublished_len },
+        { .iov_base = (void *)data, .iov_len = complete },
+    };
+    char *unpublished;
+
+    if (!newline && tinfo->unpublished_len + len >= SUBSCRIBER_QUEUE_BYTES)
+        iov[1].iov_len = complete = len;
+    if (complete > 0) {
+        if (aesd_fanout_publishv(g_fanout, iov, 2) < 0)
+            syslog(LOG_ERR, "Out of memory publishing %zu bytes to subscribers", iov[0].iov_len + complete);
+        tinfo->unpublished_len = 0;
+    }
+    if (complete == len)
+        return;
+    unpublished = realloc(tinfo->unpublished, tinfo->unpublished_len + len - complete);
+    if (!unpublished) {
+        syslog(LOG_ERR, "Out of memory holding a partial packet for subscribers");
+        tinfo->unpublished_len = 0;
+        return;
+    }
+    memcpy(unpublished + tinfo->unpublished_len, data + complete, len - complete);
+    tinfo->unpublished = unpublished;
+    tinfo->unpublished_len += len - complete;
+}
+
+/**
+ * Append @param len bytes of @param data to @param fd and publish them to the subscribers, called
+ * in a turn so subscribers see packets in the order they were appended.  @param tinfo is the text
+ * connection the bytes came from, whose packets are published once complete, or NULL to publish
+ * @param data as it is
+ * @return the result of the backend write
+ */
+static ssize_t append_data(client_thread_t *tinfo, int fd, const void *data, size_t len)
+{
+    ssize_t written = g_backend->write(fd, data, len);
+
+    if (written <= 0)
+        return written;
+    if (tinfo)
+        publish_packets(tinfo, data, written);
+    else if (aesd_fanout_publish(g_fanout, data, written) < 0)
+        syslog(LOG_ERR, "Out of memory publishing %zd bytes to subscribers", written);
+    return written;
+}
+
+/**
+ * Queue the subscribed connection of @param tinfo for subscriber_thread_func(), which serves it
+ * from then on and closes it
+ * @return 0 on success, -1 if out of memory
+ */
+static int hand_to_subscriber_thread(client_thread_t *tinfo, struct aesd_fanout_sub *sub)
+{
+    subscriber_t *subscriber = calloc(1, sizeof(*subscriber));
+
+    if (!subscriber)
+        return -1;
+    subscriber->tinfo = tinfo;
+    subscriber->sub = sub;
+    syslog(LOG_DEBUG, "Switching connection to subscriber");
+    pthread_mutex_lock(&g_mutex);
+    SLIST_INSERT_HEAD(&g_new_subscribers, subscriber, entries);
+    pthread_mutex_unlock(&g_mutex);
+    eventfd_write(g_subscriber_wake, 1);
+    return 0;
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Send what is queued to @param subscriber as far as its socket buffer and send rate allow,
+ * without blocking
+ * @return 0 to keep serving it, -1 once it is to be closed
+ */
+static int subscriber_send(subscriber_t *subscriber)
+{
+    for (;;) {
+        if (!subscriber->msg) {
+            bool cut_off = false;
+
+            subscriber->msg = aesd_fanout_next(g_fanout, subscriber->sub, &cut_off);
+            if (!subscriber->msg)
+                return cut_off ? -1 : 0;
+            subscriber->data = aesd_fanout_msg_data(subscriber->msg, &subscriber->len);
+            subscriber->sent = 0;
+            subscriber->send_after_ns = monotonic_ns() +
+                aesd_sched_charge_out(g_sched, subscriber->tinfo->sched_client, subscriber->len);
+        }
+        if (monotonic_ns() < subscriber->send_after_ns)
+            return 0;
+
+        uint64_t traced = aesd_trace_begin();
+        ssize_t sent = send(subscriber->tinfo->client_fd, subscriber->data + subscriber->sent,
+                            subscriber->len - subscriber->sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (sent < 0) {
+            syslog(LOG_ERR, "Send failed: %s", strerror(errno));
+            return -1;
+        }
+        aesd_trace_end(AESD_TRACE_SEND, traced, sent);
+        subscriber->sent += sent;
+        if (subscriber->sent == subscriber->len) {
+            aesd_fanout_msg_put(subscriber->msg);
+            subscriber->msg = NULL;
+        }
+    }
+}
+
+/**
+ * Unsubscribe @param subscriber, close its connection and free it
+ */
+static void subscriber_close(subscriber_t *subscriber)
+{
+    struct aesd_fanout_sub_stats stats;
+
+    if (subscriber->msg)
+        aesd_fanout_msg_put(subscriber->msg);
+    aesd_fanout_get_stats(g_fanout, subscriber->sub, &stats);
+    syslog(LOG_INFO, "Subscriber %s received %llu bytes, dropped %llu bytes%s",
+           inet_ntoa(subscriber->tinfo->client_addr.sin_addr), (unsigned long long)stats.delivered_bytes,
+           (unsigned long long)stats.dropped_bytes, stats.cut_off ? " and was disconnected" : "");
+    aesd_fanout_unsubscribe(g_fanout, subscriber->sub);
+    close_client(subscriber->tinfo);
+    free(subscriber);
+}
+
+/**
+ * Serve every subscribed connection from one thread, so subscribers cost no thread each.  A poll
+ * covers each connection, for its close or anything it sends, which is discarded, and either its
+ * fan-out descriptor or, while a message is partly sent, its socket becoming writable.  A client
+ * over its send rate is polled again once its next message may go.  Connections are closed when
+ * the client closes or is cut off, including by graceful_shutdown() shutting down their reading
+ * side, and the thread exits once main() asks and every subscriber is gone
+ */
+void* subscriber_thread_func(void* arg)
+{
+    subscriber_t **subs = NULL;
+    struct pollfd *fds = NULL;
+    size_t nr_subs = 0, capacity = 0, i;
+    char discard[BUFFER_SIZE];
+
+    (void)arg;
+    aesd_trace_thread_name("subscribers");
+    for (;;) {
+        bool stop;
+
+        pthread_mutex_lock(&g_mutex);
+        while (!SLIST_EMPTY(&g_new_subscribers)) {
+            subscriber_t *subscriber = SLIST_FIRST(&g_new_subscribers);
+
+            if (nr_subs == capacity) {
+                size_t new_capacity = capacity ? capacity * 2 : 16;
+                subscriber_t **new_subs = realloc(subs, new_capacity * sizeof(*subs));
+                struct pollfd *new_fds = new_subs ? realloc(fds, (1 + 2 * new_capacity) * sizeof(*fds)) : NULL;
+
+                if (new_subs)
+                    subs = new_subs;
+                if (!new_fds) {
+                    // Left queued, picked up on a later pass
+                    syslog(LOG_ERR, "Out of memory serving %zu subscribers", nr_subs + 1);
+                    break;
+                }
+                fds = new_fds;
+                capacity = new_capacity;
+            }
+            SLIST_REMOVE_HEAD(&g_new_subscribers, entries);
+            subs[nr_subs++] = subscriber;
+        }
+        stop = g_subscribers_stop;
+        pthread_mutex_unlock(&g_mutex);
+        if (stop && nr_subs == 0)
+            break;
+
+        uint64_t now = monotonic_ns();
+        int timeout_ms = -1;
+        // Until the first subscriber arrives there is only the wake descriptor to poll
+        struct pollfd wake_only, *poll_fds = fds ? fds : &wake_only;
+
+        poll_fds[0].fd = g_subscriber_wake;
+        poll_fds[0].events = POLLIN;
+        for (i = 0; i < nr_subs; i++) {
+            subscriber_t *subscriber = subs[i];
+            bool held = subscriber->msg && now < subscriber->send_after_ns;
+
+            fds[1 + 2 * i].fd = subscriber->tinfo->client_fd;
+            fds[1 + 2 * i].events = POLLIN | (subscriber->msg && !held ? POLLOUT : 0);
+            // The fan-out descriptor stays readable until aesd_fanout_next(), only poll it between messages
+            fds[2 + 2 * i].fd = subscriber->msg ? -1 : aesd_fanout_sub_fd(subscriber->sub);
+            fds[2 + 2 * i].events = POLLIN;
+            if (held) {
+                int wait_ms = (subscriber->send_after_ns - now + 999999) / 1000000;
+
+                if (timeout_ms < 0 || wait_ms < timeout_ms)
+                    timeout_ms = wait_ms;
+            }
+        }
+
+        if (poll(poll_fds, 1 + 2 * nr_subs, timeout_ms) < 0) {
+            if (errno != EINTR)
+                syslog(LOG_ERR, "poll failed: %s", strerror(errno));
+            continue;
+        }
+        if (poll_fds[0].revents) {
+            eventfd_t count;
+
+            eventfd_read(g_subscriber_wake, &count);
+        }
+
+        // Backwards, so the last subscriber moved into a closed one's place was already served
+        for (i = nr_subs; i-- > 0;) {
+            subscriber_t *subscriber = subs[i];
+            bool closing = false;
+
+            if (fds[1 + 2 * i].revents) {
+                ssize_t received = recv(subscriber->tinfo->client_fd, discard, sizeof(discard), MSG_DONTWAIT);
+
+                closing = received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                                            errno != EINTR);
+            }
+            if (closing || subscriber_send(subscriber) < 0) {
+                subscriber_close(subscriber);
+                subs[i] = subs[--nr_subs];
+            }
+        }
+    }
+
+    free(subs);
+    free(fds);
     return NULL;
 }
 
-#if !USE_AESD_CHAR_DEVICE
+/**
+ * Measure the data left to read from the current position of @param fd without moving it
+ * @return the number of bytes, or -1 on error
+ */
+static off_t data_remaining(int fd)
+{
+    off_t pos = g_backend->lseek(fd, 0, SEEK_CUR);
+    off_t end = g_backend->lseek(fd, 0, SEEK_END);
+
+    if (pos == (off_t)-1 || end == (off_t)-1 || g_backend->lseek(fd, pos, SEEK_SET) != pos)
+    {
+        syslog(LOG_ERR, "Failed to find the end of %s: %s", g_backend_options.path, strerror(errno));
+        return -1;
+    }
+    return end - pos;
+}
+
+/**
+ * Send the data from the current position of @param fd to its end, as it is in the turn this is
+ * called in, to the client of @param tinfo, keeping to the client's send rate.  Ends the turn.
+ *
+ * A file only grows, so a long reply from it is read a chunk per turn, letting other clients
+ * in between.  Offsets in the character device shift as every write pushes out the oldest, so a
+ * reply from it, a few writes at most, is read whole in the turn that positioned @param fd.
+ */
+void send_from_position(client_thread_t *tinfo, int fd)
+{
+    off_t remaining = data_remaining(fd);
+    size_t chunk = g_backend->stable_offsets ? SEND_CHUNK : remaining > 0 ? remaining : 1;
+    /* Read from same FD to preserve new seek offset */
+    char *read_buf = remaining > 0 ? malloc(chunk) : NULL;
+    bool in_turn = true;
+
+    while (read_buf && remaining > 0 && !g_exit_flag)
+    {
+        size_t want = remaining < (off_t)chunk ? remaining : chunk, len = 0;
+        ssize_t read_size;
+
+        if (!in_turn)
+            turn_begin(tinfo->sched_client);
+        uint64_t traced = aesd_trace_begin();
+        while (len < want && (read_size = g_backend->read(fd, read_buf + len, want - len)) > 0)
+            len += read_size;
+        aesd_trace_end(AESD_TRACE_REPLY_READ, traced, len);
+        aesd_sched_turn_end(g_sched);
+        in_turn = false;
+        if (len == 0)
+            break;
+        remaining -= len;
+
+        throttle_out(tinfo, len);
+        if (send_all(tinfo->client_fd, read_buf, len) < 0)
+            break;
+    }
+    if (in_turn)
+        aesd_sched_turn_end(g_sched);
+    free(read_buf);
+}
+
+/**
+ * Growable byte buffer for the frames received from and sent to a binary mode client
+ */
+struct frame_buf {
+    char *data;
+    size_t len;
+    size_t capacity;
+};
+
+/**
+ * Make room for @param extra more bytes in @param buf
+ * @return 0 on success, -1 if out of memory
+ */
+static int frame_buf_reserve(struct frame_buf *buf, size_t extra)
+{
+    size_t capacity = buf->capacity ? buf->capacity : 2 * BUFFER_SIZE;
+    char *data;
+
+    if (buf->len + extra <= buf->capacity)
+        return 0;
+    while (capacity < buf->len + extra)
+        capacity *= 2;
+    data = realloc(buf->data, capacity);
+    if (!data)
+        return -1;
+    buf->data = data;
+    buf->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Append a response header for the request @param req to @param tx
+ * @return the offset of the header in @param tx, to fill in its length later, or -1 if out of memory
+ */
+static ssize_t put_response_header(struct frame_buf *tx, const struct aesd_frame_header *req,
+                                   uint16_t status, uint32_t length)
+{
+    struct aesd_frame_header header = {
+        .length = htobe32(length),
+        .opcode = htobe16(req->opcode),
+        .flags_status = htobe16(status),
+        .request_id = htobe64(req->request_id),
+    };
+    size_t offset = tx->len;
+
+    if (frame_buf_reserve(tx, sizeof(header)) < 0)
+        return -1;
+    memcpy(tx->data + tx->len, &header, sizeof(header));
+    tx->len += sizeof(header);
+    return offset;
+}
+
+/**
+ * Replace the @param len bytes of payload at @param start, the end of @param tx, with a
+ * struct aesd_frame_compressed and the LZ4 block of those bytes
+ * @return the new payload length, or -1 if out of memory
+ */
+static ssize_t compress_payload(struct frame_buf *tx, size_t start, size_t len)
+{
+    struct aesd_frame_compressed prefix = { .raw_length = htobe32(len) };
+    size_t bound = aesd_lz4_compress_bound(len);
+    char *block = malloc(bound);
+    ssize_t compressed;
+
+    if (!block)
+        return -1;
+    compressed = aesd_lz4_compress(tx->data + start, len, block, bound);
+    tx->len = start;
+    if (compressed < 0 || frame_buf_reserve(tx, sizeof(prefix) + compressed) < 0) {
+        free(block);
+        return -1;
+    }
+    memcpy(tx->data + tx->len, &prefix, sizeof(prefix));
+    memcpy(tx->data + tx->len + sizeof(prefix), block, compressed);
+    tx->len += sizeof(prefix) + compressed;
+    free(block);
+    return sizeof(prefix) + compressed;
+}
+
+/**
+ * Append a response to @param req holding up to @param max_len bytes read from the current position
+ * of @param fd to @param tx, compressed if @param req asks for AESD_READ_FLAG_COMPRESS.  A read error
+ * is reported as the status of the response, without data.
+ * @return 0 on success, -1 if out of memory
+ */
+static int put_read_response(struct frame_buf *tx, int fd, const struct aesd_frame_header *req, size_t max_len)
+{
+    ssize_t offset = put_response_header(tx, req, 0, 0);
+    struct aesd_frame_header *header;
+    size_t total = 0;
+    uint16_t status = 0;
+
+    if (offset < 0)
+        return -1;
+    while (total < max_len) {
+        size_t chunk = max_len - total < BUFFER_SIZE ? max_len - total : BUFFER_SIZE;
+        ssize_t n;
+
+        if (frame_buf_reserve(tx, chunk) < 0)
+            return -1;
+        n = g_backend->read(fd, tx->data + tx->len, chunk);
+        if (n < 0) {
+            status = errno;
+            tx->len -= total;
+            total = 0;
+            break;
+        }
+        if (n == 0)
+            break;
+        tx->len += n;
+        total += n;
+    }
+    if (status == 0 && (req->flags_status & AESD_READ_FLAG_COMPRESS)) {
+        ssize_t compressed = compress_payload(tx, offset + sizeof(*header), total);
+
+        if (compressed < 0)
+            return -1;
+        total = compressed;
+    }
+
+    header = (struct aesd_frame_header *)(tx->data + offset);
+    header->length = htobe32(total);
+    header->flags_status = htobe16(status);
+    return 0;
+}
+
+/**
+ * Seek @param fd to the position in @param payload, a struct aesd_frame_seek or aesd_frame_range
+ * @return 0 on success, an errno value on failure
+ */
+static int seek_frame(int fd, const char *payload, uint32_t length)
+{
+    struct aesd_seekto seekto;
+    int status = aesd_frame_get_seek(payload, length, &seekto);
+
+    if (status != 0)
+        return status;
+    if (g_backend->ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) == -1)
+        return errno;
+    return 0;
+}
+
+struct client_stats_buf {
+    struct frame_buf *tx;
+    bool failed;
+};
+
+/**
+ * Append the counters @param stats of one client to the response in @param arg, a struct client_stats_buf
+ */
+static void put_client_stats_entry(const struct aesd_sched_stats *stats, void *arg)
+{
+    struct client_stats_buf *buf = arg;
+    struct aesd_frame_client_stats entry = {
+        .addr = stats->addr.s_addr,
+        .connections = htobe32(stats->connections),
+        .bytes_in = htobe64(stats->bytes_in),
+        .bytes_out = htobe64(stats->bytes_out),
+        .throttled_in = htobe64(stats->throttled_in),
+        .throttled_out = htobe64(stats->throttled_out),
+        .throttled_in_ns = htobe64(stats->throttled_in_ns),
+        .throttled_out_ns = htobe64(stats->throttled_out_ns),
+        .turns = htobe64(stats->turns),
+        .turn_wait_ns = htobe64(stats->turn_wait_ns),
+    };
+
+    if (buf->failed || frame_buf_reserve(buf->tx, sizeof(entry)) < 0) {
+        buf->failed = true;
+        return;
+    }
+    memcpy(buf->tx->data + buf->tx->len, &entry, sizeof(entry));
+    buf->tx->len += sizeof(entry);
+}
+
+/**
+ * Append the response to the AESD_OP_CLIENT_STATS request @param req to @param tx
+ * @return 0 on success, -1 if out of memory
+ */
+static int put_client_stats(struct frame_buf *tx, const struct aesd_frame_header *req)
+{
+    struct client_stats_buf buf = { .tx = tx };
+    ssize_t offset = put_response_header(tx, req, 0, 0);
+    struct aesd_frame_header *header;
+
+    if (offset < 0)
+        return -1;
+    aesd_sched_foreach(g_sched, put_client_stats_entry, &buf);
+    if (buf.failed)
+        return -1;
+    header = (struct aesd_frame_header *)(tx->data + offset);
+    header->length = htobe32(tx->len - offset - sizeof(*header));
+    return 0;
+}
+
+/**
+ * Run the request @param req with @param payload against @param fd, appending its response to @param tx
+ * @return 0 on success, -1 if out of memory
+ */
+static int handle_frame(int fd, const struct aesd_frame_header *req, const char *payload, struct frame_buf *tx)
+{
+    struct aesd_frame_range range;
+    ssize_t written;
+    int status;
+
+    switch (req->opcode) {
+    case AESD_OP_APPEND:
+        written = append_data(NULL, fd, payload, req->length);
+        if (written != (ssize_t)req->length)
+            return put_response_header(tx, req, written < 0 ? errno : EIO, 0) < 0 ? -1 : 0;
+        if (!(req->flags_status & AESD_APPEND_FLAG_READBACK))
+            return put_response_header(tx, req, 0, 0) < 0 ? -1 : 0;
+        if (g_backend->lseek(fd, 0, SEEK_SET) == (off_t)-1)
+            return put_response_header(tx, req, errno, 0) < 0 ? -1 : 0;
+        return put_read_response(tx, fd, req, SIZE_MAX);
+
+    case AESD_OP_SEEK_READ:
+        status = seek_frame(fd, payload, req->length);
+        if (status != 0)
+            return put_response_header(tx, req, status, 0) < 0 ? -1 : 0;
+        return put_read_response(tx, fd, req, SIZE_MAX);
+
+    case AESD_OP_READ_RANGE:
+        status = req->length < sizeof(range) ? EINVAL : seek_frame(fd, payload, req->length);
+        if (status != 0)
+            return put_response_header(tx, req, status, 0) < 0 ? -1 : 0;
+        memcpy(&range, payload, sizeof(range));
+        return put_read_response(tx, fd, req, be32toh(range.length));
+
+    case AESD_OP_CLIENT_STATS:
+        return put_client_stats(tx, req);
+
+    default:
+        return put_response_header(tx, req, EOPNOTSUPP, 0) < 0 ? -1 : 0;
+    }
+}
+
+/**
+ * Send all of @param len bytes of @param data to @param client_fd
+ * @return 0 on success, -1 on error
+ */
+static int send_all(int client_fd, const char *data, size_t len)
+{
+    uint64_t traced = aesd_trace_begin();
+    size_t total = len;
+
+    while (len > 0) {
+        ssize_t sent = send(client_fd, data, len, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0) {
+            syslog(LOG_ERR, "Send failed: %s", strerror(errno));
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    aesd_trace_end(AESD_TRACE_SEND, traced, total);
+    return 0;
+}
+
+/**
+ * Serve the binary framed protocol of aesdsocket_proto.h on the connection of @param tinfo until it
+ * closes.  @param pending holds @param pending_len bytes received after the hello line.
+ * Every complete frame received so far is handled in one turn at the data and their responses
+ * are sent together, so pipelined small requests cost one turn and one send per batch.
+ */
+void serve_binary(client_thread_t *tinfo, const char *pending, size_t pending_len)
+{
+    struct frame_buf rx = {0}, tx = {0};
+    struct aesd_frame_header hello = { .opcode = AESD_OP_HELLO };
+    uint32_t version = htobe32(AESD_PROTO_VERSION);
+
+    syslog(LOG_DEBUG, "Switching connection to binary protocol version %d", AESD_PROTO_VERSION);
+    // Responses are already batched into one send, Nagle would only hold them back for the ACK
+    int one = 1;
+    setsockopt(tinfo->client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (put_response_header(&tx, &hello, 0, sizeof(version)) < 0 ||
+        frame_buf_reserve(&tx, sizeof(version)) < 0 ||
+        frame_buf_reserve(&rx, pending_len) < 0)
+        goto out;
+    memcpy(tx.data + tx.len, &version, sizeof(version));
+    tx.len += sizeof(version);
+    memcpy(rx.data, pending, pending_len);
+    rx.len = pending_len;
+
+    while (!g_exit_flag) {
+        struct aesd_frame_header header;
+        size_t offset = 0, end;
+        ssize_t received, scanned;
+
+        // Find the complete frames at the start of rx
+        scanned = aesd_frame_scan(rx.data, rx.len);
+        if (scanned < 0) {
+            syslog(LOG_ERR, "Binary frame exceeds the maximum of %d bytes", AESD_FRAME_MAX_PAYLOAD);
+            goto out;
+        }
+        end = scanned;
+
+        if (end > 0) {
+            turn_begin(tinfo->sched_client);
+            uint64_t traced = aesd_trace_begin();
+            while (offset < end) {
+                aesd_frame_get_header(rx.data + offset, &header);
+                if (handle_frame(tinfo->data_fd, &header, rx.data + offset + sizeof(header), &tx) < 0) {
+                    syslog(LOG_ERR, "Out of memory building binary responses");
+                    aesd_sched_turn_end(g_sched);
+                    goto out;
+                }
+                offset += sizeof(header) + header.length;
+            }
+            aesd_trace_end(AESD_TRACE_FRAMES, traced, end);
+            traced = aesd_trace_begin();
+            g_backend->fsync(tinfo->data_fd);
+            aesd_trace_end(AESD_TRACE_FSYNC, traced, 0);
+            aesd_sched_turn_end(g_sched);
+
+            memmove(rx.data, rx.data + end, rx.len - end);
+            rx.len -= end;
+        }
+
+        if (tx.len > 0) {
+            throttle_out(tinfo, tx.len);
+            if (send_all(tinfo->client_fd, tx.data, tx.len) < 0)
+                goto out;
+            tx.len = 0;
+        }
+
+        // Room for at least the rest of a partly received frame
+        if (rx.len >= sizeof(header)) {
+            aesd_frame_get_header(rx.data, &header);
+            if (frame_buf_reserve(&rx, sizeof(header) + header.length - rx.len) < 0)
+                goto out;
+        }
+        if (frame_buf_reserve(&rx, BUFFER_SIZE) < 0)
+            goto out;
+        uint64_t traced = aesd_trace_begin();
+        received = recv(tinfo->client_fd, rx.data + rx.len, rx.capacity - rx.len, 0);
+        aesd_trace_end(AESD_TRACE_RECV, traced, received > 0 ? received : 0);
+        if (received <= 0)
+            break;
+        rx.len += received;
+        throttle_in(tinfo, received);
+    }
+
+out:
+    free(rx.data);
+    free(tx.data);
+}
+
 void* timestamp_thread_func(void* arg)
 {
+    int fd = g_backend->open(g_backend_options.path, O_WRONLY | O_APPEND);
+
+    if (fd < 0) {
+        syslog(LOG_ERR, "Failed to open %s for timestamps: %s", g_backend_options.path, strerror(errno));
+        return NULL;
+    }
+    aesd_trace_thread_name("timestamp");
     while (!g_exit_flag) {
         sleep(TIMESTAMP_INTSEC);
         if (g_exit_flag) break;
@@ -269,17 +1269,36 @@ void* timestamp_thread_func(void* arg)
         char timestr[128];
         strftime(timestr, sizeof(timestr), "timestamp:%a, %d %b %Y %T %z\n", tmp);
 
-        pthread_mutex_lock(&g_mutex);
-        FILE* file = fopen(FILE_PATH, "a");
-        if (file) {
-            fputs(timestr, file);
-            fclose(file);
-        }
-        pthread_mutex_unlock(&g_mutex);
+        turn_begin(NULL);
+        uint64_t traced = aesd_trace_begin();
+        append_data(NULL, fd, timestr, strlen(timestr));
+        aesd_trace_end(AESD_TRACE_WRITE, traced, strlen(timestr));
+        aesd_sched_turn_end(g_sched);
+    }
+    g_backend->close(fd);
+    return NULL;
+}
+
+/**
+ * Write the trace to g_trace_path on every SIGUSR1, the last time once the server is exiting
+ */
+void* trace_dump_thread_func(void* arg)
+{
+    int sig;
+
+    (void)arg;
+    while (sigwait(&g_trace_signals, &sig) == 0) {
+        ssize_t events = aesd_trace_dump(g_trace_path);
+
+        if (events < 0)
+            syslog(LOG_ERR, "Failed to write the trace to %s: %s", g_trace_path, strerror(errno));
+        else
+            syslog(LOG_INFO, "Wrote %zd trace events to %s", events, g_trace_path);
+        if (g_exit_flag)
+            break;
     }
     return NULL;
 }
-#endif
 
 void graceful_shutdown(void)
 {
@@ -288,13 +1307,20 @@ void graceful_shutdown(void)
         g_server_socket = -1;
     }
 
+    // Wake clients blocked in recv() so their threads finish the request in hand and exit
     client_thread_t *tnode;
-    while (!SLIST_EMPTY(&g_thread_list_head)) {
-        tnode = SLIST_FIRST(&g_thread_list_head);
-        SLIST_REMOVE_HEAD(&g_thread_list_head, entries);
-        pthread_join(tnode->thread_id, NULL);
-        free(tnode);
-    }
+    pthread_mutex_lock(&g_mutex);
+    SLIST_FOREACH(tnode, &g_thread_list_head, entries)
+        shutdown(tnode->client_fd, SHUT_RD);
+    pthread_mutex_unlock(&g_mutex);
+    // and those waiting out their rate limit
+    aesd_sched_shutdown(g_sched);
+
+    // Each client thread removes itself from the list as its last step
+    pthread_mutex_lock(&g_mutex);
+    while (!SLIST_EMPTY(&g_thread_list_head))
+        pthread_cond_wait(&g_clients_done, &g_mutex);
+    pthread_mutex_unlock(&g_mutex);
 }
 
 int setup_server_socket(const char* port)
@@ -307,11 +1333,15 @@ int setup_server_socket(const char* port)
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags    = AI_PASSIVE;
 
-    if ((rc = getaddrinfo(NULL, port, &hints, &servinfo)) != 0) {
+    uint64_t traced = aesd_trace_begin();
+    rc = getaddrinfo(NULL, port, &hints, &servinfo);
+    aesd_trace_end(AESD_TRACE_GETADDRINFO, traced, 0);
+    if (rc != 0) {
         syslog(LOG_ERR, "getaddrinfo failed: %s", gai_strerror(rc));
         return -1;
     }
 
+    traced = aesd_trace_begin();
     for (p = servinfo; p != NULL; p = p->ai_next) {
         sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
         if (sockfd < 0)
@@ -339,6 +1369,7 @@ int setup_server_socket(const char* port)
         return -1;
     }
 
+    aesd_trace_end(AESD_TRACE_LISTEN, traced, 0);
     syslog(LOG_INFO, "Listening on port %s", port);
     return sockfd;
 }
@@ -0,0 +1,439 @@
+/**
+ * @file aesdsocket_bench.c
+ * @brief Small packet throughput of aesdsocket's text and binary protocols
+ *
+ * Usage: aesdsocket_bench [-p packets] [-w window] [-s size] [-z] [-f source] [host]
+ * Sends @param packets packets of @param size bytes (default 10000 of 16) to a running aesdsocket
+ * on port 9000 of @param host, localhost by default:
+ *  - text: one newline terminated packet at a time, waiting for the read back of the data
+ *  - binary readback: AESD_OP_APPEND with AESD_APPEND_FLAG_READBACK, the same work as text
+ *  - binary append: AESD_OP_APPEND alone
+ *  - binary readback lz4, with -z: binary readback with AESD_READ_FLAG_COMPRESS, decompressing
+ *    every response
+ * The binary modes keep @param window requests in flight (default 32) and check every response
+ * against its request id.  The readback modes also report the mean response payload size.
+ * With -f, another connection bound to the local address @param source floods the server with
+ * FLOOD_SIZE byte packets throughout, to measure how well aesdsocket's per client limits protect
+ * the others, and the per client counters of AESD_OP_CLIENT_STATS are printed at the end.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <poll.h>
+#include "aesdsocket_proto.h"
+#include "aesd_lz4.h"
+
+#define PORT "9000"
+/* Largest read back expected, the data holds the last 10 writes which earlier clients may have made long */
+#define MAX_READBACK (1024 * 1024)
+/* Size of the flood packets, the most aesdsocket receives at once */
+#define FLOOD_SIZE   1024
+
+static double now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Connect to aesdsocket on @param host, from the IPv4 address @param source unless NULL
+ * @return the socket, -1 on error
+ */
+static int connect_from(const char *host, const char *source)
+{
+    struct addrinfo hints = { .ai_family = source ? AF_INET : AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+    struct sockaddr_in local = { .sin_family = AF_INET };
+    int fd, one = 1;
+
+    if (getaddrinfo(host, PORT, &hints, &res) != 0) {
+        fprintf(stderr, "Cannot resolve %s\n", host);
+        return -1;
+    }
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && source &&
+        (inet_pton(AF_INET, source, &local.sin_addr) != 1 || bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0)) {
+        fprintf(stderr, "Cannot bind to %s\n", source);
+        close(fd);
+        fd = -1;
+    }
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        perror("connect");
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int connect_to(const char *host)
+{
+    return connect_from(host, NULL);
+}
+
+static int send_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0) {
+        ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0)
+            return -1;
+        p += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *data, size_t len)
+{
+    char *p = data;
+
+    while (len > 0) {
+        ssize_t received = recv(fd, p, len, 0);
+
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return -1;
+        p += received;
+        len -= received;
+    }
+    return 0;
+}
+
+/**
+ * Fill @param packet with @param size bytes ending in a newline and identifying packet @param i
+ */
+static void make_packet(char *packet, size_t size, size_t i)
+{
+    memset(packet, 'x', size);
+    snprintf(packet, size, "%zu", i);
+    packet[strlen(packet)] = 'x';
+    packet[size - 1] = '\n';
+}
+
+static double run_text(const char *host, size_t packets, size_t size)
+{
+    char *packet = malloc(size), *reply = malloc(MAX_READBACK);
+    size_t i, len;
+    double start;
+    int fd = connect_to(host);
+
+    if (fd < 0 || !packet || !reply)
+        return -1;
+    start = now_s();
+    for (i = 0; i < packets; i++) {
+        make_packet(packet, size, i);
+        if (send_all(fd, packet, size) < 0)
+            return -1;
+        // The reply is all the data, which ends with this packet
+        len = 0;
+        while (len < size || memcmp(reply + len - size, packet, size) != 0) {
+            ssize_t received = recv(fd, reply + len, MAX_READBACK - len, 0);
+
+            if (received <= 0)
+                return -1;
+            len += received;
+        }
+    }
+    start = now_s() - start;
+    close(fd);
+    free(packet);
+    free(reply);
+    return packets / start;
+}
+
+/**
+ * Switch @param fd to the binary protocol and check the server's hello
+ * @return 0 on success, -1 on error
+ */
+static int binary_hello(int fd)
+{
+    struct aesd_frame_header header;
+    uint32_t version;
+
+    if (send_all(fd, AESD_PROTO_BINARY_HELLO, strlen(AESD_PROTO_BINARY_HELLO)) < 0 ||
+        recv_all(fd, &header, sizeof(header)) < 0 || be16toh(header.opcode) != AESD_OP_HELLO ||
+        be32toh(header.length) != sizeof(version) || recv_all(fd, &version, sizeof(version)) < 0) {
+        fprintf(stderr, "Binary protocol negotiation failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Receive one response and check it answers request @param expected_id
+ * @return the payload length, or -1 on error
+ */
+static ssize_t binary_response(int fd, uint64_t expected_id, char *payload, size_t max_payload)
+{
+    struct aesd_frame_header header;
+    uint32_t length;
+
+    if (recv_all(fd, &header, sizeof(header)) < 0)
+        return -1;
+    length = be32toh(header.length);
+    if (be64toh(header.request_id) != expected_id || be16toh(header.flags_status) != 0 ||
+        length > max_payload || recv_all(fd, payload, length) < 0) {
+        fprintf(stderr, "Bad response to request %llu\n", (unsigned long long)expected_id);
+        return -1;
+    }
+    return length;
+}
+
+/**
+ * Check the compressed response @param payload of @param length bytes decompresses to data
+ * ending in @param packet of @param size bytes
+ * @return 0 on success, -1 on error
+ */
+static int check_compressed(const char *payload, size_t length, const char *packet, size_t size, char *data)
+{
+    struct aesd_frame_compressed prefix;
+    ssize_t raw_length;
+
+    if (length < sizeof(prefix))
+        return -1;
+    memcpy(&prefix, payload, sizeof(prefix));
+    raw_length = aesd_lz4_decompress(payload + sizeof(prefix), length - sizeof(prefix), data, MAX_READBACK);
+    if (raw_length < 0 || (size_t)raw_length != be32toh(prefix.raw_length) || (size_t)raw_length < size ||
+        memcmp(data + raw_length - size, packet, size) != 0) {
+        fprintf(stderr, "Bad compressed response\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Run @param packets appends with request @param flags, storing the mean response payload size in
+ * *@param response_bytes
+ * @return packets per second, -1 on error
+ */
+static double run_binary(const char *host, size_t packets, size_t size, size_t window, uint16_t flags,
+                         double *response_bytes)
+{
+    size_t frame_len = sizeof(struct aesd_frame_header) + size, max_payload = MAX_READBACK;
+    char *frame = malloc(frame_len), *payload = malloc(max_payload), *data = malloc(MAX_READBACK);
+    char *packet = malloc(size);
+    uint64_t total_bytes = 0;
+    struct aesd_frame_header *header = (struct aesd_frame_header *)frame;
+    size_t sent = 0, received = 0;
+    double start;
+    int fd = connect_to(host);
+
+    if (fd < 0 || !frame || !payload || !data || !packet || binary_hello(fd) < 0)
+        return -1;
+    header->length = htobe32(size);
+    header->opcode = htobe16(AESD_OP_APPEND);
+    header->flags_status = htobe16(flags);
+
+    start = now_s();
+    while (received < packets) {
+        while (sent < packets && sent - received < window) {
+            header->request_id = htobe64(sent);
+            make_packet(frame + sizeof(*header), size, sent);
+            if (send_all(fd, frame, frame_len) < 0)
+                return -1;
+            sent++;
+        }
+        ssize_t length = binary_response(fd, received, payload, max_payload);
+
+        if (length < 0)
+            return -1;
+        if (flags & AESD_READ_FLAG_COMPRESS) {
+            make_packet(packet, size, received);
+            if (check_compressed(payload, length, packet, size, data) < 0)
+                return -1;
+        }
+        total_bytes += length;
+        received++;
+    }
+    start = now_s() - start;
+    close(fd);
+    free(frame);
+    free(payload);
+    free(data);
+    free(packet);
+    *response_bytes = (double)total_bytes / packets;
+    return packets / start;
+}
+
+struct flood {
+    const char *source;
+    int fd;
+    volatile bool stop;
+    uint64_t bytes;
+};
+
+/**
+ * Send text packets of FLOOD_SIZE bytes as fast as the server takes them, discarding the replies
+ * as they come so the server is never held up sending them
+ */
+static void *flood_func(void *arg)
+{
+    struct flood *flood = arg;
+    char packet[FLOOD_SIZE], reply[64 * 1024];
+    size_t sent = 0;
+
+    memset(packet, 'f', sizeof(packet));
+    packet[sizeof(packet) - 1] = '\n';
+    while (!flood->stop) {
+        struct pollfd pfd = { .fd = flood->fd, .events = POLLIN | POLLOUT };
+        ssize_t n;
+
+        if (poll(&pfd, 1, 100) < 0 || (pfd.revents & (POLLERR | POLLHUP)))
+            break;
+        if (pfd.revents & POLLIN) {
+            if (recv(flood->fd, reply, sizeof(reply), MSG_DONTWAIT) <= 0)
+                break;
+        }
+        if (pfd.revents & POLLOUT) {
+            n = send(flood->fd, packet + sent, sizeof(packet) - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN)
+                break;
+            if (n > 0) {
+                flood->bytes += n;
+                sent = (sent + n) % sizeof(packet);
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Print the per client counters of the server on @param host
+ * @return 0 on success, -1 on error
+ */
+static int print_client_stats(const char *host)
+{
+    struct aesd_frame_header header = { .opcode = htobe16(AESD_OP_CLIENT_STATS) };
+    struct aesd_frame_client_stats *entries = malloc(MAX_READBACK);
+    ssize_t length;
+    int fd = connect_to(host);
+
+    if (fd < 0 || !entries || binary_hello(fd) < 0 || send_all(fd, &header, sizeof(header)) < 0)
+        return -1;
+    length = binary_response(fd, 0, (char *)entries, MAX_READBACK);
+    if (length < 0)
+        return -1;
+    printf("%-16s %12s %12s %13s %13s %12s %14s\n", "client", "bytes_in", "bytes_out",
+           "throttled_in", "throttled_out", "throttle_ms", "turn_wait_ms");
+    for (size_t i = 0; i < length / sizeof(*entries); i++) {
+        struct in_addr addr = { .s_addr = entries[i].addr };
+
+        printf("%-16s %12llu %12llu %13llu %13llu %12.0f %14.0f\n", inet_ntoa(addr),
+               (unsigned long long)be64toh(entries[i].bytes_in), (unsigned long long)be64toh(entries[i].bytes_out),
+               (unsigned long long)be64toh(entries[i].throttled_in),
+               (unsigned long long)be64toh(entries[i].throttled_out),
+               (be64toh(entries[i].throttled_in_ns) + be64toh(entries[i].throttled_out_ns)) / 1e6,
+               be64toh(entries[i].turn_wait_ns) / 1e6);
+    }
+    close(fd);
+    free(entries);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t packets = 10000, window = 32, size = 16;
+    const char *host = "localhost";
+    double text, binary_readback, binary_append, binary_lz4 = 0;
+    double readback_bytes, append_bytes, lz4_bytes = 0;
+    bool compress = false;
+    struct flood flood = { .fd = -1 };
+    pthread_t flood_thread;
+    double flood_start = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:w:s:zf:")) != -1) {
+        switch (opt) {
+        case 'p':
+            packets = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            window = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'z':
+            compress = true;
+            break;
+        case 'f':
+            flood.source = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p packets] [-w window] [-s size] [-z] [-f source] [host]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        host = argv[optind];
+    // Room for the packet number and the newline
+    if (packets == 0 || window == 0 || size < 16) {
+        fprintf(stderr, "packets and window must be positive and size at least 16\n");
+        return 1;
+    }
+
+    if (flood.source) {
+        flood.fd = connect_from(host, flood.source);
+        if (flood.fd < 0 || pthread_create(&flood_thread, NULL, flood_func, &flood) != 0)
+            return 1;
+        flood_start = now_s();
+    }
+
+    text = run_text(host, packets, size);
+    binary_readback = run_binary(host, packets, size, window, AESD_APPEND_FLAG_READBACK, &readback_bytes);
+    binary_append = run_binary(host, packets, size, window, 0, &append_bytes);
+    if (compress)
+        binary_lz4 = run_binary(host, packets, size, window, AESD_APPEND_FLAG_READBACK | AESD_READ_FLAG_COMPRESS,
+                                &lz4_bytes);
+    if (flood.source) {
+        flood.stop = true;
+        pthread_join(flood_thread, NULL);
+        flood_start = now_s() - flood_start;
+    }
+    if (text < 0 || binary_readback < 0 || binary_append < 0 || binary_lz4 < 0) {
+        fprintf(stderr, "Benchmark failed\n");
+        return 1;
+    }
+
+    printf("packets %zu size %zu window %zu\n", packets, size, window);
+    printf("%-20s %12s %14s\n", "mode", "packets_per_s", "response_bytes");
+    printf("%-20s %12.0f\n", "text", text);
+    printf("%-20s %12.0f %14.0f\n", "binary readback", binary_readback, readback_bytes);
+    printf("%-20s %12.0f %14.0f\n", "binary append", binary_append, append_bytes);
+    if (compress)
+        printf("%-20s %12.0f %14.0f\n", "binary readback lz4", binary_lz4, lz4_bytes);
+    if (flood.source) {
+        printf("flood from %s %.2f MB/s\n", flood.source, flood.bytes / flood_start / 1e6);
+        if (print_client_stats(host) < 0) {
+            fprintf(stderr, "AESD_OP_CLIENT_STATS failed\n");
+            return 1;
+        }
+        close(flood.fd);
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file aesdsocket_parse.c
+ * @brief Parsing of aesdsocket text commands and binary frames, see aesdsocket_parse.h
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "aesdsocket_parse.h"
+#include <endian.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+ * @return true if the @param len bytes at @param data start with the string @param prefix
+ */
+static bool has_prefix(const char *data, size_t len, const char *prefix)
+{
+    size_t prefix_len = strlen(prefix);
+
+    return len >= prefix_len && memcmp(data, prefix, prefix_len) == 0;
+}
+
+/**
+ * Parse the decimal number at *@param pos, before @param end, of at most @param max into
+ * *@param value and move *@param pos past it
+ * @return false if there are no digits or the number exceeds @param max
+ */
+static bool parse_number(const char **pos, const char *end, uint64_t max, uint64_t *value)
+{
+    const char *p = *pos;
+    uint64_t v = 0;
+
+    if (p == end || *p < '0' || *p > '9')
+        return false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        unsigned int digit = *p - '0';
+
+        if (v > (max - digit) / 10)
+            return false;
+        v = v * 10 + digit;
+    }
+    *pos = p;
+    *value = v;
+    return true;
+}
+
+/**
+ * @return true if @param pos, before @param end, is where a command may end
+ */
+static bool at_command_end(const char *pos, const char *end)
+{
+    return pos == end || *pos == '\n';
+}
+
+static bool parse_seekto(const char *p, const char *end, struct aesd_seekto *seekto)
+{
+    uint64_t write_cmd, write_cmd_offset;
+
+    if (!parse_number(&p, end, UINT32_MAX, &write_cmd) || p == end || *p++ != ',' ||
+        !parse_number(&p, end, UINT32_MAX, &write_cmd_offset) || !at_command_end(p, end))
+        return false;
+    seekto->write_cmd = write_cmd;
+    seekto->write_cmd_offset = write_cmd_offset;
+    return true;
+}
+
+static bool parse_seek_since(const char *p, const char *end, struct aesd_seek_since *since)
+{
+    if (end - p >= 4 && memcmp(p, "seq,", 4) == 0) {
+        since->by = AESDCHAR_SEEK_SINCE_SEQ;
+        p += 4;
+    } else if (end - p >= 5 && memcmp(p, "time,", 5) == 0) {
+        since->by = AESDCHAR_SEEK_SINCE_TIME;
+        p += 5;
+    } else {
+        return false;
+    }
+    return parse_number(&p, end, UINT64_MAX, &since->value) && at_command_end(p, end);
+}
+
+enum aesd_text_kind aesd_parse_text_command(const char *data, size_t len, struct aesd_text_command *cmd)
+{
+    const char *end = data + len;
+
+    memset(cmd, 0, sizeof(*cmd));
+    if (has_prefix(data, len, AESD_PROTO_BINARY_HELLO)) {
+        cmd->kind = AESD_TEXT_BINARY_HELLO;
+        cmd->hello_len = strlen(AESD_PROTO_BINARY_HELLO);
+    } else if (has_prefix(data, len, AESD_PROTO_SUBSCRIBE)) {
+        cmd->kind = AESD_TEXT_SUBSCRIBE;
+        cmd->drop = has_prefix(data + strlen(AESD_PROTO_SUBSCRIBE), len - strlen(AESD_PROTO_SUBSCRIBE), ":drop");
+    } else if (has_prefix(data, len, AESD_TEXT_SEEKTO_PREFIX)) {
+        cmd->kind = AESD_TEXT_SEEKTO;
+        if (!parse_seekto(data + strlen(AESD_TEXT_SEEKTO_PREFIX), end, &cmd->seekto)) {
+            cmd->kind = AESD_TEXT_MALFORMED;
+            cmd->malformed = AESD_TEXT_SEEKTO;
+        }
+    } else if (has_prefix(data, len, AESD_TEXT_SEEK_SINCE_PREFIX)) {
+        cmd->kind = AESD_TEXT_SEEK_SINCE;
+        if (!parse_seek_since(data + strlen(AESD_TEXT_SEEK_SINCE_PREFIX), end, &cmd->since)) {
+            memset(&cmd->since, 0, sizeof(cmd->since));
+            cmd->kind = AESD_TEXT_MALFORMED;
+            cmd->malformed = AESD_TEXT_SEEK_SINCE;
+        }
+    } else {
+        cmd->kind = AESD_TEXT_DATA;
+    }
+    return cmd->kind;
+}
+
+void aesd_frame_get_header(const char *data, struct aesd_frame_header *header)
+{
+    memcpy(header, data, sizeof(*header));
+    header->length = be32toh(header->length);
+    header->opcode = be16toh(header->opcode);
+    header->flags_status = be16toh(header->flags_status);
+    header->request_id = be64toh(header->request_id);
+}
+
+ssize_t aesd_frame_scan(const char *data, size_t len)
+{
+    struct aesd_frame_header header;
+    size_t end = 0;
+
+    while (len - end >= sizeof(header)) {
+        aesd_frame_get_header(data + end, &header);
+        if (header.length > AESD_FRAME_MAX_PAYLOAD)
+            return -1;
+        if (len - end - sizeof(header) < header.length)
+            break;
+        end += sizeof(header) + header.length;
+    }
+    return end;
+}
+
+int aesd_frame_get_seek(const char *payload, uint32_t length, struct aesd_seekto *seekto)
+{
+    struct aesd_frame_seek frame;
+
+    if (length < sizeof(frame))
+        return EINVAL;
+    memcpy(&frame, payload, sizeof(frame));
+    seekto->write_cmd = be32toh(frame.write_cmd);
+    seekto->write_cmd_offset = be32toh(frame.write_cmd_offset);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * aesdsocket_parse.h
+ *
+ *  @brief Parsing of what aesdsocket receives: text commands and binary frames
+ *
+ *  Every function works on exactly the bytes it is given, which need not be
+ *  NUL terminated, so each can be fed arbitrary input by the fuzz targets in
+ *  student-test/fuzz and checked against a reference model there.
+ *
+ *  A text command is recognized at the start of the bytes of one receive.
+ *  Its numbers are unsigned decimal, without sign or spaces, and must fit
+ *  their field; the command ends at a newline or at the end of the bytes.
+ */
+
+#ifndef AESDSOCKET_PARSE_H
+#define AESDSOCKET_PARSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../aesd-char-driver/aesd_ioctl.h"
+#include "aesdsocket_proto.h"
+
+#define AESD_TEXT_SEEKTO_PREFIX     "AESDCHAR_IOCSEEKTO:"
+#define AESD_TEXT_SEEK_SINCE_PREFIX "AESDCHAR_IOCSEEKSINCE:"
+
+enum aesd_text_kind {
+    /**
+     * Not a command, bytes to append to the data
+     */
+    AESD_TEXT_DATA,
+    /**
+     * AESD_PROTO_BINARY_HELLO, the bytes after it are the first binary frames
+     */
+    AESD_TEXT_BINARY_HELLO,
+    /**
+     * AESD_PROTO_SUBSCRIBE, optionally followed by ":drop" or ":disconnect"
+     */
+    AESD_TEXT_SUBSCRIBE,
+    /**
+     * AESDCHAR_IOCSEEKTO:write_cmd,write_cmd_offset
+     */
+    AESD_TEXT_SEEKTO,
+    /**
+     * AESDCHAR_IOCSEEKSINCE:seq,N or AESDCHAR_IOCSEEKSINCE:time,NS
+     */
+    AESD_TEXT_SEEK_SINCE,
+    /**
+     * Starts like AESD_TEXT_SEEKTO or AESD_TEXT_SEEK_SINCE, which malformed tells, but does not parse
+     */
+    AESD_TEXT_MALFORMED,
+};
+
+struct aesd_text_command {
+    enum aesd_text_kind kind;
+    union {
+        /* AESD_TEXT_BINARY_HELLO: length of the hello line */
+        size_t hello_len;
+        /* AESD_TEXT_SUBSCRIBE: true for ":drop" */
+        bool drop;
+        struct aesd_seekto seekto;
+        /* AESD_TEXT_SEEK_SINCE: by and value set */
+        struct aesd_seek_since since;
+        /* AESD_TEXT_MALFORMED: AESD_TEXT_SEEKTO or AESD_TEXT_SEEK_SINCE */
+        enum aesd_text_kind malformed;
+    };
+};
+
+/**
+ * Recognize the command at the start of the @param len bytes at @param data, filling in @param cmd
+ * @return cmd->kind
+ */
+enum aesd_text_kind aesd_parse_text_command(const char *data, size_t len, struct aesd_text_command *cmd);
+
+/**
+ * Decode the struct aesd_frame_header at the start of @param data, which must hold one, into host order
+ */
+void aesd_frame_get_header(const char *data, struct aesd_frame_header *header);
+
+/**
+ * Find the complete frames at the start of the @param len bytes at @param data
+ * @return the number of bytes they span, or -1 if a frame exceeds AESD_FRAME_MAX_PAYLOAD
+ */
+ssize_t aesd_frame_scan(const char *data, size_t len);
+
+/**
+ * Decode the position at the start of the @param length byte payload @param payload, a
+ * struct aesd_frame_seek or the start of a struct aesd_frame_range, into @param seekto
+ * @return 0 on success, EINVAL if the payload is too short
+ */
+int aesd_frame_get_seek(const char *payload, uint32_t length, struct aesd_seekto *seekto);
+
+#endif /* AESDSOCKET_PARSE_H */
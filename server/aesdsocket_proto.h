@@ -0,0 +1,132 @@
+/*
+ * aesdsocket_proto.h
+ *
+ *  @brief Binary framed protocol of aesdsocket
+ *
+ *  A connection starts in the newline terminated text protocol.  Sending the
+ *  line AESD_PROTO_BINARY_HELLO switches it to binary frames: the server
+ *  answers with an AESD_OP_HELLO frame whose payload is the 32 bit protocol
+ *  version, then every request and response is a struct aesd_frame_header
+ *  followed by length bytes of payload.  All integers are big endian.
+ *
+ *  Responses carry the request_id of their request, so a client may pipeline
+ *  any number of requests and must match responses by id rather than by
+ *  order.  The server currently answers in request order.
+ *
+ *  Version 2 adds AESD_READ_FLAG_COMPRESS, letting a client trade server CPU
+ *  for fewer bytes on the wire when reading back large data.  Version 3
+ *  adds AESD_OP_CLIENT_STATS, reporting the rate limiting of each client.
+ *
+ *  A text connection may instead send the line AESD_PROTO_SUBSCRIBE,
+ *  optionally followed by ":drop" or ":disconnect".  From then on the server
+ *  sends it every packet appended to the data, once complete and in the
+ *  order appended, and ignores what it sends.  A subscriber falling too far
+ *  behind has its oldest pending packets dropped with ":drop", or by default
+ *  is sent the packets pending and then disconnected, so without ":drop" it
+ *  receives every packet from when it subscribed up to the connection
+ *  closing.
+ */
+
+#ifndef AESDSOCKET_PROTO_H
+#define AESDSOCKET_PROTO_H
+
+#include <stdint.h>
+
+#define AESD_PROTO_BINARY_HELLO "AESDSOCKET_BINARY\n"
+#define AESD_PROTO_SUBSCRIBE    "AESDSOCKET_SUBSCRIBE"
+#define AESD_PROTO_VERSION      3
+
+/* Largest payload accepted in a request, larger frames close the connection */
+#define AESD_FRAME_MAX_PAYLOAD  (1024 * 1024)
+
+enum aesd_opcode {
+    /**
+     * Response to the switch to binary mode, payload is the protocol version
+     */
+    AESD_OP_HELLO = 0,
+    /**
+     * Append the payload to the data.  With AESD_APPEND_FLAG_READBACK the response holds all
+     * the data afterwards, as a newline terminated text packet would, otherwise it is empty
+     */
+    AESD_OP_APPEND = 1,
+    /**
+     * Payload is a struct aesd_frame_seek, the response holds the data from that position to
+     * the end, like AESDCHAR_IOCSEEKTO
+     */
+    AESD_OP_SEEK_READ = 2,
+    /**
+     * Payload is a struct aesd_frame_range, the response holds up to length bytes from that
+     * position
+     */
+    AESD_OP_READ_RANGE = 3,
+    /**
+     * The response holds a struct aesd_frame_client_stats for every client address the server
+     * remembers: those with connections open, including the requester, and recent ones
+     */
+    AESD_OP_CLIENT_STATS = 4,
+};
+
+#define AESD_APPEND_FLAG_READBACK 0x1
+/**
+ * Valid on every request whose response holds data: that payload is a struct aesd_frame_compressed
+ * followed by the data as one LZ4 block, see aesd_lz4.h
+ */
+#define AESD_READ_FLAG_COMPRESS   0x2
+
+struct aesd_frame_header {
+    /**
+     * Number of payload bytes following the header
+     */
+    uint32_t length;
+    /**
+     * One of enum aesd_opcode, responses echo the opcode of the request
+     */
+    uint16_t opcode;
+    /**
+     * Request flags, in responses 0 on success or an errno value
+     */
+    uint16_t flags_status;
+    uint64_t request_id;
+} __attribute__((packed));
+
+struct aesd_frame_seek {
+    uint32_t write_cmd;
+    uint32_t write_cmd_offset;
+} __attribute__((packed));
+
+struct aesd_frame_range {
+    uint32_t write_cmd;
+    uint32_t write_cmd_offset;
+    uint32_t length;
+} __attribute__((packed));
+
+struct aesd_frame_compressed {
+    /**
+     * Length of the data once decompressed
+     */
+    uint32_t raw_length;
+} __attribute__((packed));
+
+struct aesd_frame_client_stats {
+    /**
+     * IPv4 address of the client, in network order like every other field
+     */
+    uint32_t addr;
+    uint32_t connections;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    /**
+     * Receives and sends delayed by the rate limits, and the total delay
+     */
+    uint64_t throttled_in;
+    uint64_t throttled_out;
+    uint64_t throttled_in_ns;
+    uint64_t throttled_out_ns;
+    /**
+     * Turns at the data taken, and the total time spent waiting for them
+     */
+    uint64_t turns;
+    uint64_t turn_wait_ns;
+} __attribute__((packed));
+
+#endif /* AESDSOCKET_PROTO_H */
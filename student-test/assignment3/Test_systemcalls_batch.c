@@ -0,0 +1,81 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+/**
+* Tests for the posix_spawn() based do_exec_redirect() and for do_exec_batch(), which must report
+* the status of each command and fail the batch if any command fails or cannot be started.
+*/
+
+#define BATCH_REDIRECT_FILE "/tmp/Test_systemcalls_batch.txt"
+
+static void read_file(const char *path, char *buf, size_t len)
+{
+    FILE *file = fopen(path, "r");
+    size_t read_len;
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(file, "The redirect file should have been created");
+    read_len = fread(buf, 1, len - 1, file);
+    buf[read_len] = '\0';
+    fclose(file);
+}
+
+void test_exec_redirect_uses_spawn_file_actions()
+{
+    char buf[64];
+
+    unlink(BATCH_REDIRECT_FILE);
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_redirect(BATCH_REDIRECT_FILE, 3, "/bin/echo", "spawn", "test"),
+                             "echo should succeed with its output redirected");
+    read_file(BATCH_REDIRECT_FILE, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("spawn test\n", buf, "The redirect file should hold the output of echo");
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_redirect("/nonexistent/dir/file", 2, "/bin/echo", "x"),
+                              "An unopenable redirect file should fail");
+    TEST_ASSERT_FALSE_MESSAGE(do_exec(2, "echo", "x"),
+                              "A command without a full path should fail");
+    unlink(BATCH_REDIRECT_FILE);
+}
+
+void test_exec_batch_reports_each_status()
+{
+    char *true_cmd[] = { "/bin/true", NULL };
+    char *false_cmd[] = { "/bin/false", NULL };
+    char *sleep_cmd[] = { "/bin/sleep", "0.2", NULL };
+    char *missing_cmd[] = { "/nonexistent/command", NULL };
+    char *echo_cmd[] = { "/bin/echo", "batch", NULL };
+    struct exec_request requests[] = {
+        { .argv = sleep_cmd },
+        { .argv = true_cmd },
+        { .argv = echo_cmd, .outputfile = BATCH_REDIRECT_FILE },
+    };
+    struct exec_request failing[] = {
+        { .argv = true_cmd },
+        { .argv = false_cmd },
+        { .argv = missing_cmd },
+    };
+    char buf[64];
+    size_t i;
+
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_batch(requests, 3), "A batch of successful commands should succeed");
+    for (i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(requests[i].status) && WEXITSTATUS(requests[i].status) == 0,
+                                 "Every command should report exit status 0");
+    }
+    read_file(BATCH_REDIRECT_FILE, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("batch\n", buf, "Batch commands should honour their redirect");
+    unlink(BATCH_REDIRECT_FILE);
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_batch(failing, 3), "A batch with a failing command should fail");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(failing[0].status) && WEXITSTATUS(failing[0].status) == 0,
+                             "/bin/true should still report success");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(failing[1].status) && WEXITSTATUS(failing[1].status) == 1,
+                             "/bin/false should report exit status 1");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, failing[2].status, "A command which cannot start should report -1");
+
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_batch(NULL, 0), "An empty batch should succeed");
+}
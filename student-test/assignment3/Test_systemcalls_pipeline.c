@@ -0,0 +1,93 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+/**
+* Tests for the do_exec_pipeline() family: output of the last stage to a file, a buffer and a
+* file descriptor, truncated captures, and the per stage statuses.
+*/
+
+#define PIPELINE_OUTPUT_FILE "/tmp/Test_systemcalls_pipeline.txt"
+
+static char *const echo_stage[] = { "/bin/echo", "one two three", NULL };
+static char *const tr_stage[] = { "/usr/bin/tr", " ", "\n", NULL };
+static char *const wc_stage[] = { "/usr/bin/wc", "-l", NULL };
+
+static void read_file(const char *path, char *buf, size_t len)
+{
+    FILE *file = fopen(path, "r");
+    size_t read_len;
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(file, "The output file should have been created");
+    read_len = fread(buf, 1, len - 1, file);
+    buf[read_len] = '\0';
+    fclose(file);
+}
+
+void test_pipeline_output_to_file_and_fd()
+{
+    char *const *const stages[] = { echo_stage, tr_stage, wc_stage };
+    int statuses[3];
+    char buf[64];
+    int fd;
+
+    unlink(PIPELINE_OUTPUT_FILE);
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_pipeline(PIPELINE_OUTPUT_FILE, 3, stages, statuses),
+                             "echo | tr | wc should succeed");
+    read_file(PIPELINE_OUTPUT_FILE, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("3\n", buf, "wc should count the three words tr split into lines");
+
+    fd = open(PIPELINE_OUTPUT_FILE, O_WRONLY | O_TRUNC);
+    TEST_ASSERT_TRUE_MESSAGE(fd >= 0, "The output file should reopen");
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_pipeline_fd(fd, 2, stages, statuses),
+                             "echo | tr into a file descriptor should succeed");
+    close(fd);
+    read_file(PIPELINE_OUTPUT_FILE, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("one\ntwo\nthree\n", buf, "The output should be spliced into the file");
+    unlink(PIPELINE_OUTPUT_FILE);
+}
+
+void test_pipeline_capture_and_statuses()
+{
+    char *const false_stage[] = { "/bin/false", NULL };
+    char *const missing_stage[] = { "/nonexistent/command", NULL };
+    char *const *const stages[] = { echo_stage, tr_stage };
+    char *const *const failing[] = { echo_stage, false_stage, wc_stage };
+    char *const *const missing[] = { missing_stage, wc_stage };
+    int statuses[3];
+    char buf[32];
+    size_t len = sizeof(buf);
+
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_pipeline_capture(buf, &len, 2, stages, statuses),
+                             "echo | tr should succeed when captured");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(14, len, "The whole output should be captured");
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE("one\ntwo\nthree\n", buf, len, "The captured output should match");
+
+    len = 4;
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_pipeline_capture(buf, &len, 2, stages, NULL),
+                             "A truncated capture should still succeed");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(14, len, "The total output length should be reported");
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE("one\n", buf, 4, "The start of the output should be captured");
+
+    len = sizeof(buf);
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_pipeline_capture(buf, &len, 3, failing, statuses),
+                              "A failing middle stage should fail the pipeline");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(statuses[1]) && WEXITSTATUS(statuses[1]) == 1,
+                             "/bin/false should report exit status 1");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(statuses[2]) && WEXITSTATUS(statuses[2]) == 0,
+                             "wc should still succeed on empty input");
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE("0\n", buf, 2, "wc should have counted no lines");
+
+    len = sizeof(buf);
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_pipeline_capture(buf, &len, 2, missing, statuses),
+                              "A stage which cannot start should fail the pipeline");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, statuses[0], "The missing command should report -1");
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(statuses[1]) && WEXITSTATUS(statuses[1]) == 0,
+                             "The next stage should run with empty input");
+}
@@ -0,0 +1,52 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "../../examples/threading/bench_lock.h"
+
+/**
+* Checks that every lock type used by lock_bench provides mutual exclusion: threads increment a
+* plain counter under the lock and no increment may be lost.
+*/
+
+#define EXCLUSION_THREADS    4
+#define EXCLUSION_INCREMENTS 20000
+
+static struct bench_lock exclusion_lock;
+static unsigned long exclusion_counter;
+
+static void *exclusion_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < EXCLUSION_INCREMENTS; i++) {
+        bench_lock_lock(&exclusion_lock);
+        // Split read and write so a missing lock loses increments rather than racing in one instruction
+        unsigned long value = *(volatile unsigned long *)&exclusion_counter;
+        *(volatile unsigned long *)&exclusion_counter = value + 1;
+        bench_lock_unlock(&exclusion_lock);
+    }
+    return NULL;
+}
+
+void test_bench_lock_types_are_mutually_exclusive()
+{
+    const struct bench_lock_ops *ops;
+    pthread_t threads[EXCLUSION_THREADS];
+    char message[64];
+    int i;
+
+    for (ops = bench_lock_types; ops->name; ops++) {
+        snprintf(message, sizeof(message), "%s should not lose increments", ops->name);
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(ops, bench_lock_find(ops->name), "Each lock type should be found by name");
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, bench_lock_init(&exclusion_lock, ops), "Lock init should succeed");
+        exclusion_counter = 0;
+        for (i = 0; i < EXCLUSION_THREADS; i++)
+            TEST_ASSERT_EQUAL_INT_MESSAGE(0, pthread_create(&threads[i], NULL, exclusion_thread, NULL),
+                                          "pthread_create should succeed");
+        for (i = 0; i < EXCLUSION_THREADS; i++)
+            pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(EXCLUSION_THREADS * EXCLUSION_INCREMENTS, exclusion_counter, message);
+        bench_lock_destroy(&exclusion_lock);
+    }
+    TEST_ASSERT_NULL_MESSAGE(bench_lock_find("bogus"), "Unknown lock types should not be found");
+}
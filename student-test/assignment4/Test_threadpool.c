@@ -0,0 +1,110 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../../examples/threading/threadpool.h"
+#include "../../examples/threading/threading.h"
+
+/**
+* Tests for the thread pool: futures return each task's result, tasks submitted from tasks are
+* stolen and run, shutdown drains every queued task, and start_task_obtaining_mutex() keeps the
+* thread_data completion contract of start_thread_obtaining_mutex().
+*/
+
+#define POOL_WORKERS 4
+#define POOL_TASKS   1000
+#define FANOUT_DEPTH 8
+
+static atomic_int tasks_run;
+
+static void *square_task(void *arg)
+{
+    uintptr_t value = (uintptr_t)arg;
+
+    atomic_fetch_add(&tasks_run, 1);
+    return (void *)(value * value);
+}
+
+struct fanout {
+    struct threadpool *pool;
+    int depth;
+};
+
+/**
+ * Submits two detached children from inside the pool until FANOUT_DEPTH, 2^FANOUT_DEPTH - 1 tasks in all
+ */
+static void *fanout_task(void *arg)
+{
+    struct fanout *fanout = arg;
+
+    atomic_fetch_add(&tasks_run, 1);
+    if (fanout->depth + 1 < FANOUT_DEPTH) {
+        for (int i = 0; i < 2; i++) {
+            struct fanout *child = malloc(sizeof(*child));
+
+            TEST_ASSERT_NOT_NULL(child);
+            child->pool = fanout->pool;
+            child->depth = fanout->depth + 1;
+            TEST_ASSERT_TRUE_MESSAGE(threadpool_submit_detached(fanout->pool, fanout_task, child),
+                                     "Workers should be able to submit tasks");
+        }
+    }
+    free(fanout);
+    return NULL;
+}
+
+void test_threadpool_futures_and_shutdown()
+{
+    struct threadpool *pool = threadpool_create(POOL_WORKERS, false);
+    struct threadpool_future *futures[POOL_TASKS];
+    struct fanout *root = malloc(sizeof(*root));
+    uintptr_t i;
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "threadpool_create should succeed");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(POOL_WORKERS, threadpool_size(pool), "The pool should have the requested workers");
+    atomic_store(&tasks_run, 0);
+    for (i = 0; i < POOL_TASKS; i++) {
+        futures[i] = threadpool_submit(pool, square_task, (void *)i);
+        TEST_ASSERT_NOT_NULL_MESSAGE(futures[i], "threadpool_submit should succeed");
+    }
+    for (i = 0; i < POOL_TASKS; i++) {
+        TEST_ASSERT_EQUAL_PTR_MESSAGE((void *)(i * i), threadpool_future_get(futures[i]),
+                                      "Each future should return the result of its own task");
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(POOL_TASKS, atomic_load(&tasks_run), "Every task should have run once");
+
+    // Shutdown must wait for the whole tree, most of which is submitted after it starts
+    atomic_store(&tasks_run, 0);
+    root->pool = pool;
+    root->depth = 0;
+    TEST_ASSERT_TRUE(threadpool_submit_detached(pool, fanout_task, root));
+    threadpool_shutdown(pool);
+    TEST_ASSERT_EQUAL_INT_MESSAGE((1 << FANOUT_DEPTH) - 1, atomic_load(&tasks_run),
+                                  "Shutdown should drain tasks submitted by tasks");
+}
+
+void test_threadpool_keeps_thread_data_contract()
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct threadpool *pool = threadpool_create(2, true);
+    struct threadpool_future *future;
+    struct thread_data *tdata;
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "threadpool_create with pinned workers should succeed");
+    pthread_mutex_lock(&mutex);
+    future = start_task_obtaining_mutex(pool, &mutex, 1, 1);
+    TEST_ASSERT_NOT_NULL_MESSAGE(future, "start_task_obtaining_mutex should queue the task");
+    usleep(20 * 1000);
+    TEST_ASSERT_FALSE_MESSAGE(threadpool_future_done(future), "The task should be blocked on the held mutex");
+    pthread_mutex_unlock(&mutex);
+
+    tdata = threadpool_future_get(future);
+    TEST_ASSERT_NOT_NULL_MESSAGE(tdata, "The future should return the thread_data structure");
+    TEST_ASSERT_TRUE_MESSAGE(tdata->thread_complete_success, "The task should report success");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(&mutex, tdata->mutex, "The thread_data should describe the task");
+    free(tdata);
+    threadpool_shutdown(pool);
+}
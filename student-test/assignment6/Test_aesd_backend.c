@@ -0,0 +1,116 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../server/aesd_backend.h"
+#include "../../aesd-char-driver/aesd_ioctl.h"
+
+/**
+* Tests for the aesdsocket storage backends: every backend that runs in userspace serves what
+* aesdsocket does with one descriptor kept open, appends in pieces read back whole from the start,
+* positioning by command where the backend supports it, and data kept or removed on stop.
+*/
+
+#define DATA_PATH "/tmp/Test_aesd_backend.data"
+
+static const char *backend_path(const struct aesd_backend *backend)
+{
+    return backend->is_file ? DATA_PATH : backend->default_path;
+}
+
+/**
+* Read from @param fd until the end, as the device backends return one command per read
+* @return the bytes read into the @param size bytes at @param buf
+*/
+static ssize_t read_all(const struct aesd_backend *backend, int fd, char *buf, size_t size)
+{
+    ssize_t n, len = 0;
+
+    while ((size_t)len < size && (n = backend->read(fd, buf + len, size - len)) > 0)
+        len += n;
+    return len;
+}
+
+/**
+* Start @param name, append a packet in two writes and another, and read them back from the start
+*/
+static void check_backend(const char *name)
+{
+    const struct aesd_backend *backend = aesd_backend_find(name);
+    struct aesd_backend_options options = { .keep_data = false };
+    struct aesd_seekto seekto = { .write_cmd = 1, .write_cmd_offset = 2 };
+    char buf[64] = {0};
+    int fd;
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(backend, name);
+    options.path = backend_path(backend);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, backend->start(&options), name);
+    fd = backend->open(options.path, O_RDWR | O_APPEND);
+    TEST_ASSERT_TRUE_MESSAGE(fd >= 0, name);
+
+    TEST_ASSERT_EQUAL_INT(6, backend->write(fd, "first ", 6));
+    TEST_ASSERT_EQUAL_INT(7, backend->write(fd, "packet\n", 7));
+    TEST_ASSERT_EQUAL_INT(7, backend->write(fd, "second\n", 7));
+    TEST_ASSERT_EQUAL_INT(0, backend->fsync(fd));
+    TEST_ASSERT_EQUAL_INT(0, backend->lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(20, read_all(backend, fd, buf, sizeof(buf) - 1), name);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("first packet\nsecond\n", buf, name);
+
+    memset(buf, 0, sizeof(buf));
+    if (backend->is_file) {
+        TEST_ASSERT_EQUAL_INT(-1, backend->ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto));
+        TEST_ASSERT_EQUAL_INT(ENOTTY, errno);
+    } else {
+        TEST_ASSERT_EQUAL_INT(0, backend->ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto));
+        TEST_ASSERT_EQUAL_INT(5, backend->read(fd, buf, sizeof(buf)));
+        TEST_ASSERT_EQUAL_STRING("cond\n", buf);
+    }
+    TEST_ASSERT_EQUAL_INT(0, backend->close(fd));
+    backend->stop(&options);
+    if (backend->is_file)
+        TEST_ASSERT_EQUAL_INT_MESSAGE(-1, access(DATA_PATH, F_OK), "The data file should be removed on stop");
+}
+
+void test_backends_store_and_read_back()
+{
+    check_backend("memory");
+    check_backend("file");
+    check_backend("log");
+    TEST_ASSERT_NULL(aesd_backend_find("nonexistent"));
+}
+
+void test_file_backends_keep_data()
+{
+    static const char *const names[] = { "file", "log" };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const struct aesd_backend *backend = aesd_backend_find(names[i]);
+        struct aesd_backend_options options = { .path = DATA_PATH, .keep_data = true };
+        char buf[16] = {0};
+        int fd;
+
+        remove(DATA_PATH);
+        TEST_ASSERT_EQUAL_INT(0, backend->start(&options));
+        fd = backend->open(DATA_PATH, O_RDWR | O_APPEND);
+        TEST_ASSERT_EQUAL_INT(5, backend->write(fd, "kept\n", 5));
+        backend->close(fd);
+        backend->stop(&options);
+
+        // A restart with keep_data finds the data, one without starts empty
+        TEST_ASSERT_EQUAL_INT(0, backend->start(&options));
+        fd = backend->open(DATA_PATH, O_RDONLY);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(5, backend->read(fd, buf, sizeof(buf)), names[i]);
+        TEST_ASSERT_EQUAL_STRING("kept\n", buf);
+        backend->close(fd);
+        backend->stop(&options);
+        options.keep_data = false;
+        TEST_ASSERT_EQUAL_INT(0, backend->start(&options));
+        fd = backend->open(DATA_PATH, O_RDONLY);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, backend->read(fd, buf, sizeof(buf)), names[i]);
+        backend->close(fd);
+        backend->stop(&options);
+    }
+}
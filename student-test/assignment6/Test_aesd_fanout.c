@@ -0,0 +1,112 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <string.h>
+#include <poll.h>
+#include "../../server/aesd_fanout.h"
+
+/**
+* Tests for the aesdsocket subscriber fan-out: a publish is copied once and shared by every
+* subscriber, wakes each through its descriptor, and a subscriber falling behind loses its oldest
+* messages or, once it has taken what was queued, its subscription, as its policy says.
+*/
+
+static bool readable(const struct aesd_fanout_sub *sub)
+{
+    struct pollfd pfd = { .fd = aesd_fanout_sub_fd(sub), .events = POLLIN };
+
+    return poll(&pfd, 1, 0) == 1;
+}
+
+void test_fanout_shares_one_copy()
+{
+    struct aesd_fanout *fanout = aesd_fanout_create(4, 1024);
+    struct aesd_fanout_sub *a, *b;
+    struct aesd_fanout_msg *from_a, *from_b;
+    const char *data;
+    size_t len;
+    bool cut_off;
+
+    TEST_ASSERT_NOT_NULL(fanout);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_fanout_publish(fanout, "lost\n", 5),
+                                  "Nothing should be kept without subscribers");
+    a = aesd_fanout_subscribe(fanout, AESD_FANOUT_DISCONNECT);
+    b = aesd_fanout_subscribe(fanout, AESD_FANOUT_DROP_OLDEST);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    TEST_ASSERT_FALSE(readable(a));
+
+    TEST_ASSERT_EQUAL_INT(2, aesd_fanout_publish(fanout, "hello\n", 6));
+    TEST_ASSERT_TRUE_MESSAGE(readable(a) && readable(b), "A publish should wake every subscriber");
+    from_a = aesd_fanout_next(fanout, a, &cut_off);
+    from_b = aesd_fanout_next(fanout, b, &cut_off);
+    TEST_ASSERT_NOT_NULL(from_a);
+    TEST_ASSERT_TRUE_MESSAGE(from_a == from_b, "Subscribers should share one copy of a message");
+    data = aesd_fanout_msg_data(from_a, &len);
+    TEST_ASSERT_EQUAL_UINT(6, len);
+    TEST_ASSERT_EQUAL_MEMORY("hello\n", data, 6);
+    aesd_fanout_msg_put(from_a);
+    // Still readable by b after a released its reference
+    TEST_ASSERT_EQUAL_MEMORY("hello\n", aesd_fanout_msg_data(from_b, &len), 6);
+    aesd_fanout_msg_put(from_b);
+
+    TEST_ASSERT_NULL(aesd_fanout_next(fanout, a, &cut_off));
+    TEST_ASSERT_FALSE(cut_off);
+    TEST_ASSERT_FALSE_MESSAGE(readable(a), "Taking the last message should clear the descriptor");
+    aesd_fanout_unsubscribe(fanout, b);
+    struct iovec iov[2] = { { .iov_base = "hel", .iov_len = 3 }, { .iov_base = "lo\n", .iov_len = 3 } };
+    TEST_ASSERT_EQUAL_INT(1, aesd_fanout_publishv(fanout, iov, 2));
+    from_a = aesd_fanout_next(fanout, a, &cut_off);
+    TEST_ASSERT_NOT_NULL(from_a);
+    data = aesd_fanout_msg_data(from_a, &len);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(6, len, "Buffers published together should make one message");
+    TEST_ASSERT_EQUAL_MEMORY("hello\n", data, 6);
+    aesd_fanout_msg_put(from_a);
+    aesd_fanout_unsubscribe(fanout, a);
+    aesd_fanout_destroy(fanout);
+}
+
+void test_fanout_bounds_slow_subscribers()
+{
+    struct aesd_fanout *fanout = aesd_fanout_create(4, 10);
+    struct aesd_fanout_sub *drop = aesd_fanout_subscribe(fanout, AESD_FANOUT_DROP_OLDEST);
+    struct aesd_fanout_sub *disconnect = aesd_fanout_subscribe(fanout, AESD_FANOUT_DISCONNECT);
+    struct aesd_fanout_sub_stats stats;
+    struct aesd_fanout_msg *msg;
+    const char packets[] = "abcdefgh";
+    bool cut_off;
+    size_t len;
+    int i;
+
+    // Eight 2 byte messages into queues of 4 messages and 10 bytes
+    for (i = 0; i < 8; i++)
+        aesd_fanout_publish(fanout, packets + i, 2);
+
+    aesd_fanout_get_stats(fanout, drop, &stats);
+    TEST_ASSERT_EQUAL_UINT(4, stats.queued);
+    TEST_ASSERT_EQUAL_UINT(4, stats.dropped);
+    TEST_ASSERT_FALSE(stats.cut_off);
+    for (i = 4; (msg = aesd_fanout_next(fanout, drop, &cut_off)); i++) {
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(packets + i, aesd_fanout_msg_data(msg, &len), 2,
+                                         "The newest messages should be kept, in order");
+        aesd_fanout_msg_put(msg);
+    }
+    TEST_ASSERT_EQUAL_INT(8, i);
+    TEST_ASSERT_FALSE(cut_off);
+
+    aesd_fanout_get_stats(fanout, disconnect, &stats);
+    TEST_ASSERT_TRUE(stats.cut_off);
+    TEST_ASSERT_EQUAL_UINT(4, stats.dropped);
+    for (i = 0; (msg = aesd_fanout_next(fanout, disconnect, &cut_off)); i++) {
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(packets + i, aesd_fanout_msg_data(msg, &len), 2,
+                                         "A cut off subscriber should still get what was queued");
+        aesd_fanout_msg_put(msg);
+    }
+    TEST_ASSERT_EQUAL_INT(4, i);
+    TEST_ASSERT_TRUE(cut_off);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(1, aesd_fanout_publish(fanout, "z", 1),
+                                  "A cut off subscriber should receive nothing more");
+
+    aesd_fanout_unsubscribe(fanout, drop);
+    aesd_fanout_unsubscribe(fanout, disconnect);
+    aesd_fanout_destroy(fanout);
+}
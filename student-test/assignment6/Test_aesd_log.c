@@ -0,0 +1,151 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../server/aesd_log.h"
+#include "../../server/aesd_lz4.h"
+#include "../../server/aesd_crc32c.h"
+
+/**
+* Tests for the aesdsocket data file: the LZ4 codec and CRC32C give known results, reads at any
+* offset return the written data while decompressing only the block holding it, a reopened log
+* finds every block and the open run again, and a torn last record is truncated on open.
+*/
+
+#define LOG_PATH   "/tmp/Test_aesd_log.data"
+#define BLOCK_SIZE 256
+#define LINES      200
+
+static size_t make_lines(char *buf, size_t size)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < LINES && len < size; i++)
+        len += snprintf(buf + len, size - len, "timestamp:Sat, 18 Oct 2026 16:%02d:%02d +0000\n", i / 60, i % 60);
+    return len;
+}
+
+void test_lz4_round_trip()
+{
+    static char data[16384], compressed[16384 + 16384 / 255 + 16], out[16384];
+    size_t len = make_lines(data, sizeof(data));
+    ssize_t compressed_len = aesd_lz4_compress(data, len, compressed, sizeof(compressed));
+
+    TEST_ASSERT_TRUE_MESSAGE(compressed_len > 0 && (size_t)compressed_len < len / 2,
+                             "Repetitive log lines should compress at least 2:1");
+    TEST_ASSERT_EQUAL_INT(len, aesd_lz4_decompress(compressed, compressed_len, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_MEMORY(data, out, len);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, aesd_lz4_decompress(compressed, compressed_len, out, len - 1),
+                                  "Output overruns should be detected");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, aesd_lz4_compress(data, len, compressed, 8),
+                                  "A destination too small should fail");
+}
+
+void test_crc32c_known_value()
+{
+    static char data[4096];
+
+    TEST_ASSERT_EQUAL_HEX32(0xe3069283, aesd_crc32c(0, "123456789", 9));
+    TEST_ASSERT_EQUAL_HEX32(0xe3069283, aesd_crc32c_sw(0, "123456789", 9));
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(aesd_crc32c(0, "123456789", 9), aesd_crc32c(aesd_crc32c(0, "1234", 4), "56789", 5),
+                                    "Checksums should extend across calls");
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = i * 7;
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(aesd_crc32c_sw(0, data + 3, sizeof(data) - 3), aesd_crc32c(0, data + 3, sizeof(data) - 3),
+                                    "The accelerated implementation should match the table driven one");
+}
+
+void test_log_reads_any_offset_and_reloads()
+{
+    static char data[16384], out[16384];
+    size_t len = make_lines(data, sizeof(data)), done;
+    struct aesd_log_stats stats;
+    int fd;
+
+    aesd_log_reset();
+    aesd_log_set_block_size(BLOCK_SIZE);
+    aesd_log_set_compress(true);
+    fd = aesd_log_open(LOG_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT_TRUE_MESSAGE(fd >= 0, "aesd_log_open should create the log");
+    // Uneven writes so blocks are cut in the middle of them
+    for (done = 0; done < len; done += 37) {
+        size_t n = len - done < 37 ? len - done : 37;
+
+        TEST_ASSERT_EQUAL_INT(n, aesd_log_write(fd, data + done, n));
+    }
+    aesd_log_get_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(len, stats.raw_bytes, "Every byte written should be counted");
+    TEST_ASSERT_EQUAL_UINT(len / BLOCK_SIZE, stats.blocks);
+    TEST_ASSERT_TRUE_MESSAGE(stats.stored_bytes < len, "The log should be stored compressed");
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_log_lseek(fd, 0, SEEK_SET));
+    TEST_ASSERT_EQUAL_INT(len, aesd_log_read(fd, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_MEMORY(data, out, len);
+    TEST_ASSERT_EQUAL_INT(0, aesd_log_read(fd, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_log_ioctl(fd, 0));
+    TEST_ASSERT_EQUAL_INT(ENOTTY, errno);
+    aesd_log_close(fd);
+
+    // A fresh load indexes the file and decompresses just the block holding the offset
+    aesd_log_reset();
+    fd = aesd_log_open(LOG_PATH, O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(3 * BLOCK_SIZE + 10, aesd_log_lseek(fd, 3 * BLOCK_SIZE + 10, SEEK_SET));
+    TEST_ASSERT_EQUAL_INT(20, aesd_log_read(fd, out, 20));
+    TEST_ASSERT_EQUAL_MEMORY(data + 3 * BLOCK_SIZE + 10, out, 20);
+    aesd_log_get_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(1, stats.blocks_decompressed, "Only the block read should be decompressed");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(len, stats.raw_bytes, "The open block should be loaded again");
+
+    TEST_ASSERT_EQUAL_INT(len - 5, aesd_log_lseek(fd, -5, SEEK_END));
+    TEST_ASSERT_EQUAL_INT(5, aesd_log_read(fd, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_MEMORY(data + len - 5, out, 5);
+    aesd_log_close(fd);
+    aesd_log_reset();
+    aesd_log_set_block_size(AESD_LOG_DEFAULT_BLOCK_SIZE);
+    aesd_log_set_compress(false);
+    unlink(LOG_PATH);
+}
+
+void test_log_truncates_torn_record()
+{
+    char out[64];
+    struct aesd_log_stats stats;
+    int fd;
+
+    aesd_log_reset();
+    fd = aesd_log_open(LOG_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(6, aesd_log_write(fd, "first\n", 6));
+    TEST_ASSERT_EQUAL_INT(7, aesd_log_write(fd, "second\n", 7));
+    aesd_log_close(fd);
+    aesd_log_reset();
+
+    // A crash in the middle of the second record
+    TEST_ASSERT_EQUAL_INT(0, truncate(LOG_PATH, 2 * sizeof(struct aesd_log_record_header) + 6 + 3));
+    fd = aesd_log_open(LOG_PATH, O_RDWR);
+    TEST_ASSERT_TRUE(fd >= 0);
+    aesd_log_get_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(6, stats.raw_bytes, "Only the intact record should be recovered");
+    TEST_ASSERT_EQUAL_UINT(sizeof(struct aesd_log_record_header) + 3, stats.truncated_bytes);
+    TEST_ASSERT_EQUAL_INT(6, aesd_log_write(fd, "third\n", 6));
+    TEST_ASSERT_EQUAL_INT(12, aesd_log_read(fd, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_MEMORY("first\nthird\n", out, 12);
+    aesd_log_close(fd);
+    aesd_log_reset();
+
+    // A flipped bit fails the checksum of the record holding it
+    fd = open(LOG_PATH, O_RDWR);
+    TEST_ASSERT_EQUAL_INT(1, pwrite(fd, "X", 1, 2 * sizeof(struct aesd_log_record_header) + 6 + 1));
+    close(fd);
+    fd = aesd_log_open(LOG_PATH, O_RDWR);
+    aesd_log_get_stats(&stats);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(6, stats.raw_bytes, "A corrupt record should be truncated");
+    aesd_log_close(fd);
+    aesd_log_reset();
+    unlink(LOG_PATH);
+}
@@ -0,0 +1,175 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "../../server/aesd_sched.h"
+
+/**
+* Tests for the aesdsocket scheduler: connections from one address, past and present, share their
+* counters and token buckets, a client bursting past its rate waits for the bucket to refill, or is
+* told how long to wait, and a waiting connection gets the next turn before one that asks again after
+* its own.
+*/
+
+#define RATE  100000
+#define BURST 10000
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void count_client(const struct aesd_sched_stats *stats, void *arg)
+{
+    (*(int *)arg)++;
+}
+
+void test_sched_throttles_past_burst()
+{
+    struct aesd_sched_limits limits = { .in_rate = RATE, .in_burst = BURST };
+    struct aesd_sched *sched = aesd_sched_create(&limits);
+    struct aesd_sched_client *a, *b, *other;
+    struct aesd_sched_stats stats;
+    struct in_addr addr;
+    uint64_t start;
+    int clients = 0;
+
+    TEST_ASSERT_NOT_NULL(sched);
+    inet_pton(AF_INET, "192.0.2.1", &addr);
+    a = aesd_sched_join(sched, addr);
+    b = aesd_sched_join(sched, addr);
+    TEST_ASSERT_TRUE_MESSAGE(a == b, "Connections from one address should share a client");
+    inet_pton(AF_INET, "192.0.2.2", &addr);
+    other = aesd_sched_join(sched, addr);
+    aesd_sched_foreach(sched, count_client, &clients);
+    TEST_ASSERT_EQUAL_INT(2, clients);
+
+    start = now_ms();
+    aesd_sched_throttle_in(sched, a, BURST);
+    aesd_sched_throttle_out(sched, a, 10 * BURST);
+    TEST_ASSERT_TRUE_MESSAGE(now_ms() - start < 50, "A burst and unlimited sends should not wait");
+
+    // 20000 bytes past the burst at 100000 bytes/s is 200 ms, split over both connections
+    start = now_ms();
+    aesd_sched_throttle_in(sched, a, BURST);
+    aesd_sched_throttle_in(sched, b, BURST);
+    TEST_ASSERT_TRUE_MESSAGE(now_ms() - start >= 190, "Going past the burst should wait for the refill");
+    aesd_sched_throttle_in(sched, other, BURST);
+    aesd_sched_get_stats(sched, other, &stats);
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, stats.throttled_in, "Each address should have its own bucket");
+
+    aesd_sched_get_stats(sched, b, &stats);
+    TEST_ASSERT_EQUAL_UINT(2, stats.connections);
+    TEST_ASSERT_EQUAL_UINT(3 * BURST, stats.bytes_in);
+    TEST_ASSERT_EQUAL_UINT(10 * BURST, stats.bytes_out);
+    TEST_ASSERT_EQUAL_UINT(2, stats.throttled_in);
+    TEST_ASSERT_EQUAL_UINT(0, stats.throttled_out);
+    TEST_ASSERT_TRUE(stats.throttled_in_ns >= 190000000);
+
+    aesd_sched_leave(sched, a);
+    aesd_sched_leave(sched, b);
+    aesd_sched_leave(sched, other);
+    clients = 0;
+    aesd_sched_foreach(sched, count_client, &clients);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(2, clients, "Clients should be remembered after their last connection");
+
+    // Reconnecting neither refills the bucket nor resets the counters
+    inet_pton(AF_INET, "192.0.2.1", &addr);
+    a = aesd_sched_join(sched, addr);
+    start = now_ms();
+    aesd_sched_throttle_in(sched, a, BURST);
+    TEST_ASSERT_TRUE_MESSAGE(now_ms() - start >= 50, "A reconnected client should find its bucket short");
+    aesd_sched_get_stats(sched, a, &stats);
+    TEST_ASSERT_EQUAL_UINT(1, stats.connections);
+    TEST_ASSERT_EQUAL_UINT(4 * BURST, stats.bytes_in);
+    aesd_sched_leave(sched, a);
+    aesd_sched_destroy(sched);
+}
+
+void test_sched_charge_out_returns_the_wait()
+{
+    struct aesd_sched_limits limits = { .out_rate = RATE, .out_burst = BURST };
+    struct aesd_sched *sched = aesd_sched_create(&limits);
+    struct aesd_sched_client *client;
+    struct aesd_sched_stats stats;
+    struct in_addr addr;
+    uint64_t start, delay;
+
+    TEST_ASSERT_NOT_NULL(sched);
+    inet_pton(AF_INET, "192.0.2.3", &addr);
+    client = aesd_sched_join(sched, addr);
+
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(0, aesd_sched_charge_out(sched, client, BURST), "A burst should not be held back");
+    // 10000 bytes past the burst at 100000 bytes/s is 100 ms, returned instead of waited
+    start = now_ms();
+    delay = aesd_sched_charge_out(sched, client, BURST);
+    TEST_ASSERT_TRUE_MESSAGE(now_ms() - start < 50, "Charging should never wait");
+    TEST_ASSERT_TRUE(delay > 90000000 && delay <= 100000000);
+
+    aesd_sched_get_stats(sched, client, &stats);
+    TEST_ASSERT_EQUAL_UINT(2 * BURST, stats.bytes_out);
+    TEST_ASSERT_EQUAL_UINT(1, stats.throttled_out);
+    TEST_ASSERT_EQUAL_UINT64(delay, stats.throttled_out_ns);
+
+    aesd_sched_shutdown(sched);
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(0, aesd_sched_charge_out(sched, client, BURST), "Nothing should be held back after shutdown");
+    aesd_sched_leave(sched, client);
+    aesd_sched_destroy(sched);
+}
+
+struct turn_order {
+    struct aesd_sched *sched;
+    struct aesd_sched_client *client;
+    char order[2];
+    int taken;
+};
+
+static void *waiting_turn(void *arg)
+{
+    struct turn_order *turns = arg;
+
+    aesd_sched_turn_begin(turns->sched, turns->client);
+    turns->order[turns->taken++] = 'B';
+    aesd_sched_turn_end(turns->sched);
+    return NULL;
+}
+
+void test_sched_turns_in_arrival_order()
+{
+    struct aesd_sched_limits limits = {0};
+    struct turn_order turns = { .sched = aesd_sched_create(&limits) };
+    struct aesd_sched_client *a;
+    struct aesd_sched_stats stats;
+    struct in_addr addr;
+    pthread_t thread;
+
+    TEST_ASSERT_NOT_NULL(turns.sched);
+    inet_pton(AF_INET, "192.0.2.1", &addr);
+    a = aesd_sched_join(turns.sched, addr);
+    inet_pton(AF_INET, "192.0.2.2", &addr);
+    turns.client = aesd_sched_join(turns.sched, addr);
+
+    aesd_sched_turn_begin(turns.sched, a);
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&thread, NULL, waiting_turn, &turns));
+    usleep(50000);
+    // Asking again straight after ending a turn queues behind the connection already waiting
+    aesd_sched_turn_end(turns.sched);
+    aesd_sched_turn_begin(turns.sched, a);
+    turns.order[turns.taken++] = 'A';
+    aesd_sched_turn_end(turns.sched);
+    pthread_join(thread, NULL);
+    TEST_ASSERT_EQUAL_MEMORY_MESSAGE("BA", turns.order, 2, "Turns should be handed over in arrival order");
+
+    aesd_sched_get_stats(turns.sched, turns.client, &stats);
+    TEST_ASSERT_EQUAL_UINT(1, stats.turns);
+    TEST_ASSERT_TRUE_MESSAGE(stats.turn_wait_ns >= 40000000, "The wait for the turn should be counted");
+    aesd_sched_leave(turns.sched, a);
+    aesd_sched_leave(turns.sched, turns.client);
+    aesd_sched_destroy(turns.sched);
+}
@@ -0,0 +1,135 @@
+#include "unity.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/aesd_trace.h"
+
+/**
+* Tests for the aesdsocket phase trace: nothing is recorded until enabled, each thread keeps the
+* latest events of its own ring, rings of exited threads are reused, and a dump taken while threads
+* record is a complete Chrome trace.
+*/
+
+#define TRACE_PATH  "/tmp/Test_aesd_trace.json"
+#define RING_EVENTS 8
+
+static char dump_text[1 << 20];
+
+/**
+* Dump the trace and read it back into dump_text
+* @return the number of events the dump reported, -1 if it could not be read back
+*/
+static ssize_t dump(void)
+{
+    ssize_t events = aesd_trace_dump(TRACE_PATH);
+    FILE *file = fopen(TRACE_PATH, "r");
+    size_t len;
+
+    dump_text[0] = '\0';
+    if (!file)
+        return -1;
+    len = fread(dump_text, 1, sizeof(dump_text) - 1, file);
+    dump_text[len] = '\0';
+    fclose(file);
+    return events;
+}
+
+static size_t count(const char *needle)
+{
+    size_t found = 0;
+
+    for (const char *p = dump_text; (p = strstr(p, needle)); p += strlen(needle))
+        found++;
+    return found;
+}
+
+void test_trace_keeps_latest_per_thread()
+{
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(0, aesd_trace_begin(), "Nothing should be timed before aesd_trace_enable()");
+    aesd_trace_end(AESD_TRACE_RECV, aesd_trace_begin(), 1);
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_enable(RING_EVENTS - 1));
+    aesd_trace_thread_name("test");
+    for (int i = 0; i < 3 * RING_EVENTS; i++)
+        aesd_trace_end(i < 2 * RING_EVENTS ? AESD_TRACE_RECV : AESD_TRACE_SEND, aesd_trace_begin(), 100);
+    TEST_ASSERT_EQUAL_INT(RING_EVENTS, dump());
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(RING_EVENTS, count("\"name\":\"send\""), "The ring should hold the latest events");
+    TEST_ASSERT_EQUAL_UINT(0, count("\"name\":\"recv\""));
+    TEST_ASSERT_EQUAL_UINT(RING_EVENTS, count("\"args\":{\"bytes\":100}"));
+    TEST_ASSERT_EQUAL_UINT(1, count("\"args\":{\"name\":\"test "));
+    aesd_trace_shutdown();
+
+    // A new trace starts over with fresh rings
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_enable(RING_EVENTS));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, aesd_trace_enable(RING_EVENTS), "A trace should only be enabled once");
+    aesd_trace_end(AESD_TRACE_FSYNC, aesd_trace_begin(), 0);
+    TEST_ASSERT_EQUAL_INT(1, dump());
+    TEST_ASSERT_EQUAL_UINT(0, count("\"args\":{\"bytes\""));
+    aesd_trace_shutdown();
+    remove(TRACE_PATH);
+}
+
+static volatile bool recording;
+
+static void *record_thread(void *arg)
+{
+    (void)arg;
+    aesd_trace_thread_name("recorder");
+    while (recording)
+        aesd_trace_end(AESD_TRACE_WRITE, aesd_trace_begin(), 7);
+    return NULL;
+}
+
+void test_trace_dump_while_recording()
+{
+    pthread_t threads[2];
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_enable(64));
+    recording = true;
+    for (int i = 0; i < 2; i++)
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, record_thread, NULL));
+    for (int i = 0; i < 50; i++) {
+        ssize_t events = dump();
+
+        TEST_ASSERT_TRUE(events >= 0 && events <= 2 * 64);
+        TEST_ASSERT_EQUAL_UINT((size_t)events, count("\"ph\":\"X\""));
+        TEST_ASSERT_NOT_NULL_MESSAGE(strstr(dump_text, "\n]}\n"), "Every dump should be complete");
+    }
+    recording = false;
+    for (int i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+    TEST_ASSERT_EQUAL_INT(2 * 64, dump());
+    TEST_ASSERT_EQUAL_UINT(2, count("\"args\":{\"name\":\"recorder "));
+    aesd_trace_shutdown();
+    remove(TRACE_PATH);
+}
+
+static void *short_lived_thread(void *arg)
+{
+    aesd_trace_thread_name(arg);
+    for (int i = 0; i < 3; i++)
+        aesd_trace_end(AESD_TRACE_RECV, aesd_trace_begin(), 0);
+    return NULL;
+}
+
+void test_trace_reuses_rings_of_exited_threads()
+{
+    pthread_t thread;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_trace_enable(RING_EVENTS));
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&thread, NULL, short_lived_thread, "first"));
+    pthread_join(thread, NULL);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(3, dump(), "An exited thread's events should be dumped until its ring is reused");
+    TEST_ASSERT_EQUAL_UINT(1, count("\"args\":{\"name\":\"first "));
+    for (int i = 0; i < 100; i++) {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&thread, NULL, short_lived_thread, "later"));
+        pthread_join(thread, NULL);
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(3, dump(), "Only the last owner's events should be kept");
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(1, count("\"ph\":\"M\""), "Threads alive one at a time should share one ring");
+    TEST_ASSERT_EQUAL_UINT(0, count("\"args\":{\"name\":\"first "));
+    aesd_trace_shutdown();
+    remove(TRACE_PATH);
+}
@@ -0,0 +1,104 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "../../server/aesdsocket_parse.h"
+#include "../fuzz/aesdsocket_parse_model.h"
+
+/**
+* Tests for the aesdsocket text command and frame parsers: the commands clients send, then random
+* near misses of them and random frame streams, each checked against the reference model of
+* student-test/fuzz/aesdsocket_parse_model.c.  The fuzz target fuzz_aesdsocket_parse runs the same
+* model on generated input.
+*/
+
+#define MODEL_RUNS 20000
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static enum aesd_text_kind parse(const char *text, struct aesd_text_command *cmd)
+{
+    return aesd_parse_text_command(text, strlen(text), cmd);
+}
+
+void test_parse_text_commands()
+{
+    struct aesd_text_command cmd;
+
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_SEEKTO, parse("AESDCHAR_IOCSEEKTO:2,5\n", &cmd));
+    TEST_ASSERT_EQUAL_UINT32(2, cmd.seekto.write_cmd);
+    TEST_ASSERT_EQUAL_UINT32(5, cmd.seekto.write_cmd_offset);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(AESD_TEXT_SEEKTO, parse("AESDCHAR_IOCSEEKTO:4294967295,0", &cmd),
+                                  "A command may end with the bytes received");
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, cmd.seekto.write_cmd);
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_MALFORMED, parse("AESDCHAR_IOCSEEKTO:4294967296,0\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_SEEKTO, cmd.malformed);
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_MALFORMED, parse("AESDCHAR_IOCSEEKTO:-1,0\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_MALFORMED, parse("AESDCHAR_IOCSEEKTO:1,2x\n", &cmd));
+
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_SEEK_SINCE, parse("AESDCHAR_IOCSEEKSINCE:time,18446744073709551615\n", &cmd));
+    TEST_ASSERT_EQUAL_UINT32(AESDCHAR_SEEK_SINCE_TIME, cmd.since.by);
+    TEST_ASSERT_TRUE(cmd.since.value == UINT64_MAX);
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_MALFORMED, parse("AESDCHAR_IOCSEEKSINCE:when,1\n", &cmd));
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_SEEK_SINCE, cmd.malformed);
+
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_SUBSCRIBE, parse("AESDSOCKET_SUBSCRIBE:drop\n", &cmd));
+    TEST_ASSERT_TRUE(cmd.drop);
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_BINARY_HELLO, parse("AESDSOCKET_BINARY\nframes", &cmd));
+    TEST_ASSERT_EQUAL_UINT(strlen(AESD_PROTO_BINARY_HELLO), cmd.hello_len);
+    // A short receive is data, even when the buffer it came in held a command before
+    TEST_ASSERT_EQUAL_INT(AESD_TEXT_DATA, aesd_parse_text_command("AESDCHAR_IOCSEEKTO:1,1\n", 8, &cmd));
+}
+
+void test_parse_matches_model()
+{
+    static const char *const tokens[] = {
+        "AESDCHAR_IOCSEEKTO:", "AESDCHAR_IOCSEEKSINCE:", "AESDSOCKET_SUBSCRIBE", "AESDSOCKET_BINARY\n",
+        "seq,", "time,", ":drop", "0", "1", "9", "4294967295", "4294967296", "18446744073709551615",
+        "18446744073709551616", ",", "\n", " ", "-", "+", "x", "\0",
+    };
+    uint8_t data[96];
+    char why[256], message[320];
+    uint32_t run, state = 0x9e3779b9;
+
+    for (run = 0; run < MODEL_RUNS; run++) {
+        size_t len = 0, i, count = xorshift32(&state) % 8;
+
+        // Half the runs string tokens together into near commands, the rest are random frame streams
+        if (run % 2 == 0) {
+            for (i = 0; i < count; i++) {
+                const char *token = tokens[xorshift32(&state) % (sizeof(tokens) / sizeof(tokens[0]))];
+                size_t token_len = *token ? strlen(token) : 1;
+
+                if (len + token_len > sizeof(data))
+                    break;
+                memcpy(data + len, token, token_len);
+                len += token_len;
+            }
+        } else {
+            len = xorshift32(&state) % sizeof(data);
+            for (i = 0; i < len; i++)
+                data[i] = xorshift32(&state);
+            // Payload lengths small enough for frames to complete, or past the maximum
+            for (i = 0; i + 16 <= len; i += 16 + data[i + 3] % 16) {
+                uint32_t length = xorshift32(&state) % 17 == 0 ? AESD_FRAME_MAX_PAYLOAD + 1 : data[i + 3] % 16;
+
+                data[i] = length >> 24;
+                data[i + 1] = length >> 16;
+                data[i + 2] = length >> 8;
+                data[i + 3] = length;
+            }
+        }
+        if (!aesdsocket_parse_model_run(data, len, why, sizeof(why))) {
+            snprintf(message, sizeof(message), "Run %u: %s", run, why);
+            TEST_FAIL_MESSAGE(message);
+        }
+    }
+}
@@ -0,0 +1,161 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../aesd-char-driver/aesdchar_emu.h"
+#include "../../aesd-char-driver/aesd_ioctl.h"
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Tests for the userspace emulation of the aesdchar driver file operations, checking the
+* semantics aesdsocket relies on: commands committed at newlines, one command per read,
+* and AESDCHAR_IOCSEEKTO positioning.
+*/
+
+static int open_fresh_device(void)
+{
+    aesd_emu_reset();
+    return aesd_emu_open("/dev/aesdchar", O_RDWR);
+}
+
+static void write_string(int fd, const char *str)
+{
+    TEST_ASSERT_EQUAL_INT(strlen(str), aesd_emu_write(fd, str, strlen(str)));
+}
+
+void test_emu_commits_at_newline_and_reads_one_command_per_call()
+{
+    int fd = open_fresh_device();
+    char buf[64];
+
+    write_string(fd, "abc");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_emu_read(fd, buf, sizeof(buf)), "Partial commands should not be readable");
+
+    write_string(fd, "def\n");
+    write_string(fd, "second\n");
+    TEST_ASSERT_EQUAL_INT(7, aesd_emu_read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY("abcdef\n", buf, 7);
+    TEST_ASSERT_EQUAL_INT(7, aesd_emu_read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY("second\n", buf, 7);
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_read(fd, buf, sizeof(buf)));
+    aesd_emu_close(fd);
+}
+
+void test_emu_seekto_and_lseek_bounds()
+{
+    int fd = open_fresh_device();
+    struct aesd_seekto seekto = { .write_cmd = 1, .write_cmd_offset = 2 };
+    char buf[64];
+
+    write_string(fd, "first\n");
+    write_string(fd, "second\n");
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto));
+    TEST_ASSERT_EQUAL_INT(5, aesd_emu_read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY("cond\n", buf, 5);
+
+    seekto.write_cmd = 2;
+    TEST_ASSERT_EQUAL_INT(-1, aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+
+    TEST_ASSERT_EQUAL_INT(13, aesd_emu_lseek(fd, 0, SEEK_END));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_emu_lseek(fd, 1, SEEK_END));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+    aesd_emu_close(fd);
+}
+
+void test_emu_stats_and_readv()
+{
+    int fd = open_fresh_device();
+    struct aesd_stats stats;
+    struct aesd_seek_range ranges[2] = { { 0, 1, 3 }, { 1, 0, 100 } };
+    char part1[4], part2[32];
+    struct iovec iov[2] = { { part1, sizeof(part1) }, { part2, sizeof(part2) } };
+    struct aesd_readv readv = {
+        .ranges = (uintptr_t)ranges, .iov = (uintptr_t)iov, .nr_ranges = 2, .iovcnt = 2,
+    };
+
+    write_string(fd, "first\n");
+    write_string(fd, "second\n");
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCGSTATS, &stats));
+    TEST_ASSERT_EQUAL_UINT32(2, stats.entry_count);
+    TEST_ASSERT_EQUAL_UINT32(13, stats.total_bytes);
+    TEST_ASSERT_EQUAL_UINT32(6, stats.entry_size[0]);
+    TEST_ASSERT_EQUAL_UINT32(7, stats.entry_size[1]);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.writes);
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCREADV, &readv));
+    TEST_ASSERT_EQUAL_UINT32(10, readv.bytes_read);
+    TEST_ASSERT_EQUAL_MEMORY("irss", part1, 4);
+    TEST_ASSERT_EQUAL_MEMORY("econd\n", part2, 6);
+
+    // A bad range anywhere fails the call before the good ones before it are copied
+    ranges[1].write_cmd = 2;
+    memset(part1, 'x', sizeof(part1));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_emu_ioctl(fd, AESDCHAR_IOCREADV, &readv));
+    TEST_ASSERT_EQUAL_INT(EINVAL, errno);
+    TEST_ASSERT_EQUAL_MEMORY("xxxx", part1, 4);
+    aesd_emu_close(fd);
+}
+
+void test_emu_follow_mode_nonblocking_read()
+{
+    int fd;
+    uint32_t enable = 1;
+    char buf[16];
+
+    aesd_emu_reset();
+    fd = aesd_emu_open("/dev/aesdchar", O_RDWR | O_NONBLOCK);
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCFOLLOW, &enable));
+    TEST_ASSERT_EQUAL_INT(-1, aesd_emu_read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(EAGAIN, errno);
+
+    write_string(fd, "tail\n");
+    TEST_ASSERT_EQUAL_INT(5, aesd_emu_read(fd, buf, sizeof(buf)));
+    aesd_emu_close(fd);
+}
+
+void test_emu_seek_since_seq_and_time()
+{
+    int fd = open_fresh_device();
+    struct aesd_seek_since since = { .by = AESDCHAR_SEEK_SINCE_SEQ, .value = 11 };
+    uint64_t third_timestamp;
+    char buf[64];
+    int i;
+
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2; i++) {
+        snprintf(buf, sizeof(buf), "cmd%02d\n", i);
+        write_string(fd, buf);
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKSINCE, &since));
+    TEST_ASSERT_EQUAL_UINT64(11, since.seq);
+    TEST_ASSERT_EQUAL_INT(6, aesd_emu_read(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY("cmd11\n", buf, 6);
+
+    since.value = 0;
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKSINCE, &since));
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(2, since.seq, "Evicted sequence numbers should resume at the oldest command");
+
+    since.value = 3;
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKSINCE, &since));
+    third_timestamp = since.timestamp_ns;
+    TEST_ASSERT_TRUE_MESSAGE(third_timestamp != 0, "Commands should carry their receive time");
+
+    since.by = AESDCHAR_SEEK_SINCE_TIME;
+    since.value = third_timestamp;
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKSINCE, &since));
+    TEST_ASSERT_TRUE_MESSAGE(since.seq <= 3, "Seeking by time should land on or before the command with that time");
+    TEST_ASSERT_TRUE(since.timestamp_ns == third_timestamp);
+
+    since.value = third_timestamp + 3600ULL * 1000000000ULL;
+    TEST_ASSERT_EQUAL_INT(0, aesd_emu_ioctl(fd, AESDCHAR_IOCSEEKSINCE, &since));
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(12, since.seq, "No match should report the next sequence number");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, aesd_emu_read(fd, buf, sizeof(buf)), "No match should seek to the end");
+    aesd_emu_close(fd);
+}
@@ -0,0 +1,221 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+/**
+* Tests for the byte limit and memory accounting of the circular buffer.  Entries are released
+* through buffer.release, which records the order entries were evicted in.
+*/
+
+static const char *released[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 4];
+static size_t released_count;
+
+static void record_release(struct aesd_buffer_entry *entry)
+{
+    released[released_count++] = entry->buffptr;
+}
+
+static void setup_buffer(struct aesd_circular_buffer *buffer, size_t max_bytes)
+{
+    aesd_circular_buffer_init(buffer);
+    buffer->max_bytes = max_bytes;
+    buffer->release = record_release;
+    released_count = 0;
+}
+
+static void add_string(struct aesd_circular_buffer *buffer, const char *str)
+{
+    struct aesd_buffer_entry entry;
+    entry.buffptr = str;
+    entry.size = strlen(str);
+    aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+void test_byte_limit_evicts_oldest_first()
+{
+    struct aesd_circular_buffer buffer;
+    size_t offset_rtn;
+    struct aesd_buffer_entry *rtnentry;
+
+    setup_buffer(&buffer, 10);
+    add_string(&buffer, "aaaa\n");
+    add_string(&buffer, "bbbb\n");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(10, buffer.total_bytes, "Two entries should fit exactly in the limit");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, released_count, "Nothing should be evicted at the limit");
+
+    add_string(&buffer, "cc\n");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, released_count, "Exceeding the limit should evict one entry");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("aaaa\n", released[0], "The oldest entry should be evicted first");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(8, buffer.total_bytes, "Accounting should drop the evicted entry");
+
+    rtnentry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &offset_rtn);
+    TEST_ASSERT_NOT_NULL_MESSAGE(rtnentry, "Offset 0 should be found after eviction");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("bbbb\n", rtnentry->buffptr, "Offset 0 should start at the oldest kept entry");
+    rtnentry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 8, &offset_rtn);
+    TEST_ASSERT_NULL_MESSAGE(rtnentry, "Offsets past the retained bytes should not be found");
+}
+
+void test_byte_limit_keeps_newest_oversized_entry()
+{
+    struct aesd_circular_buffer buffer;
+    size_t offset_rtn;
+    struct aesd_buffer_entry *rtnentry;
+
+    setup_buffer(&buffer, 4);
+    add_string(&buffer, "ab\n");
+    add_string(&buffer, "this entry is larger than the limit\n");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, released_count, "Only the older entry should be evicted");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("ab\n", released[0], "The older entry should be evicted");
+    TEST_ASSERT_EQUAL_UINT32(strlen("this entry is larger than the limit\n"), buffer.total_bytes);
+
+    rtnentry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 5, &offset_rtn);
+    TEST_ASSERT_NOT_NULL_MESSAGE(rtnentry, "The oversized entry should still be readable");
+    TEST_ASSERT_EQUAL_UINT32(5, offset_rtn);
+
+    add_string(&buffer, "x\n");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(2, released_count, "A new entry should evict the oversized one");
+    TEST_ASSERT_EQUAL_UINT32(2, buffer.total_bytes);
+}
+
+void test_byte_limit_evicts_several_entries_at_once()
+{
+    struct aesd_circular_buffer buffer;
+    size_t i;
+    const char *small[] = { "1\n", "2\n", "3\n", "4\n", "5\n" };
+
+    setup_buffer(&buffer, 10);
+    for (i = 0; i < 5; i++)
+        add_string(&buffer, small[i]);
+    TEST_ASSERT_EQUAL_UINT32(10, buffer.total_bytes);
+
+    add_string(&buffer, "large\n");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(3, released_count, "Three small entries should make room for six bytes");
+    for (i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(small[i], released[i], "Entries should be evicted in insertion order");
+    TEST_ASSERT_EQUAL_UINT32(10, buffer.total_bytes);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(10, buffer.high_water_bytes, "High water mark should not exceed the limit");
+}
+
+void test_entry_limit_releases_overwritten_entries()
+{
+    struct aesd_circular_buffer buffer;
+    char strings[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2][4];
+    size_t i;
+
+    setup_buffer(&buffer, 0);
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 2; i++) {
+        snprintf(strings[i], sizeof(strings[i]), "%zu\n", i % 10);
+        add_string(&buffer, strings[i]);
+    }
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(2, released_count, "Overwriting a full buffer should release the oldest entries");
+    TEST_ASSERT_EQUAL_PTR(strings[0], released[0]);
+    TEST_ASSERT_EQUAL_PTR(strings[1], released[1]);
+    TEST_ASSERT_EQUAL_UINT32(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 2, buffer.total_bytes);
+}
+
+void test_high_water_mark_tracks_peak_usage()
+{
+    struct aesd_circular_buffer buffer;
+
+    setup_buffer(&buffer, 100);
+    add_string(&buffer, "0123456789012345678\n");
+    add_string(&buffer, "0123456789012345678\n");
+    TEST_ASSERT_EQUAL_UINT32(40, buffer.high_water_bytes);
+
+    buffer.max_bytes = 20;
+    add_string(&buffer, "x\n");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(2, buffer.total_bytes, "Lowering the limit should apply on the next add");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(40, buffer.high_water_bytes, "High water mark should keep the peak");
+}
+
+void test_add_entry_evict_returns_entries_without_release()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry, evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    const char *small[] = { "1\n", "2\n", "3\n" };
+    size_t i, evicted_count;
+
+    setup_buffer(&buffer, 6);
+    for (i = 0; i < 3; i++)
+        add_string(&buffer, small[i]);
+
+    entry.buffptr = "four\n";
+    entry.size = strlen(entry.buffptr);
+    evicted_count = aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(3, evicted_count, "All older entries should be evicted to fit five bytes");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, released_count, "Returned entries should not be passed to release");
+    for (i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(small[i], evicted[i].buffptr, "Evicted entries should be returned oldest first");
+    TEST_ASSERT_EQUAL_UINT32(5, buffer.total_bytes);
+}
+
+void test_set_max_bytes_evicts_down_to_lowered_limit()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    const char *strings[] = { "aaaa\n", "bb\n", "cccccc\n" };
+    size_t i, evicted_count;
+
+    setup_buffer(&buffer, 0);
+    for (i = 0; i < 3; i++)
+        add_string(&buffer, strings[i]);
+
+    evicted_count = aesd_circular_buffer_set_max_bytes(&buffer, 9, evicted);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(2, evicted_count, "Lowering the limit should evict the oldest entries at once");
+    TEST_ASSERT_EQUAL_PTR(strings[0], evicted[0].buffptr);
+    TEST_ASSERT_EQUAL_PTR(strings[1], evicted[1].buffptr);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, released_count, "Returned entries should not be passed to release");
+    TEST_ASSERT_EQUAL_UINT32(7, buffer.total_bytes);
+    TEST_ASSERT_EQUAL_UINT32(9, buffer.max_bytes);
+
+    evicted_count = aesd_circular_buffer_set_max_bytes(&buffer, 1, evicted);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, evicted_count, "The newest entry should be kept even over the limit");
+    TEST_ASSERT_EQUAL_UINT32(7, buffer.total_bytes);
+}
+
+void test_add_entries_matches_repeated_add_entry()
+{
+    struct aesd_circular_buffer bulk, single;
+    struct aesd_buffer_entry entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3];
+    char strings[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3][8];
+    const char *released_single[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 4];
+    size_t released_single_count, i;
+
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3; i++) {
+        snprintf(strings[i], sizeof(strings[i]), "%.*s\n", (int)(i % 4) + 1, "abcd");
+        entries[i].buffptr = strings[i];
+        entries[i].size = strlen(strings[i]);
+    }
+
+    setup_buffer(&single, 30);
+    add_string(&single, "old\n");
+    add_string(&single, "older\n");
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3; i++)
+        aesd_circular_buffer_add_entry(&single, &entries[i]);
+    released_single_count = released_count;
+    memcpy(released_single, released, sizeof(released));
+
+    setup_buffer(&bulk, 30);
+    add_string(&bulk, "old\n");
+    add_string(&bulk, "older\n");
+    aesd_circular_buffer_add_entries(&bulk, entries, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 3);
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(released_single_count, released_count, "Bulk add should release the same entries");
+    for (i = 0; i < released_count; i++)
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(released_single[i], released[i], "Bulk add should release in the same order");
+    TEST_ASSERT_EQUAL_UINT32(single.total_bytes, bulk.total_bytes);
+    // Skipped entries never take a slot, so compare the retained entries in order, not by index
+    for (i = 0; i < single.total_bytes; i++) {
+        size_t single_offset, bulk_offset;
+        struct aesd_buffer_entry *single_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&single, i, &single_offset);
+        struct aesd_buffer_entry *bulk_entry = aesd_circular_buffer_find_entry_offset_for_fpos(&bulk, i, &bulk_offset);
+
+        TEST_ASSERT_NOT_NULL(bulk_entry);
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(single_entry->buffptr, bulk_entry->buffptr, "Bulk add should retain the same entries");
+        TEST_ASSERT_EQUAL_UINT32(single_offset, bulk_offset);
+    }
+}
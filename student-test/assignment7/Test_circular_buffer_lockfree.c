@@ -0,0 +1,142 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../../aesd-char-driver/aesd-circular-buffer-lockfree.h"
+
+/**
+* Tests for the lock free circular buffer: single threaded semantics matching
+* aesd_circular_buffer_find_entry_offset_for_fpos(), and a threaded stress test where consumers
+* check every entry they find against what its producer wrote.
+*/
+
+#define STRESS_PRODUCERS         4
+#define STRESS_ENTRIES_PER_PRODUCER 20000
+#define STRESS_ENTRY_LEN         16
+
+static struct aesd_lf_circular_buffer stress_buffer;
+static char stress_strings[STRESS_PRODUCERS][STRESS_ENTRIES_PER_PRODUCER][STRESS_ENTRY_LEN];
+static volatile bool stress_done;
+
+static void add_string(struct aesd_lf_circular_buffer *buffer, const char *str)
+{
+    struct aesd_buffer_entry entry;
+    entry.buffptr = str;
+    entry.size = strlen(str);
+    aesd_lf_circular_buffer_add_entry(buffer, &entry);
+}
+
+void test_lockfree_matches_locked_buffer_semantics()
+{
+    struct aesd_lf_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+    size_t offset_rtn;
+    char strings[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1][8];
+    size_t i;
+
+    aesd_lf_circular_buffer_init(&buffer, AESD_LF_SINGLE_PRODUCER);
+    TEST_ASSERT_FALSE_MESSAGE(aesd_lf_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &entry, &offset_rtn),
+            "An empty buffer should not find offset 0");
+
+    for (i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1; i++) {
+        snprintf(strings[i], sizeof(strings[i]), "w%zu\n", i);
+        add_string(&buffer, strings[i]);
+    }
+
+    TEST_ASSERT_TRUE(aesd_lf_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &entry, &offset_rtn));
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(strings[1], entry.buffptr, "The oldest entry should have been overwritten");
+    TEST_ASSERT_EQUAL_UINT32(0, offset_rtn);
+
+    TEST_ASSERT_TRUE(aesd_lf_circular_buffer_find_entry_offset_for_fpos(&buffer, 29, &entry, &offset_rtn));
+    TEST_ASSERT_EQUAL_PTR(strings[10], entry.buffptr);
+    TEST_ASSERT_EQUAL_UINT32(2, offset_rtn);
+
+    TEST_ASSERT_FALSE(aesd_lf_circular_buffer_find_entry_offset_for_fpos(&buffer, 31, &entry, &offset_rtn));
+}
+
+static void *stress_producer(void *arg)
+{
+    size_t producer = (size_t)arg;
+    size_t i;
+
+    for (i = 0; i < STRESS_ENTRIES_PER_PRODUCER; i++)
+        add_string(&stress_buffer, stress_strings[producer][i]);
+    return NULL;
+}
+
+/**
+* Walk the buffer by offset and check that every entry found is one a producer wrote with a
+* matching size.  Each lookup is a new snapshot, and the window only moves forward, so the entries
+* of each producer must be found in the order they were added
+*/
+static void *stress_consumer(void *arg)
+{
+    long failures = 0;
+    (void)arg;
+
+    while (!stress_done) {
+        long last_index[STRESS_PRODUCERS];
+        struct aesd_buffer_entry entry;
+        size_t offset = 0, offset_rtn;
+        unsigned int producer, index;
+
+        memset(last_index, 0xff, sizeof(last_index));
+        while (aesd_lf_circular_buffer_find_entry_offset_for_fpos(&stress_buffer, offset, &entry, &offset_rtn)) {
+            if (offset_rtn >= entry.size || entry.size != strlen(entry.buffptr) ||
+                    sscanf(entry.buffptr, "p%u e%u", &producer, &index) != 2 ||
+                    producer >= STRESS_PRODUCERS || index >= STRESS_ENTRIES_PER_PRODUCER ||
+                    entry.buffptr != stress_strings[producer][index] ||
+                    (long)index < last_index[producer]) {
+                failures++;
+                break;
+            }
+            last_index[producer] = index;
+            offset += entry.size - offset_rtn;
+        }
+    }
+    return (void *)failures;
+}
+
+static void run_stress(enum aesd_lf_producer_mode mode, size_t producers)
+{
+    pthread_t producer_threads[STRESS_PRODUCERS], consumer_threads[2];
+    struct aesd_buffer_entry entry;
+    size_t offset_rtn, p, i;
+    void *failures;
+    long total_failures = 0;
+
+    for (p = 0; p < STRESS_PRODUCERS; p++)
+        for (i = 0; i < STRESS_ENTRIES_PER_PRODUCER; i++)
+            snprintf(stress_strings[p][i], STRESS_ENTRY_LEN, "p%zu e%zu\n", p, i);
+
+    aesd_lf_circular_buffer_init(&stress_buffer, mode);
+    stress_done = false;
+    for (i = 0; i < 2; i++)
+        pthread_create(&consumer_threads[i], NULL, stress_consumer, NULL);
+    for (p = 0; p < producers; p++)
+        pthread_create(&producer_threads[p], NULL, stress_producer, (void *)p);
+    for (p = 0; p < producers; p++)
+        pthread_join(producer_threads[p], NULL);
+    stress_done = true;
+    for (i = 0; i < 2; i++) {
+        pthread_join(consumer_threads[i], &failures);
+        total_failures += (long)failures;
+    }
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, total_failures, "Consumers should only ever find consistent entries");
+    TEST_ASSERT_EQUAL_UINT64(producers * STRESS_ENTRIES_PER_PRODUCER, atomic_load(&stress_buffer.published));
+    TEST_ASSERT_TRUE_MESSAGE(aesd_lf_circular_buffer_find_entry_offset_for_fpos(&stress_buffer, 0, &entry, &offset_rtn),
+            "The buffer should hold the most recent entries after the producers finish");
+}
+
+void test_lockfree_single_producer_stress()
+{
+    run_stress(AESD_LF_SINGLE_PRODUCER, 1);
+}
+
+void test_lockfree_multi_producer_stress()
+{
+    run_stress(AESD_LF_MULTI_PRODUCER, STRESS_PRODUCERS);
+}
@@ -0,0 +1,62 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../fuzz/circular_buffer_model.h"
+
+/**
+* Model based tests of the circular buffers: random sequences of adds, batched adds, evicting adds
+* and byte limit changes, each checked operation by operation against the reference model of
+* student-test/fuzz/circular_buffer_model.c.  The fuzz target fuzz_circular_buffer runs the same
+* model on generated input.
+*/
+
+#define MODEL_RUNS    2000
+#define MODEL_OPS_LEN 512
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+void test_circular_buffer_matches_model()
+{
+    uint8_t ops[MODEL_OPS_LEN];
+    char why[256], message[320];
+    uint32_t run, state = 0x2545f491;
+    size_t i;
+
+    for (run = 0; run < MODEL_RUNS; run++) {
+        // Vary the length too, so runs end at every point of an operation
+        size_t len = xorshift32(&state) % MODEL_OPS_LEN + 1;
+
+        for (i = 0; i < len; i++)
+            ops[i] = xorshift32(&state);
+        if (!aesd_circular_buffer_model_run(ops, len, why, sizeof(why))) {
+            snprintf(message, sizeof(message), "Run %u: %s", run, why);
+            TEST_FAIL_MESSAGE(message);
+        }
+    }
+}
+
+void test_circular_buffer_model_batches()
+{
+    // A full buffer with late timestamps, then a batch overwriting it twice with earlier ones
+    static const uint8_t ops[] = {
+        0, 5, 200, 0,  0, 5, 200, 0,  0, 5, 200, 0,  0, 5, 200, 0,  0, 5, 200, 0,
+        0, 5, 200, 0,  0, 5, 200, 0,  0, 5, 200, 0,  0, 5, 200, 0,  0, 5, 200, 0,
+        2, 21,
+        1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,
+        1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,
+        1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,  1, 0, 255,
+        // A byte limit smaller than one entry keeps just the newest
+        3, 1, 4,  0, 30, 1, 0,  1, 30, 1, 0,
+    };
+    char why[256];
+
+    TEST_ASSERT_TRUE_MESSAGE(aesd_circular_buffer_model_run(ops, sizeof(ops), why, sizeof(why)), why);
+}
@@ -0,0 +1,202 @@
+/**
+ * @file aesdsocket_parse_model.c
+ * @brief Reference model of the aesdsocket parsers, see aesdsocket_parse_model.h
+ */
+
+#include "aesdsocket_parse_model.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/aesdsocket_parse.h"
+
+/* Commands are short, only this many starts of the input are parsed as one besides the whole */
+#define MODEL_TEXT_PREFIXES 80
+
+static bool fail(char *why, size_t why_len, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(why, why_len, fmt, args);
+    va_end(args);
+    return false;
+}
+
+/**
+ * Parse the number at @param str up to @param max with strtoull, setting *@param end past it
+ * @return false unless it is one or more decimal digits within @param max
+ */
+static bool model_number(const char *str, uint64_t max, uint64_t *value, const char **end)
+{
+    char *stop;
+
+    if (!isdigit((unsigned char)*str))
+        return false;
+    errno = 0;
+    *value = strtoull(str, &stop, 10);
+    *end = stop;
+    return errno == 0 && *value <= max;
+}
+
+/**
+ * Model of aesd_parse_text_command() on @param text, a NUL terminated copy of @param len bytes
+ */
+static void model_text_command(const char *text, size_t len, struct aesd_text_command *cmd)
+{
+    const char *end_of_data = text + len, *p;
+    uint64_t a, b;
+
+    memset(cmd, 0, sizeof(*cmd));
+    // A NUL in the data ends the comparison early, so matching a prefix means it lies within len
+    if (strncmp(text, AESD_PROTO_BINARY_HELLO, strlen(AESD_PROTO_BINARY_HELLO)) == 0) {
+        cmd->kind = AESD_TEXT_BINARY_HELLO;
+        cmd->hello_len = strlen(AESD_PROTO_BINARY_HELLO);
+    } else if (strncmp(text, AESD_PROTO_SUBSCRIBE, strlen(AESD_PROTO_SUBSCRIBE)) == 0) {
+        cmd->kind = AESD_TEXT_SUBSCRIBE;
+        cmd->drop = strncmp(text + strlen(AESD_PROTO_SUBSCRIBE), ":drop", 5) == 0;
+    } else if (strncmp(text, AESD_TEXT_SEEKTO_PREFIX, strlen(AESD_TEXT_SEEKTO_PREFIX)) == 0) {
+        p = text + strlen(AESD_TEXT_SEEKTO_PREFIX);
+        if (model_number(p, UINT32_MAX, &a, &p) && *p == ',' && model_number(p + 1, UINT32_MAX, &b, &p) &&
+            (p == end_of_data || *p == '\n')) {
+            cmd->kind = AESD_TEXT_SEEKTO;
+            cmd->seekto.write_cmd = a;
+            cmd->seekto.write_cmd_offset = b;
+        } else {
+            cmd->kind = AESD_TEXT_MALFORMED;
+            cmd->malformed = AESD_TEXT_SEEKTO;
+        }
+    } else if (strncmp(text, AESD_TEXT_SEEK_SINCE_PREFIX, strlen(AESD_TEXT_SEEK_SINCE_PREFIX)) == 0) {
+        p = text + strlen(AESD_TEXT_SEEK_SINCE_PREFIX);
+        cmd->kind = AESD_TEXT_MALFORMED;
+        cmd->malformed = AESD_TEXT_SEEK_SINCE;
+        if (strncmp(p, "seq,", 4) == 0 || strncmp(p, "time,", 5) == 0) {
+            uint32_t by = p[0] == 's' ? AESDCHAR_SEEK_SINCE_SEQ : AESDCHAR_SEEK_SINCE_TIME;
+
+            if (model_number(p + (by == AESDCHAR_SEEK_SINCE_SEQ ? 4 : 5), UINT64_MAX, &a, &p) &&
+                (p == end_of_data || *p == '\n')) {
+                cmd->kind = AESD_TEXT_SEEK_SINCE;
+                cmd->since.by = by;
+                cmd->since.value = a;
+            }
+        }
+    } else {
+        cmd->kind = AESD_TEXT_DATA;
+    }
+}
+
+static bool check_text_command(const char *data, size_t len, char *text, char *why, size_t why_len)
+{
+    struct aesd_text_command cmd, expected;
+    // An exact copy, so the sanitizers catch the parser reading past the bytes it is given
+    char *exact = malloc(len ? len : 1);
+
+    if (!exact)
+        return fail(why, why_len, "out of memory");
+    memcpy(exact, data, len);
+    memcpy(text, data, len);
+    text[len] = '\0';
+    model_text_command(text, len, &expected);
+    aesd_parse_text_command(exact, len, &cmd);
+    free(exact);
+
+    if (cmd.kind != expected.kind)
+        return fail(why, why_len, "%zu bytes parsed as command %d, expected %d", len, cmd.kind, expected.kind);
+    switch (cmd.kind) {
+    case AESD_TEXT_BINARY_HELLO:
+        if (cmd.hello_len != expected.hello_len)
+            return fail(why, why_len, "hello of %zu bytes, expected %zu", cmd.hello_len, expected.hello_len);
+        break;
+    case AESD_TEXT_SUBSCRIBE:
+        if (cmd.drop != expected.drop)
+            return fail(why, why_len, "subscribe drop %d, expected %d", cmd.drop, expected.drop);
+        break;
+    case AESD_TEXT_SEEKTO:
+        if (cmd.seekto.write_cmd != expected.seekto.write_cmd ||
+            cmd.seekto.write_cmd_offset != expected.seekto.write_cmd_offset)
+            return fail(why, why_len, "seekto %u,%u, expected %u,%u", cmd.seekto.write_cmd,
+                        cmd.seekto.write_cmd_offset, expected.seekto.write_cmd, expected.seekto.write_cmd_offset);
+        break;
+    case AESD_TEXT_SEEK_SINCE:
+        if (cmd.since.by != expected.since.by || cmd.since.value != expected.since.value)
+            return fail(why, why_len, "seek since %u,%llu, expected %u,%llu", cmd.since.by,
+                        (unsigned long long)cmd.since.value, expected.since.by,
+                        (unsigned long long)expected.since.value);
+        break;
+    case AESD_TEXT_MALFORMED:
+        if (cmd.malformed != expected.malformed)
+            return fail(why, why_len, "malformed command %d, expected %d", cmd.malformed, expected.malformed);
+        break;
+    case AESD_TEXT_DATA:
+        break;
+    }
+    return true;
+}
+
+static uint64_t model_be(const uint8_t *data, size_t bytes)
+{
+    uint64_t value = 0;
+
+    while (bytes--)
+        value = value << 8 | *data++;
+    return value;
+}
+
+/**
+ * Check aesd_frame_scan() and aesd_frame_get_header() against decoding the header fields byte by byte
+ */
+static bool check_frames(const uint8_t *data, size_t len, char *why, size_t why_len)
+{
+    struct aesd_frame_header header;
+    struct aesd_seekto seekto;
+    ssize_t expected = 0, scanned = aesd_frame_scan((const char *)data, len);
+    size_t pos = 0;
+    int status;
+
+    // Frames are a 16 byte header, of which the first 4 are the payload length, and the payload
+    while (len - pos >= 16) {
+        uint64_t length = model_be(data + pos, 4);
+
+        aesd_frame_get_header((const char *)data + pos, &header);
+        if (header.length != length || header.opcode != model_be(data + pos + 4, 2) ||
+            header.flags_status != model_be(data + pos + 6, 2) || header.request_id != model_be(data + pos + 8, 8))
+            return fail(why, why_len, "frame header at %zu decoded wrong", pos);
+        if (length > AESD_FRAME_MAX_PAYLOAD) {
+            expected = -1;
+            break;
+        }
+        if (len - pos - 16 < length)
+            break;
+        pos += 16 + length;
+        expected = pos;
+    }
+    if (scanned != expected)
+        return fail(why, why_len, "%zu bytes scanned as %zd bytes of frames, expected %zd", len, scanned, expected);
+
+    status = aesd_frame_get_seek((const char *)data, len > UINT32_MAX ? UINT32_MAX : len, &seekto);
+    if (status != (len < 8 ? EINVAL : 0))
+        return fail(why, why_len, "seek payload of %zu bytes returned %d", len, status);
+    if (status == 0 && (seekto.write_cmd != model_be(data, 4) || seekto.write_cmd_offset != model_be(data + 4, 4)))
+        return fail(why, why_len, "seek payload decoded wrong");
+    return true;
+}
+
+bool aesdsocket_parse_model_run(const uint8_t *data, size_t len, char *why, size_t why_len)
+{
+    char *text = malloc(len + 1);
+    bool ok = true;
+    size_t prefix;
+
+    if (!text)
+        return fail(why, why_len, "out of memory");
+    for (prefix = 0; ok && prefix <= len && prefix <= MODEL_TEXT_PREFIXES; prefix++)
+        ok = check_text_command((const char *)data, prefix, text, why, why_len);
+    if (ok && len > MODEL_TEXT_PREFIXES)
+        ok = check_text_command((const char *)data, len, text, why, why_len);
+    if (ok)
+        ok = check_frames(data, len, why, why_len);
+    free(text);
+    return ok;
+}
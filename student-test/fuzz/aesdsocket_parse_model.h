@@ -0,0 +1,28 @@
+/*
+ * aesdsocket_parse_model.h
+ *
+ *  @brief Reference model of the aesdsocket parsers, for randomized and fuzz testing
+ *
+ *  aesdsocket_parse_model_run() hands the same bytes to aesdsocket_parse.c
+ *  and to a straightforward reimplementation of the text command grammar and
+ *  the frame layout, written with the C library on a NUL terminated copy, and
+ *  compares what they make of them.  The parsers must also never read past
+ *  the bytes they are given, which the sanitizers the tests and fuzz targets
+ *  are built with catch.
+ */
+
+#ifndef AESDSOCKET_PARSE_MODEL_H
+#define AESDSOCKET_PARSE_MODEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Parse the @param len bytes at @param data, and every start of them, as text commands and as frames
+ * @return true if aesdsocket_parse.c agreed with the model, otherwise false with the first difference
+ *   described in the @param why_len bytes at @param why
+ */
+bool aesdsocket_parse_model_run(const uint8_t *data, size_t len, char *why, size_t why_len);
+
+#endif /* AESDSOCKET_PARSE_MODEL_H */
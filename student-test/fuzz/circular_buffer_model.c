@@ -0,0 +1,329 @@
+/**
+ * @file circular_buffer_model.c
+ * @brief Reference model of the aesd circular buffers, see circular_buffer_model.h
+ *
+ * The model is kept deliberately naive: every entry added is recorded in
+ * added[] by sequence number, and the locked buffer is expected to hold the
+ * sequence numbers [oldest, next_seq), the lock free buffer the last
+ * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED of them.  Both buffers only ever
+ * evict their oldest entries, so what an operation evicts is the range of
+ * sequence numbers oldest moved over, in order.
+ */
+
+#include "circular_buffer_model.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+#include "../../aesd-char-driver/aesd-circular-buffer-lockfree.h"
+
+#define CAPACITY        AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+#define MAX_ENTRIES     4096
+#define MAX_ENTRY_SIZE  32
+/* Most entries a single add_entries operation adds, enough to overwrite the buffer twice */
+#define MAX_BATCH       (2 * CAPACITY + 2)
+
+enum model_op {
+    OP_ADD_ENTRY,
+    OP_ADD_ENTRY_EVICT,
+    OP_ADD_ENTRIES,
+    OP_SET_MAX_BYTES,
+    OP_COUNT,
+};
+
+struct model {
+    /* Every entry added, indexed by sequence number, with the timestamp the buffer should store */
+    struct aesd_buffer_entry added[MAX_ENTRIES];
+    uint64_t next_seq;
+    /* Oldest sequence number the locked buffer holds */
+    uint64_t oldest;
+    size_t total_bytes;
+    size_t high_water_bytes;
+    size_t max_bytes;
+    uint64_t clock_ns;
+};
+
+struct model_run {
+    const uint8_t *ops;
+    size_t len;
+    size_t pos;
+    char *why;
+    size_t why_len;
+    struct model model;
+    struct aesd_circular_buffer buffer;
+    struct aesd_lf_circular_buffer lf_buffer;
+};
+
+/* Distinct addresses for the entries, only the pointers are compared */
+static char entry_data[MAX_ENTRIES];
+
+/* Entries the locked buffer passed to its release callback during the current operation */
+static struct aesd_buffer_entry released[MAX_BATCH + CAPACITY];
+static size_t released_count;
+
+static void record_release(struct aesd_buffer_entry *entry)
+{
+    if (released_count < sizeof(released) / sizeof(released[0]))
+        released[released_count] = *entry;
+    released_count++;
+}
+
+static uint8_t next_byte(struct model_run *run)
+{
+    return run->pos < run->len ? run->ops[run->pos++] : 0;
+}
+
+static bool fail(struct model_run *run, const char *fmt, ...)
+{
+    va_list args;
+    int used = snprintf(run->why, run->why_len, "at op byte %zu: ", run->pos);
+
+    va_start(args, fmt);
+    if (used >= 0 && (size_t)used < run->why_len)
+        vsnprintf(run->why + used, run->why_len - used, fmt, args);
+    va_end(args);
+    return false;
+}
+
+/**
+ * Build the next entry from the input, with a timestamp that may run backwards
+ */
+static struct aesd_buffer_entry make_entry(struct model_run *run, uint64_t seq)
+{
+    struct aesd_buffer_entry entry = {
+        .buffptr = &entry_data[seq],
+        .size = 1 + next_byte(run) % MAX_ENTRY_SIZE,
+    };
+    uint8_t back;
+
+    run->model.clock_ns += next_byte(run);
+    back = next_byte(run);
+    entry.timestamp_ns = run->model.clock_ns > back ? run->model.clock_ns - back : 0;
+    return entry;
+}
+
+/**
+ * Apply the retention rules to the model for @param entry added, as by aesd_circular_buffer_add_entry()
+ */
+static void model_add(struct model *model, const struct aesd_buffer_entry *entry)
+{
+    struct aesd_buffer_entry *stored = &model->added[model->next_seq];
+
+    *stored = *entry;
+    stored->seq = model->next_seq;
+    // Timestamps never decrease from one entry to the next, whatever has been evicted meanwhile
+    if (stored->seq > 0 && stored->timestamp_ns < model->added[stored->seq - 1].timestamp_ns)
+        stored->timestamp_ns = model->added[stored->seq - 1].timestamp_ns;
+    if (model->next_seq - model->oldest == CAPACITY)
+        model->total_bytes -= model->added[model->oldest++].size;
+    model->next_seq++;
+    model->total_bytes += entry->size;
+    while (model->max_bytes && model->total_bytes > model->max_bytes && model->next_seq - model->oldest > 1)
+        model->total_bytes -= model->added[model->oldest++].size;
+}
+
+static bool same_entry(const struct aesd_buffer_entry *a, const struct aesd_buffer_entry *b, bool timestamps)
+{
+    return a->buffptr == b->buffptr && a->size == b->size && a->seq == b->seq &&
+        (!timestamps || a->timestamp_ns == b->timestamp_ns);
+}
+
+/**
+ * Check the @param count entries at @param evicted are those between sequence numbers @param from and
+ * @param to of the model, in order
+ */
+static bool check_evicted(struct model_run *run, const char *how, const struct aesd_buffer_entry *evicted,
+                          size_t count, uint64_t from, uint64_t to)
+{
+    size_t i;
+
+    if (count != to - from)
+        return fail(run, "%s %zu entries, expected %llu", how, count, (unsigned long long)(to - from));
+    for (i = 0; i < count; i++) {
+        if (!same_entry(&evicted[i], &run->model.added[from + i], false))
+            return fail(run, "%s entry %zu is seq %llu, expected seq %llu", how, i,
+                        (unsigned long long)evicted[i].seq, (unsigned long long)(from + i));
+    }
+    return true;
+}
+
+/**
+ * Check every lookup of the locked buffer against the model
+ */
+static bool check_buffer(struct model_run *run)
+{
+    struct model *model = &run->model;
+    struct aesd_circular_buffer *buffer = &run->buffer;
+    uint64_t count = model->next_seq - model->oldest, seq;
+    size_t start = 0, offset_rtn;
+
+    if (buffer->total_bytes != model->total_bytes)
+        return fail(run, "total_bytes %zu, expected %zu", buffer->total_bytes, model->total_bytes);
+    if (buffer->high_water_bytes != model->high_water_bytes)
+        return fail(run, "high_water_bytes %zu, expected %zu", buffer->high_water_bytes, model->high_water_bytes);
+    if (buffer->next_seq != model->next_seq)
+        return fail(run, "next_seq %llu, expected %llu", (unsigned long long)buffer->next_seq,
+                    (unsigned long long)model->next_seq);
+    if (buffer->full != (count == CAPACITY))
+        return fail(run, "full is %d with %llu entries", buffer->full, (unsigned long long)count);
+
+    for (seq = model->oldest; seq < model->next_seq; seq++) {
+        const struct aesd_buffer_entry *expected = &model->added[seq];
+        size_t offsets[2] = { start, start + expected->size - 1 };
+        int i;
+
+        for (i = 0; i < 2; i++) {
+            struct aesd_buffer_entry *entry =
+                aesd_circular_buffer_find_entry_offset_for_fpos(buffer, offsets[i], &offset_rtn);
+
+            if (!entry)
+                return fail(run, "offset %zu not found, expected seq %llu", offsets[i], (unsigned long long)seq);
+            if (!same_entry(entry, expected, true))
+                return fail(run, "offset %zu found seq %llu size %zu time %llu, expected seq %llu size %zu time %llu",
+                            offsets[i], (unsigned long long)entry->seq, entry->size,
+                            (unsigned long long)entry->timestamp_ns, (unsigned long long)seq, expected->size,
+                            (unsigned long long)expected->timestamp_ns);
+            if (offset_rtn != offsets[i] - start)
+                return fail(run, "offset %zu found at entry offset %zu, expected %zu", offsets[i], offset_rtn,
+                            offsets[i] - start);
+        }
+        start += expected->size;
+    }
+    if (aesd_circular_buffer_find_entry_offset_for_fpos(buffer, start, &offset_rtn))
+        return fail(run, "offset %zu found past the end of the data", start);
+
+    // Sequence numbers from before the oldest to past the newest
+    for (seq = model->oldest > 0 ? model->oldest - 1 : 0; seq <= model->next_seq + 1; seq++) {
+        int expected = count == 0 ? -1 : seq <= model->oldest ? 0 : seq < model->next_seq ? (int)(seq - model->oldest) : -1;
+        int index = aesd_circular_buffer_find_entry_index_for_seq(buffer, seq);
+
+        if (index != expected)
+            return fail(run, "seq %llu found at index %d, expected %d", (unsigned long long)seq, index, expected);
+    }
+
+    // The timestamps held, one past each, and 0
+    for (seq = model->oldest; seq <= model->next_seq; seq++) {
+        uint64_t timestamps[2] = { 0, 0 }, candidate;
+        int i;
+
+        if (seq < model->next_seq) {
+            timestamps[0] = model->added[seq].timestamp_ns;
+            timestamps[1] = timestamps[0] + 1;
+        }
+        for (i = 0; i < 2; i++) {
+            int expected = -1, index;
+
+            for (candidate = model->oldest; candidate < model->next_seq; candidate++) {
+                if (model->added[candidate].timestamp_ns >= timestamps[i]) {
+                    expected = candidate - model->oldest;
+                    break;
+                }
+            }
+            index = aesd_circular_buffer_find_entry_index_for_time(buffer, timestamps[i]);
+            if (index != expected)
+                return fail(run, "time %llu found at index %d, expected %d", (unsigned long long)timestamps[i],
+                            index, expected);
+        }
+    }
+    return true;
+}
+
+/**
+ * Check the lock free buffer, which keeps the last CAPACITY entries whatever their size
+ */
+static bool check_lf_buffer(struct model_run *run)
+{
+    struct model *model = &run->model;
+    uint64_t seq = model->next_seq > CAPACITY ? model->next_seq - CAPACITY : 0;
+    struct aesd_buffer_entry entry;
+    size_t start = 0, offset_rtn;
+
+    for (; seq < model->next_seq; seq++) {
+        const struct aesd_buffer_entry *expected = &model->added[seq];
+        size_t last = start + expected->size - 1;
+
+        if (!aesd_lf_circular_buffer_find_entry_offset_for_fpos(&run->lf_buffer, last, &entry, &offset_rtn) ||
+            !same_entry(&entry, expected, false) || offset_rtn != expected->size - 1)
+            return fail(run, "lock free offset %zu did not find the end of seq %llu", last, (unsigned long long)seq);
+        start += expected->size;
+    }
+    if (aesd_lf_circular_buffer_find_entry_offset_for_fpos(&run->lf_buffer, start, &entry, &offset_rtn))
+        return fail(run, "lock free offset %zu found past the end of the data", start);
+    return true;
+}
+
+/**
+ * Decode and apply one operation to the buffers and the model
+ * @return false if it did not match the model
+ */
+static bool run_op(struct model_run *run)
+{
+    struct model *model = &run->model;
+    struct aesd_buffer_entry entries[MAX_BATCH], evicted[CAPACITY];
+    uint64_t oldest = model->oldest;
+    size_t count = 1, evicted_count, i;
+    uint8_t op = next_byte(run) % OP_COUNT;
+
+    if (op == OP_SET_MAX_BYTES) {
+        // Mostly small limits, so the byte limit evicts often, sometimes none
+        model->max_bytes = next_byte(run) % 4 == 0 ? 0 : next_byte(run);
+        run->buffer.max_bytes = model->max_bytes;
+        return true;
+    }
+    if (op == OP_ADD_ENTRIES)
+        count = next_byte(run) % (MAX_BATCH + 1);
+    if (model->next_seq + count > MAX_ENTRIES) {
+        run->pos = run->len;
+        return true;
+    }
+    for (i = 0; i < count; i++)
+        entries[i] = make_entry(run, model->next_seq + i);
+
+    released_count = 0;
+    evicted_count = 0;
+    if (op == OP_ADD_ENTRY)
+        aesd_circular_buffer_add_entry(&run->buffer, &entries[0]);
+    else if (op == OP_ADD_ENTRY_EVICT)
+        evicted_count = aesd_circular_buffer_add_entry_evict(&run->buffer, &entries[0], evicted);
+    else
+        aesd_circular_buffer_add_entries(&run->buffer, entries, count);
+    for (i = 0; i < count; i++) {
+        model_add(model, &entries[i]);
+        aesd_lf_circular_buffer_add_entry(&run->lf_buffer, &entries[i]);
+    }
+    // Measured when each call returns, not at every step of a batch
+    if (model->total_bytes > model->high_water_bytes)
+        model->high_water_bytes = model->total_bytes;
+
+    if (op == OP_ADD_ENTRY_EVICT) {
+        if (released_count)
+            return fail(run, "add_entry_evict released %zu entries instead of returning them", released_count);
+        if (!check_evicted(run, "add_entry_evict returned", evicted, evicted_count, oldest, model->oldest))
+            return false;
+    } else if (released_count > sizeof(released) / sizeof(released[0])) {
+        return fail(run, "released %zu entries", released_count);
+    } else if (!check_evicted(run, "released", released, released_count, oldest, model->oldest)) {
+        return false;
+    }
+    return check_buffer(run) && check_lf_buffer(run);
+}
+
+bool aesd_circular_buffer_model_run(const uint8_t *ops, size_t len, char *why, size_t why_len)
+{
+    static struct model_run run;
+
+    memset(&run, 0, sizeof(run));
+    run.ops = ops;
+    run.len = len;
+    run.why = why;
+    run.why_len = why_len;
+    aesd_circular_buffer_init(&run.buffer);
+    run.buffer.release = record_release;
+    aesd_lf_circular_buffer_init(&run.lf_buffer, AESD_LF_SINGLE_PRODUCER);
+
+    while (run.pos < run.len) {
+        if (!run_op(&run))
+            return false;
+    }
+    return check_buffer(&run) && check_lf_buffer(&run);
+}
@@ -0,0 +1,30 @@
+/*
+ * circular_buffer_model.h
+ *
+ *  @brief Reference model of the aesd circular buffers, for randomized and fuzz testing
+ *
+ *  aesd_circular_buffer_model_run() decodes a byte string into operations,
+ *  applies each to aesd-circular-buffer.c and to the lock free buffer, and
+ *  after every operation checks what they hold, what they evicted and what
+ *  their lookups return against a model which keeps every entry ever added
+ *  in an array and applies the documented retention rules to it.  Any byte
+ *  string is a valid sequence of operations, so the Unity tests can run
+ *  random ones and the fuzz targets whatever the fuzzer generates.
+ */
+
+#ifndef CIRCULAR_BUFFER_MODEL_H
+#define CIRCULAR_BUFFER_MODEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Run the operations encoded in the @param len bytes at @param ops.  Operations adding entries past
+ * the first few thousand are ignored, so a run takes bounded time
+ * @return true if the buffers always matched the model, otherwise false with the first difference
+ *   described in the @param why_len bytes at @param why
+ */
+bool aesd_circular_buffer_model_run(const uint8_t *ops, size_t len, char *why, size_t why_len);
+
+#endif /* CIRCULAR_BUFFER_MODEL_H */
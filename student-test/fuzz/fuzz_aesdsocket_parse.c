@@ -0,0 +1,23 @@
+/**
+ * @file fuzz_aesdsocket_parse.c
+ * @brief Fuzz target parsing the input as aesdsocket text commands and frames against aesdsocket_parse_model.c
+ *
+ * Built against libFuzzer with the AESD_LIBFUZZER CMake option, otherwise against fuzz_main.c,
+ * which also serves AFL and corpus replay.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "aesdsocket_parse_model.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char why[256];
+
+    if (!aesdsocket_parse_model_run(data, size, why, sizeof(why))) {
+        fprintf(stderr, "aesdsocket parser differs from the model: %s\n", why);
+        abort();
+    }
+    return 0;
+}
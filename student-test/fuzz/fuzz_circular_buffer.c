@@ -0,0 +1,23 @@
+/**
+ * @file fuzz_circular_buffer.c
+ * @brief Fuzz target running the input as circular buffer operations against circular_buffer_model.c
+ *
+ * Built against libFuzzer with the AESD_LIBFUZZER CMake option, otherwise against fuzz_main.c,
+ * which also serves AFL and corpus replay.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "circular_buffer_model.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char why[256];
+
+    if (!aesd_circular_buffer_model_run(data, size, why, sizeof(why))) {
+        fprintf(stderr, "Circular buffer differs from the model: %s\n", why);
+        abort();
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file fuzz_main.c
+ * @brief Standalone driver for the fuzz targets when libFuzzer is not available
+ *
+ * Usage: fuzz_target [file...]      run each file, or standard input without any, as one input
+ *        fuzz_target -r runs [seed] run that many random inputs of up to FUZZ_MAX_INPUT bytes
+ *
+ * Reading standard input makes the target usable under AFL (afl-fuzz -- ./fuzz_target), and file
+ * arguments replay a corpus or a crash found by libFuzzer.  A mismatch aborts in the target.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FUZZ_MAX_INPUT (64 * 1024)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/**
+ * Read all of @param file into a buffer of FUZZ_MAX_INPUT bytes at @param buf
+ * @return the number of bytes read, -1 on error
+ */
+static long read_input(FILE *file, uint8_t *buf)
+{
+    size_t len = fread(buf, 1, FUZZ_MAX_INPUT, file);
+
+    return ferror(file) ? -1 : (long)len;
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static int run_random(unsigned long runs, uint64_t seed)
+{
+    static uint8_t buf[FUZZ_MAX_INPUT];
+    uint64_t state = seed ? seed : 1;
+    unsigned long run;
+
+    printf("Running %lu random inputs, seed %llu\n", runs, (unsigned long long)seed);
+    for (run = 0; run < runs; run++) {
+        // Mostly short inputs, which reach the interesting states most often
+        size_t i, len = xorshift64(&state) % (run % 16 == 0 ? FUZZ_MAX_INPUT : 1024);
+
+        for (i = 0; i < len; i++)
+            buf[i] = xorshift64(&state) >> 56;
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t buf[FUZZ_MAX_INPUT];
+    long len;
+    int i;
+
+    if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s -r runs [seed]\n", argv[0]);
+            return 1;
+        }
+        return run_random(strtoul(argv[2], NULL, 0),
+                          argc > 3 ? strtoull(argv[3], NULL, 0) : (uint64_t)time(NULL));
+    }
+    if (argc == 1) {
+        len = read_input(stdin, buf);
+        if (len < 0) {
+            perror("stdin");
+            return 1;
+        }
+        return LLVMFuzzerTestOneInput(buf, len);
+    }
+    for (i = 1; i < argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+
+        if (!file) {
+            perror(argv[i]);
+            return 1;
+        }
+        len = read_input(file, buf);
+        fclose(file);
+        if (len < 0) {
+            perror(argv[i]);
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    return 0;
+}